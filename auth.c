@@ -0,0 +1,550 @@
+/*
+ * auth.c
+ *
+ * Control frame authentication.
+ *
+ * Control frames can carry a 32 bit SipHash-2-4 tag under a 128 bit
+ * key shared by the layout.  SipHash only needs 64 bit add, rotate and
+ * xor, which the Cortex-M3 does in a few instructions, and costs about
+ * as much as the SPI transfer of the frame.  Sign and verify times are
+ * measured with the DWT cycle counter.
+ *
+ * Each sender numbers its frames with a 32 bit counter.  The receiver
+ * keeps the highest counter seen from each sender and a bitmap of the
+ * AUTH_WINDOW counters below it, so late frames are accepted once and
+ * repeats are dropped.
+ *
+ * The key is held in RAM only and must be set again after a reset.
+ * The sender's counter carries on from where it was: its upper half is
+ * an epoch logged in flash, a new one for each reset, so receivers
+ * keep their replay windows and accept a reset base station.
+ *
+ */
+
+#include "types.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "ctrl_frame.h"
+#include "ota.h"
+#include "auth.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+typedef unsigned long long u64;
+
+// Replay window for one sender
+typedef struct {
+	uint8_t used;
+	uint8_t src;
+	uint32_t ctr;						// Highest counter accepted
+	uint32_t bitmap;					// bit n set: ctr - n accepted
+} AUTH_PEER;
+
+
+uint8_t auth_mode;
+uint8_t auth_key_valid;
+AUTH_STATS auth_stats;
+
+u64 auth_k0;
+u64 auth_k1;
+uint32_t auth_tx_ctr;					// Epoch 0 until the first frame is signed
+AUTH_PEER auth_peers[AUTH_MAX_PEERS];
+uint8_t auth_peer_next;
+
+
+u64 siphash(uint8_t *in, int n);
+int auth_replay(uint8_t src, uint32_t ctr);
+uint16_t auth_epoch_last(void);
+int auth_epoch_next(void);
+
+
+
+#define ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND	\
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);	\
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;						\
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;						\
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32)
+
+
+/* siphash
+ *
+ * Parameters
+ * in			Message
+ * n			Message length
+ *
+ * Returns
+ * SipHash-2-4 of the message under the current key.
+ */
+u64 siphash(uint8_t *in, int n)
+{
+	u64 v0;
+	u64 v1;
+	u64 v2;
+	u64 v3;
+	u64 m;
+	int i;
+	int j;
+
+
+	v0 = auth_k0 ^ 0x736f6d6570736575ULL;
+	v1 = auth_k1 ^ 0x646f72616e646f6dULL;
+	v2 = auth_k0 ^ 0x6c7967656e657261ULL;
+	v3 = auth_k1 ^ 0x7465646279746573ULL;
+
+	// Whole 8 byte words
+	for(i=0; i + 8 <= n; i += 8)
+	{
+		m = 0;
+		for(j=7; j>=0; j--)
+			m = (m << 8) | in[i + j];
+
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	// Last word, length in the top byte
+	m = (u64)n << 56;
+	for(j=n - i - 1; j>=0; j--)
+		m |= (u64)in[i + j] << (8 * j);
+
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+
+	v2 ^= 0xFF;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/* auth_set_key
+ *
+ * Parameters
+ * key			AUTH_KEY_LEN bytes, NULL to remove the key
+ *
+ * Returns
+ * 0
+ *
+ * Set the layout key.  The replay windows are cleared.
+ */
+int auth_set_key(uint8_t *key)
+{
+	int i;
+
+
+	auth_k0 = 0;
+	auth_k1 = 0;
+	auth_key_valid = 0;
+
+	if(key != NULL)
+	{
+		for(i=7; i>=0; i--)
+		{
+			auth_k0 = (auth_k0 << 8) | key[i];
+			auth_k1 = (auth_k1 << 8) | key[i + 8];
+		}
+		auth_key_valid = 1;
+	}
+
+	for(i=0; i<AUTH_MAX_PEERS; i++)
+		auth_peers[i].used = 0;
+
+	return 0;
+}
+
+
+/* auth_epoch_last
+ *
+ * Returns
+ * Highest epoch in the flash log, 0 if there is none.
+ */
+uint16_t auth_epoch_last(void)
+{
+	volatile uint16_t *log;
+	uint16_t epoch;
+	int i;
+
+
+	log = (volatile uint16_t *)AUTH_EPOCH_ADDR;
+
+	epoch = 0;
+	for(i=0; i<2 * AUTH_EPOCH_SLOTS; i++)
+	{
+		if((log[i] != 0xFFFF) && (log[i] > epoch))
+			epoch = log[i];
+	}
+
+	return epoch;
+}
+
+
+/* auth_epoch_next
+ *
+ * Returns
+ * 0 on success, -1 if the epochs have run out or on a flash error.
+ *
+ * Log the next epoch in flash and restart the counter from it.
+ * Epoch e goes in halfword e % AUTH_EPOCH_SLOTS of page
+ * (e / AUTH_EPOCH_SLOTS) % 2.  A page is erased when its first slot is
+ * written, the other page still holds the last epoch if power is lost
+ * during the erase.  The CPU stalls for about 20ms for an erase, one
+ * reset in AUTH_EPOCH_SLOTS, and 50us for the write.
+ */
+int auth_epoch_next(void)
+{
+	volatile uint16_t *slot;
+	uint32_t page;
+	uint16_t epoch;
+	uint8_t data[2];
+	int err;
+
+
+	epoch = auth_epoch_last();
+	if(epoch >= AUTH_EPOCH_MAX)
+		return -1;
+	epoch++;
+
+	page = AUTH_EPOCH_ADDR + ((epoch / AUTH_EPOCH_SLOTS) % 2) * AUTH_EPOCH_PAGE;
+	slot = (volatile uint16_t *)page + (epoch % AUTH_EPOCH_SLOTS);
+
+	data[0] = (uint8_t)epoch;
+	data[1] = (uint8_t)(epoch >> 8);
+
+	ota_flash_unlock();
+
+	err = 0;
+	if(((epoch % AUTH_EPOCH_SLOTS) == 0) || (*slot != 0xFFFF))
+		err = ota_flash_erase(page);
+	if(err == 0)
+		err = ota_flash_write((uint32_t)slot, data, 2);
+
+	ota_flash_lock();
+
+	if((err < 0) || (*slot != epoch))
+		return -1;
+
+	auth_tx_ctr = (uint32_t)epoch << AUTH_EPOCH_SHIFT;
+
+	return 0;
+}
+
+
+/* auth_sign
+ *
+ * Parameters
+ * addr			Packet ADDR byte the frame will be sent to
+ * frame		Control frame, the trailer is added
+ * len			Control frame length
+ * max			Frame buffer size
+ *
+ * Returns
+ * Authenticated frame length, or -1 if there is no key or no room.
+ */
+int auth_sign(uint8_t addr, uint8_t *frame, int len, int max)
+{
+	uint8_t hdr;
+	int n;
+
+
+	hdr = frame[0];
+	frame[0] = AUTH_FRAME | (hdr & ~CTRL_FRAME_MASK);
+
+	n = auth_sign_msg(addr, frame, len, max);
+	if(n < 0)
+		frame[0] = hdr;
+
+	return n;
+}
+
+
+/* auth_verify
+ *
+ * Parameters
+ * addr			Packet ADDR byte the frame was received with
+ * frame		Authenticated frame, changed to a plain control frame
+ * len			Frame length
+ *
+ * Returns
+ * Control frame length, or -1 if the tag is bad or the frame is a
+ * replay.
+ */
+int auth_verify(uint8_t addr, uint8_t *frame, int len)
+{
+	int n;
+
+
+	if(!auth_is_frame(frame, len))
+	{
+		auth_stats.bad_mac++;
+		return -1;
+	}
+
+	n = auth_verify_msg(addr, frame, len);
+	if(n < 0)
+		return -1;
+
+	frame[0] = CTRL_FRAME | (frame[0] & ~CTRL_FRAME_MASK);
+
+	return n;
+}
+
+
+/* auth_sign_msg
+ *
+ * Parameters
+ * addr			Packet ADDR byte the message will be sent to
+ * msg			Message, the trailer is added
+ * len			Message length
+ * max			Message buffer size
+ *
+ * Returns
+ * Signed message length, or -1 if there is no key or no room.
+ *
+ * Add the sender, counter and tag to any message.
+ */
+int auth_sign_msg(uint8_t addr, uint8_t *msg, int len, int max)
+{
+	uint8_t buf[RF_MAX_DATA + 1];
+	uint32_t t0;
+	u64 tag;
+	int i;
+
+
+	if(!auth_key_valid || (len + AUTH_TRAILER_LEN > max) || (len + AUTH_TRAILER_LEN > RF_MAX_DATA))
+		return -1;
+
+	// First frame after a reset, or the frame count has wrapped
+	if(((auth_tx_ctr & AUTH_FRAME_MASK) == 0) && (auth_epoch_next() < 0))
+	{
+		auth_stats.epoch_err++;
+		return -1;
+	}
+
+	t0 = cyc_count();
+
+	msg[len++] = cc_reg_get(ADDR);
+	for(i=0; i<AUTH_CTR_LEN; i++)
+		msg[len++] = (uint8_t)(auth_tx_ctr >> (8 * i));
+	auth_tx_ctr++;
+
+	buf[0] = addr;
+	for(i=0; i<len; i++)
+		buf[i + 1] = msg[i];
+
+	tag = siphash(buf, len + 1);
+	for(i=0; i<AUTH_TAG_LEN; i++)
+		msg[len++] = (uint8_t)(tag >> (8 * i));
+
+	auth_stats.sign_cyc = cyc_count() - t0;
+	auth_stats.signed_frames++;
+
+	return len;
+}
+
+
+/* auth_verify_msg
+ *
+ * Parameters
+ * addr			Packet ADDR byte the message was received with
+ * msg			Signed message
+ * len			Message length, trailer included
+ *
+ * Returns
+ * Message length without the trailer, or -1 if there is no key, the
+ * tag is bad or the message is a replay.
+ */
+int auth_verify_msg(uint8_t addr, uint8_t *msg, int len)
+{
+	uint8_t buf[RF_MAX_DATA + 1];
+	uint8_t diff;
+	uint32_t t0;
+	uint32_t ctr;
+	u64 tag;
+	int n;
+	int i;
+
+
+	t0 = cyc_count();
+
+	if(!auth_key_valid || (len <= AUTH_TRAILER_LEN) || (len > RF_MAX_DATA))
+	{
+		auth_stats.bad_mac++;
+		return -1;
+	}
+
+	n = len - AUTH_TAG_LEN;
+
+	buf[0] = addr;
+	for(i=0; i<n; i++)
+		buf[i + 1] = msg[i];
+
+	tag = siphash(buf, n + 1);
+
+	// Compare all bytes, no early exit
+	diff = 0;
+	for(i=0; i<AUTH_TAG_LEN; i++)
+		diff |= msg[n + i] ^ (uint8_t)(tag >> (8 * i));
+
+	auth_stats.verify_cyc = cyc_count() - t0;
+	if(auth_stats.verify_cyc > auth_stats.verify_cyc_max)
+		auth_stats.verify_cyc_max = auth_stats.verify_cyc;
+
+	if(diff)
+	{
+		auth_stats.bad_mac++;
+		return -1;
+	}
+
+	n -= AUTH_CTR_LEN;
+	ctr = 0;
+	for(i=AUTH_CTR_LEN - 1; i>=0; i--)
+		ctr = (ctr << 8) | msg[n + i];
+
+	if(auth_replay(msg[n - 1], ctr))
+	{
+		auth_stats.replay++;
+		return -1;
+	}
+
+	auth_stats.verified++;
+
+	return len - AUTH_TRAILER_LEN;
+}
+
+
+/* auth_mac
+ *
+ * Parameters
+ * in			Data, RAM or flash
+ * n			Length
+ * mac			AUTH_MAC_LEN bytes, LSB first
+ *
+ * Returns
+ * 0, or -1 if there is no key.
+ *
+ * Full 64 bit SipHash-2-4 of a block too large for a message, the OTA
+ * image.  Tens of msec for a full size image.
+ */
+int auth_mac(uint8_t *in, uint32_t n, uint8_t *mac)
+{
+	u64 tag;
+	int i;
+
+
+	if(!auth_key_valid)
+		return -1;
+
+	tag = siphash(in, (int)n);
+	for(i=0; i<AUTH_MAC_LEN; i++)
+		mac[i] = (uint8_t)(tag >> (8 * i));
+
+	return 0;
+}
+
+
+/* auth_replay
+ *
+ * Parameters
+ * src			Sender
+ * ctr			Frame counter
+ *
+ * Returns
+ * 1 if the counter has been seen or is too old, 0 if it is new.  New
+ * counters are added to the sender's window.  A new sender takes a
+ * free window or reuses them in turn.
+ */
+int auth_replay(uint8_t src, uint32_t ctr)
+{
+	AUTH_PEER *peer;
+	uint32_t shift;
+	int i;
+
+
+	peer = NULL;
+	for(i=0; i<AUTH_MAX_PEERS; i++)
+	{
+		if(auth_peers[i].used && (auth_peers[i].src == src))
+		{
+			peer = &auth_peers[i];
+			break;
+		}
+	}
+
+	if(peer == NULL)
+	{
+		peer = &auth_peers[auth_peer_next];
+		auth_peer_next = (auth_peer_next + 1) % AUTH_MAX_PEERS;
+
+		peer->used = 1;
+		peer->src = src;
+		peer->ctr = ctr;
+		peer->bitmap = 1;
+		return 0;
+	}
+
+	if(ctr > peer->ctr)
+	{
+		shift = ctr - peer->ctr;
+		peer->bitmap = (shift < AUTH_WINDOW) ? (peer->bitmap << shift) | 1 : 1;
+		peer->ctr = ctr;
+		return 0;
+	}
+
+	shift = peer->ctr - ctr;
+	if((shift >= AUTH_WINDOW) || (peer->bitmap & (1UL << shift)))
+		return 1;
+
+	peer->bitmap |= 1UL << shift;
+	return 0;
+}
+
+
+/* auth_is_frame
+ *
+ * Parameters
+ * frame		Packet data
+ * len			Packet data length
+ *
+ * Returns
+ * 1 if the data is an authenticated control frame of the right
+ * length, 0 if not.
+ */
+int auth_is_frame(uint8_t *frame, int len)
+{
+	if((len < CTRL_FRAME_LEN(1) + AUTH_TRAILER_LEN) || ((frame[0] & CTRL_FRAME_MASK) != AUTH_FRAME))
+		return 0;
+
+	return (len == CTRL_FRAME_LEN((frame[0] & ~CTRL_FRAME_MASK) + 1) + AUTH_TRAILER_LEN);
+}
+
+
+/* auth_clear
+ *
+ * Clear the statistics.
+ */
+void auth_clear(void)
+{
+	auth_stats.signed_frames = 0;
+	auth_stats.verified = 0;
+	auth_stats.bad_mac = 0;
+	auth_stats.replay = 0;
+	auth_stats.unauth = 0;
+	auth_stats.epoch_err = 0;
+	auth_stats.sign_cyc = 0;
+	auth_stats.verify_cyc = 0;
+	auth_stats.verify_cyc_max = 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * auth.h
+ *
+ * Control frame authentication.
+ *
+ */
+
+#ifndef AUTH_H_
+#define AUTH_H_
+
+#include "types.h"
+
+
+// Authenticated control frame
+// [HDR][RECORD]...[SRC][CTR0][CTR1][CTR2][CTR3][TAG0][TAG1][TAG2][TAG3]
+// HDR upper nibble is AUTH_FRAME instead of CTRL_FRAME.
+// SRC is the sender's ADDR, CTR its frame counter (LSB first).
+// TAG is the low 32 bits of SipHash-2-4 over the packet ADDR byte and
+// everything before TAG.
+// Other signed messages, the OTA start, carry the same trailer after
+// their own data: [MSG...][SRC][CTR0..3][TAG0..3].
+#define AUTH_FRAME			0xD0
+#define AUTH_CTR_LEN		4
+#define AUTH_TAG_LEN		4
+#define AUTH_TRAILER_LEN	(1 + AUTH_CTR_LEN + AUTH_TAG_LEN)
+#define AUTH_KEY_LEN		16
+#define AUTH_MAC_LEN		8			// auth_mac(), all 64 bits
+
+// Replay protection
+#define AUTH_MAX_PEERS		8			// Senders with a replay window
+#define AUTH_WINDOW			32			// Counters behind the highest still accepted
+
+// Sender counter, [31-16] epoch, [15-0] frame in the epoch
+// A new epoch is taken from flash after each reset and when the frame
+// count wraps, so the counter never goes back.
+#define AUTH_EPOCH_ADDR		0x0801F800UL	// Two flash pages, a log of halfwords
+#define AUTH_EPOCH_PAGE		1024
+#define AUTH_EPOCH_SLOTS	(AUTH_EPOCH_PAGE / 2)
+#define AUTH_EPOCH_MAX		0xFFFE
+#define AUTH_EPOCH_SHIFT	16
+#define AUTH_FRAME_MASK		0xFFFF
+
+// Modes
+#define AUTH_OFF			0			// Plain control frames
+#define AUTH_ON				1			// Frames signed, plain frames dropped
+
+typedef struct {
+	uint32_t signed_frames;
+	uint32_t verified;
+	uint32_t bad_mac;					// Tag mismatch or no key
+	uint32_t replay;					// Counter repeated or too old
+	uint32_t unauth;					// Plain frame dropped
+	uint32_t epoch_err;					// New epoch couldn't be stored, frame not sent
+	uint32_t sign_cyc;					// Last sign, CPU cycles
+	uint32_t verify_cyc;				// Last verify, CPU cycles
+	uint32_t verify_cyc_max;
+} AUTH_STATS;
+
+extern uint8_t auth_mode;
+extern uint8_t auth_key_valid;
+extern AUTH_STATS auth_stats;
+extern uint32_t auth_tx_ctr;
+
+
+int auth_set_key(uint8_t *key);
+int auth_sign(uint8_t addr, uint8_t *frame, int len, int max);
+int auth_verify(uint8_t addr, uint8_t *frame, int len);
+int auth_sign_msg(uint8_t addr, uint8_t *msg, int len, int max);
+int auth_verify_msg(uint8_t addr, uint8_t *msg, int len);
+int auth_mac(uint8_t *in, uint32_t n, uint8_t *mac);
+int auth_is_frame(uint8_t *frame, int len);
+void auth_clear(void);
+
+#endif /* AUTH_H_ */
@@ -5,6 +5,10 @@
  *      Author: pmatthews
  *
  * Low-level access to CC2500 registers.
+ *
+ * Every access takes the radio instance (CC_DEV).  cc2500_regs.h maps
+ * the original cc_ names to radio 0.  Only radio 0 uses SPI1 DMA, so a
+ * DMA burst in progress is always radio 0's.
  */
 
 
@@ -16,13 +20,42 @@
 
 
 // CC2500 Chip Select
-#define CSn_LO() 	GPIO_BitReset(GPIOB, GPIO_PIN12);			// CSn low
-#define CSn_HI() 	GPIO_BitSet(GPIOB, GPIO_PIN12);				// CSn low
+// CSn low wakes the radio from SLEEP or WOR, so wait for it then.
+#define CSn_LO(dev) 	do { GPIO_BitReset((dev)->cs_port, (dev)->cs_pin); if((dev)->sleeping) cc_wake_wait(dev); } while(0)	// CSn low
+#define CSn_HI(dev) 	GPIO_BitSet((dev)->cs_port, (dev)->cs_pin)				// CSn high
+
+// MISO is the CC2500 SO pin, low when the chip is ready
+#define SO_HI(dev)		((dev)->so_port->IDR & (1 << (dev)->so_pin))
+#define WAKE_TIMEOUT	10000
+
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
 
 
+// Radio instances
+// Radio 0 on SPI1, CSn PB12, SO on PA6.  Bursts use SPI1 DMA.
+// Radio 1 on SPI2, CSn PA4, SO on PB14.  Polled, PB12 is radio 0 CSn.
+CC_DEV cc_dev[CC_N_DEV] =
+{
+	{spi_out, spi_speed, 1, GPIOB, GPIO_PIN12, GPIOA, GPIO_PIN6},
+	{spi2_out, spi2_speed, 0, GPIOA, GPIO_PIN4, GPIOB, GPIO_PIN14}
+};
+
+// Save the status byte and latch FIFO errors.  All ones is a chip that isn't ready.
+#define STATUS_SAVE(dev, x)	do { (dev)->status = (x); if(((dev)->status & (STATUS_CHIP_RDYn | STATUS_FIFO_ERR)) == STATUS_FIFO_ERR) (dev)->fault = (dev)->status; } while(0)
+
+// DMA burst completion callback, and the radio with CSn held low
+void (*cc_dma_callback)(void);
+CC_DEV *cc_dma_dev;
 
-// CC2500 status byte
-uint8_t status;
+
+void cc_burst(CC_DEV *dev, uint8_t *tx, uint8_t *rx, uint8_t n);
+int cc_burst_dma(CC_DEV *dev, uint8_t hdr, uint8_t *tx, uint8_t *rx, uint8_t n, void (*done)(void));
+void cc_dma_done(void);
+void cc_wake_wait(CC_DEV *dev);
 
 // Status byte is updated on every SPI read or write.
 // The CC2500 clocks out the status on MISO as the header byte is
@@ -42,13 +75,86 @@ uint8_t status;
 
 
 
+/* cc_wake_wait
+ *
+ * Called with CSn low when the radio may be in SLEEP or WOR.
+ * Waits for SO to go low, which shows the crystal oscillator is
+ * running and SPI access is possible.  The radio is then in IDLE.
+ */
+void cc_wake_wait(CC_DEV *dev)
+{
+	int i;
+
+
+	for(i=0; i<WAKE_TIMEOUT; i++)
+	{
+		if(!SO_HI(dev))
+			break;
+	}
+
+	dev->sleeping = 0;
+}
+
+
+
+/******************************************************************************
+ * SPI access locking.
+ ******************************************************************************/
+
+
+/* cc_lock
+ *
+ * Returns
+ * key			Previous BASEPRI value, pass to cc_unlock().
+ *
+ * The radio is accessed from the main loop and from interrupt handlers
+ * (GDO pin interrupts, SPI DMA complete, timer tick).  All interrupts that access the radio
+ * run at CC_IRQ_PRIORITY.  Raising BASEPRI to that priority blocks them
+ * while an SPI transaction is in progress, without blocking higher
+ * priority interrupts such as the UART.
+ *
+ * Locks nest.  BASEPRI is only raised, never lowered.
+ *
+ * A DMA burst may still be running from an earlier locked section.
+ * The SPI1 DMA interrupt is also at CC_IRQ_PRIORITY, so the transfer
+ * is finished here before the lock is returned.
+ */
+uint32_t cc_lock(void)
+{
+	uint32_t key;
+	uint32_t pri;
+
+
+	pri = CC_IRQ_PRIORITY << (8 - __NVIC_PRIO_BITS);
+
+	key = __get_BASEPRI();
+	if((key == 0) || (key > pri))
+		__set_BASEPRI(pri);
+
+	spi_dma_wait();
+
+	return key;
+}
+
+
+/* cc_unlock
+ *
+ * Restore BASEPRI saved by cc_lock().
+ */
+void cc_unlock(uint32_t key)
+{
+	__set_BASEPRI(key);
+}
+
+
+
 
 /******************************************************************************
  * CC2500 Register access and command/status interface.
  ******************************************************************************/
 
 
-/* cc_write_cmd
+/* cc_dev_write_cmd
  *
  * Write a command to the CC2500.
  *
@@ -67,9 +173,10 @@ uint8_t status;
  * B = 0
  *
  */
-uint8_t cc_write_cmd(uint8_t cmd)
+uint8_t cc_dev_write_cmd(CC_DEV *dev, uint8_t cmd)
 {
 	uint8_t d;
+	uint32_t key;
 
 
 	// Check range command
@@ -78,15 +185,18 @@ uint8_t cc_write_cmd(uint8_t cmd)
 
 	d = cmd & 0x3F;						// R/W=0, B=0
 
-	CSn_LO();
-	status = spi_out(d);
-	CSn_HI();
+	key = cc_lock();
+	dev->spi_speed(SPI_SINGLE);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(d));
+	CSn_HI(dev);
+	cc_unlock(key);
 
 	return 1;
 }
 
 
-/* cc_read_status
+/* cc_dev_read_status
  *
  * Reads a status register.
  * Status registers are 0x30-0x3D.
@@ -100,26 +210,30 @@ uint8_t cc_write_cmd(uint8_t cmd)
  * B = 1
  *
  */
-uint8_t cc_read_status(uint8_t reg)
+uint8_t cc_dev_read_status(CC_DEV *dev, uint8_t reg)
 {
 	uint8_t status_reg;
 	uint8_t hdr;
+	uint32_t key;
 
 
 	if(!((reg >= 0x30) && (reg <= 0x3D)))
 		return 0;
 
 	hdr = 0xC0 | reg;					// Set R/W bit, clear burst bit.
-	CSn_LO();
-	status = spi_out(hdr);				// Send register address, read status.
-	status_reg = spi_out(0x00);			// Send zeroes to read in data.
-	CSn_HI();
+	key = cc_lock();
+	dev->spi_speed(SPI_SINGLE);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));				// Send register address, read status.
+	status_reg = dev->spi_out(0x00);			// Send zeroes to read in data.
+	CSn_HI(dev);
+	cc_unlock(key);
 
 	return status_reg;
 }
 
 
-/* cc_read
+/* cc_dev_read
  *
  * Parameters
  * reg			Address of register
@@ -130,24 +244,28 @@ uint8_t cc_read_status(uint8_t reg)
  * Read one config register.
  * Status is updated.
  */
-uint8_t cc_read(uint8_t reg)
+uint8_t cc_dev_read(CC_DEV *dev, uint8_t reg)
 {
 	uint8_t data;
 	uint8_t hdr;
+	uint32_t key;
 
 
 	hdr = 0x80 | (reg & 0x3F);			// Set R/W bit, clear burst bit.
 
-	CSn_LO();
-	status = spi_out(hdr);				// Send register address, read status.
-	data = spi_out(0x00);				// Send zeroes to read in data.
-	CSn_HI();
+	key = cc_lock();
+	dev->spi_speed(SPI_SINGLE);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));				// Send register address, read status.
+	data = dev->spi_out(0x00);				// Send zeroes to read in data.
+	CSn_HI(dev);
+	cc_unlock(key);
 
 	return data;
 }
 
 
-/* cc_read_b
+/* cc_dev_read_b
  *
  * Read n-consecutive config registers starting at addr.
  * Reads registers using SPI burst read.
@@ -155,10 +273,10 @@ uint8_t cc_read(uint8_t reg)
  *
  * Status is updated.
  */
-int cc_read_b(uint8_t addr, uint8_t *data, uint8_t n)
+int cc_dev_read_b(CC_DEV *dev, uint8_t addr, uint8_t *data, uint8_t n)
 {
 	uint8_t hdr;
-	int i;
+	uint32_t key;
 
 
 	if(addr > 0x3D)
@@ -167,24 +285,22 @@ int cc_read_b(uint8_t addr, uint8_t *data, uint8_t n)
 	addr &= 0x3F;					// 6-bit register address
 	hdr = 0xC0 | addr;				// Set R/W bit, set burst bit.
 
-	CSn_LO();
-	status = spi_out(hdr);				// Send register address, read status.
-	for(i=0; i<n; i++)
-	{
-		if(addr > 0x3D)					//
-			break;
+	if(n > (0x3E - addr))			// Stop at the last register.
+		n = 0x3E - addr;
 
-		*data++ = spi_out(0x00);		// Send zeroes to read in data.
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));				// Send register address, read status.
+	cc_burst(dev, NULL, data, n);			// Send zeroes to read in data.
+	CSn_HI(dev);
+	cc_unlock(key);
 
-		addr++;
-	}
-	CSn_HI();
-
-	return i;
+	return n;
 }
 
 
-/* cc_write
+/* cc_dev_write
  *
  * Parameters
  * reg					Address of register to write to
@@ -193,32 +309,36 @@ int cc_read_b(uint8_t addr, uint8_t *data, uint8_t n)
  *
  * Status is updated.
  */
-uint8_t cc_write(uint8_t reg, uint8_t data)
+uint8_t cc_dev_write(CC_DEV *dev, uint8_t reg, uint8_t data)
 {
 	uint8_t hdr;
+	uint32_t key;
 
 
 	hdr = reg & 0x3F;					// R/W=0, burst=0.
 
-	CSn_LO();
-	status = spi_out(hdr);				// Send register address, read status.
-	spi_out(data);						// Send data byte.
-	CSn_HI();
+	key = cc_lock();
+	dev->spi_speed(SPI_SINGLE);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));				// Send register address, read status.
+	dev->spi_out(data);						// Send data byte.
+	CSn_HI(dev);
+	cc_unlock(key);
 
 	return 0;
 }
 
 
-/* cc_write_b
+/* cc_dev_write_b
  *
  *  Write n-consecutive config registers starting at addr.
  *  Writes registers using SPI burst write.
  *  Returns the actual number of register written.
  */
-int cc_write_b(uint8_t addr, uint8_t *data, uint8_t n)
+int cc_dev_write_b(CC_DEV *dev, uint8_t addr, uint8_t *data, uint8_t n)
 {
 	uint8_t hdr;
-	int i;
+	uint32_t key;
 
 
 	if(addr > 0x3D)
@@ -227,62 +347,261 @@ int cc_write_b(uint8_t addr, uint8_t *data, uint8_t n)
 	addr &= 0x3F;					// 6-bit register address
 	hdr = 0x40 | addr;				// R/W=0, burst=1.
 
-	CSn_LO();
-	status = spi_out(hdr);			// Send register address, read status.
-	for(i=0; i<n; i++)
-	{
-		if(addr > 0x3D)
-			break;
+	if(n > (0x3E - addr))			// Stop at the last register.
+		n = 0x3E - addr;
 
-		 spi_out(*data++);			// Send data byte.
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));			// Send register address, read status.
+	cc_burst(dev, data, NULL, n);		// Send data bytes.
+	CSn_HI(dev);
+	cc_unlock(key);
 
-		addr++;
-	}
-	CSn_HI();
+
+	return n;
+}
+
+
+/* cc_dev_write_patable
+ *
+ * Write the PA power table from entry 0.
+ * The PATABLE index counts up with each byte of a burst and goes
+ * back to 0 when CSn goes high.
+ * Returns the actual number of entries written.
+ */
+int cc_dev_write_patable(CC_DEV *dev, uint8_t *data, uint8_t n)
+{
+	uint8_t hdr;
+	uint32_t key;
 
 
-	return i;
+	if(n > PATABLE_SIZE)
+		n = PATABLE_SIZE;
+
+	hdr = 0x40 | PATABLE;			// R/W=0, burst=1.
+
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));			// Send PATABLE address, read status.
+	cc_burst(dev, data, NULL, n);		// Send power settings.
+	CSn_HI(dev);
+	cc_unlock(key);
+
+
+	return n;
 }
 
-/* cc_write_fifo
+/* cc_dev_write_fifo
  *
  * Write to TX FIFO.
  * This function doesn't check if there is room in the FIFO buffer.
  */
-int cc_write_fifo(uint8_t *data, uint8_t n)
+int cc_dev_write_fifo(CC_DEV *dev, uint8_t *data, uint8_t n)
 {
 	uint8_t hdr;
-	int i;
+	uint32_t key;
 
 
 	hdr = 0x40 | TX_FIFO;			// R/W=0, burst=1.
 
-	CSn_LO();
-	status = spi_out(hdr);			// Send register address, read status.
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));			// Send register address, read status.
+	cc_burst(dev, data, NULL, n);		// Send data bytes.
+	CSn_HI(dev);
+	cc_unlock(key);
+
+
+	return n;
+}
+
+
+/* cc_dev_read_fifo
+ *
+ * Read n bytes from the RX FIFO in a single SPI burst.
+ * The caller must make sure there are at least n bytes in the FIFO
+ * (RXBYTES).  The RX FIFO must not be emptied while a packet is still
+ * being received.
+ *
+ * Status is updated.
+ */
+int cc_dev_read_fifo(CC_DEV *dev, uint8_t *data, uint8_t n)
+{
+	uint8_t hdr;
+	uint32_t key;
+
+
+	hdr = 0xC0 | RX_FIFO;			// R/W=1, burst=1.
+
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));			// Send FIFO address, read status.
+	cc_burst(dev, NULL, data, n);		// Send zeroes to read in data.
+	CSn_HI(dev);
+	cc_unlock(key);
+
+
+	return n;
+}
+
+
+/* cc_dev_write_fifo_dma
+ *
+ * Parameters
+ * *data		Bytes to write.  Must stay valid until done() is called.
+ * n			No. of bytes
+ * done			Called when the FIFO write is complete, or NULL.
+ *
+ * Write to the TX FIFO using DMA and return without waiting.
+ * Chip select is released and done() called from the DMA interrupt.
+ * Any other radio access waits for the transfer to finish.
+ *
+ * This must be the last radio access in a locked section.
+ */
+int cc_dev_write_fifo_dma(CC_DEV *dev, uint8_t *data, uint8_t n, void (*done)(void))
+{
+	return cc_burst_dma(dev, 0x40 | TX_FIFO, data, NULL, n, done);
+}
+
+
+/* cc_dev_read_fifo_dma
+ *
+ * Parameters
+ * *data		Buffer for the FIFO bytes.  Valid when done() is called.
+ * n			No. of bytes
+ * done			Called when the FIFO read is complete, or NULL.
+ *
+ * Read from the RX FIFO using DMA and return without waiting.
+ * As cc_read_fifo(), the caller checks RXBYTES first.
+ *
+ * This must be the last radio access in a locked section.
+ */
+int cc_dev_read_fifo_dma(CC_DEV *dev, uint8_t *data, uint8_t n, void (*done)(void))
+{
+	return cc_burst_dma(dev, 0xC0 | RX_FIFO, NULL, data, n, done);
+}
+
+
+
+/******************************************************************************
+ * SPI burst transfers.
+ ******************************************************************************/
+
+
+/* cc_burst
+ *
+ * Parameters
+ * *tx			Bytes to send, or NULL to send zeroes.
+ * *rx			Buffer for received bytes, or NULL to discard them.
+ * n			No. of bytes
+ *
+ * Transfer the data bytes of a burst access.  The header byte has
+ * already been sent.  Bursts of SPI_DMA_MIN bytes or more use DMA,
+ * shorter ones are polled.  Waits for the transfer to complete.
+ */
+void cc_burst(CC_DEV *dev, uint8_t *tx, uint8_t *rx, uint8_t n)
+{
+	uint8_t d;
+	int i;
+
+
+	if(dev->dma && (n >= SPI_DMA_MIN))
+	{
+		spi_dma_xfer(tx, rx, n, NULL);
+		spi_dma_wait();
+		return;
+	}
+
 	for(i=0; i<n; i++)
 	{
-		 spi_out(*data++);			// Send data byte.
+		d = dev->spi_out(tx ? *tx++ : 0x00);
+		if(rx)
+			*rx++ = d;
+	}
+}
+
+
+/* cc_burst_dma
+ *
+ * Parameters
+ * hdr			SPI header byte
+ * *tx			Bytes to send, or NULL to send zeroes.
+ * *rx			Buffer for received bytes, or NULL to discard them.
+ * n			No. of bytes
+ * done			Completion callback, or NULL.
+ *
+ * Start a burst access and return while the DMA transfer runs.
+ * Short bursts are polled and done() is called before returning.
+ */
+int cc_burst_dma(CC_DEV *dev, uint8_t hdr, uint8_t *tx, uint8_t *rx, uint8_t n, void (*done)(void))
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+	dev->spi_speed(SPI_BURST);
+	CSn_LO(dev);
+	STATUS_SAVE(dev, dev->spi_out(hdr));				// Send header, read status.
+
+	if(!dev->dma || (n < SPI_DMA_MIN))
+	{
+		cc_burst(dev, tx, rx, n);
+		CSn_HI(dev);
+		cc_unlock(key);
+
+		if(done)
+			done();
+
+		return n;
 	}
-	CSn_HI();
 
+	cc_dma_callback = done;
+	cc_dma_dev = dev;
+	spi_dma_xfer(tx, rx, n, cc_dma_done);
+
+	cc_unlock(key);
+
+	return n;
+}
+
+
+/* cc_dma_done
+ *
+ * DMA burst complete.
+ * Release chip select, then call the burst completion callback.
+ */
+void cc_dma_done(void)
+{
+	void (*done)(void);
+
+
+	CSn_HI(cc_dma_dev);
+
+	done = cc_dma_callback;
+	cc_dma_callback = NULL;
 
-	return i;
+	if(done)
+		done();
 }
 
 
-/* cc_get_state
+/* cc_dev_get_state
  *
  * Returns the STATE field of the CC2500 status.
  *
- * The global status variable is updated on every read and write
+ * The radio's status byte is updated on every read and write
  * to the CC2500.  The CC2500 status byte is returned when the
  * SPI header byte is clocked out.
  *
  * The CC2500 chip state is status.bit[6-4]
  */
-uint8_t cc_get_state(void)
+uint8_t cc_dev_get_state(CC_DEV *dev)
 {
-	return ((status >> 4) & 0x07);
+	return ((dev->status >> 4) & 0x07);
 }
 
 
@@ -8,6 +8,7 @@
 #ifndef CC2500_H_
 #define CC2500_H_
 
+#include "stm32f103xb.h"
 #include "types.h"
 
 
@@ -15,6 +16,10 @@
 #define N_COMMANDS 13
 #define N_STATUS_REGS 14
 
+#define CC_FIFO_SIZE	64		// Size of each of the RX and TX FIFOs
+
+#define CC_FXOSC		26000000	// Crystal frequency (Hz)
+
 
 // Configuration Registers
 #define IOCFG2		0x00	// GPO0 configuration
@@ -96,9 +101,120 @@
 #define RCCTRL1_STATUS	0x3C	// Last RC oscillator calibration result
 #define RCCTRL0_STATUS	0x3D	// Last RC oscillator calibration result
 
+#define PATABLE			0x3E	// PA power table, 8 bytes, burst access
 #define TX_FIFO			0x3F	//
 #define RX_FIFO			0x3F	//
 
+// PATABLE
+// With 2-FSK and MSK the PA uses the entry selected by FREND0 PA_POWER,
+// entry 0 in all the profiles.  Entry 0 is kept in SLEEP, the rest are
+// lost.  Settings for each output power from the datasheet.
+#define PATABLE_SIZE		8
+#define FREND0_PA_POWER		0x07	// PATABLE entry used
+#define PA_RESET			0xC6	// -12dBm, PATABLE entry 0 after reset
+#define PA_M30_DBM			0x50
+#define PA_M26_DBM			0xC0
+#define PA_M22_DBM			0x81
+#define PA_M18_DBM			0x93
+#define PA_M14_DBM			0x8D
+#define PA_M12_DBM			0xC6
+#define PA_M10_DBM			0x97
+#define PA_M8_DBM			0x6E
+#define PA_M6_DBM			0x7F
+#define PA_M4_DBM			0xA9
+#define PA_M2_DBM			0xBB
+#define PA_0_DBM			0xFE
+#define PA_P1_DBM			0xFF
+
+// PARTNUM value
+#define CC2500_PARTNUM				0x80
+
+// MARCSTATE values
+#define MARCSTATE_SLEEP				0x00
+#define MARCSTATE_IDLE				0x01
+#define MARCSTATE_RX				0x0D
+#define MARCSTATE_RXFIFO_OVERFLOW	0x11
+#define MARCSTATE_TX				0x13
+#define MARCSTATE_TXFIFO_UNDERFLOW	0x16
+
+// IOCFGx GDO signal selection (GDOx_CFG[5:0])
+#define GDO_RX_THR			0x00	// RX FIFO at or above threshold
+#define GDO_RX_THR_EOP		0x01	// RX FIFO at or above threshold or end of packet
+#define GDO_TX_THR			0x02	// TX FIFO at or above threshold
+#define GDO_TX_FULL			0x03	// TX FIFO full
+#define GDO_SYNC_EOP		0x06	// Asserts on sync word, de-asserts at end of packet
+#define GDO_CRC_OK			0x07	// Packet received with CRC OK
+#define GDO_CHIP_RDYn		0x29	// CHIP_RDYn
+#define GDO_HI_Z			0x2E	// High impedance (3-state)
+
+// PKTCTRL1
+#define PKTCTRL1_CRC_AUTOFLUSH	0x08	// Flush RX FIFO if CRC is not OK
+#define PKTCTRL1_APPEND_STATUS	0x04	// Append RSSI and LQI to RX payload
+#define PKTCTRL1_ADR_CHK		0x03	// Address check mask
+#define ADR_CHK_NONE			0x00	// No address check
+#define ADR_CHK_ADDR			0x01	// ADDR only
+#define ADR_CHK_BCAST0			0x02	// ADDR and 0x00 broadcast
+#define ADR_CHK_BCAST			0x03	// ADDR, 0x00 and 0xFF broadcast
+
+// PKTCTRL0
+#define PKTCTRL0_WHITE_DATA		0x40	// Data whitening
+#define PKTCTRL0_CRC_EN			0x04	// CRC calculation in TX, check in RX
+#define PKTCTRL0_LEN_CONFIG		0x03	// Length config mask
+#define PKTCTRL0_LEN_FIXED		0x00	// Fixed packet length, PKTLEN
+#define PKTCTRL0_LEN_VAR		0x01	// Variable packet length, first byte after sync
+#define PKTCTRL0_LEN_INFINITE	0x02	// Infinite packet length
+
+// FIFOTHR
+#define FIFOTHR_FIFO_THR		0x0F	// TX FIFO 61-4n bytes, RX FIFO 4(n+1) bytes
+
+// MDMCFG4
+#define MDMCFG4_DRATE_E			0x0F	// Data rate exponent
+
+// MDMCFG2
+#define MDMCFG2_SYNC_MODE		0x07	// Sync word qualifier mode
+
+// MDMCFG1
+#define MDMCFG1_NUM_PREAMBLE	0x70	// Preamble bytes, 2 to 24
+
+// MCSM1
+#define MCSM1_CCA_MODE			0x30	// Clear channel indication mode
+#define MCSM1_RXOFF_RX			0x0C	// RXOFF_MODE: stay in RX after packet received
+#define MCSM1_TXOFF_RX			0x03	// TXOFF_MODE: go to RX after packet sent
+
+// RXBYTES/TXBYTES
+#define FIFO_OVERFLOW			0x80	// RX FIFO overflow / TX FIFO underflow
+#define FIFO_NUM_BYTES			0x7F	// No. of bytes in FIFO
+
+// Appended status byte 2 (LQI)
+#define LQI_CRC_OK				0x80	// CRC OK flag
+#define LQI_EST					0x7F	// Link quality estimate
+
+
+// MCSM0
+#define MCSM0_FS_AUTOCAL		0x30	// Automatic calibration mask
+#define FS_AUTOCAL_NEVER		0x00	// Calibrate only with SCAL strobe
+#define FS_AUTOCAL_FROM_IDLE	0x10	// Calibrate going from IDLE to RX or TX
+
+// MCSM2
+#define MCSM2_RX_TIME_RSSI		0x10	// RX timeout on carrier sense
+#define MCSM2_RX_TIME_QUAL		0x08	// RX timeout on preamble quality
+#define MCSM2_RX_TIME			0x07	// RX timeout, fraction of EVENT0
+
+// WORCTRL
+#define WORCTRL_RC_PD			0x80	// RC oscillator power down
+#define WORCTRL_EVENT1			0x70	// Time from wake to RX (RC clocks)
+#define WORCTRL_RC_CAL			0x08	// RC oscillator calibration
+#define WORCTRL_WOR_RES			0x03	// EVENT0 resolution
+
+#define CC_RCOSC		(CC_FXOSC / 750)	// WOR RC oscillator (Hz)
+
+// Frequency synthesizer calibration results.
+// FSCAL3, FSCAL2 and FSCAL1 are consecutive and can be saved after
+// an SCAL and written back with one burst to skip calibration.
+#define FSCAL_REG			FSCAL3
+#define N_FSCAL_REGS		3
+
+
 // CC2500 States
 #define	IDLE_STATE  			0
 #define RX_STATE 				1
@@ -109,23 +225,76 @@
 #define RXFIFO_OVERFLOW_STATE	6
 #define TXFIFO_UNDERFLOW_STATE	7
 
+// Status byte fields
+#define STATUS_CHIP_RDYn		0x80	// High until the crystal is running
+#define STATUS_STATE			0x70
+#define STATUS_FIFO_ERR			0x60	// Both FIFO error states have these bits set
 
 
+
+// Radio instance
+// Each CC2500 has its own SPI port, chip select and status byte.  The
+// cc_dev_ functions take the radio, the cc_ names below are radio 0.
+typedef struct {
+	uint8_t (*spi_out)(uint8_t d);		// SPI byte transfer
+	void (*spi_speed)(int access);		// SCLK for SPI_SINGLE or SPI_BURST
+	uint8_t dma;						// Bursts may use SPI1 DMA
+	GPIO_TypeDef *cs_port;				// CSn
+	uint16_t cs_pin;
+	GPIO_TypeDef *so_port;				// MISO, SO is low when the chip is ready
+	uint16_t so_pin;
+	uint8_t status;						// Last status byte
+	volatile uint8_t fault;				// Last status byte with a FIFO error, 0 if none
+	volatile uint8_t sleeping;			// In SLEEP or WOR
+} CC_DEV;
+
+#define CC_N_DEV		2
+#define CC_DEV0			(&cc_dev[0])	// SPI1, packet engine in cc_hal.c
+#define CC_DEV1			(&cc_dev[1])	// SPI2, second receiver in dual.c
+
+extern CC_DEV cc_dev[CC_N_DEV];
+
 //  Command and status register access.
-uint8_t cc_write_cmd(uint8_t cmd);
-uint8_t cc_read_status(uint8_t reg);
+uint8_t cc_dev_write_cmd(CC_DEV *dev, uint8_t cmd);
+uint8_t cc_dev_read_status(CC_DEV *dev, uint8_t reg);
 
 // Configuration Register access
-uint8_t cc_read(uint8_t reg);
-int cc_read_b(uint8_t addr, uint8_t *data, uint8_t n);
-uint8_t cc_write(uint8_t reg, uint8_t data);
-int cc_write_b(uint8_t addr, uint8_t *data, uint8_t n);
+uint8_t cc_dev_read(CC_DEV *dev, uint8_t reg);
+int cc_dev_read_b(CC_DEV *dev, uint8_t addr, uint8_t *data, uint8_t n);
+uint8_t cc_dev_write(CC_DEV *dev, uint8_t reg, uint8_t data);
+int cc_dev_write_b(CC_DEV *dev, uint8_t addr, uint8_t *data, uint8_t n);
+int cc_dev_write_patable(CC_DEV *dev, uint8_t *data, uint8_t n);
 
 // FIFO buffer access
-int cc_write_fifo(uint8_t *data, uint8_t n);
+int cc_dev_write_fifo(CC_DEV *dev, uint8_t *data, uint8_t n);
+int cc_dev_read_fifo(CC_DEV *dev, uint8_t *data, uint8_t n);
+int cc_dev_write_fifo_dma(CC_DEV *dev, uint8_t *data, uint8_t n, void (*done)(void));
+int cc_dev_read_fifo_dma(CC_DEV *dev, uint8_t *data, uint8_t n, void (*done)(void));
 
 // Chip state
-uint8_t cc_get_state(void);
+uint8_t cc_dev_get_state(CC_DEV *dev);
+
+// Radio 0
+#define cc_write_cmd(cmd)					cc_dev_write_cmd(CC_DEV0, cmd)
+#define cc_read_status(reg)					cc_dev_read_status(CC_DEV0, reg)
+#define cc_read(reg)						cc_dev_read(CC_DEV0, reg)
+#define cc_read_b(addr, data, n)			cc_dev_read_b(CC_DEV0, addr, data, n)
+#define cc_write(reg, data)					cc_dev_write(CC_DEV0, reg, data)
+#define cc_write_b(addr, data, n)			cc_dev_write_b(CC_DEV0, addr, data, n)
+#define cc_write_patable(data, n)			cc_dev_write_patable(CC_DEV0, data, n)
+#define cc_write_fifo(data, n)				cc_dev_write_fifo(CC_DEV0, data, n)
+#define cc_read_fifo(data, n)				cc_dev_read_fifo(CC_DEV0, data, n)
+#define cc_write_fifo_dma(data, n, done)	cc_dev_write_fifo_dma(CC_DEV0, data, n, done)
+#define cc_read_fifo_dma(data, n, done)		cc_dev_read_fifo_dma(CC_DEV0, data, n, done)
+#define cc_get_state()						cc_dev_get_state(CC_DEV0)
+#define cc_sleeping							(cc_dev[0].sleeping)
+#define cc_fault							(cc_dev[0].fault)
+
+// Radio interrupt priority and SPI access locking
+#define CC_IRQ_PRIORITY		1		// NVIC priority of all interrupts that access the radio
+
+uint32_t cc_lock(void);
+void cc_unlock(uint32_t key);
 
 
 
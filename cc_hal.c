@@ -19,11 +19,20 @@
 
 #include <string.h>
 
+#include "gpio.h"
+#include "timer.h"
+#include "spi.h"
 #include "cc2500_regs.h"
 #include "cc_hal.h"
 
 
-extern uint8_t status;
+// GDO0 is connected to PB0 (EXTI0).
+// IOCFG0 is set so GDO0 asserts on sync word and de-asserts at end of packet.
+#define GDO0_PIN		GPIO_PIN0
+#define GDO0_ACTIVE()	(GPIOB->IDR & (1 << GDO0_PIN))
+#define GDO2_PIN		GPIO_PIN1			// PB1, EXTI1, bulk transfer FIFO threshold
+
+#define IDLE_TIMEOUT	1000		// MARCSTATE polls waiting for IDLE
 
 
 
@@ -64,17 +73,216 @@ const char *radio_states [] =
 };
 
 
-// Configuration registers
+// Configuration register shadow cache.
+// config_regs holds the last value read from or written to each config
+// register.  Registers changed by cc_reg_set() are marked dirty until
+// cc_reg_commit() writes them to the radio.
 uint8_t config_regs[N_CONFIG_REGS];
+uint32_t config_dirty[2];			// One bit per register
+uint8_t config_valid;				// Cache has been loaded from the radio
+
+#define REG_DIRTY(a)		(config_dirty[(a) >> 5] & (1UL << ((a) & 0x1F)))
+#define REG_SET_DIRTY(a)	(config_dirty[(a) >> 5] |= (1UL << ((a) & 0x1F)))
+
+// Profile last written with cc_profile_apply()
+const RF_PROFILE *rf_profile;
+
+// Frequency synthesizer calibration table.
+// FSCAL3, FSCAL2, FSCAL1 for each channel, measured at startup.
+uint8_t cal_table[RF_N_CHANNELS][N_FSCAL_REGS];
+uint8_t cal_valid;
+
+// Registers updated by the radio itself (frequency synthesizer
+// calibration results).  These are always read from the radio.
+#define REG_VOLATILE(a)		(((a) >= FSCAL3) && ((a) <= FSCAL1))
+
+
+// Receive packet queue.
+// The GDO0 interrupt handler puts packets in at rx_head,
+// the main loop takes them out at rx_tail.
+RF_PKT rx_queue[RX_QUEUE_SIZE];
+volatile uint8_t rx_head;
+volatile uint8_t rx_tail;
+
+// RX FIFO staging buffer.
+// Holds the bytes of a packet that was still being received
+// when the FIFO was read.
+uint8_t rx_buf[2*CC_FIFO_SIZE];
+uint8_t rx_buf_n;
+uint8_t rx_dma_n;					// Bytes being read by DMA
+
+RF_RX_STATS rx_stats;
+
+// Two radio duplicate check, the last good packet from either radio
+RF_DIV_STATS div_stats;
+uint8_t div_pkt[RF_MAX_LEN + 1];	// [LEN][ADDR][DATA...]
+uint8_t div_radio;					// Radio that heard it
+uint8_t div_rssi;					// Raw RSSI status byte
+uint8_t div_slot = RX_QUEUE_SIZE;	// Receive queue entry, RX_QUEUE_SIZE if not queued
+uint32_t div_time;					// cyc_count() when it was put
+
+
+// Transmit packet queue.
+// The main loop puts packets in at tx_head.  The transmit state machine
+// takes them out at tx_tail, from the GDO0 interrupt or cc_hal_tick().
+RF_TX_PKT tx_queue[TX_QUEUE_SIZE];
+volatile uint8_t tx_head;
+volatile uint8_t tx_tail;
+
+// Transmit state machine
+#define TX_IDLE		0				// Nothing in the TX FIFO
+#define TX_BUSY		1				// Packet in TX FIFO, STX issued
+
+volatile uint8_t tx_state;
+uint8_t tx_tries;					// STX strobes for current packet
+uint16_t tx_timer;					// msec since last STX
+uint8_t tx_frame[RF_MAX_LEN + 1];	// Packet being written to TX FIFO by DMA
+
+RF_TX_STATS tx_stats;
+
+// Acks waiting to be sent.  Acks go ahead of the transmit queue.
+uint8_t ack_addr[ACK_QUEUE_SIZE];
+uint8_t ack_seq[ACK_QUEUE_SIZE];
+uint32_t ack_time[ACK_QUEUE_SIZE];	// End of the packet being acked
+uint8_t ack_rssi[ACK_QUEUE_SIZE];	// Raw RSSI of the packet being acked
+uint8_t ack_lqi[ACK_QUEUE_SIZE];
+volatile uint8_t ack_head;
+volatile uint8_t ack_tail;
+uint8_t tx_is_ack;					// tx_frame is an ack
+
+// Urgent packet, sent ahead of everything else
+volatile uint8_t urg_reps;			// Copies still to send
+uint8_t tx_is_urgent;				// tx_frame is an urgent copy
+int (*urg_build)(uint8_t *frame, int rep);
+
+// Packets waiting to be acked
+RF_ARQ_PKT arq_queue[ARQ_QUEUE_SIZE];
+uint32_t arq_order;
+RF_PEER arq_peers[ARQ_MAX_PEERS];
+uint8_t arq_n_peers;
+uint8_t arq_peer_next;				// Next peer entry to reuse
+RF_ARQ_STATS arq_stats;
+
+// Link quality for each sending address
+RF_LINK_STATS link_stats[LINK_MAX_ADDR];
+uint8_t link_n_addr;
+uint8_t link_next;					// Next entry to reuse
+
+// Transmit power control, levels from the datasheet's PATABLE settings
+const uint8_t pa_table[PA_LEVELS] =
+{
+	PA_M30_DBM, PA_M26_DBM, PA_M22_DBM, PA_M18_DBM, PA_M14_DBM, PA_M12_DBM, PA_M10_DBM,
+	PA_M8_DBM, PA_M6_DBM, PA_M4_DBM, PA_M2_DBM, PA_0_DBM, PA_P1_DBM
+};
+
+const int8_t pa_dbm[PA_LEVELS] = {-30, -26, -22, -18, -14, -12, -10, -8, -6, -4, -2, 0, 1};
+
+RF_PA_CTRL pa_ctrl = {1, PA_LEVEL_MAX, PA_MARGIN};
+
+#define PA_UNKNOWN		0xFF			// PATABLE entry 0 not set since reset
+uint8_t pa_loaded = PA_UNKNOWN;			// Level in PATABLE entry 0
+
+// Bulk transfer
+#define BULK_IDLE		0
+#define BULK_TX			1
+#define BULK_RX			2
+
+volatile uint8_t bulk_state;
+uint8_t bulk_fixed;					// Switched to fixed length mode
+uint8_t bulk_hdr[BULK_HDR_LEN];
+uint8_t *bulk_buf;					// Caller's data
+int bulk_n;							// Data bytes
+int bulk_max;						// Receive buffer size
+uint16_t bulk_total;				// Packet bytes on air, without CRC
+uint16_t bulk_pos;					// Packet bytes written to or read from FIFO
+uint16_t bulk_timer;				// msec since FIFO progress
+uint32_t bulk_t0;					// cyc_count() at STX
+uint8_t bulk_tmp[CC_FIFO_SIZE];
+uint8_t bulk_saved[5];				// Registers changed for a bulk transfer
+void (*bulk_done)(int result);
+uint8_t bulk_rx_addr;				// ADDR byte of the last packet received
+RF_BULK_STATS bulk_stats;
+
+uint8_t scan_active;				// Spectrum scan, hold off transmit
+uint8_t cal_active;					// Calibration table build, hold off transmit
+
+void (*cc_rx_tap)(uint8_t *p, uint32_t time);	// Sniffer, replaces the receive queue
+int (*cc_rx_fast)(uint8_t *p, uint32_t time);	// Packets acted on in the interrupt
+
+// Fault watchdog
+RF_FAULT_STATS fault_stats;
+uint16_t fault_timer;				// msec since the last poll
+
+// Latency timestamps, cyc_count() time of the last GDO0 edges
+volatile uint32_t lat_sync_time;
+volatile uint32_t lat_eop_time;
+LAT_HIST lat_rtt;
+LAT_HIST lat_oneway;
+LAT_STATS lat_stats;
+
+// Preamble bytes for MDMCFG1 NUM_PREAMBLE
+const uint8_t lat_preamble[8] = {2, 3, 4, 6, 8, 12, 16, 24};
+
+#define ARQ_FREE		0
+#define ARQ_QUEUED		1				// Waiting for earlier packets to the address
+#define ARQ_WAIT_ACK	2
+
+
+void cc_gdo0_isr(void);
+void cc_tx_start(void);
+void cc_tx_loaded(void);
+void cc_tx_done(int result);
+void cc_tx_urgent(void);
+int cc_rx_avail(int n);
+int cc_rx_isr(void);
+void cc_rx_drain(void);
+void cc_rx_dma_done(void);
+void cc_rx_parse(void);
+int cc_div_dup(uint8_t *p, uint8_t radio);
+void cc_rx_flush(void);
+uint8_t cc_read_rxbytes(void);
+RF_PEER *cc_arq_peer(uint8_t addr);
+int cc_arq_rx(uint8_t *p);
+void cc_arq_ack(uint8_t src, uint8_t seq, uint8_t rssi, uint8_t lqi);
+void cc_arq_next(uint8_t addr);
+void cc_arq_service(RF_ARQ_PKT *pkt);
+void cc_arq_done(RF_ARQ_PKT *pkt, int result);
+void cc_arq_rtt(RF_PEER *peer, uint32_t rtt);
+void cc_arq_tick(void);
+void cc_link_update(uint8_t *p);
+void cc_bulk_setup(uint8_t iocfg2);
+void cc_bulk_finish(int result);
+void cc_bulk_length(int remain);
+void cc_bulk_fill(void);
+int cc_bulk_store(int n);
+void cc_bulk_drain(void);
+void cc_bulk_restart(void);
+void cc_bulk_eop(void);
+void cc_bulk_tick(void);
+void cc_fault_tick(void);
+uint32_t cc_lat_capture(uint16_t ccr);
+void cc_lat_sync(void);
+void cc_lat_eop(void);
+void cc_lat_ack(RF_ARQ_PKT *pkt, uint8_t *p);
+void cc_pa_set(uint8_t addr);
+void cc_pa_load(uint8_t level);
+void cc_pa_report(uint8_t src, uint8_t *p);
+void cc_pa_missed(uint8_t addr);
 
 
 
 /* cc_reset
  *
  * Send reset command.
+ * The registers return to their reset values, so the register cache
+ * is invalidated.
  */
 uint8_t cc_reset(void)
 {
+	config_valid = 0;
+	cal_valid = 0;
+	pa_loaded = PA_UNKNOWN;
+
 	return (cc_write_cmd(SRES));
 }
 
@@ -95,51 +303,99 @@ uint8_t cc_cmd_rx(void)
  * Request CC2500 status.
  * Sends a NOP command to the CC2500 to return the status.
  *
- * Returns the global status byte.
+ * Returns the radio 0 status byte.
  */
 uint8_t cc_status_update(void)
 {
 	cc_write_cmd(SNOP);
 
-	return status;
+	return CC_DEV0->status;
 }
 
 
-/*
+/* cc_set_base_frequency
+ *
+ * Parameters
+ * base_freq		Frequency of channel 0 (Hz)
  *
+ * Returns
+ * 0 on success, -1 if the frequency is outside the band.
+ *
+ * FREQ[23:0] = base_freq * 2^16 / fXOSC
+ *
+ * The radio is put in IDLE to change frequency.  The channel
+ * calibration table is no longer valid, so it is rebuilt, and the
+ * radio is back in RX afterwards.
  */
 int cc_set_base_frequency(uint32_t base_freq)
 {
+	uint32_t freq;
+	uint32_t key;
+
+
+	if((base_freq < RF_BAND_MIN) || (base_freq >= RF_BAND_MAX))
+		return -1;
+
+	freq = (uint32_t)(((unsigned long long)base_freq << 16) / CC_FXOSC);
+
+	key = cc_lock();
+
+	cc_radio_stop();
 
+	cc_reg_set(FREQ2, (uint8_t)(freq >> 16));
+	cc_reg_set(FREQ1, (uint8_t)(freq >> 8));
+	cc_reg_set(FREQ0, (uint8_t)freq);
+	cc_reg_commit();
 
+	cal_active = 1;						// Hold off transmit until the table is built
+
+	cc_unlock(key);
+
+	cc_cal_build();
 
 	return 0;
 }
 
-/*
+/* cc_read_rssi
+ *
+ * Returns
+ * Signal strength on the current channel in dBm x 16.
  *
+ * Reads the RSSI status register.  Valid in RX, for received packets
+ * use the RSSI appended to the packet.
  */
 int cc_read_rssi(void)
 {
-
-		return 0;
+	return cc_rssi_dbm(cc_read_status(RSSI));
 }
 
 
 /* Write data to the Tx FIFO buffer
  *
+ * addr			Destination address
  * *buf			Buffer holding data to write
  * n			No. of bytes to write
  *
+ * Returns
+ * No. of data bytes written, or -1 if n is too long for one packet.
  *
+ * The LEN and ADDR bytes are added in front of the data and the
+ * whole packet is written to the FIFO in one SPI burst.
  */
-int rf_write_tx_fifo(uint8_t *buf, int n)
+int rf_write_tx_fifo(uint8_t addr, uint8_t *buf, int n)
 {
+	uint8_t frame[RF_MAX_LEN + 1];
 
-	// Add the LEN and ADDR bytes to the packet
 
+	if(n > RF_MAX_DATA)
+		return -1;
+
+	// Add the LEN and ADDR bytes to the packet
+	frame[0] = n + 1;
+	frame[1] = addr;
+	memcpy(frame + 2, buf, n);
 
-	cc_write_fifo(buf, n);
+	cc_write_fifo(frame, n + 2);
 
 	return n;
 }
@@ -152,114 +408,3190 @@ int rf_write_tx_fifo(uint8_t *buf, int n)
  *
  * Returns
  * No. of bytes read
+ * -1 if the RX FIFO has overflowed.
+ *
+ * Reads up to n bytes in a single SPI burst.  If a packet is still
+ * being received (GDO0 high) the last byte is left in the FIFO.
+ * Emptying the RX FIFO while receiving can return a corrupt byte.
  */
 int rf_read_rx_fifo(uint8_t *buf, int n)
 {
+	n = cc_rx_avail(n);
+
+	if(n > 0)
+		cc_read_fifo(buf, n);
+
+	return n;
+}
+
+
+/* cc_rx_avail
+ *
+ * n			Max no. of bytes wanted
+ *
+ * Returns
+ * No. of bytes that can be read from the RX FIFO, up to n.
+ * -1 if the RX FIFO has overflowed.
+ *
+ * If a packet is still being received (GDO0 high) the last byte must
+ * be left in the FIFO.
+ */
+int cc_rx_avail(int n)
+{
+	uint8_t rxbytes;
+	int avail;
+
+
+	rxbytes = cc_read_rxbytes();
+
+	if(rxbytes & FIFO_OVERFLOW)
+		return -1;
+
+	avail = rxbytes & FIFO_NUM_BYTES;
+	if(GDO0_ACTIVE() && (avail > 0))
+		avail--;
+
+	if(n > avail)
+		n = avail;
 
 	return n;
 }
 
 
+/* cc_read_rxbytes
+ *
+ * Read the RXBYTES status register.
+ * RXBYTES is read until two consecutive values are the same, the
+ * value may be corrupt if it changes during the SPI read.
+ */
+uint8_t cc_read_rxbytes(void)
+{
+	uint8_t rxbytes;
+	uint8_t last;
+
+
+	rxbytes = cc_read_status(RXBYTES);
+	do
+	{
+		last = rxbytes;
+		rxbytes = cc_read_status(RXBYTES);
+	} while(rxbytes != last);
+
+	return rxbytes;
+}
+
 
 
 /******************************************************************************
- * Public functions
+ * Packet receive engine.
  ******************************************************************************/
 
 
-/* cc_radio_config
+/* cc_gdo_init
  *
- * Parameters
- * *config			Pointer to configuration data structure.
+ * Configure the GDO0 external interrupt.
+ * PB0 must be configured as an input and the AFIO clock enabled.
+ *
+ * GDO0 de-asserts at the end of a packet, so EXTI0 triggers on
+ * the falling edge.
+ */
+void cc_gdo_init(void)
+{
+	AFIO->EXTICR[0] &= ~AFIO_EXTICR1_EXTI0;
+	AFIO->EXTICR[0] |= AFIO_EXTICR1_EXTI0_PB;		// EXTI0 source is PB0
+
+	EXTI->RTSR &= ~EXTI_RTSR_TR0;
+	EXTI->FTSR |= EXTI_FTSR_TR0;					// Falling edge trigger
+	EXTI->PR = EXTI_PR_PR0;							// Clear pending flag
+	EXTI->IMR |= EXTI_IMR_MR0;						// Unmask EXTI0
+
+	AFIO->EXTICR[0] &= ~AFIO_EXTICR1_EXTI1;
+	AFIO->EXTICR[0] |= AFIO_EXTICR1_EXTI1_PB;		// EXTI1 source is PB1 (GDO2)
+	EXTI->IMR &= ~EXTI_IMR_MR1;						// Unmasked for bulk transfers
+}
+
+
+/* cc_rx_isr
  *
  * Returns
+ * 1 if a DMA FIFO read was started, 0 if there was nothing to read.
  *
+ * Called from the GDO0 interrupt at the end of a packet.
+ * Starts a DMA burst read to drain the RX FIFO into the staging buffer
+ * and returns.  cc_rx_dma_done() moves complete packets to the receive
+ * queue when the read has finished.
+ */
+int cc_rx_isr(void)
+{
+	int n;
+
+
+	n = cc_rx_avail(sizeof(rx_buf) - rx_buf_n);
+
+	if(n < 0)
+	{
+		rx_stats.overflow++;
+		cc_fault_recover();
+		return 0;
+	}
+
+	if(n == 0)
+		return 0;
+
+	rx_dma_n = n;
+	cc_read_fifo_dma(rx_buf + rx_buf_n, n, cc_rx_dma_done);
+
+	return 1;
+}
+
+
+/* cc_rx_drain
  *
- * Configure HAL.
- * Call this before calling start.
- * Fill in a configuration data structure.
+ * Read the RX FIFO and queue the complete packets before the FIFO is
+ * flushed.  The radio must be in IDLE so the end of a part packet
+ * can be read.  Blocking, it doesn't start the transmitter.
+ */
+void cc_rx_drain(void)
+{
+	int n;
+
+
+	// Finish a DMA read of the FIFO
+	spi_dma_wait();
+
+	n = rf_read_rx_fifo(rx_buf + rx_buf_n, sizeof(rx_buf) - rx_buf_n);
+	if(n < 0)
+	{
+		rx_stats.overflow++;
+		return;
+	}
+
+	rx_buf_n += n;
+	cc_rx_parse();
+}
+
+
+/* cc_rx_dma_done
  *
- * Reads the configuration registers from the radio.
- * Updates the registers according to values in the
- * sonfig data structure.
- * Writes the config registers back to the radio.
+ * RX FIFO DMA read complete.
+ * Queue the packets, then start the transmitter if a packet is waiting.
+ */
+void cc_rx_dma_done(void)
+{
+	rx_buf_n += rx_dma_n;
+
+	cc_rx_parse();
+
+	cc_tx_start();
+}
+
+
+/* cc_rx_parse
  *
- * This must be called when the radio is in idle state.
+ * Split the staging buffer into packets.
+ * Each packet is [LEN][ADDR][DATA...][RSSI][LQI].
+ * An incomplete packet at the end of the buffer is kept for next time.
+ * Packets go to the receive tap instead of the queue when it is set.
+ * An invalid LEN byte means packet framing has been lost, so the
+ * buffer and RX FIFO are flushed.
  */
-int cc_radio_config(RF_CONFIG *config)
+void cc_rx_parse(void)
 {
+	uint8_t *p;
+	uint8_t len;
+	int remain;
 
-	// Read all the config registers
-	cc_read_b(0, config_regs, N_CONFIG_REGS);
 
+	p = rx_buf;
+	remain = rx_buf_n;
 
-	// Write the config registers
+	while(remain > 0)
+	{
+		len = p[0];
 
+		if((len < 1) || (len > RF_MAX_LEN))
+		{
+			rx_stats.len_err++;
+			cc_rx_flush();
+			return;
+		}
 
+		if(remain < (len + 3))			// LEN byte + packet + RSSI + LQI
+			break;
 
-	return 0;
+		if(cc_rx_tap != NULL)
+			cc_rx_tap(p, lat_sync_time);
+		else
+			cc_rx_queue_put(p, 0);
+
+		p += len + 3;
+		remain -= len + 3;
+	}
+
+	memmove(rx_buf, p, remain);
+	rx_buf_n = remain;
 }
 
-/* cc_radio_start
+
+/* cc_rx_queue_put
  *
- * Radio starts in receive state
+ * Parameters
+ * *p			[LEN][ADDR][DATA...][RSSI][LQI]
+ * radio		Receiving radio
+ *
+ * Check the CRC and put a packet in the receive queue.  Called from
+ * the radio interrupts, for radio 1 by cc_dual.c.
  */
-int cc_radio_start(void)
+void cc_rx_queue_put(uint8_t *p, uint8_t radio)
 {
-	// Check radio is in idle state.
+	RF_PKT *pkt;
+	uint8_t len;
+	uint8_t lqi;
+	uint8_t next;
 
 
-	return 0;
+	len = p[0];
+	lqi = p[len + 2];
+
+	if(!(lqi & LQI_CRC_OK))
+	{
+		rx_stats.crc_err++;
+		return;
+	}
+
+	div_stats.heard[radio]++;
+
+	// Second copy from the other radio
+	if(cc_div_dup(p, radio))
+		return;
+
+	cc_link_update(p);
+
+	if((cc_rx_fast != NULL) && cc_rx_fast(p, lat_sync_time))
+		return;
+
+	// Acks and duplicates aren't queued
+	if(cc_arq_rx(p))
+		return;
+
+	next = (rx_head + 1) % RX_QUEUE_SIZE;
+	if(next == rx_tail)
+	{
+		rx_stats.queue_full++;
+		return;
+	}
+
+	pkt = &rx_queue[rx_head];
+	pkt->addr = p[1];
+	pkt->len = len - 1;
+	memcpy(pkt->data, p + 2, len - 1);
+	pkt->rssi = p[len + 1];
+	pkt->lqi = lqi & LQI_EST;
+	pkt->radio = radio;
+	pkt->time = cyc_count();
+	pkt->sync = (radio == 0) ? lat_sync_time : pkt->time;	// No capture on radio 1
+
+	div_slot = rx_head;
+	rx_head = next;
+	rx_stats.rx_pkts++;
 }
 
 
-/* cc_radio_stop
+/* cc_div_dup
  *
- * Radio stops receiving or transmitting.
- * Radio changes to idle state.
- * This is necessary to be able to update the config registers.
- * It can also be used to recover from error states such as RX FIFO
- * overflow.
+ * Parameters
+ * *p			[LEN][ADDR][DATA...][RSSI][LQI], CRC good
+ * radio		Receiving radio
+ *
+ * Returns
+ * 1 if the packet is a copy of the last one, heard by the other radio.
+ *
+ * If the copy is stronger and the first is still in the receive queue,
+ * the queued packet takes its RSSI and LQI.  Otherwise the packet is
+ * kept to match against the next one.
  */
-int cc_radio_stop(void)
+int cc_div_dup(uint8_t *p, uint8_t radio)
 {
+	RF_PKT *pkt;
+	uint32_t now;
+	uint8_t len;
 
 
+	now = cyc_count();
+	len = p[0];
 
-	// Check the radio is in the idle state before returning
+	if((radio != div_radio) && ((now - div_time) < (DIV_WINDOW_USEC * CYC_PER_USEC)) &&
+		(memcmp(p, div_pkt, len + 1) == 0))
+	{
+		div_stats.dups++;
+		div_time = now - (DIV_WINDOW_USEC * CYC_PER_USEC);		// Match once
+
+		if((int8_t)p[len + 1] <= (int8_t)div_rssi)
+		{
+			div_stats.best[div_radio]++;
+			return 1;
+		}
+
+		div_stats.best[radio]++;
+
+		// Still queued, between the tail and the head
+		if((div_slot < RX_QUEUE_SIZE) &&
+			(((div_slot - rx_tail + RX_QUEUE_SIZE) % RX_QUEUE_SIZE) <
+			((rx_head - rx_tail + RX_QUEUE_SIZE) % RX_QUEUE_SIZE)))
+		{
+			pkt = &rx_queue[div_slot];
+			pkt->rssi = p[len + 1];
+			pkt->lqi = p[len + 2] & LQI_EST;
+			pkt->radio = radio;
+		}
+		return 1;
+	}
+
+	memcpy(div_pkt, p, len + 1);
+	div_radio = radio;
+	div_rssi = p[len + 1];
+	div_slot = RX_QUEUE_SIZE;
+	div_time = now;
 
 	return 0;
 }
 
-/* cc_receive_pkt
+
+/* cc_rx_flush
  *
- * Reads a receive packet from the radio.
- * This is called in response to the radio indicating it has received a packet.
- * Typically the radio sets one of the GDOx pins. The application either
- * polls the pin or an interrupt is triggered.
- * The radio remains in the receive state.
+ * Flush the RX FIFO and staging buffer and restart RX.
+ */
+void cc_rx_flush(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	cc_radio_stop();
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+	cc_write_cmd(SRX);
+
+	cc_unlock(key);
+}
+
+
+/* cc_gdo0_isr
  *
- * Note: The HAL could be set up to automatically receive
- * packets and store them in a packet queue.
+ * GDO0 end of packet.
+ *
+ * If a packet is being transmitted the end of packet is either the end
+ * of our transmission, or the end of a packet that was being received
+ * when STX was strobed (STX is ignored while receiving).  TXBYTES tells
+ * which: the TX FIFO is empty once the packet has been sent.
+ *
+ * After TX the radio returns to RX by itself (MCSM1 TXOFF_MODE).
  */
-int cc_receive_pkt(void)
+void cc_gdo0_isr(void)
 {
+	uint8_t txbytes;
 
 
+	cc_lat_eop();
 
+	// A packet wakes the radio from WOR, it stays in RX
+	cc_sleeping = 0;
 
-	return 0;
+	if(bulk_state != BULK_IDLE)
+	{
+		cc_bulk_eop();
+		return;
+	}
+
+	if(tx_state == TX_BUSY)
+	{
+		txbytes = cc_read_status(TXBYTES);
+
+		if(txbytes & FIFO_OVERFLOW)
+		{
+			cc_tx_done(RF_TX_FAIL);			// TX FIFO underflow
+		}
+		else if((txbytes & FIFO_NUM_BYTES) == 0)
+		{
+			cc_tx_done(RF_TX_OK);			// Packet sent
+		}
+		else
+		{
+			cc_write_cmd(STX);				// Packet received, now try to send
+			tx_tries++;
+			tx_timer = 0;
+		}
+	}
+
+	if(!cc_rx_isr())						// Drain RX FIFO
+		cc_tx_start();						// Send next packet
 }
 
-/*
- * Send a packet to be transmitted by the radio.
- * The radio changes to TX state and sends the packet, then
- * returns to RX state.
+
+/* EXTI0 Interrupt Handler
+ *
+ * GDO0 falling edge, end of packet.
+ */
+void __attribute__((interrupt("IRQ")))EXTI0_IRQHandler(void)
+{
+	EXTI->PR = EXTI_PR_PR0;				// Clear pending flag (write 1).
+
+	cc_gdo0_isr();
+}
+
+
+
+/******************************************************************************
+ * Packet transmit state machine.
+ ******************************************************************************/
+
+
+/* cc_tx_start
+ *
+ * If the transmitter is idle and there is a packet in the transmit
+ * queue, start a DMA write of the packet to the TX FIFO.
+ * STX is strobed when the FIFO write is complete.
+ * Completion is detected by the GDO0 end of packet interrupt.
+ */
+void cc_tx_start(void)
+{
+	RF_TX_PKT *pkt;
+	uint32_t key;
+	uint32_t turn;
+
+
+	key = cc_lock();
+
+	if(urg_reps && !tx_is_urgent && !scan_active && !cal_active)
+	{
+		cc_tx_urgent();
+	}
+	else if((bulk_state != BULK_IDLE) || scan_active || cal_active)
+	{
+		// Normal packets wait for the bulk transfer, scan or calibration
+	}
+	else if((tx_state == TX_IDLE) && (ack_tail != ack_head))
+	{
+		// [LEN][ADDR][ARQ_ACK][SRC][SEQ][TURN_L][TURN_H][RSSI][LQI]
+		turn = (cyc_count() - ack_time[ack_tail]) / CYC_PER_USEC;
+		if(turn > 0xFFFF)
+			turn = 0xFFFF;
+
+		tx_frame[0] = ARQ_ACK_LEN + 1;
+		tx_frame[1] = ack_addr[ack_tail];
+		tx_frame[2] = ARQ_ACK;
+		tx_frame[3] = cc_reg_get(ADDR);
+		tx_frame[4] = ack_seq[ack_tail];
+		tx_frame[5] = (uint8_t)turn;
+		tx_frame[6] = (uint8_t)(turn >> 8);
+		tx_frame[7] = ack_rssi[ack_tail];
+		tx_frame[8] = ack_lqi[ack_tail];
+
+		tx_is_ack = 1;
+		tx_state = TX_BUSY;
+		tx_tries = 0;
+		tx_timer = 0;
+
+		cc_pa_set(tx_frame[1]);
+
+		cc_write_fifo_dma(tx_frame, ARQ_ACK_LEN + 2, cc_tx_loaded);
+	}
+	else if((tx_state == TX_IDLE) && (tx_tail != tx_head))
+	{
+		pkt = &tx_queue[tx_tail];
+
+		// [LEN][ADDR][DATA...]
+		tx_frame[0] = pkt->len + 1;
+		tx_frame[1] = pkt->addr;
+		memcpy(tx_frame + 2, pkt->data, pkt->len);
+
+		tx_state = TX_BUSY;
+		tx_tries = 0;
+		tx_timer = 0;
+
+		cc_pa_set(pkt->addr);
+
+		cc_write_fifo_dma(tx_frame, pkt->len + 2, cc_tx_loaded);
+	}
+
+	cc_unlock(key);
+}
+
+
+/* cc_tx_loaded
+ *
+ * TX FIFO DMA write complete, send the packet.
+ */
+void cc_tx_loaded(void)
+{
+	// An urgent packet came while the FIFO was being written
+	if(urg_reps)
+	{
+		cc_tx_urgent();
+		return;
+	}
+
+	cc_write_cmd(STX);
+
+	tx_tries = 1;
+	tx_timer = 0;
+}
+
+
+/* cc_tx_urgent
+ *
+ * Send the next copy of the urgent packet now.  A packet in the TX
+ * FIFO, on air or not, is pulled back and stays at the head of its
+ * queue, and a packet being received is lost.  From IDLE, STX doesn't
+ * wait for a clear channel.  Copies go at full power, whatever the
+ * level of the last packet.
+ *
+ * Called with the radio locked and no SPI DMA transfer running.
+ */
+void cc_tx_urgent(void)
+{
+	int n;
+
+
+	if((tx_state == TX_BUSY) && !tx_is_urgent)
+	{
+		tx_is_ack = 0;					// The ack is still in its queue
+		tx_stats.preempted++;
+	}
+
+	cc_radio_stop();
+	cc_write_cmd(SFTX);
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+	cc_sleeping = 0;
+
+	// GDO0 falls when a packet is cut off, it isn't an end of packet
+	EXTI->PR = EXTI_PR_PR0;
+	NVIC_ClearPendingIRQ(EXTI0_IRQn);
+
+	n = urg_build(tx_frame, urg_reps);
+	cc_pa_load(PA_LEVEL_MAX);
+	cc_write_fifo(tx_frame, n);
+	cc_write_cmd(STX);
+
+	tx_is_urgent = 1;
+	tx_state = TX_BUSY;
+	tx_tries = 1;
+	tx_timer = 0;
+	tx_stats.urgent++;
+}
+
+
+/* cc_tx_done
+ *
+ * result		RF_TX_OK or RF_TX_FAIL
  *
+ * Finish the current packet.  Removes it from the transmit queue and
+ * calls its completion callback.  A failed packet may still be in the
+ * TX FIFO, so the TX FIFO is flushed.
  *
+ * Called with the radio locked.
  */
-int cc_send_pkt(void)
+void cc_tx_done(int result)
 {
+	RF_TX_PKT *pkt;
+
+
+	pkt = &tx_queue[tx_tail];
+
+	if(result == RF_TX_OK)
+	{
+		tx_stats.tx_pkts++;
+	}
+	else
+	{
+		tx_stats.tx_fail++;
+
+		cc_radio_stop();
+		cc_write_cmd(SFTX);
+		cc_write_cmd(SRX);
+	}
+
+	tx_state = TX_IDLE;
+
+	if(tx_is_urgent)
+	{
+		tx_is_urgent = 0;
+		if(urg_reps)
+			urg_reps--;
+		return;
+	}
+
+	// Acks have no callback, a lost ack is covered by the sender's retry
+	if(tx_is_ack)
+	{
+		tx_is_ack = 0;
+		ack_tail = (ack_tail + 1) % ACK_QUEUE_SIZE;
+		return;
+	}
+
+	tx_tail = (tx_tail + 1) % TX_QUEUE_SIZE;
+
+	if(pkt->done != NULL)
+		pkt->done(result);
+}
+
+
+/* cc_hal_tick
+ *
+ * Call every 1msec from the main loop.
+ *
+ * Checks on a transmission that hasn't completed.  If CCA stopped STX
+ * (channel busy) the radio is still in RX with data in the TX FIFO, so
+ * STX is strobed again.  After TX_MAX_TRIES the packet is dropped.
+ * If the end of packet interrupt was missed the TX FIFO will be empty.
+ */
+void cc_hal_tick(void)
+{
+	uint8_t txbytes;
+	uint8_t marcstate;
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if((tx_state == TX_BUSY) && (++tx_timer >= TX_RETRY_MSEC))
+	{
+		tx_timer = 0;
+
+		txbytes = cc_read_status(TXBYTES);
+		marcstate = cc_read_status(MARCSTATE);
+
+		if(txbytes & FIFO_OVERFLOW)
+		{
+			cc_tx_done(RF_TX_FAIL);
+		}
+		else if((txbytes & FIFO_NUM_BYTES) == 0)
+		{
+			cc_tx_done(RF_TX_OK);
+		}
+		else if(marcstate == MARCSTATE_RX)
+		{
+			if(tx_tries >= TX_MAX_TRIES)
+			{
+				cc_tx_done(RF_TX_FAIL);
+			}
+			else
+			{
+				cc_write_cmd(STX);
+				tx_tries++;
+				tx_stats.tx_retries++;
+			}
+		}
+	}
+
+	cc_unlock(key);
+
+	cc_arq_tick();
+	cc_bulk_tick();
+	cc_fault_tick();
+
+	cc_tx_start();
+}
+
+
+/* cc_tx_queued
+ *
+ * Returns
+ * 1 if a packet is waiting in the transmit queue or being sent, 0 if
+ * the transmitter is free.
+ */
+int cc_tx_queued(void)
+{
+	return (tx_state != TX_IDLE) || (tx_head != tx_tail);
+}
+
+
+/* cc_rx_active
+ *
+ * Returns
+ * 1 if a packet is being received, 0 if not.
+ *
+ * GDO0 is high from the sync word to the end of the packet.
+ */
+int cc_rx_active(void)
+{
+	return GDO0_ACTIVE() ? 1 : 0;
+}
+
+
+/* cc_tx_active
+ *
+ * Returns
+ * 1 if a packet is on air, 0 if not.
+ *
+ * A packet that is queued or waiting for a clear channel isn't on air,
+ * the radio can be moved to another channel and it will be sent there.
+ */
+int cc_tx_active(void)
+{
+	uint8_t marcstate;
+	uint32_t key;
+	int active;
+
+
+	key = cc_lock();
+
+	active = 0;
+	if(tx_state == TX_BUSY)
+	{
+		marcstate = cc_read_status(MARCSTATE);
+		if((marcstate != MARCSTATE_RX) && (marcstate != MARCSTATE_IDLE))
+			active = 1;
+	}
+
+	cc_unlock(key);
+
+	return active;
+}
+
+
+
+
+/******************************************************************************
+ * Bulk transfer.
+ *
+ * A bulk packet is longer than the 64 byte FIFOs.  It is sent in
+ * infinite length mode, switching to fixed length mode with PKTLEN set
+ * to the packet length mod 256 once fewer than 256 bytes are left on
+ * air.  The packet then ends and the CRC is sent and checked as usual.
+ *
+ * GDO2 (PB1, EXTI1) is set to the FIFO threshold while a bulk packet is
+ * on air.  In TX it de-asserts when the TX FIFO drains below the
+ * threshold, and the FIFO is refilled.  In RX it asserts when the RX
+ * FIFO fills to the threshold, and the FIFO is drained, leaving one
+ * byte while the packet is still being received (errata).  GDO0 end of
+ * packet finishes the transfer.
+ *
+ * The radio does nothing else during a bulk transfer.  Normal packets
+ * wait in the transmit queue, and CCA is off so STX always starts the
+ * packet.  The packet handling registers are restored at the end.
+ ******************************************************************************/
+
+
+/* cc_bulk_setup
+ *
+ * Parameters
+ * iocfg2		GDO2 FIFO threshold signal
+ *
+ * Save the packet handling registers and set them up for a bulk
+ * transfer.  The radio must be in IDLE.
+ */
+void cc_bulk_setup(uint8_t iocfg2)
+{
+	bulk_saved[0] = cc_reg_get(IOCFG2);
+	bulk_saved[1] = cc_reg_get(FIFOTHR);
+	bulk_saved[2] = cc_reg_get(PKTCTRL0);
+	bulk_saved[3] = cc_reg_get(PKTLEN);
+	bulk_saved[4] = cc_reg_get(MCSM1);
+
+	cc_reg_set(IOCFG2, iocfg2);
+	cc_reg_set(FIFOTHR, (bulk_saved[1] & ~FIFOTHR_FIFO_THR) | BULK_FIFO_THR);
+	cc_reg_set(PKTCTRL0, (bulk_saved[2] & ~PKTCTRL0_LEN_CONFIG) | PKTCTRL0_LEN_INFINITE);
+	cc_reg_set(MCSM1, bulk_saved[4] & ~MCSM1_CCA_MODE);
+	cc_reg_commit();
+
+	bulk_pos = 0;
+	bulk_total = 0;
+	bulk_fixed = 0;
+	bulk_timer = 0;
+
+	// GDO2 interrupt
+	if(iocfg2 == GDO_TX_THR)
+	{
+		EXTI->RTSR &= ~EXTI_RTSR_TR1;
+		EXTI->FTSR |= EXTI_FTSR_TR1;				// TX FIFO below threshold
+	}
+	else
+	{
+		EXTI->FTSR &= ~EXTI_FTSR_TR1;
+		EXTI->RTSR |= EXTI_RTSR_TR1;				// RX FIFO at threshold
+	}
+	EXTI->PR = EXTI_PR_PR1;
+	EXTI->IMR |= EXTI_IMR_MR1;
+}
+
+
+/* cc_bulk_finish
+ *
+ * Parameters
+ * result		No. of data bytes received, 0 for a packet sent, or
+ *				RF_BULK_FAIL
+ *
+ * End a bulk transfer.  Restore the packet handling registers, return
+ * to RX and call the completion callback.
+ */
+void cc_bulk_finish(int result)
+{
+	void (*done)(int result);
+
+
+	EXTI->IMR &= ~EXTI_IMR_MR1;
+
+	cc_radio_stop();
+
+	cc_reg_set(IOCFG2, bulk_saved[0]);
+	cc_reg_set(FIFOTHR, bulk_saved[1]);
+	cc_reg_set(PKTCTRL0, bulk_saved[2]);
+	cc_reg_set(PKTLEN, bulk_saved[3]);
+	cc_reg_set(MCSM1, bulk_saved[4]);
+	cc_reg_commit();
+
+	bulk_state = BULK_IDLE;
+	done = bulk_done;
+
+	cc_radio_start();
+
+	if(done != NULL)
+		done(result);
+
+	cc_tx_start();
+}
+
+
+/* cc_bulk_length
+ *
+ * Parameters
+ * remain		Bytes of the packet not yet on air, at most
+ *
+ * Switch to fixed length mode once fewer than 256 bytes are left.
+ */
+void cc_bulk_length(int remain)
+{
+	if(bulk_fixed || (remain >= 256))
+		return;
+
+	cc_write(PKTLEN, (uint8_t)bulk_total);
+	config_regs[PKTLEN] = (uint8_t)bulk_total;
+
+	config_regs[PKTCTRL0] = (config_regs[PKTCTRL0] & ~PKTCTRL0_LEN_CONFIG) | PKTCTRL0_LEN_FIXED;
+	cc_write(PKTCTRL0, config_regs[PKTCTRL0]);
+
+	bulk_fixed = 1;
+}
+
+
+/* cc_bulk_fill
+ *
+ * Write the next part of the packet to the TX FIFO.
+ * Called from the GDO2 interrupt when the TX FIFO is below the
+ * threshold.
+ */
+void cc_bulk_fill(void)
+{
+	uint8_t txbytes;
+	int n;
+	int i;
+
+
+	txbytes = cc_read_status(TXBYTES);
+
+	if(txbytes & FIFO_OVERFLOW)
+	{
+		bulk_stats.underflow++;
+		cc_bulk_finish(RF_BULK_FAIL);
+		return;
+	}
+
+	n = CC_FIFO_SIZE - (txbytes & FIFO_NUM_BYTES);
+	if(n > bulk_total - bulk_pos)
+		n = bulk_total - bulk_pos;
+
+	for(i=0; i<n; i++, bulk_pos++)
+	{
+		if(bulk_pos < BULK_HDR_LEN)
+			bulk_tmp[i] = bulk_hdr[bulk_pos];
+		else if(bulk_pos - BULK_HDR_LEN < bulk_n)
+			bulk_tmp[i] = bulk_buf[bulk_pos - BULK_HDR_LEN];
+		else
+			bulk_tmp[i] = 0;						// Pad
+	}
+
+	if(n > 0)
+		cc_write_fifo(bulk_tmp, n);
+
+	// Bytes still to go on air, at most
+	cc_bulk_length(bulk_total - bulk_pos + CC_FIFO_SIZE);
+
+	bulk_timer = 0;
+
+	// All written, wait for end of packet
+	if(bulk_pos == bulk_total)
+		EXTI->IMR &= ~EXTI_IMR_MR1;
+}
+
+
+/* cc_bulk_store
+ *
+ * Parameters
+ * n			No. of bytes in bulk_tmp
+ *
+ * Returns
+ * 0, or -1 if the length header is bad.
+ *
+ * Put received packet bytes in the header or the data buffer.
+ */
+int cc_bulk_store(int n)
+{
+	uint16_t len;
+	int i;
+
+
+	for(i=0; (i<n) && ((bulk_total == 0) || (bulk_pos < bulk_total)); i++, bulk_pos++)
+	{
+		if(bulk_pos < BULK_HDR_LEN)
+			bulk_hdr[bulk_pos] = bulk_tmp[i];
+		else if(bulk_pos - BULK_HDR_LEN < bulk_n)
+			bulk_buf[bulk_pos - BULK_HDR_LEN] = bulk_tmp[i];
+
+		if(bulk_pos == 1)
+		{
+			len = (bulk_hdr[0] << 8) | bulk_hdr[1];
+			if((len < BULK_MIN_DATA + 1) || (len - 1 > bulk_max))
+				return -1;
+
+			bulk_n = len - 1;
+			bulk_total = len + 2;
+			if((bulk_total & 0xFF) == 0)
+				bulk_total++;
+		}
+	}
+
+	return 0;
+}
+
+
+/* cc_bulk_drain
+ *
+ * Read the RX FIFO while a bulk packet is being received.
+ * Called from the GDO2 interrupt when the RX FIFO reaches the
+ * threshold.  A bad length header restarts RX.
+ */
+void cc_bulk_drain(void)
+{
+	uint8_t rxbytes;
+	int n;
+
+
+	rxbytes = cc_read_rxbytes();
+
+	if(rxbytes & FIFO_OVERFLOW)
+	{
+		bulk_stats.overflow++;
+		cc_bulk_finish(RF_BULK_FAIL);
+		return;
+	}
+
+	n = (rxbytes & FIFO_NUM_BYTES) - 1;		// Leave one byte
+	if(n <= 0)
+		return;
+
+	cc_read_fifo(bulk_tmp, n);
+
+	if(cc_bulk_store(n) < 0)
+	{
+		bulk_stats.len_err++;
+		cc_bulk_restart();
+		return;
+	}
+
+	if(bulk_total)
+		cc_bulk_length(bulk_total - bulk_pos);
+
+	bulk_timer = 0;
+}
+
+
+/* cc_bulk_restart
+ *
+ * Throw away a bad bulk packet and wait for the next one.
+ */
+void cc_bulk_restart(void)
+{
+	cc_radio_stop();
+	cc_write_cmd(SFRX);
+
+	config_regs[PKTCTRL0] = (config_regs[PKTCTRL0] & ~PKTCTRL0_LEN_CONFIG) | PKTCTRL0_LEN_INFINITE;
+	cc_write(PKTCTRL0, config_regs[PKTCTRL0]);
+
+	bulk_pos = 0;
+	bulk_total = 0;
+	bulk_fixed = 0;
+	bulk_timer = 0;
+
+	cc_write_cmd(SRX);
+}
+
+
+/* cc_bulk_eop
+ *
+ * GDO0 end of a bulk packet.
+ * TX: the TX FIFO must be empty.
+ * RX: read the rest of the packet and the status bytes, check CRC.
+ */
+void cc_bulk_eop(void)
+{
+	uint8_t txbytes;
+	uint8_t rxbytes;
+	uint8_t lqi;
+	int n;
+
+
+	if(bulk_state == BULK_TX)
+	{
+		bulk_stats.cycles = cyc_count() - bulk_t0;
+		bulk_stats.bytes = bulk_total;
+
+		txbytes = cc_read_status(TXBYTES);
+		if(txbytes != 0)
+		{
+			bulk_stats.underflow++;
+			cc_bulk_finish(RF_BULK_FAIL);
+			return;
+		}
+
+		bulk_stats.tx_pkts++;
+		cc_bulk_finish(0);
+		return;
+	}
+
+	// RX, the end is only seen in fixed length mode
+	if(!bulk_fixed)
+		return;
+
+	rxbytes = cc_read_rxbytes();
+	n = rxbytes & FIFO_NUM_BYTES;
+
+	if((rxbytes & FIFO_OVERFLOW) || (bulk_pos + n != bulk_total + 2))
+	{
+		bulk_stats.overflow++;
+		cc_bulk_finish(RF_BULK_FAIL);
+		return;
+	}
+
+	cc_read_fifo(bulk_tmp, n);
+	cc_bulk_store(n - 2);
+
+	lqi = bulk_tmp[n - 1];
+	if(!(lqi & LQI_CRC_OK))
+	{
+		bulk_stats.crc_err++;
+		cc_bulk_finish(RF_BULK_FAIL);
+		return;
+	}
+
+	bulk_rx_addr = bulk_hdr[2];
+	bulk_stats.rx_pkts++;
+	cc_bulk_finish(bulk_n);
+}
+
+
+/* cc_bulk_send
+ *
+ * Parameters
+ * addr			Destination address
+ * data			Data bytes, must stay valid until done is called
+ * n			No. of bytes [BULK_MIN_DATA-BULK_MAX_DATA]
+ * done			Called with 0 when sent, or RF_BULK_FAIL.  May be NULL.
+ *
+ * Returns
+ * 0 if started, -1 if the radio is busy or n is out of range.
+ *
+ * Send a bulk packet.  The receiver must be waiting in cc_bulk_recv().
+ * The callback is called from interrupt context.
+ */
+int cc_bulk_send(uint8_t addr, uint8_t *data, int n, void (*done)(int result))
+{
+	uint32_t key;
+
+
+	if((n < BULK_MIN_DATA) || (n > BULK_MAX_DATA))
+		return -1;
+
+	key = cc_lock();
+
+	if((bulk_state != BULK_IDLE) || (tx_state != TX_IDLE))
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	cc_radio_stop();
+	cc_write_cmd(SFTX);
+
+	cc_bulk_setup(GDO_TX_THR);
+
+	bulk_hdr[0] = (uint8_t)((n + 1) >> 8);
+	bulk_hdr[1] = (uint8_t)(n + 1);
+	bulk_hdr[2] = addr;
+	bulk_buf = data;
+	bulk_n = n;
+	bulk_total = n + BULK_HDR_LEN;
+	if((bulk_total & 0xFF) == 0)
+		bulk_total++;
+	bulk_done = done;
+	bulk_state = BULK_TX;
+
+	cc_pa_set(addr);
+
+	// Fill the FIFO, then more on each threshold interrupt
+	cc_bulk_fill();
+
+	bulk_t0 = cyc_count();
+	cc_write_cmd(STX);
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_bulk_recv
+ *
+ * Parameters
+ * buf			Buffer for the data, must stay valid until done is called
+ * max			Buffer size
+ * done			Called with the no. of data bytes received, or
+ *				RF_BULK_FAIL.  May be NULL.
+ *
+ * Returns
+ * 0 if started, -1 if the radio is busy.
+ *
+ * Wait for one bulk packet.  Normal packets can't be received until
+ * it arrives or cc_bulk_abort() is called.  The sender's ADDR byte is
+ * in bulk_rx_addr.  The callback is called from interrupt context.
+ */
+int cc_bulk_recv(uint8_t *buf, int max, void (*done)(int result))
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if((bulk_state != BULK_IDLE) || (tx_state != TX_IDLE))
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	cc_radio_stop();
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+
+	cc_bulk_setup(GDO_RX_THR);
+
+	bulk_buf = buf;
+	bulk_max = (max > BULK_MAX_DATA) ? BULK_MAX_DATA : max;
+	bulk_n = 0;
+	bulk_done = done;
+	bulk_state = BULK_RX;
+
+	cc_write_cmd(SRX);
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_bulk_abort
+ *
+ * Stop a bulk transfer.  The callback is called with RF_BULK_FAIL.
+ */
+void cc_bulk_abort(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if(bulk_state != BULK_IDLE)
+		cc_bulk_finish(RF_BULK_FAIL);
+
+	cc_unlock(key);
+}
+
+
+/* cc_bulk_tick
+ *
+ * Called from cc_hal_tick() every 1msec.
+ * Ends a transfer that has stopped, e.g. the sender went away.
+ */
+void cc_bulk_tick(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	// Waiting for a packet to start isn't timed
+	if(((bulk_state == BULK_TX) || (bulk_pos > 0)) && (++bulk_timer >= BULK_TIMEOUT))
+	{
+		bulk_stats.timeout++;
+
+		if(bulk_state == BULK_TX)
+			cc_bulk_finish(RF_BULK_FAIL);
+		else
+			cc_bulk_restart();
+	}
+
+	cc_unlock(key);
+}
+
+
+/* EXTI1 Interrupt Handler
+ *
+ * GDO2 FIFO threshold during a bulk transfer.
+ */
+void __attribute__((interrupt("IRQ")))EXTI1_IRQHandler(void)
+{
+	EXTI->PR = EXTI_PR_PR1;				// Clear pending flag (write 1).
+
+	if(bulk_state == BULK_TX)
+		cc_bulk_fill();
+	else if(bulk_state == BULK_RX)
+		cc_bulk_drain();
+}
+
+
+/* cc_data_rate
+ *
+ * Returns
+ * Data rate set in MDMCFG4/MDMCFG3 (baud).
+ *
+ * R = (256 + DRATE_M) * 2^DRATE_E * fXOSC / 2^28
+ */
+uint32_t cc_data_rate(void)
+{
+	unsigned long long rate;
+
+
+	rate = (unsigned long long)(256 + cc_reg_get(MDMCFG3)) * CC_FXOSC;
+	rate <<= (cc_reg_get(MDMCFG4) & MDMCFG4_DRATE_E);
+
+	return (uint32_t)(rate >> 28);
+}
+
+
+
+/******************************************************************************
+ * Fault watchdog.
+ *
+ * The radio stops in the RX FIFO overflow or TX FIFO underflow state
+ * until the FIFO is flushed.  Every SPI access latches these states
+ * from the status byte in cc_fault, and cc_fault_tick() polls with
+ * SNOP when nothing else has accessed the radio.  The radio is then
+ * taken to IDLE, the complete packets in the RX FIFO are queued, and
+ * the FIFO in error is flushed before SRX.  The RX FIFO is only flushed
+ * after an underflow if a part packet is left in it.
+ *
+ * A packet waiting in the TX FIFO survives an RX overflow and is sent
+ * by the cc_hal_tick() retry.  An underflow drops it.
+ ******************************************************************************/
+
+
+/* cc_fault_recover
+ *
+ * Queue the packets received before the fault, flush the FIFO in error
+ * and restart RX.  Only packets actually lost count as dropped.
+ * Called with the radio locked.
+ */
+void cc_fault_recover(void)
+{
+	uint32_t t0;
+	uint8_t state;
+	int n;
+
+
+	t0 = cyc_count();
+
+	state = (cc_fault & STATUS_STATE) >> 4;
+	if(state == TXFIFO_UNDERFLOW_STATE)
+		fault_stats.tx_underflow++;
+	else
+		fault_stats.rx_overflow++;
+
+	cc_radio_stop();
+
+	// Queue the complete packets.  After an overflow the FIFO holds
+	// everything received up to it, and can still be read.
+	spi_dma_wait();
+	n = cc_read_rxbytes() & FIFO_NUM_BYTES;
+	if(n > (int)sizeof(rx_buf) - rx_buf_n)
+		n = sizeof(rx_buf) - rx_buf_n;
+	if(n > 0)
+	{
+		cc_read_fifo(rx_buf + rx_buf_n, n);
+		rx_buf_n += n;
+		cc_rx_parse();
+		cc_radio_stop();		// A framing error flush returns to RX
+	}
+
+	// The packet that overflowed, or a part packet left by the TX
+	if((state != TXFIFO_UNDERFLOW_STATE) || (rx_buf_n > 0) || cc_read_rxbytes())
+	{
+		cc_write_cmd(SFRX);
+		fault_stats.dropped++;
+	}
+	rx_buf_n = 0;
+
+	if(state == TXFIFO_UNDERFLOW_STATE)
+	{
+		cc_write_cmd(SFTX);
+		if(tx_state == TX_BUSY)
+		{
+			fault_stats.dropped++;
+			cc_tx_done(RF_TX_FAIL);
+		}
+	}
+
+	cc_write_cmd(SRX);
+
+	cc_fault = 0;
+	cc_status_update();
+	state = cc_get_state();
+	if((state != IDLE_STATE) && (state < RXFIFO_OVERFLOW_STATE))
+		fault_stats.recovered++;
+	else
+		fault_stats.failed++;
+
+	fault_stats.rec_usec = (cyc_count() - t0) / CYC_PER_USEC;
+	if(fault_stats.rec_usec > fault_stats.rec_usec_max)
+		fault_stats.rec_usec_max = fault_stats.rec_usec;
+}
+
+
+/* cc_fault_tick
+ *
+ * Called from cc_hal_tick() every 1msec.
+ * Recover from a latched fault, or poll the status byte every
+ * FAULT_POLL_MSEC.  Bulk transfers and scans handle the FIFOs
+ * themselves, and polling would wake a radio in WOR.
+ */
+void cc_fault_tick(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if((bulk_state != BULK_IDLE) || scan_active || cal_active || cc_sleeping)
+	{
+		cc_unlock(key);
+		return;
+	}
+
+	if(!cc_fault && (++fault_timer >= FAULT_POLL_MSEC))
+	{
+		fault_timer = 0;
+		cc_status_update();
+	}
+
+	if(cc_fault)
+		cc_fault_recover();
+
+	cc_unlock(key);
+}
+
+
+/* cc_fault_clear
+ *
+ * Clear the fault watchdog statistics.
+ */
+void cc_fault_clear(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+	memset(&fault_stats, 0, sizeof(fault_stats));
+	cc_unlock(key);
+}
+
+
+
+/******************************************************************************
+ * Reliable delivery (ARQ).
+ *
+ * Stop and wait per destination address.  Each data packet carries
+ * the sender's address and a sequence number, and the receiver sends
+ * an ack straight back from the GDO0 interrupt.  Packets to the same
+ * address are sent one at a time in order, packets to different
+ * addresses are in flight together.
+ *
+ * The retransmit timeout follows the measured round trip time
+ * (Jacobson/Karels, RTO = SRTT + 4 x RTTVAR), so it stays short on a
+ * good link and backs off on a slow one.  Each retry doubles the
+ * timeout.  Only packets acked on the first transmission are used to
+ * measure the round trip time.
+ *
+ * The receiver drops a packet with the same sequence number as the
+ * last one from that address, but still acks it.
+ ******************************************************************************/
+
+
+/* cc_send_rel
+ *
+ * Parameters
+ * addr			Destination address, not broadcast
+ * data			Data bytes
+ * n			No. of bytes [0-ARQ_MAX_DATA]
+ * done			Called with RF_TX_OK when the packet is acked, or
+ *				RF_TX_FAIL after ARQ_MAX_TRIES.  May be NULL.
+ *
+ * Returns
+ * 0 if queued, -1 if the queue is full or n is out of range.
+ *
+ * Send a packet with acknowledgement and retransmission.
+ * The callback is called from interrupt context.
+ */
+int cc_send_rel(uint8_t addr, uint8_t *data, int n, void (*done)(int result))
+{
+	RF_ARQ_PKT *pkt;
+	uint32_t key;
+	int i;
+
+
+	if((n < 0) || (n > ARQ_MAX_DATA) || (addr == 0x00))
+		return -1;
+
+	key = cc_lock();
+
+	for(i=0; i<ARQ_QUEUE_SIZE; i++)
+	{
+		if(arq_queue[i].state == ARQ_FREE)
+			break;
+	}
+
+	if(i == ARQ_QUEUE_SIZE)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	pkt = &arq_queue[i];
+	pkt->state = ARQ_QUEUED;
+	pkt->addr = addr;
+	pkt->len = n + ARQ_HDR_LEN;
+	pkt->order = arq_order++;
+	pkt->done = done;
+	memcpy(pkt->data + ARQ_HDR_LEN, data, n);
+
+	cc_arq_next(addr);
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_arq_peer
+ *
+ * Parameters
+ * addr			Remote address
+ *
+ * Returns
+ * Peer entry for the address.
+ *
+ * A new address takes a free entry, or reuses the entries in turn.
+ */
+RF_PEER *cc_arq_peer(uint8_t addr)
+{
+	RF_PEER *peer;
+	int i;
+
+
+	for(i=0; i<arq_n_peers; i++)
+	{
+		if(arq_peers[i].addr == addr)
+			return &arq_peers[i];
+	}
+
+	if(arq_n_peers < ARQ_MAX_PEERS)
+	{
+		peer = &arq_peers[arq_n_peers++];
+	}
+	else
+	{
+		peer = &arq_peers[arq_peer_next];
+		arq_peer_next = (arq_peer_next + 1) % ARQ_MAX_PEERS;
+	}
+
+	peer->addr = addr;
+	peer->tx_seq = 0;
+	peer->rx_seq = 0;
+	peer->rx_valid = 0;
+	peer->srtt = 0;
+	peer->rttvar = 0;
+	peer->rto = ARQ_RTO_INIT;
+
+	return peer;
+}
+
+
+/* cc_arq_next
+ *
+ * Parameters
+ * addr			Destination address
+ *
+ * Send the oldest queued packet to the address, if none is waiting
+ * for an ack.
+ */
+void cc_arq_next(uint8_t addr)
+{
+	RF_ARQ_PKT *pkt;
+	RF_PEER *peer;
+	int i;
+
+
+	pkt = NULL;
+
+	for(i=0; i<ARQ_QUEUE_SIZE; i++)
+	{
+		if(arq_queue[i].addr != addr)
+			continue;
+
+		if(arq_queue[i].state == ARQ_WAIT_ACK)
+			return;
+
+		if((arq_queue[i].state == ARQ_QUEUED) &&
+			((pkt == NULL) || ((long)(arq_queue[i].order - pkt->order) < 0)))
+			pkt = &arq_queue[i];
+	}
+
+	if(pkt == NULL)
+		return;
+
+	peer = cc_arq_peer(addr);
+
+	// [ARQ_DATA][SRC][SEQ]
+	pkt->data[0] = ARQ_DATA;
+	pkt->data[1] = cc_reg_get(ADDR);
+	pkt->data[2] = peer->tx_seq++;
+
+	pkt->state = ARQ_WAIT_ACK;
+	pkt->tries = 0;
+	pkt->rto = peer->rto;
+	pkt->timer = pkt->rto;				// Due now
+
+	cc_arq_service(pkt);
+}
+
+
+/* cc_arq_service
+ *
+ * Parameters
+ * pkt			Packet waiting for an ack
+ *
+ * (Re)transmit a packet whose timeout has run out.
+ * If the transmit queue is full the packet stays due and is tried
+ * again on the next tick.
+ */
+void cc_arq_service(RF_ARQ_PKT *pkt)
+{
+	if(pkt->timer < pkt->rto)
+		return;
+
+	if(pkt->tries >= ARQ_MAX_TRIES)
+	{
+		cc_arq_done(pkt, RF_TX_FAIL);
+		return;
+	}
+
+	// No ack, more power for the retransmission
+	if(pkt->tries > 0)
+		cc_pa_missed(pkt->addr);
+
+	if(cc_send_pkt(pkt->addr, pkt->data, pkt->len, NULL) < 0)
+		return;
+
+	if(pkt->tries == 0)
+	{
+		pkt->sent = cyc_count();
+	}
+	else
+	{
+		arq_stats.retries++;
+		pkt->rto = (pkt->rto * 2 > ARQ_RTO_MAX) ? ARQ_RTO_MAX : pkt->rto * 2;
+	}
+
+	pkt->tries++;
+	pkt->timer = 0;
+}
+
+
+/* cc_arq_done
+ *
+ * Parameters
+ * pkt			Packet acked or given up
+ * result		RF_TX_OK or RF_TX_FAIL
+ *
+ * Free the packet, call its callback and start the next packet to
+ * the same address.
+ */
+void cc_arq_done(RF_ARQ_PKT *pkt, int result)
+{
+	void (*done)(int result);
+
+
+	if(result == RF_TX_OK)
+		arq_stats.sent++;
+	else
+		arq_stats.failed++;
+
+	done = pkt->done;
+	pkt->state = ARQ_FREE;
+
+	if(done != NULL)
+		done(result);
+
+	cc_arq_next(pkt->addr);
+}
+
+
+/* cc_arq_rtt
+ *
+ * Parameters
+ * peer			Remote address entry
+ * rtt			Measured round trip time (usec)
+ *
+ * Update the smoothed round trip time and the retransmit timeout.
+ */
+void cc_arq_rtt(RF_PEER *peer, uint32_t rtt)
+{
+	uint32_t err;
+	uint32_t rto;
+
+
+	if(peer->srtt == 0)
+	{
+		peer->srtt = rtt;
+		peer->rttvar = rtt / 2;
+	}
+	else
+	{
+		err = (rtt > peer->srtt) ? rtt - peer->srtt : peer->srtt - rtt;
+		peer->rttvar = peer->rttvar - (peer->rttvar / 4) + (err / 4);
+		peer->srtt = peer->srtt - (peer->srtt / 8) + (rtt / 8);
+	}
+
+	// usec to msec, rounded up
+	rto = (peer->srtt + 4 * peer->rttvar + 999) / 1000;
+
+	if(rto < ARQ_RTO_MIN)
+		rto = ARQ_RTO_MIN;
+	if(rto > ARQ_RTO_MAX)
+		rto = ARQ_RTO_MAX;
+
+	peer->rto = rto;
+}
+
+
+/* cc_arq_ack
+ *
+ * Parameters
+ * src			Address to ack
+ * seq			Sequence number received
+ * rssi			Raw RSSI of the packet received
+ * lqi			LQI of the packet received
+ *
+ * Queue an ack.  If the ack queue is full the ack is dropped and the
+ * sender retries.
+ */
+void cc_arq_ack(uint8_t src, uint8_t seq, uint8_t rssi, uint8_t lqi)
+{
+	uint8_t next;
+
+
+	next = (ack_head + 1) % ACK_QUEUE_SIZE;
+	if(next == ack_tail)
+		return;
+
+	ack_addr[ack_head] = src;
+	ack_seq[ack_head] = seq;
+	ack_time[ack_head] = lat_eop_time;
+	ack_rssi[ack_head] = rssi;
+	ack_lqi[ack_head] = lqi;
+	ack_head = next;
+	arq_stats.acks++;
+}
+
+
+/* cc_arq_rx
+ *
+ * Parameters
+ * p			Received packet [LEN][ADDR][DATA...]
+ *
+ * Returns
+ * 1 if the packet has been used, 0 if it should be queued.
+ *
+ * Called from the GDO0 interrupt for each good packet.
+ * Acks complete a waiting packet.  Data packets to this address are
+ * acked, and duplicates dropped.
+ */
+int cc_arq_rx(uint8_t *p)
+{
+	RF_ARQ_PKT *pkt;
+	RF_PEER *peer;
+	uint8_t len;
+	uint8_t src;
+	uint8_t seq;
+	int i;
+
+
+	len = p[0] - 1;						// Data bytes after ADDR
+	if(len < ARQ_HDR_LEN)
+		return 0;
+
+	if((p[2] != ARQ_DATA) && (p[2] != ARQ_ACK))
+		return 0;
+
+	// Not for this address
+	if((p[1] == 0x00) || (p[1] != cc_reg_get(ADDR)))
+		return (p[2] == ARQ_ACK);
+
+	src = p[3];
+	seq = p[4];
+
+	if(p[2] == ARQ_ACK)
+	{
+		cc_pa_report(src, p);
+
+		for(i=0; i<ARQ_QUEUE_SIZE; i++)
+		{
+			pkt = &arq_queue[i];
+			if((pkt->state == ARQ_WAIT_ACK) && (pkt->addr == src) && (pkt->data[2] == seq))
+			{
+				if(pkt->tries == 1)
+				{
+					cc_arq_rtt(cc_arq_peer(src), (cyc_count() - pkt->sent) / CYC_PER_USEC);
+					cc_lat_ack(pkt, p);
+				}
+
+				cc_arq_done(pkt, RF_TX_OK);
+				break;
+			}
+		}
+		return 1;
+	}
+
+	cc_arq_ack(src, seq, p[p[0] + 1], p[p[0] + 2] & LQI_EST);
+
+	peer = cc_arq_peer(src);
+	if(peer->rx_valid && (peer->rx_seq == seq))
+	{
+		arq_stats.dups++;
+		return 1;
+	}
+
+	peer->rx_seq = seq;
+	peer->rx_valid = 1;
+
+	return 0;
+}
+
+
+/* cc_arq_tick
+ *
+ * Retransmit timers, called from cc_hal_tick() every 1msec.
+ */
+void cc_arq_tick(void)
+{
+	RF_ARQ_PKT *pkt;
+	uint32_t key;
+	int i;
+
+
+	key = cc_lock();
+
+	for(i=0; i<ARQ_QUEUE_SIZE; i++)
+	{
+		pkt = &arq_queue[i];
+		if(pkt->state != ARQ_WAIT_ACK)
+			continue;
+
+		if(pkt->timer < pkt->rto)
+			pkt->timer++;
+
+		cc_arq_service(pkt);
+	}
+
+	cc_unlock(key);
+}
+
+
+
+/******************************************************************************
+ * Latency timestamps.
+ *
+ * TIM3 runs free at the CPU clock and captures both GDO0 edges, so the
+ * time of the sync word and end of packet are known to 31nsec whatever
+ * the interrupt latency.  A capture is turned into cyc_count() time by
+ * reading the counter and the cycle count together, which is good as
+ * long as the capture is read within the 2msec TIM3 period.
+ *
+ * The receiver of an ARQ data packet puts its turnaround, end of the
+ * data packet to writing the ack, in the ack.  The sender then has,
+ * all on its own clock:
+ *
+ *   round trip		first transmission to the end of the ack
+ *   one way		first transmission to the end of the packet at
+ *					the receiver: the ack sync word, less the ack
+ *					preamble and sync word and the turnaround
+ *
+ * Both include the time in the transmit queue and any CCA wait.  The
+ * one way time also includes the ack FIFO write and RX to TX switch at
+ * the receiver, a few tens of usec.  Only first transmissions are used.
+ ******************************************************************************/
+
+
+/* cc_lat_capture
+ *
+ * Parameters
+ * ccr			TIM3 capture register value
+ *
+ * Returns
+ * cyc_count() at the capture.
+ */
+uint32_t cc_lat_capture(uint16_t ccr)
+{
+	uint32_t now;
+	uint16_t cnt;
+
+
+	now = cyc_count();
+	cnt = TIM3->CNT;
+
+	return now - (uint16_t)(cnt - ccr);
+}
+
+
+/* cc_lat_sync
+ *
+ * Read the sync word capture, if there is one.
+ */
+void cc_lat_sync(void)
+{
+	uint16_t sr;
+
+
+	sr = TIM3->SR;
+
+	if(sr & TIM_SR_CC3OF)
+	{
+		TIM3->SR = (uint16_t)~TIM_SR_CC3OF;
+		lat_stats.missed++;
+	}
+
+	if(sr & TIM_SR_CC3IF)
+	{
+		lat_sync_time = cc_lat_capture(TIM3->CCR3);		// Clears CC3IF
+		lat_stats.sync++;
+	}
+}
+
+
+/* cc_lat_eop
+ *
+ * Read the end of packet capture.  Called from the GDO0 interrupt.
+ * The sync word capture is read first, its interrupt may be waiting
+ * behind this one.  Without a capture the interrupt time is used.
+ */
+void cc_lat_eop(void)
+{
+	uint16_t sr;
+
+
+	cc_lat_sync();
+
+	sr = TIM3->SR;
+
+	if(sr & TIM_SR_CC4OF)
+	{
+		TIM3->SR = (uint16_t)~TIM_SR_CC4OF;
+		lat_stats.missed++;
+	}
+
+	if(sr & TIM_SR_CC4IF)
+	{
+		lat_eop_time = cc_lat_capture(TIM3->CCR4);		// Clears CC4IF
+		lat_stats.eop++;
+	}
+	else
+	{
+		lat_eop_time = cyc_count();
+	}
+}
+
+
+/* TIM3 Interrupt Handler
+ *
+ * GDO0 rising edge captured, sync word.
+ * TIM3 must be at CC_IRQ_PRIORITY.
+ */
+void __attribute__((interrupt("IRQ")))TIM3_IRQHandler(void)
+{
+	cc_lat_sync();
+}
+
+
+/* cc_presync_usec
+ *
+ * Returns
+ * Air time of the preamble and sync word (usec).
+ */
+uint32_t cc_presync_usec(void)
+{
+	uint32_t bytes;
+	uint8_t sync;
+
+
+	bytes = lat_preamble[(cc_reg_get(MDMCFG1) & MDMCFG1_NUM_PREAMBLE) >> 4];
+
+	// 30/32 sync modes send the sync word twice
+	sync = cc_reg_get(MDMCFG2) & MDMCFG2_SYNC_MODE;
+	if((sync == 3) || (sync == 7))
+		bytes += 4;
+	else
+		bytes += 2;
+
+	return (bytes * 8 * 1000000) / cc_data_rate();
+}
+
+
+/* cc_lat_add
+ *
+ * Parameters
+ * h			Histogram
+ * cyc			Time (CPU cycles)
+ */
+void cc_lat_add(LAT_HIST *h, uint32_t cyc)
+{
+	uint32_t usec;
+	uint32_t nsec;
+	int i;
+
+
+	usec = cyc / CYC_PER_USEC;
+	if(usec < 4000000)
+		nsec = (uint32_t)(((unsigned long long)cyc * 1000) / CYC_PER_USEC);
+	else
+		nsec = 0xFFFFFFFF;
+
+	if((h->n == 0) || (nsec < h->min))
+		h->min = nsec;
+	if(nsec > h->max)
+		h->max = nsec;
+
+	h->n++;
+	h->sum += usec;
+
+	for(i=0; (i < LAT_BINS - 1) && (usec >> (i + 1)); i++)
+		;
+	h->bin[i]++;
+}
+
+
+/* cc_lat_ack
+ *
+ * Parameters
+ * pkt			Packet acked at the first transmission
+ * p			Ack [LEN][ADDR][ARQ_ACK][SRC][SEQ][TURN_L][TURN_H]...
+ *
+ * Add the ack to the latency histograms.  Called from the receive
+ * path with the ack's GDO0 edges the last ones captured.
+ */
+void cc_lat_ack(RF_ARQ_PKT *pkt, uint8_t *p)
+{
+	uint32_t turn;
+	uint32_t rx_end;
+
+
+	cc_lat_add(&lat_rtt, lat_eop_time - pkt->sent);
+
+	if(p[0] - 1 < ARQ_ACK_TURN_LEN)
+	{
+		lat_stats.no_turn++;			// Receiver doesn't send a turnaround
+		return;
+	}
+
+	turn = p[5] | (p[6] << 8);
+	lat_stats.turn = turn;
+
+	rx_end = lat_sync_time - (cc_presync_usec() + turn) * CYC_PER_USEC;
+
+	// A turnaround capped at 0xFFFF usec can put the end before the start
+	if((int32_t)(rx_end - pkt->sent) > 0)
+		cc_lat_add(&lat_oneway, rx_end - pkt->sent);
+}
+
+
+/* cc_lat_clear
+ *
+ * Clear the latency histograms.
+ */
+void cc_lat_clear(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	memset(&lat_rtt, 0, sizeof(lat_rtt));
+	memset(&lat_oneway, 0, sizeof(lat_oneway));
+	memset(&lat_stats, 0, sizeof(lat_stats));
+
+	cc_unlock(key);
+}
+
+
+
+/******************************************************************************
+ * Link quality statistics.
+ *
+ * The radio appends the RSSI and LQI of each packet to the RX FIFO
+ * (PKTCTRL1 APPEND_STATUS), so signal strength comes with the packet
+ * and doesn't need an RSSI register read over SPI.  Statistics are kept
+ * for each sending address in the GDO0 interrupt.
+ ******************************************************************************/
+
+
+/* cc_rssi_dbm
+ *
+ * Parameters
+ * rssi			RSSI status byte, appended or read from the RSSI register
+ *
+ * Returns
+ * Signal strength in dBm x 16.
+ *
+ * The RSSI byte is a two's complement value in 0.5dB steps.
+ * RSSI_dBm = RSSI / 2 - RSSI_offset
+ */
+int cc_rssi_dbm(uint8_t rssi)
+{
+	int value;
+	int offset;
+
+
+	value = (rssi >= 128) ? (int)rssi - 256 : (int)rssi;
+
+	offset = (rf_profile != NULL) ? rf_profile->rssi_offset : RSSI_OFFSET;
+
+	return ((value * (1 << RSSI_FRAC)) / 2) - (offset * (1 << RSSI_FRAC));
+}
+
+
+/* cc_link_update
+ *
+ * Parameters
+ * p			Received packet [LEN][ADDR][DATA...][RSSI][LQI]
+ *
+ * Add a good packet to the statistics for its address.
+ * Packets with an ARQ header are counted against the sender, others
+ * against the ADDR byte.  A new address takes a free entry or reuses
+ * the entries in turn.
+ */
+void cc_link_update(uint8_t *p)
+{
+	RF_LINK_STATS *link;
+	uint8_t addr;
+	uint8_t len;
+	uint8_t lqi;
+	int rssi;
+	int bin;
+	int i;
+
+
+	len = p[0];
+	addr = p[1];
+	if((len > ARQ_HDR_LEN) && ((p[2] == ARQ_DATA) || (p[2] == ARQ_ACK)))
+		addr = p[3];
+
+	rssi = cc_rssi_dbm(p[len + 1]);
+	lqi = p[len + 2] & LQI_EST;
+
+	link = cc_link_find(addr);
+
+	if(link == NULL)
+	{
+		i = link_n_addr;
+		if(link_n_addr < LINK_MAX_ADDR)
+		{
+			link_n_addr++;
+		}
+		else
+		{
+			i = link_next;
+			link_next = (link_next + 1) % LINK_MAX_ADDR;
+		}
+
+		memset(&link_stats[i], 0, sizeof(RF_LINK_STATS));
+		link_stats[i].addr = addr;
+		link_stats[i].rssi_avg = rssi;
+		link_stats[i].rssi_min = rssi;
+		link_stats[i].lqi_avg = lqi << RSSI_FRAC;
+		link_stats[i].pa_level = PA_LEVEL_MAX;
+
+		link = &link_stats[i];
+	}
+
+	link->pkts++;
+	link->rssi_last = rssi;
+	link->rssi_avg += (rssi - link->rssi_avg) / (1 << LINK_AVG_SHIFT);
+	link->lqi_avg += ((int)(lqi << RSSI_FRAC) - (int)link->lqi_avg) / (1 << LINK_AVG_SHIFT);
+
+	if(rssi < link->rssi_min)
+		link->rssi_min = rssi;
+	if(lqi > link->lqi_max)
+		link->lqi_max = lqi;
+
+	bin = ((rssi >> RSSI_FRAC) - LINK_HIST_MIN) / LINK_HIST_STEP;
+	if((rssi >> RSSI_FRAC) < LINK_HIST_MIN)
+		bin = 0;
+	else
+		bin++;
+	if(bin >= LINK_HIST_BINS)
+		bin = LINK_HIST_BINS - 1;
+
+	link->hist[bin]++;
+}
+
+
+/* cc_link_clear
+ *
+ * Clear the link statistics.
+ */
+void cc_link_clear(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	link_n_addr = 0;
+	link_next = 0;
+
+	cc_unlock(key);
+}
+
+
+/* cc_link_find
+ *
+ * Parameters
+ * addr			Address
+ *
+ * Returns
+ * The link table entry for addr, or NULL if it has none.
+ */
+RF_LINK_STATS *cc_link_find(uint8_t addr)
+{
+	int i;
+
+
+	for(i=0; i<link_n_addr; i++)
+	{
+		if(link_stats[i].addr == addr)
+			return &link_stats[i];
+	}
+
+	return NULL;
+}
+
+
+
+/******************************************************************************
+ * Transmit power control.
+ *
+ * The PA uses PATABLE entry 0.  It is rewritten before a packet only
+ * when the destination's level differs from the last packet's, a 2 byte
+ * SPI burst, so a run of packets to one address costs nothing.  Entry 0
+ * is kept in SLEEP, and is lost only by a reset.  Urgent copies always
+ * go at the top level.
+ ******************************************************************************/
+
+
+/* cc_pa_set
+ *
+ * Parameters
+ * addr			Destination of the next packet
+ *
+ * Load the power level for addr into PATABLE entry 0 if it isn't
+ * there already.  Called with the radio locked, before the packet is
+ * written to the TX FIFO.
+ */
+void cc_pa_set(uint8_t addr)
+{
+	cc_pa_load(cc_pa_level(addr));
+}
+
+
+/* cc_pa_load
+ *
+ * Parameters
+ * level		pa_table[] index
+ *
+ * Load level into PATABLE entry 0 if it isn't there already.
+ * Called with the radio locked.
+ */
+void cc_pa_load(uint8_t level)
+{
+	if(level == pa_loaded)
+		return;
+
+	cc_write_patable((uint8_t *)&pa_table[level], 1);
+	pa_loaded = level;
+	pa_ctrl.writes++;
+}
+
+
+/* cc_pa_level
+ *
+ * Parameters
+ * addr			Destination address
+ *
+ * Returns
+ * The power level packets to addr are sent at, pa_table[] index.
+ */
+int cc_pa_level(uint8_t addr)
+{
+	RF_LINK_STATS *link;
+
+
+	if(!pa_ctrl.on)
+		return pa_ctrl.fixed;
+
+	link = (addr == 0x00) ? NULL : cc_link_find(addr);
+	if(link == NULL)
+		return PA_LEVEL_MAX;
+
+	return link->pa_level;
+}
+
+
+/* cc_pa_report
+ *
+ * Parameters
+ * src			Address that sent the ack
+ * p			Ack [LEN][ADDR][ARQ_ACK][SRC][SEQ][TURN_L][TURN_H][RSSI][LQI]
+ *
+ * Step the power level for src from the signal report in its ack.
+ * Called from the receive path after cc_link_update(), so src has a
+ * link table entry unless the ack was the first packet from src and
+ * the table was full.
+ */
+void cc_pa_report(uint8_t src, uint8_t *p)
+{
+	RF_LINK_STATS *link;
+	int sens;
+	int margin;
+
+
+	if(p[0] - 1 < ARQ_ACK_LEN)
+		return;							// Receiver doesn't report
+
+	link = cc_link_find(src);
+	if(link == NULL)
+		return;
+
+	link->rssi_peer = cc_rssi_dbm(p[7]);
+	link->lqi_peer = p[8] & LQI_EST;
+
+	sens = (rf_profile != NULL) ? rf_profile->sensitivity : RX_SENS_DBM;
+	margin = (link->rssi_peer >> RSSI_FRAC) - sens;
+
+	if((margin < pa_ctrl.margin - PA_HYST) || (link->lqi_peer >= PA_LQI_POOR))
+	{
+		link->pa_above = 0;
+		if(link->pa_level < PA_LEVEL_MAX)
+		{
+			link->pa_level++;
+			pa_ctrl.up++;
+		}
+	}
+	else if(margin > pa_ctrl.margin + PA_HYST)
+	{
+		// Down slowly, a step too far costs retransmissions
+		if(++link->pa_above < PA_DOWN_ACKS)
+			return;
+
+		link->pa_above = 0;
+		if(link->pa_level > 0)
+		{
+			link->pa_level--;
+			pa_ctrl.down++;
+		}
+	}
+	else
+	{
+		link->pa_above = 0;
+	}
+}
+
+
+/* cc_pa_missed
+ *
+ * Parameters
+ * addr			Destination of a packet that wasn't acked
+ *
+ * Step the power level for addr up before the retransmission.
+ */
+void cc_pa_missed(uint8_t addr)
+{
+	RF_LINK_STATS *link;
+
+
+	link = cc_link_find(addr);
+	if((link == NULL) || (link->pa_level == PA_LEVEL_MAX))
+		return;
+
+	link->pa_level++;
+	link->pa_above = 0;
+	pa_ctrl.missed++;
+}
+
+
+/* cc_pa_auto
+ *
+ * Parameters
+ * margin		Target signal at the receiver (dB above sensitivity)
+ *
+ * Control the power to each address from its acks.
+ */
+void cc_pa_auto(int margin)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	pa_ctrl.on = 1;
+	pa_ctrl.margin = margin;
+
+	cc_unlock(key);
+}
+
+
+/* cc_pa_fixed
+ *
+ * Parameters
+ * level		pa_table[] index
+ *
+ * Send every packet at one power level.  The signal reports are still
+ * used to keep the level for each address.
+ */
+void cc_pa_fixed(int level)
+{
+	uint32_t key;
+
+
+	if(level < 0)
+		level = 0;
+	if(level > PA_LEVEL_MAX)
+		level = PA_LEVEL_MAX;
+
+	key = cc_lock();
+
+	pa_ctrl.on = 0;
+	pa_ctrl.fixed = level;
+
+	cc_unlock(key);
+}
+
+
+
+/******************************************************************************
+ * Register shadow cache.
+ ******************************************************************************/
+
+
+/* cc_reg_sync
+ *
+ * Load the register cache from the radio with one burst read.
+ * Discards any uncommitted changes.
+ */
+void cc_reg_sync(void)
+{
+	cc_read_b(0, config_regs, N_CONFIG_REGS);
+
+	config_dirty[0] = 0;
+	config_dirty[1] = 0;
+	config_valid = 1;
+}
+
+
+/* cc_reg_get
+ *
+ * Parameters
+ * addr			Config register address [00-2E]
+ *
+ * Returns
+ * Register value
+ *
+ * Reads a config register from the cache.  Calibration result
+ * registers are read from the radio.  Uncommitted values written with
+ * cc_reg_set() are returned.
+ */
+uint8_t cc_reg_get(uint8_t addr)
+{
+	if(addr >= N_CONFIG_REGS)
+		return 0;
+
+	if(!config_valid)
+		cc_reg_sync();
+
+	if(REG_VOLATILE(addr) && !REG_DIRTY(addr))
+		config_regs[addr] = cc_read(addr);
+
+	return config_regs[addr];
+}
+
+
+/* cc_reg_set
+ *
+ * Parameters
+ * addr			Config register address [00-2E]
+ * value		New register value
+ *
+ * Writes a config register in the cache and marks it dirty if the
+ * value has changed.  The radio isn't written until cc_reg_commit().
+ */
+void cc_reg_set(uint8_t addr, uint8_t value)
+{
+	if(addr >= N_CONFIG_REGS)
+		return;
+
+	if(!config_valid)
+		cc_reg_sync();
+
+	if((config_regs[addr] == value) && !REG_VOLATILE(addr))
+		return;
+
+	config_regs[addr] = value;
+	REG_SET_DIRTY(addr);
+}
+
+
+/* cc_reg_commit
+ *
+ * Returns
+ * No. of SPI bursts used.
+ *
+ * Write the dirty registers to the radio.
+ * Each run of consecutive dirty registers is written with one
+ * cc_write_b() burst.  Runs separated by a single clean register are
+ * joined, re-writing one cached byte is cheaper than another header
+ * byte and chip select cycle.  Calibration registers are never
+ * re-written unless dirty.
+ */
+int cc_reg_commit(void)
+{
+	int addr;
+	int end;
+	int bursts;
+
+
+	bursts = 0;
+	addr = 0;
+
+	while(addr < N_CONFIG_REGS)
+	{
+		if(!REG_DIRTY(addr))
+		{
+			addr++;
+			continue;
+		}
+
+		// Find the end of the run
+		end = addr + 1;
+		while(end < N_CONFIG_REGS)
+		{
+			if(REG_DIRTY(end))
+				end++;
+			else if(((end + 1) < N_CONFIG_REGS) && REG_DIRTY(end + 1) && !REG_VOLATILE(end))
+				end += 2;
+			else
+				break;
+		}
+
+		cc_write_b(addr, &config_regs[addr], end - addr);
+		bursts++;
+
+		addr = end;
+	}
+
+	config_dirty[0] = 0;
+	config_dirty[1] = 0;
+
+	return bursts;
+}
+
+
+
+/******************************************************************************
+ * Register profiles.
+ ******************************************************************************/
+
+
+/* cc_find_profile
+ *
+ * Returns the profile with a matching name, or NULL.
+ */
+const RF_PROFILE *cc_find_profile(char *name)
+{
+	int i;
+
+
+	for(i=0; i<n_rf_profiles; i++)
+	{
+		if(strcmp(name, rf_profiles[i].name) == 0)
+			return &rf_profiles[i];
+	}
+
+	return NULL;
+}
+
+
+/* cc_get_profile
+ *
+ * Returns the profile last applied, or NULL.
+ */
+const RF_PROFILE *cc_get_profile(void)
+{
+	return rf_profile;
+}
+
+
+/* cc_profile_apply
+ *
+ * Parameters
+ * *profile		Register profile
+ *
+ * Returns
+ * 0 on success, -1 if the radio didn't go to IDLE.
+ *
+ * Put the radio in IDLE and write the profile image to all config
+ * registers with one burst.  The node address and channel are kept.
+ * The register cache is loaded with the new image.
+ *
+ * The profile turns automatic calibration back on, so the channel
+ * calibration table is rebuilt for the new settings.  The radio is
+ * back in RX when the table is built.
+ */
+int cc_profile_apply(const RF_PROFILE *profile)
+{
+	uint8_t addr;
+	uint8_t chan;
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if(cc_radio_stop() < 0)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	addr = cc_reg_get(ADDR);
+	chan = cc_reg_get(CHANNR);
+
+	memcpy(config_regs, profile->regs, N_CONFIG_REGS);
+	config_regs[ADDR] = addr;
+	config_regs[CHANNR] = chan;
+
+	cc_write_b(0, config_regs, N_CONFIG_REGS);
+
+	config_dirty[0] = 0;
+	config_dirty[1] = 0;
+	config_valid = 1;
+	rf_profile = profile;
+
+	cal_active = 1;						// Hold off transmit until the table is built
+
+	cc_unlock(key);
+
+	cc_cal_build();
+
+	return 0;
+}
+
+
+
+/******************************************************************************
+ * Channel calibration table.
+ *
+ * An SCAL calibration takes about 720us.  With automatic calibration
+ * every IDLE to RX or TX transition pays this after a channel change.
+ * Instead each channel is calibrated once and the FSCAL3-FSCAL1 results
+ * are stored.  Changing channel writes CHANNR and a 3 byte burst of
+ * stored results, and automatic calibration is turned off.
+ ******************************************************************************/
+
+
+/* cc_cal_build
+ *
+ * Returns
+ * 0 on success, -1 if a calibration didn't complete or an urgent
+ * packet stopped the build.
+ *
+ * Calibrate every channel and store the results.
+ * Takes about RF_N_CHANNELS x 0.8ms.  The radio is locked for one
+ * channel at a time, so the radio, timer and DMA interrupts are held
+ * off for one SCAL.  Packets are not sent while the table is built,
+ * and a channel change is applied at the end.
+ *
+ * The radio goes back to RX on its channel, with automatic calibration
+ * off.  If the build doesn't complete the radio calibrates itself on
+ * each channel change instead.
+ */
+int cc_cal_build(void)
+{
+	int result;
+	int ch;
+	int i;
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	cal_active = 1;
+	cal_valid = 0;
+
+	cc_radio_stop();
+	cc_rx_drain();
+	cc_radio_stop();			// A framing error flush returns to RX
+
+	cc_unlock(key);
+
+	result = 0;
+	for(ch=0; (ch<RF_N_CHANNELS) && (result == 0); ch++)
+	{
+		key = cc_lock();
+
+		if(urg_reps)
+		{
+			result = -1;					// Send the urgent packet now
+		}
+		else
+		{
+			cc_write(CHANNR, ch);
+			cc_write_cmd(SCAL);
+
+			// Calibration ends in IDLE
+			for(i=0; i<IDLE_TIMEOUT; i++)
+			{
+				if(cc_read_status(MARCSTATE) == MARCSTATE_IDLE)
+					break;
+			}
+
+			if(i == IDLE_TIMEOUT)
+				result = -1;
+			else
+				cc_read_b(FSCAL_REG, cal_table[ch], N_FSCAL_REGS);
+		}
+
+		cc_unlock(key);
+	}
+
+	key = cc_lock();
+
+	// Use the stored calibration from now on, or calibrate on each change
+	cal_valid = (result == 0);
+	cc_reg_set(MCSM0, (cc_reg_get(MCSM0) & ~MCSM0_FS_AUTOCAL) |
+		(cal_valid ? FS_AUTOCAL_NEVER : FS_AUTOCAL_FROM_IDLE));
+	cc_reg_commit();
+
+	cc_write(CHANNR, config_regs[CHANNR]);
+	if(cal_valid && (config_regs[CHANNR] < RF_N_CHANNELS))
+		cc_write_b(FSCAL_REG, cal_table[config_regs[CHANNR]], N_FSCAL_REGS);
+
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+	cc_write_cmd(SRX);
+
+	cal_active = 0;
+
+	cc_unlock(key);
+
+	// Packets held off by the build, urgent first
+	cc_tx_start();
+
+	return result;
+}
+
+
+/* cc_set_channel
+ *
+ * Parameters
+ * chan			Channel number [0-(RF_N_CHANNELS-1)]
+ *
+ * Returns
+ * 0 on success, -1 if chan is out of range.
+ *
+ * Change channel and return to RX.
+ * The stored calibration for the channel is written with CHANNR, so
+ * RX starts without calibrating.  If there is no calibration table
+ * the radio calibrates itself going to RX.
+ *
+ * Complete packets in the RX FIFO are queued first, including one
+ * whose GDO0 interrupt is still pending, then any part packet is
+ * flushed.  A packet waiting to be sent stays in the TX FIFO and is
+ * sent on the new channel.  While the calibration table is being built
+ * the channel is changed when the build ends.
+ */
+int cc_set_channel(uint8_t chan)
+{
+	uint32_t key;
+
+
+	if(chan >= RF_N_CHANNELS)
+		return -1;
+
+	key = cc_lock();
+
+	// cc_cal_build() goes to the channel when it has finished
+	if(cal_active)
+	{
+		config_regs[CHANNR] = chan;
+		cc_unlock(key);
+		return 0;
+	}
+
+	cc_radio_stop();
+	cc_rx_drain();
+	cc_radio_stop();			// A framing error flush returns to RX
+
+	cc_write(CHANNR, chan);
+	config_regs[CHANNR] = chan;
+
+	if(cal_valid)
+		cc_write_b(FSCAL_REG, cal_table[chan], N_FSCAL_REGS);
+
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+	cc_write_cmd(SRX);
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+
+/* cc_scan
+ *
+ * Parameters
+ * result		One entry for each channel first..last
+ * first		First channel
+ * last			Last channel
+ * busy_dbm		Occupancy threshold (dBm)
+ *
+ * Returns
+ * 0 on success, -1 if the channels are out of range, the calibration
+ * table couldn't be built, a bulk transfer is running or the scan was
+ * stopped for an urgent packet.
+ *
+ * Sweep the channels and sample RSSI.  Each channel is tuned from the
+ * calibration table, so there is no SCAL and the synthesizer settles in
+ * about 90us.  The radio is locked for one channel at a time, so the
+ * interrupts at CC_IRQ_PRIORITY (TIM2, the GDO EXTIs, TIM3, DMA and the
+ * e-stop SWI) are only held off for about 600us.  USART2 is above
+ * CC_IRQ_PRIORITY and is never masked.
+ * Packets are not sent or received during the scan.  The radio goes
+ * back to the original channel at the end.
+ */
+int cc_scan(RF_SCAN_CHAN *result, int first, int last, int busy_dbm)
+{
+	uint32_t key;
+	uint32_t t0;
+	uint8_t chan;
+	int rssi;
+	int sum;
+	int busy;
+	int i;
+	int j;
+
+
+	if((first < 0) || (last >= RF_N_CHANNELS) || (first > last))
+		return -1;
+
+	key = cc_lock();
+
+	if((bulk_state != BULK_IDLE) || (tx_state != TX_IDLE))
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	scan_active = 1;
+
+	cc_unlock(key);
+
+	if(!cal_valid && (cc_cal_build() < 0))
+	{
+		scan_active = 0;
+		cc_tx_start();
+		return -1;
+	}
+
+	busy = busy_dbm * (1 << RSSI_FRAC);
+	chan = config_regs[CHANNR];
+
+	// An urgent packet stops the scan
+	for(i=first; (i <= last) && !urg_reps; i++, result++)
+	{
+		key = cc_lock();
+
+		cc_radio_stop();
+		cc_write(CHANNR, i);
+		cc_write_b(FSCAL_REG, cal_table[i], N_FSCAL_REGS);
+		cc_write_cmd(SRX);
+
+		t0 = cyc_count();
+		while((cyc_count() - t0) < SCAN_SETTLE_USEC * CYC_PER_USEC);
+
+		result->rssi_max = -32768;
+		result->busy = 0;
+		sum = 0;
+
+		for(j=0; j<SCAN_SAMPLES; j++)
+		{
+			t0 = cyc_count();
+
+			rssi = cc_read_rssi();
+			sum += rssi;
+			if(rssi > result->rssi_max)
+				result->rssi_max = rssi;
+			if(rssi >= busy)
+				result->busy++;
+
+			while((cyc_count() - t0) < SCAN_SAMPLE_USEC * CYC_PER_USEC);
+		}
+
+		result->rssi_mean = sum / SCAN_SAMPLES;
+
+		// Don't leave noise in the FIFO for the GDO0 interrupt
+		cc_radio_stop();
+		cc_write_cmd(SFRX);
+		rx_buf_n = 0;
+
+		cc_unlock(key);
+	}
+
+	cc_set_channel(chan);
+	scan_active = 0;
+
+	// Stopped for an urgent packet, send it now
+	if(i <= last)
+	{
+		cc_tx_start();
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/******************************************************************************
+ * Public functions
+ ******************************************************************************/
+
+
+/* cc_radio_config
+ *
+ * Parameters
+ * *config			Pointer to configuration data structure.
+ *
+ * Returns
+ *
+ *
+ * Configure HAL.
+ * Call this before calling start.
+ * Fill in a configuration data structure.
+ *
+ * Writes the register profile, or reads the configuration registers
+ * from the radio if there is no profile.
+ * Updates the registers according to values in the
+ * sonfig data structure.
+ * Writes the changed config registers back to the radio.
+ *
+ * This must be called when the radio is in idle state.
+ */
+int cc_radio_config(RF_CONFIG *config)
+{
+	uint8_t pktctrl0;
+
+
+	// Write the register profile, or read all the config registers
+	if(config->profile)
+		cc_profile_apply(config->profile);
+	else
+		cc_reg_sync();
+
+	// Packet handling for the receive engine.
+	pktctrl0 = cc_reg_get(PKTCTRL0) & ~0x03;
+
+	cc_reg_set(IOCFG0, GDO_SYNC_EOP);									// GDO0 end of packet
+	cc_reg_set(PKTLEN, RF_MAX_LEN);										// Max variable length
+	cc_reg_set(PKTCTRL1, cc_reg_get(PKTCTRL1) | PKTCTRL1_APPEND_STATUS);	// RSSI, LQI and CRC_OK
+	cc_reg_set(PKTCTRL0, pktctrl0 | PKTCTRL0_CRC_EN | PKTCTRL0_LEN_VAR);
+	cc_reg_set(MCSM1, cc_reg_get(MCSM1) | MCSM1_RXOFF_RX | MCSM1_TXOFF_RX);
+		// Stay in RX after a packet is received, go to RX after a packet is sent.
+
+	// Write the changed config registers
+	cc_reg_commit();
+
+	// Calibrate all channels
+	if(config->base_freq)
+		cc_set_base_frequency(config->base_freq);
+	else if(!cal_valid)
+		cc_cal_build();
+
+
+	return 0;
+}
+
+/* cc_radio_start
+ *
+ * Radio starts in receive state
+ * The RX FIFO and receive staging buffer are flushed.
+ */
+int cc_radio_start(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	cc_radio_stop();						// Make sure radio is in idle state.
+	cc_write_cmd(SFRX);
+	cc_write_cmd(SFTX);
+	rx_buf_n = 0;
+	tx_state = TX_IDLE;
+	tx_is_ack = 0;
+	tx_is_urgent = 0;
+	cc_fault = 0;
+	cc_write_cmd(SRX);
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_wor_start
+ *
+ * Returns
+ * 0 on success, -1 if the radio didn't go to IDLE.
+ *
+ * Put the radio in Wake-on-Radio.  It sleeps, waking every EVENT0 to
+ * listen for up to the MCSM2 RX timeout.  A packet ends on GDO0 as
+ * usual and leaves the radio in RX, so call this again after handling
+ * it.  WORCTRL must have the RC oscillator on.
+ *
+ * Any SPI access wakes the radio to IDLE.
+ */
+int cc_wor_start(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	if(cc_radio_stop() < 0)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	cc_write_cmd(SFRX);
+	rx_buf_n = 0;
+
+	cc_write_cmd(SWORRST);
+	cc_write_cmd(SWOR);
+	cc_sleeping = 1;
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_hal_idle
+ *
+ * Returns
+ * 1 if the HAL has nothing to do until the next packet, 0 if not.
+ *
+ * Nothing to transmit, no ack outstanding and no received packets
+ * waiting for the application.
+ */
+int cc_hal_idle(void)
+{
+	int i;
+
+
+	if((tx_state != TX_IDLE) || (tx_head != tx_tail) || (ack_head != ack_tail) ||
+		(rx_head != rx_tail) || (bulk_state != BULK_IDLE) || spi_dma_busy())
+		return 0;
+
+	for(i=0; i<ARQ_QUEUE_SIZE; i++)
+	{
+		if(arq_queue[i].state != ARQ_FREE)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* cc_radio_stop
+ *
+ * Radio stops receiving or transmitting.
+ * Radio changes to idle state.
+ * This is necessary to be able to update the config registers.
+ * It can also be used to recover from error states such as RX FIFO
+ * overflow.
+ */
+int cc_radio_stop(void)
+{
+	int i;
+
+
+	cc_write_cmd(SIDLE);
+
+	// Check the radio is in the idle state before returning
+	for(i=0; i<IDLE_TIMEOUT; i++)
+	{
+		if(cc_read_status(MARCSTATE) == MARCSTATE_IDLE)
+			return 0;
+	}
+
+	return -1;
+}
+
+/* cc_receive_pkt
+ *
+ * Parameters
+ * *pkt			Packet buffer
+ *
+ * Returns
+ * 1 if a packet was copied to *pkt, 0 if the receive queue is empty.
+ *
+ * Takes the next packet from the receive queue.
+ * Packets are received in the background by the GDO0 interrupt,
+ * which drains the RX FIFO and queues packets with a good CRC.
+ * The radio remains in the receive state.
+ */
+int cc_receive_pkt(RF_PKT *pkt)
+{
+	if(rx_tail == rx_head)
+		return 0;
+
+	memcpy(pkt, &rx_queue[rx_tail], sizeof(RF_PKT));
+	rx_tail = (rx_tail + 1) % RX_QUEUE_SIZE;
+
+	return 1;
+}
+
+/*
+ * Send a packet to be transmitted by the radio.
+ * The radio changes to TX state and sends the packet, then
+ * returns to RX state.
+ *
+ * addr			Destination address
+ * *data		Packet data
+ * n			No. of data bytes [0-RF_MAX_DATA]
+ * done			Completion callback, or NULL.
+ *
+ * Returns
+ * 0 if the packet was queued, -1 if it is too long or the queue is full.
+ *
+ * The packet is copied into the transmit queue and this function
+ * returns straight away.  done() is called with RF_TX_OK or RF_TX_FAIL
+ * when the packet has been sent.  It is called from interrupt context.
+ */
+int cc_send_pkt(uint8_t addr, uint8_t *data, int n, void (*done)(int result))
+{
+	RF_TX_PKT *pkt;
+	uint8_t next;
+	uint32_t key;
+
+
+	if((n < 0) || (n > RF_MAX_DATA))
+		return -1;
+
+	// Packets are also queued from the radio interrupts
+	key = cc_lock();
+
+	next = (tx_head + 1) % TX_QUEUE_SIZE;
+	if(next == tx_tail)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	pkt = &tx_queue[tx_head];
+	pkt->addr = addr;
+	pkt->len = n;
+	pkt->done = done;
+	memcpy(pkt->data, data, n);
+
+	tx_head = next;
+
+	cc_tx_start();
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* cc_send_urgent
+ *
+ * Parameters
+ * reps			Copies to send
+ * build		Writes copy rep (reps down to 1) into frame as
+ *				[LEN][ADDR][DATA...] and returns its length
+ *
+ * Returns
+ * 0
+ *
+ * Send a packet ahead of everything else, for an emergency stop.  The
+ * copies go back to back and a bulk transfer or packet being sent is
+ * stopped for them.  build() is called from interrupt context just
+ * before each copy is written to the TX FIFO, so it can timestamp it.
+ * A new call replaces the copies still to send, one on air included.
+ *
+ * May be called from interrupts at CC_IRQ_PRIORITY.  The first copy
+ * waits for an SPI DMA transfer to finish, or for the scan to move on
+ * to the next channel.
+ */
+int cc_send_urgent(int reps, int (*build)(uint8_t *frame, int rep))
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	urg_build = build;
+	urg_reps = reps;
+
+	if(bulk_state != BULK_IDLE)
+		cc_bulk_finish(RF_BULK_FAIL);
+
+	// A DMA callback may start the first copy
+	spi_dma_wait();
+
+	if(!tx_is_urgent && !scan_active && !cal_active)
+		cc_tx_urgent();
+
+	cc_unlock(key);
 
 	return 0;
 }
@@ -9,14 +9,333 @@
 #define CC_HAL_H_
 
 #include "types.h"
+#include "cc2500_regs.h"
+
+
+// Radio register profile, a complete config register image.
+typedef struct {
+	char *name;
+	char *help_txt;
+	int rssi_offset;					// RSSI offset (dB), depends on data rate
+	int sensitivity;					// Receiver sensitivity (dBm), 1% packet errors
+	uint8_t regs[N_CONFIG_REGS];		// Config registers [00-2E]
+} RF_PROFILE;
+
+extern const RF_PROFILE rf_profiles[];
+extern const int n_rf_profiles;
 
 
 typedef struct {
 uint32_t base_freq;					//
+const RF_PROFILE *profile;			// Register profile, NULL to keep radio settings
 
 } RF_CONFIG;
 
 
+// Packet format
+// [LEN][ADDR][DATA...]
+// LEN is the no. of bytes following the LEN byte (ADDR + DATA).
+// With APPEND_STATUS, RSSI and LQI follow the packet in the RX FIFO.
+#define RF_MAX_LEN		61					// Max LEN so packet and status fit in FIFO
+#define RF_MAX_DATA		(RF_MAX_LEN - 1)	// Max data bytes after ADDR
+
+// Received packet
+typedef struct {
+	uint8_t addr;						// Destination address
+	uint8_t len;						// No. of data bytes
+	uint8_t rssi;						// Raw RSSI status byte
+	uint8_t lqi;						// Link quality estimate (CRC_OK removed)
+	uint8_t radio;						// Receiving radio, stronger copy if both
+	uint32_t time;						// cyc_count() when the packet was read
+	uint32_t sync;						// Sync word time, read time from radio 1
+	uint8_t data[RF_MAX_DATA];
+} RF_PKT;
+
+#define RX_QUEUE_SIZE	8				// Receive packet queue depth
+
+// Frequency plan, set by the register profiles.
+// CHANNR 0 is at the base frequency, channels are 405kHz apart.
+#define RF_BASE_FREQ	2402000000UL		// Default base frequency (Hz)
+#define RF_N_CHANNELS	196					// Channels in the 2.4GHz ISM band
+#define RF_BAND_MIN		2400000000UL
+#define RF_BAND_MAX		2483500000UL
+
+// Spectrum scan
+#define SCAN_SETTLE_USEC	250				// IDLE to RX and first RSSI update
+#define SCAN_SAMPLE_USEC	40				// Between RSSI samples
+#define SCAN_SAMPLES		8				// RSSI samples per channel
+#define SCAN_BUSY_DBM		-85				// Occupied at or above this level
+
+typedef struct {
+	int rssi_max;							// dBm x 2^RSSI_FRAC
+	int rssi_mean;
+	uint8_t busy;							// Samples at or above the threshold
+} RF_SCAN_CHAN;
+
+// Receive statistics
+typedef struct {
+	uint32_t rx_pkts;					// Packets queued
+	uint32_t crc_err;					// Packets discarded with bad CRC
+	uint32_t len_err;					// Invalid length byte, FIFO flushed
+	uint32_t overflow;					// RX FIFO overflows
+	uint32_t queue_full;				// Packets dropped, queue full
+} RF_RX_STATS;
+
+extern RF_RX_STATS rx_stats;
+
+// Two radio receive
+// A packet heard by both radios within DIV_WINDOW_USEC is queued once,
+// with the status bytes of the stronger copy.  The window is shorter
+// than the shortest packet at 250kBaud, so repeats aren't merged.
+#define DIV_WINDOW_USEC	300
+
+typedef struct {
+	uint32_t heard[CC_N_DEV];			// Good packets from each radio
+	uint32_t dups;						// Heard by both, second copy dropped
+	uint32_t best[CC_N_DEV];			// Duplicates where each radio had the stronger copy
+} RF_DIV_STATS;
+
+extern RF_DIV_STATS div_stats;
+
+// Packet waiting to be transmitted
+typedef struct {
+	uint8_t addr;						// Destination address
+	uint8_t len;						// No. of data bytes
+	void (*done)(int result);			// Completion callback
+	uint8_t data[RF_MAX_DATA];
+} RF_TX_PKT;
+
+#define TX_QUEUE_SIZE	4				// Transmit packet queue depth
+#define TX_RETRY_MSEC	5				// Check a busy transmitter after this time
+#define TX_MAX_TRIES	20				// STX strobes before giving up
+
+// Transmit results
+#define RF_TX_OK		0
+#define RF_TX_FAIL		-1
+
+// Transmit statistics
+typedef struct {
+	uint32_t tx_pkts;					// Packets sent
+	uint32_t tx_fail;					// Packets dropped
+	uint32_t tx_retries;				// STX repeated, channel busy
+	uint32_t urgent;					// Urgent copies sent
+	uint32_t preempted;					// Packets pulled back for an urgent copy
+} RF_TX_STATS;
+
+extern RF_TX_STATS tx_stats;
+
+
+// Bulk transfer
+// Packets longer than the FIFO.  The FIFOs are refilled and drained
+// from GDO2 FIFO threshold interrupts while the packet is on air.
+// [LEN_H][LEN_L][ADDR][DATA...]
+// LEN counts ADDR and DATA.  If the packet length is a multiple of 256
+// one pad byte is sent after the data.
+#define BULK_HDR_LEN	3
+#define BULK_MIN_DATA	(RF_MAX_DATA + 1)	// Shorter data fits a normal packet
+#define BULK_MAX_DATA	8192
+#define BULK_FIFO_THR	11					// TX FIFO 17 bytes, RX FIFO 48 bytes
+#define BULK_TIMEOUT	100					// msec without FIFO progress
+#define RF_BULK_FAIL	-1
+
+// Bulk transfer statistics
+typedef struct {
+	uint32_t tx_pkts;					// Packets sent
+	uint32_t rx_pkts;					// Packets received
+	uint32_t underflow;					// TX FIFO ran empty on air
+	uint32_t overflow;					// RX FIFO overflowed
+	uint32_t len_err;					// Bad length header or too long
+	uint32_t crc_err;					// Bad CRC
+	uint32_t timeout;					// No FIFO progress
+	uint32_t bytes;						// Last packet sent, bytes on air
+	uint32_t cycles;					// Last packet sent, STX to end
+} RF_BULK_STATS;
+
+extern RF_BULK_STATS bulk_stats;
+
+
+// Fault watchdog
+// The status byte of every SPI access is checked for the RX FIFO
+// overflow and TX FIFO underflow states.  The radio is polled with
+// SNOP when there has been no other access.
+#define FAULT_POLL_MSEC		10
+
+typedef struct {
+	uint32_t rx_overflow;				// RX FIFO overflow state seen
+	uint32_t tx_underflow;				// TX FIFO underflow state seen
+	uint32_t recovered;					// Back in RX after recovery
+	uint32_t failed;					// Not in RX after recovery
+	uint32_t dropped;					// Packets lost to the flushes
+	uint32_t rec_usec;					// Last recovery time
+	uint32_t rec_usec_max;
+} RF_FAULT_STATS;
+
+extern RF_FAULT_STATS fault_stats;
+extern uint8_t bulk_rx_addr;
+
+
+// Reliable delivery (ARQ)
+// Data and ack packets start with a link header after ADDR.
+// [LEN][ADDR][TYPE][SRC][SEQ][DATA...]
+// Received ARQ data packets are queued with the header, the payload
+// starts at data[ARQ_HDR_LEN].
+#define ARQ_DATA		0xA1				// TYPE, data packet to be acked
+#define ARQ_ACK			0xA2				// TYPE, ack for SEQ
+#define ARQ_HDR_LEN		3
+#define ARQ_MAX_DATA	(RF_MAX_DATA - ARQ_HDR_LEN)
+
+#define ARQ_QUEUE_SIZE	8					// Packets waiting for an ack
+#define ARQ_MAX_PEERS	16					// Remote addresses tracked
+#define ARQ_MAX_TRIES	5					// Transmissions before giving up
+#define ARQ_RTO_INIT	20					// Retransmit timeout before an RTT sample (msec)
+#define ARQ_RTO_MIN		2					// msec
+#define ARQ_RTO_MAX		250					// msec
+#define ACK_QUEUE_SIZE	4
+
+// Sequence numbers and round trip time for one remote address
+typedef struct {
+	uint8_t addr;						// Remote address
+	uint8_t tx_seq;						// Next sequence number to send
+	uint8_t rx_seq;						// Last sequence number received
+	uint8_t rx_valid;					// rx_seq has been set
+	uint32_t srtt;						// Smoothed round trip time (usec)
+	uint32_t rttvar;					// Round trip time variation (usec)
+	uint16_t rto;						// Retransmit timeout (msec)
+} RF_PEER;
+
+// Packet waiting to be acked
+typedef struct {
+	uint8_t state;
+	uint8_t addr;						// Destination address
+	uint8_t len;						// No. of bytes, including link header
+	uint8_t tries;						// Transmissions so far
+	uint16_t timer;						// msec since last transmission
+	uint16_t rto;						// Current timeout, doubles each retry
+	uint32_t order;						// Send order, to keep packets in sequence
+	uint32_t sent;						// cyc_count() at the first transmission
+	void (*done)(int result);			// Completion callback
+	uint8_t data[RF_MAX_DATA];			// Link header and payload
+} RF_ARQ_PKT;
+
+// ARQ statistics
+typedef struct {
+	uint32_t sent;						// Packets acked
+	uint32_t failed;					// Packets dropped after ARQ_MAX_TRIES
+	uint32_t retries;					// Retransmissions
+	uint32_t acks;						// Acks sent
+	uint32_t dups;						// Duplicate packets dropped
+} RF_ARQ_STATS;
+
+extern RF_ARQ_STATS arq_stats;
+
+
+// Latency timestamps
+// TIM3 captures the GDO0 edges: the rising edge at the sync word and
+// the falling edge at the end of packet.  Acks carry the receiver's
+// turnaround, end of the data packet to the ack write, in usec, then
+// the RSSI and LQI of the data packet for transmit power control.
+// [LEN][ADDR][ARQ_ACK][SRC][SEQ][TURN_L][TURN_H][RSSI][LQI]
+#define ARQ_ACK_TURN_LEN	(ARQ_HDR_LEN + 2)	// Ack with a turnaround
+#define ARQ_ACK_LEN		(ARQ_HDR_LEN + 4)	// Ack with the signal report
+#define LAT_BINS		16					// Bin i counts 2^i to 2^(i+1) usec
+
+// Latency histogram
+typedef struct {
+	uint32_t n;
+	uint32_t min;						// nsec
+	uint32_t max;						// nsec
+	uint32_t sum;						// usec
+	uint32_t bin[LAT_BINS];
+} LAT_HIST;
+
+typedef struct {
+	uint32_t sync;						// Sync word edges captured
+	uint32_t eop;						// End of packet edges captured
+	uint32_t missed;					// Edge captured again before it was read
+	uint32_t no_turn;					// Acks without a turnaround
+	uint32_t turn;						// Last turnaround received (usec)
+} LAT_STATS;
+
+extern LAT_HIST lat_rtt;				// First transmission to end of ack
+extern LAT_HIST lat_oneway;				// First transmission to end of packet at the receiver
+extern LAT_STATS lat_stats;
+extern RF_PEER arq_peers[ARQ_MAX_PEERS];
+
+
+// Link quality
+// Signal strength is in dBm x 16 (RSSI_FRAC bits of fraction).
+#define RSSI_FRAC		4
+#define RSSI_OFFSET		72					// dB, used without a profile
+#define LINK_MAX_ADDR	16					// Addresses tracked
+#define LINK_AVG_SHIFT	3					// Rolling average weight 1/8
+#define LINK_HIST_BINS	8					// RSSI histogram
+#define LINK_HIST_MIN	-100				// dBm, top of the first bin
+#define LINK_HIST_STEP	10					// dB per bin
+
+// Signal statistics for packets from one address
+typedef struct {
+	uint8_t addr;						// Sender, or destination if unknown
+	uint32_t pkts;						// Packets received
+	int rssi_avg;						// Rolling average (dBm x 16)
+	int rssi_min;						// Weakest packet (dBm x 16)
+	int rssi_last;						// Last packet (dBm x 16)
+	uint16_t lqi_avg;					// Rolling average LQI x 16, lower is better
+	uint8_t lqi_max;					// Worst LQI
+	uint32_t hist[LINK_HIST_BINS];		// Packets in each RSSI bin
+	int rssi_peer;						// Our signal at this address, last ack (dBm x 16)
+	uint8_t lqi_peer;					// LQI at this address, last ack
+	uint8_t pa_level;					// Transmit power to this address, pa_table[] index
+	uint8_t pa_above;					// Acks above the target band since the last step
+} RF_LINK_STATS;
+
+extern RF_LINK_STATS link_stats[LINK_MAX_ADDR];
+extern uint8_t link_n_addr;
+
+
+// Transmit power control
+// Each destination's power level is kept in its link table entry.
+// Acks report how strongly the data packet was received, and the level
+// is stepped to hold that margin above the profile's sensitivity.  It
+// goes up one step at once when below the band, the LQI is poor or an
+// ack is missed, and down one step after PA_DOWN_ACKS acks above it.
+// Broadcasts and addresses without an entry use the top level.
+#define PA_LEVELS		13					// Entries in pa_table[]
+#define PA_LEVEL_MAX	(PA_LEVELS - 1)
+#define PA_MARGIN		15					// Default target (dB above sensitivity)
+#define PA_HYST			4					// Band either side of the target (dB)
+#define PA_DOWN_ACKS	4					// Acks above the band to step down
+#define PA_LQI_POOR		40					// Step up at this LQI or worse
+#define RX_SENS_DBM		-88					// Sensitivity (dBm), used without a profile
+
+typedef struct {
+	uint8_t on;							// Automatic control, else all packets at fixed
+	uint8_t fixed;						// Level without automatic control
+	int margin;							// Target (dB above sensitivity)
+	uint32_t up;						// Steps up
+	uint32_t down;						// Steps down
+	uint32_t missed;					// Steps up for a retransmission
+	uint32_t writes;					// PATABLE writes
+} RF_PA_CTRL;
+
+extern const uint8_t pa_table[PA_LEVELS];	// PATABLE setting for each level
+extern const int8_t pa_dbm[PA_LEVELS];		// Output power (dBm) for each level
+extern RF_PA_CTRL pa_ctrl;
+
+
+// Receive tap
+// When set, every packet drained from the RX FIFO is passed to the tap
+// instead of the receive queue, with a bad CRC or not.  Nothing is
+// acked.  *p points to [LEN][ADDR][DATA...][RSSI][LQI], time is the
+// cyc_count() time of the last sync word.
+extern void (*cc_rx_tap)(uint8_t *p, uint32_t time);
+
+// Fast receive hook
+// When set, each good packet for the receive queue is passed to the
+// hook first, from the radio interrupt, with the cyc_count() time of
+// the last sync word.  If it returns 1 the packet has been used and
+// isn't queued or acked.
+extern int (*cc_rx_fast)(uint8_t *p, uint32_t time);
+
 
 
 
@@ -30,11 +349,76 @@ int cc_set_base_frequency(uint32_t base_freq);
 
 
 
+// Register shadow cache
+void cc_reg_sync(void);
+uint8_t cc_reg_get(uint8_t addr);
+void cc_reg_set(uint8_t addr, uint8_t value);
+int cc_reg_commit(void);
+
+// Channels and calibration
+extern uint8_t cal_table[RF_N_CHANNELS][N_FSCAL_REGS];
+extern uint8_t cal_valid;
+int cc_cal_build(void);
+int cc_set_channel(uint8_t chan);
+int cc_scan(RF_SCAN_CHAN *result, int first, int last, int busy_dbm);
+
+// Register profiles
+const RF_PROFILE *cc_find_profile(char *name);
+const RF_PROFILE *cc_get_profile(void);
+int cc_profile_apply(const RF_PROFILE *profile);
+
 int cc_radio_config(RF_CONFIG *config);
+int cc_radio_start(void);
+int cc_radio_stop(void);
+int cc_wor_start(void);
+int cc_hal_idle(void);
 uint8_t StrToCmd(char *cmd);
 int cc_state_to_str(uint8_t state, char *s);
 
-int rf_write_tx_fifo(uint8_t *buf, int n);
+int rf_write_tx_fifo(uint8_t addr, uint8_t *buf, int n);
+int rf_read_rx_fifo(uint8_t *buf, int n);
+
+// Packet receive
+void cc_gdo_init(void);
+int cc_receive_pkt(RF_PKT *pkt);
+void cc_rx_queue_put(uint8_t *p, uint8_t radio);
+
+// Packet transmit
+int cc_send_pkt(uint8_t addr, uint8_t *data, int n, void (*done)(int result));
+int cc_send_urgent(int reps, int (*build)(uint8_t *frame, int rep));
+void cc_hal_tick(void);
+int cc_rx_active(void);
+int cc_tx_active(void);
+int cc_tx_queued(void);
+
+// Link quality
+int cc_read_rssi(void);
+int cc_rssi_dbm(uint8_t rssi);
+void cc_link_clear(void);
+RF_LINK_STATS *cc_link_find(uint8_t addr);
+
+// Transmit power control
+void cc_pa_auto(int margin);
+void cc_pa_fixed(int level);
+int cc_pa_level(uint8_t addr);
+
+// Bulk transfer
+int cc_bulk_send(uint8_t addr, uint8_t *data, int n, void (*done)(int result));
+int cc_bulk_recv(uint8_t *buf, int max, void (*done)(int result));
+void cc_bulk_abort(void);
+uint32_t cc_data_rate(void);
+
+// Fault watchdog
+void cc_fault_recover(void);
+void cc_fault_clear(void);
+
+// Reliable transmit
+int cc_send_rel(uint8_t addr, uint8_t *data, int n, void (*done)(int result));
+
+// Latency
+uint32_t cc_presync_usec(void);
+void cc_lat_add(LAT_HIST *h, uint32_t cyc);
+void cc_lat_clear(void);
 
 
 #endif /* CC_HAL_H_ */
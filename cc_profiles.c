@@ -0,0 +1,191 @@
+/*
+ * cc_profiles.c
+ *
+ * CC2500 radio register profiles.
+ *
+ * Each profile is a complete image of the config registers [00-2E]
+ * in N_CONFIG_REGS order, held in flash.  cc_profile_apply() writes
+ * an image to the radio with one burst from the IDLE state.
+ *
+ * Modem settings are from SmartRF Studio for a 26MHz crystal.
+ * All profiles share the same frequency plan:
+ * 	Base frequency		2402MHz (CHANNR 0)
+ * 	Channel spacing		405kHz
+ * so the channel numbers mean the same in every profile.
+ *
+ * The packet handling and GDO0 settings are those required by the
+ * HAL receive and transmit engines.
+ */
+
+
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+
+
+const RF_PROFILE rf_profiles[] =
+{
+	{
+		"longrange", "Long range 2.4kBaud 2-FSK",
+		71,				// RSSI offset (dB) for the data rate
+		-104,			// Sensitivity (dBm)
+		{
+			0x29,		// IOCFG2
+			0x2E,		// IOCFG1
+			0x06,		// IOCFG0		GDO0 sync word / end of packet
+			0x07,		// FIFOTHR
+			0xD3,		// SYNC1
+			0x91,		// SYNC0
+			0x3D,		// PKTLEN		Max packet length 61
+			0x04,		// PKTCTRL1	Append RSSI/LQI, no address check
+			0x45,		// PKTCTRL0	Whitening, CRC, variable length
+			0x00,		// ADDR
+			0x00,		// CHANNR
+			0x08,		// FSCTRL1
+			0x00,		// FSCTRL0
+			0x5C,		// FREQ2		2402MHz base
+			0x62,		// FREQ1
+			0x77,		// FREQ0
+			0x86,		// MDMCFG4		203kHz RX bandwidth
+			0x83,		// MDMCFG3		2.4kBaud
+			0x03,		// MDMCFG2		2-FSK, 30/32 sync
+			0x23,		// MDMCFG1		4 byte preamble
+			0xFF,		// MDMCFG0		405kHz channel spacing
+			0x44,		// DEVIATN		38kHz deviation
+			0x07,		// MCSM2
+			0x3F,		// MCSM1		RX after RX and TX, CCA
+			0x18,		// MCSM0		Calibrate from IDLE
+			0x16,		// FOCCFG
+			0x6C,		// BSCFG
+			0x03,		// AGCCTRL2
+			0x40,		// AGCCTRL1
+			0x91,		// AGCCTRL0
+			0x87,		// WOREVT1
+			0x6B,		// WOREVT0
+			0xF8,		// WORCTRL
+			0x56,		// FREND1
+			0x10,		// FREND0
+			0xA9,		// FSCAL3
+			0x0A,		// FSCAL2
+			0x00,		// FSCAL1
+			0x11,		// FSCAL0
+			0x41,		// RCCTRL1
+			0x00,		// RCCTRL0
+			0x59,		// FSTEST
+			0x7F,		// PTEST
+			0x3F,		// AGCTEST
+			0x88,		// TEST2
+			0x31,		// TEST1
+			0x0B		// TEST0
+		}
+	},
+	{
+		"lowlat", "Low latency 250kBaud MSK",
+		72,				// RSSI offset (dB) for the data rate
+		-88,			// Sensitivity (dBm)
+		{
+			0x29,		// IOCFG2
+			0x2E,		// IOCFG1
+			0x06,		// IOCFG0		GDO0 sync word / end of packet
+			0x07,		// FIFOTHR
+			0xD3,		// SYNC1
+			0x91,		// SYNC0
+			0x3D,		// PKTLEN		Max packet length 61
+			0x04,		// PKTCTRL1	Append RSSI/LQI, no address check
+			0x45,		// PKTCTRL0	Whitening, CRC, variable length
+			0x00,		// ADDR
+			0x00,		// CHANNR
+			0x0A,		// FSCTRL1
+			0x00,		// FSCTRL0
+			0x5C,		// FREQ2		2402MHz base
+			0x62,		// FREQ1
+			0x77,		// FREQ0
+			0x2D,		// MDMCFG4		541kHz RX bandwidth
+			0x3B,		// MDMCFG3		250kBaud
+			0x73,		// MDMCFG2		MSK, 30/32 sync
+			0x23,		// MDMCFG1		4 byte preamble
+			0xFF,		// MDMCFG0		405kHz channel spacing
+			0x01,		// DEVIATN
+			0x07,		// MCSM2
+			0x3F,		// MCSM1		RX after RX and TX, CCA
+			0x18,		// MCSM0		Calibrate from IDLE
+			0x1D,		// FOCCFG
+			0x1C,		// BSCFG
+			0xC7,		// AGCCTRL2
+			0x00,		// AGCCTRL1
+			0xB2,		// AGCCTRL0
+			0x87,		// WOREVT1
+			0x6B,		// WOREVT0
+			0xF8,		// WORCTRL
+			0xB6,		// FREND1
+			0x10,		// FREND0
+			0xEA,		// FSCAL3
+			0x0A,		// FSCAL2
+			0x00,		// FSCAL1
+			0x11,		// FSCAL0
+			0x41,		// RCCTRL1
+			0x00,		// RCCTRL0
+			0x59,		// FSTEST
+			0x7F,		// PTEST
+			0x3F,		// AGCTEST
+			0x88,		// TEST2
+			0x31,		// TEST1
+			0x0B		// TEST0
+		}
+	},
+	{
+		"wor", "WOR handheld 10kBaud 2-FSK",
+		69,				// RSSI offset (dB) for the data rate
+		-99,			// Sensitivity (dBm)
+		{
+			0x29,		// IOCFG2
+			0x2E,		// IOCFG1
+			0x06,		// IOCFG0		GDO0 sync word / end of packet
+			0x07,		// FIFOTHR
+			0xD3,		// SYNC1
+			0x91,		// SYNC0
+			0x3D,		// PKTLEN		Max packet length 61
+			0x04,		// PKTCTRL1	Append RSSI/LQI, no address check
+			0x45,		// PKTCTRL0	Whitening, CRC, variable length
+			0x00,		// ADDR
+			0x00,		// CHANNR
+			0x08,		// FSCTRL1
+			0x00,		// FSCTRL0
+			0x5C,		// FREQ2		2402MHz base
+			0x62,		// FREQ1
+			0x77,		// FREQ0
+			0x78,		// MDMCFG4		232kHz RX bandwidth
+			0x93,		// MDMCFG3		10kBaud
+			0x03,		// MDMCFG2		2-FSK, 30/32 sync
+			0x73,		// MDMCFG1		24 byte preamble
+			0xFF,		// MDMCFG0		405kHz channel spacing
+			0x44,		// DEVIATN		38kHz deviation
+			0x0C,		// MCSM2		RX timeout, PQT check
+			0x3F,		// MCSM1		RX after RX and TX, CCA
+			0x18,		// MCSM0		Calibrate from IDLE
+			0x16,		// FOCCFG
+			0x6C,		// BSCFG
+			0x43,		// AGCCTRL2
+			0x40,		// AGCCTRL1
+			0x91,		// AGCCTRL0
+			0x28,		// WOREVT1		EVENT0 300ms
+			0xA0,		// WOREVT0
+			0x78,		// WORCTRL		RC osc on, EVENT1 1.4ms
+			0x56,		// FREND1
+			0x10,		// FREND0
+			0xA9,		// FSCAL3
+			0x0A,		// FSCAL2
+			0x00,		// FSCAL1
+			0x11,		// FSCAL0
+			0x41,		// RCCTRL1
+			0x00,		// RCCTRL0
+			0x59,		// FSTEST
+			0x7F,		// PTEST
+			0x3F,		// AGCTEST
+			0x88,		// TEST2
+			0x31,		// TEST1
+			0x0B		// TEST0
+		}
+	}
+};
+
+const int n_rf_profiles = sizeof(rf_profiles) / sizeof(RF_PROFILE);
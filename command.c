@@ -13,7 +13,19 @@
 #include "textio.h"
 #include "cc2500_regs.h"
 #include "cc_hal.h"
+#include "fhss.h"
+#include "tdma.h"
+#include "power.h"
+#include "ctrl_frame.h"
+#include "loco.h"
+#include "auth.h"
+#include "ota.h"
+#include "sniff.h"
+#include "dual.h"
+#include "estop.h"
 #include "pwm.h"
+#include "spi.h"
+#include "timer.h"
 
 
 #ifndef NULL
@@ -57,6 +69,37 @@ void cmd_speed_mode(void);
 void cmd_speed(void);
 void cmd_sres(void);
 void cmd_tx(void);
+void cmd_tx_done(int result);
+void cmd_spibaud(void);
+void cmd_regsync(void);
+void cmd_profile(void);
+void cmd_chan(void);
+void cmd_fhss(void);
+void cmd_tdma(void);
+void cmd_rtx(void);
+void cmd_arq(void);
+void cmd_addr(void);
+void cmd_link(void);
+void print_dbm(int value);
+void cmd_power(void);
+void print_duty(uint32_t duty);
+void cmd_bulk(void);
+void cmd_bulk_sent(int result);
+void cmd_bulk_rcvd(int result);
+void cmd_scan(void);
+void cmd_fault(void);
+void cmd_loco(void);
+void cmd_auth(void);
+void key_entry(uint8_t c);
+void cmd_ota(void);
+void cmd_lat(void);
+void print_lat(char *name, LAT_HIST *h);
+void print_nsec(uint32_t nsec);
+void cmd_sniff(void);
+void cmd_dual(void);
+void cmd_txpwr(void);
+void cmd_estop(void);
+void spi_measure(void);
 
 
 char cmd_buf[CMD_BUF_SIZE];			// Command line buffer.
@@ -72,6 +115,12 @@ char *args[MAX_ARGS];
 int n_args;
 
 int cmd_mode;
+#define CMD_MODE_KEY	2			// Key entry, no echo
+
+char key_buf[2 * AUTH_KEY_LEN];		// Key being typed
+int key_index;
+
+int loco_sel = -1;				// Locomotive controlled in speed adjust mode
 
 
 // Array of command structures
@@ -82,12 +131,34 @@ const CMD_ITEM cmd_list[] =
 	{"state", cmd_state, "RF state"},
 	{"reg", cmd_reg, "Read registers"},
 	{"wreg", cmd_wreg, "Write registers"},
+	{"regsync", cmd_regsync, "Reload register cache"},
+	{"profile", cmd_profile, "Radio register profile"},
 	{"status", cmd_status, "Status registers"},
 	{"cmd", cmd_command, "Send command to radio"},
 	{"ctrl", cmd_speed_mode, "Go to speed control mode"},
 	{"speed", cmd_speed, "Set speed"},
 	{"sres", cmd_sres, "RF Reset"},
-	{"tx", cmd_tx, "Transmit a string"}
+	{"tx", cmd_tx, "Transmit a string"},
+	{"spibaud", cmd_spibaud, "SPI timing profile"},
+	{"chan", cmd_chan, "RF channel and calibration"},
+	{"fhss", cmd_fhss, "Frequency hopping"},
+	{"tdma", cmd_tdma, "TDMA slots and utilisation"},
+	{"addr", cmd_addr, "Radio device address"},
+	{"rtx", cmd_rtx, "Transmit a string with acks"},
+	{"arq", cmd_arq, "ARQ statistics"},
+	{"link", cmd_link, "Link quality per address"},
+	{"power", cmd_power, "Wake-on-Radio and STOP mode"},
+	{"bulk", cmd_bulk, "Bulk transfer larger than the FIFO"},
+	{"scan", cmd_scan, "Spectrum survey"},
+	{"fault", cmd_fault, "Radio fault watchdog"},
+	{"loco", cmd_loco, "Locomotive control queue"},
+	{"auth", cmd_auth, "Control frame authentication"},
+	{"ota", cmd_ota, "Over-the-air firmware update"},
+	{"lat", cmd_lat, "Link latency histograms"},
+	{"sniff", cmd_sniff, "Capture all packets to the host"},
+	{"dual", cmd_dual, "Second radio on SPI2"},
+	{"txpwr", cmd_txpwr, "Transmit power control"},
+	{"estop", cmd_estop, "Emergency stop timing"}
 };
 
 #define N_CMDS ((sizeof(cmd_list))/(sizeof(CMD_ITEM)))
@@ -119,6 +190,12 @@ void cmd_proc_init(void)
  */
 void cmd_proc(uint8_t c)
 {
+	if(cmd_mode == CMD_MODE_KEY)
+	{
+		key_entry(c);
+		return;
+	}
+
 	if(c == '\r')					// CR, 'Enter' pressed.
 	{
 		kputc('\n');				// Send CR+LF.  Command output on next line.
@@ -136,6 +213,13 @@ void cmd_proc(uint8_t c)
 			command_process();					// Process the command.
 			//cmdline_proc();			// Process the command buffer.
 
+			// Key entry prompt stays on the line
+			if(cmd_mode == CMD_MODE_KEY)
+			{
+				cmd_index = 0;
+				return;
+			}
+
 			kputc('\n');			// Put command prompt on a new line.
 		}
 
@@ -389,6 +473,9 @@ void cmd_state(void)
 
 
 /* Read CC2500 configuration registers
+ *
+ * Registers are read from the register cache.  Use regsync to reload
+ * the cache from the radio.
  *
  * Usage:
  * > reg [addr] [count]
@@ -447,7 +534,7 @@ void cmd_reg(void)
 		if(addr >= N_CONFIG_REGS)
 			break;
 
-		value = cc_read(addr);
+		value = cc_reg_get(addr);
 
 		ByteToHex(s, addr);
 		print_str(s);
@@ -465,9 +552,9 @@ void cmd_reg(void)
 
 /* Write to CC2500 configuration register
  *
- * Write to one configuration register.
+ * Write to one configuration register through the register cache.
  *
- * Value is read back and displayed.
+ * Value is read back from the radio and displayed.
  */
 void cmd_wreg(void)
 {
@@ -501,7 +588,8 @@ void cmd_wreg(void)
 	}
 
 	// Write to config register.
-	cc_write(addr, value);
+	cc_reg_set(addr, value);
+	cc_reg_commit();
 
 	value = cc_read(addr);
 
@@ -547,7 +635,10 @@ void cmd_command(void)
 
 
 	// Send command to radio.
-	cc_write_cmd(cmd_value);
+	if(cmd_value == SRES)
+		cc_reset();						// Also invalidates the register cache
+	else
+		cc_write_cmd(cmd_value);
 }
 
 
@@ -747,6 +838,10 @@ void speed_adjust_mode(char c)
 
 	// Print the current speed.
 	speed = pwm_get_speed();
+
+	// Queue it for the selected locomotive, replacing an unsent update
+	if(loco_sel >= 0)
+		loco_set_speed(loco_sel, speed);
 //	itoa(speed, s, 10);
 	IntToHex(s, speed);
 	print_str(s);
@@ -803,21 +898,37 @@ void cmd_version(void)
  */
 void cmd_sres(void)
 {
-	cc_write_cmd(SRES);
+	cc_reset();
 	print_str("SRES\n");
 }
 
 
+/*
+ * regsync		Reload the register cache from the radio.
+ */
+void cmd_regsync(void)
+{
+	cc_reg_sync();
+	print_str("Register cache loaded\n");
+}
+
+
 /*
  * tx
  *
  * Send a string to radio for transmit
+ *
+ * Usage:
+ * tx <string>				Broadcast string (address 00)
+ * tx <string> <addr>		Send string to address (hex)
  */
 void cmd_tx(void)
 {
 	char *str;
 	int n;
 	char s[16];
+	uint32_t addr;
+	char *ptr;
 
 
 	// Check there is a string
@@ -827,6 +938,10 @@ void cmd_tx(void)
 		return;
 	}
 
+	addr = 0;
+	if(n_args > 2)
+		addr = strtol(args[2], &ptr, 16);			// Hex
+
 	str = (char *)args[1];			// Point to the start of the string
 	n = strlen(str);				// Get the string length
 
@@ -837,7 +952,1732 @@ void cmd_tx(void)
 	print_str(s);
 	print_str(" bytes\n");
 
-	// Write the string into the TX FIFO
-	rf_write_tx_fifo((uint8_t *)str, n);
+	// Queue the string for transmit
+	if(cc_send_pkt((uint8_t)addr, (uint8_t *)str, n, cmd_tx_done) < 0)
+		print_str("TX queue full or string too long\n");
+
+}
+
+
+/* cmd_tx_done
+ *
+ * Transmit completion callback for the tx command.
+ * Called from interrupt context.
+ */
+void cmd_tx_done(int result)
+{
+	if(result == RF_TX_OK)
+		print_str("TX done\n");
+	else
+		print_str("TX failed\n");
+}
+
+
+/* cmd_spibaud
+ *
+ * Select the SPI timing profile for CC2500 access and measure
+ * SPI throughput.
+ *
+ * Usage:
+ * spibaud				List profiles, measure current profile
+ * spibaud <name>		Select profile and measure it
+ */
+void cmd_spibaud(void)
+{
+	const SPI_PROFILE *profile;
+	int i;
+
+
+	if(n_args == 2)
+	{
+		if(spi_set_profile(args[1]) < 0)
+		{
+			print_str("Unknown profile\n");
+			return;
+		}
+	}
+
+	profile = spi_get_profile();
+
+	for(i=0; i<n_spi_profiles; i++)
+	{
+		print_str((profile == &spi_profiles[i]) ? "* " : "  ");
+		print_str(spi_profiles[i].name);
+		print_str("\t");
+		print_str(spi_profiles[i].help_txt);
+		print_str("\n");
+	}
+
+	spi_measure();
+}
+
+
+/* spi_measure
+ *
+ * Measure CC2500 SPI throughput with the current profile.
+ *
+ * Times SPI_MEAS_N burst reads of all config registers, and SPI_MEAS_N
+ * single register reads with the DWT cycle counter.  Throughput counts
+ * all bytes on the bus, including header bytes.
+ */
+#define SPI_MEAS_N		100
+
+void spi_measure(void)
+{
+	uint8_t regs[N_CONFIG_REGS];
+	uint32_t t0;
+	uint32_t cycles;
+	uint32_t bytes;
+	char s[16];
+	int i;
+
+
+	// Burst access
+	t0 = cyc_count();
+	for(i=0; i<SPI_MEAS_N; i++)
+		cc_read_b(0, regs, N_CONFIG_REGS);
+	cycles = cyc_count() - t0;
+	bytes = SPI_MEAS_N * (N_CONFIG_REGS + 1);
+
+	print_str("burst  ");
+	print_str(IntToStr((bytes * 8 * (CK_INT / 1000)) / cycles, s, 10));
+	print_str(" kbit/s, ");
+	print_str(IntToStr(cycles / (SPI_MEAS_N * CYC_PER_USEC), s, 10));
+	print_str(" us per 47 regs\n");
+
+	// Single access
+	t0 = cyc_count();
+	for(i=0; i<SPI_MEAS_N; i++)
+		cc_read(i % N_CONFIG_REGS);
+	cycles = cyc_count() - t0;
+	bytes = SPI_MEAS_N * 2;
+
+	print_str("single ");
+	print_str(IntToStr((bytes * 8 * (CK_INT / 1000)) / cycles, s, 10));
+	print_str(" kbit/s, ");
+	print_str(IntToStr(cycles / (SPI_MEAS_N * CYC_PER_USEC), s, 10));
+	print_str(" us per reg\n");
+}
+
+
+/* cmd_profile
+ *
+ * Select a radio register profile.
+ *
+ * Usage:
+ * profile				List profiles, * marks the current profile
+ * profile <name>		Write the profile to the radio and restart RX
+ */
+void cmd_profile(void)
+{
+	const RF_PROFILE *profile;
+	int i;
+
+
+	if(n_args == 2)
+	{
+		profile = cc_find_profile(args[1]);
+		if(profile == NULL)
+		{
+			print_str("Unknown profile\n");
+			return;
+		}
+
+		if(cc_profile_apply(profile) < 0)
+		{
+			print_str("Radio not idle\n");
+			return;
+		}
+
+		cc_radio_start();
+	}
+
+	profile = cc_get_profile();
+
+	for(i=0; i<n_rf_profiles; i++)
+	{
+		print_str((profile == &rf_profiles[i]) ? "* " : "  ");
+		print_str(rf_profiles[i].name);
+		print_str("\t");
+		print_str(rf_profiles[i].help_txt);
+		print_str("\n");
+	}
+}
+
+
+/* cmd_chan
+ *
+ * Change channel using the calibration table.
+ *
+ * Usage:
+ * chan				Show channel and its calibration
+ * chan <n>			Change to channel n (decimal) and show switch time
+ * chan cal			Rebuild the calibration table
+ */
+void cmd_chan(void)
+{
+	uint32_t chan;
+	long n;
+	uint32_t t0;
+	uint32_t cycles;
+	char s[16];
+	char *ptr;
+	int i;
+
+
+	if(n_args == 2)
+	{
+		t0 = cyc_count();
+
+		if(strcmp(args[1], "cal") == 0)
+		{
+			if(cc_cal_build() < 0)
+			{
+				print_str("Calibration timeout\n");
+				return;
+			}
+			cc_radio_start();
+		}
+		else
+		{
+			n = strtol(args[1], &ptr, 10);
+			if((n < 0) || (n >= RF_N_CHANNELS) || (cc_set_channel(n) < 0))
+			{
+				print_str("Channel range [0-195]\n");
+				return;
+			}
+		}
+
+		cycles = cyc_count() - t0;
+
+		print_str(IntToStr(cycles / CYC_PER_USEC, s, 10));
+		print_str(" us\n");
+	}
+
+	chan = cc_reg_get(CHANNR);
+
+	print_str("Channel ");
+	print_str(IntToStr(chan, s, 10));
+
+	if(cal_valid && (chan < RF_N_CHANNELS))
+	{
+		print_str("  FSCAL3-1:");
+		for(i=0; i<N_FSCAL_REGS; i++)
+		{
+			print_str(" ");
+			ByteToHex(s, cal_table[chan][i]);
+			print_str(s);
+		}
+	}
+	else
+		print_str("  not calibrated");
+
+	print_str("\n");
+}
+
+
+/* cmd_fhss
+ *
+ * Frequency hopping control.
+ *
+ * Usage:
+ * fhss										Show hopping state and statistics
+ * fhss off									Stop hopping
+ * fhss <master|slave> [seed] [slot] [n]	Start hopping
+ *		seed	Sequence seed (hex)
+ *		slot	Slot length msec
+ *		n		Channels in the sequence
+ */
+void cmd_fhss(void)
+{
+	FHSS_CONFIG config;
+	uint8_t mode;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "off") == 0)
+		{
+			fhss_stop();
+			return;
+		}
+		else if(strcmp(args[1], "master") == 0)
+			mode = FHSS_MASTER;
+		else if(strcmp(args[1], "slave") == 0)
+			mode = FHSS_SLAVE;
+		else
+		{
+			print_str("Usage: fhss [off|master|slave] [seed] [slot] [n]\n");
+			return;
+		}
+
+		config = fhss_config;
+		if(n_args > 2)
+			config.seed = strtol(args[2], &ptr, 16);			// Hex
+		if(n_args > 3)
+			config.slot_msec = strtol(args[3], &ptr, 10);
+		if(n_args > 4)
+			config.n_chan = strtol(args[4], &ptr, 10);
+
+		if(fhss_start(mode, &config) < 0)
+		{
+			print_str("Slot range [2-1000], channels [2-196]\n");
+			return;
+		}
+	}
+
+	if(fhss_mode == FHSS_OFF)
+		print_str("off");
+	else if(fhss_mode == FHSS_MASTER)
+		print_str("master");
+	else if(fhss_synced)
+		print_str("slave, in sync");
+	else
+		print_str("slave, searching");
+
+	print_str("\nseed ");
+	IntToHex(s, fhss_config.seed);
+	print_str(s);
+	print_str("  slot ");
+	print_str(IntToStr(fhss_config.slot_msec, s, 10));
+	print_str(" ms  channels ");
+	print_str(IntToStr(fhss_config.n_chan, s, 10));
+	print_str("  hop ");
+	print_str(IntToStr(fhss_hop, s, 10));
+	print_str(" ch ");
+	print_str(IntToStr(fhss_seq[fhss_hop], s, 10));
+
+	print_str("\nhops ");
+	print_str(IntToStr(fhss_stats.hops, s, 10));
+	print_str("  late ");
+	print_str(IntToStr(fhss_stats.late_hops, s, 10));
+	print_str("  beacons ");
+	print_str(IntToStr(fhss_stats.beacons, s, 10));
+	print_str("  resyncs ");
+	print_str(IntToStr(fhss_stats.resyncs, s, 10));
+	print_str("  lost ");
+	print_str(IntToStr(fhss_stats.lost, s, 10));
+	print_str("\n");
+}
+
+
+/* cmd_tdma
+ *
+ * TDMA slot scheduler control.
+ *
+ * Usage:
+ * tdma					Show the slot map and per slot utilisation
+ * tdma off				Stop the scheduler
+ * tdma base [slot]		Start as base station, slot length msec
+ * tdma loco <addr>		Start as loco with address (hex)
+ * tdma add <addr>		Give a loco a slot (base)
+ * tdma del <addr>		Free a loco's slot (base)
+ *
+ * Utilisation is the percentage of frames with a packet received
+ * in the slot.
+ */
+void cmd_tdma(void)
+{
+	uint32_t value;
+	char s[16];
+	char *ptr;
+	int i;
+
+
+	if(n_args >= 2)
+	{
+		value = 0;
+		if(n_args > 2)
+			value = strtol(args[2], &ptr, (strcmp(args[1], "base") == 0) ? 10 : 16);
+
+		if(strcmp(args[1], "off") == 0)
+		{
+			tdma_stop();
+			return;
+		}
+		else if(strcmp(args[1], "base") == 0)
+		{
+			if(tdma_start(TDMA_BASE, 0, (n_args > 2) ? value : TDMA_SLOT_MSEC) < 0)
+				print_str("Slot range [2-250]\n");
+		}
+		else if(strcmp(args[1], "loco") == 0)
+		{
+			if((n_args < 3) || (value > 0xFF) || (tdma_start(TDMA_LOCO, value, 0) < 0))
+				print_str("Address range [02-FF]\n");
+		}
+		else if(strcmp(args[1], "add") == 0)
+		{
+			if((n_args < 3) || (value > 0xFF) || (tdma_add(value) < 0))
+				print_str("No free slot\n");
+		}
+		else if(strcmp(args[1], "del") == 0)
+		{
+			if((n_args < 3) || (value > 0xFF) || (tdma_del(value) < 0))
+				print_str("No slot for address\n");
+		}
+		else
+		{
+			print_str("Usage: tdma [off|base|loco|add|del] [value]\n");
+			return;
+		}
+	}
+
+	if(tdma_mode == TDMA_OFF)
+	{
+		print_str("off\n");
+		return;
+	}
+
+	if(tdma_mode == TDMA_BASE)
+		print_str("base");
+	else if(tdma_synced)
+		print_str("loco, in sync");
+	else
+		print_str("loco, no beacon");
+
+	print_str("  slot ");
+	print_str(IntToStr(tdma_slot_msec, s, 10));
+	print_str(" ms  frames ");
+	print_str(IntToStr(tdma_frames, s, 10));
+	print_str("\nslot addr    pkts  used%  crc_err\n");
+
+	for(i=0; i<tdma_n_slots; i++)
+	{
+		print_str((i == tdma_my_slot) && (tdma_mode == TDMA_LOCO) ? "*" : " ");
+		print_str(IntToStr(i, s, 10));
+		print_str("\t");
+		ByteToHex(s, tdma_map[i]);
+		print_str(s);
+		print_str("\t");
+		print_str(IntToStr(tdma_stats[i].pkts, s, 10));
+		print_str("\t");
+		print_str(IntToStr(tdma_frames ? (tdma_stats[i].used * 100) / tdma_frames : 0, s, 10));
+		print_str("\t");
+		print_str(IntToStr(tdma_stats[i].crc_err, s, 10));
+		print_str("\n");
+	}
+}
+
+
+/* cmd_addr
+ *
+ * Show or set the radio device address (ADDR register).
+ * Acked packets are only accepted for this address.
+ *
+ * Usage:
+ * addr				Show address
+ * addr <addr>		Set address (hex)
+ */
+void cmd_addr(void)
+{
+	uint32_t addr;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args == 2)
+	{
+		addr = strtol(args[1], &ptr, 16);			// Hex
+		if(addr > 0xFF)
+		{
+			print_str("Address range [00-FF]\n");
+			return;
+		}
+
+		cc_reg_set(ADDR, addr);
+		cc_reg_commit();
+	}
+
+	ByteToHex(s, cc_reg_get(ADDR));
+	print_str(s);
+	print_str("\n");
+}
+
+
+/* cmd_rtx
+ *
+ * Send a string with acknowledgement and retransmission.
+ *
+ * Usage:
+ * rtx <string> <addr>		Send string to address (hex)
+ */
+void cmd_rtx(void)
+{
+	uint32_t addr;
+	char *ptr;
+
+
+	if(n_args < 3)
+	{
+		print_str("Usage: rtx <string> <addr>\n");
+		return;
+	}
 
+	addr = strtol(args[2], &ptr, 16);			// Hex
+
+	if(cc_send_rel((uint8_t)addr, (uint8_t *)args[1], strlen(args[1]), cmd_tx_done) < 0)
+		print_str("ARQ queue full or string too long\n");
+}
+
+
+/* cmd_arq
+ *
+ * Show ARQ statistics and the round trip time and retransmit timeout
+ * for each remote address.
+ */
+void cmd_arq(void)
+{
+	char s[16];
+	int i;
+
+
+	print_str("acked ");
+	print_str(IntToStr(arq_stats.sent, s, 10));
+	print_str("  failed ");
+	print_str(IntToStr(arq_stats.failed, s, 10));
+	print_str("  retries ");
+	print_str(IntToStr(arq_stats.retries, s, 10));
+	print_str("  acks sent ");
+	print_str(IntToStr(arq_stats.acks, s, 10));
+	print_str("  dups ");
+	print_str(IntToStr(arq_stats.dups, s, 10));
+	print_str("\naddr  srtt us  rttvar us  rto ms\n");
+
+	for(i=0; i<ARQ_MAX_PEERS; i++)
+	{
+		if(arq_peers[i].rto == 0)
+			continue;
+
+		ByteToHex(s, arq_peers[i].addr);
+		print_str(s);
+		print_str("\t");
+		print_str(IntToStr(arq_peers[i].srtt, s, 10));
+		print_str("\t");
+		print_str(IntToStr(arq_peers[i].rttvar, s, 10));
+		print_str("\t");
+		print_str(IntToStr(arq_peers[i].rto, s, 10));
+		print_str("\n");
+	}
+}
+
+
+/* print_dbm
+ *
+ * Print a signal strength in dBm x 16 to one decimal place.
+ */
+void print_dbm(int value)
+{
+	char s[16];
+
+
+	if(value < 0)
+	{
+		print_str("-");
+		value = -value;
+	}
+
+	value = (value * 10 + (1 << (RSSI_FRAC - 1))) >> RSSI_FRAC;
+
+	print_str(IntToStr(value / 10, s, 10));
+	print_str(".");
+	print_str(IntToStr(value % 10, s, 10));
+}
+
+
+/* cmd_link
+ *
+ * Show link quality for each address packets have been received from.
+ * RSSI average, minimum and last in dBm, LQI average and worst
+ * (lower is better), and the RSSI histogram.
+ *
+ * Usage:
+ * link				Show statistics
+ * link clear		Clear statistics
+ */
+void cmd_link(void)
+{
+	RF_LINK_STATS *link;
+	char s[16];
+	int i;
+	int j;
+
+
+	if((n_args == 2) && (strcmp(args[1], "clear") == 0))
+	{
+		cc_link_clear();
+		return;
+	}
+
+	print_str("addr  pkts  rssi avg  min  last  lqi avg  max\n");
+
+	for(i=0; i<link_n_addr; i++)
+	{
+		link = &link_stats[i];
+
+		ByteToHex(s, link->addr);
+		print_str(s);
+		print_str("\t");
+		print_str(IntToStr(link->pkts, s, 10));
+		print_str("\t");
+		print_dbm(link->rssi_avg);
+		print_str("\t");
+		print_dbm(link->rssi_min);
+		print_str("\t");
+		print_dbm(link->rssi_last);
+		print_str("\t");
+		print_str(IntToStr(link->lqi_avg >> RSSI_FRAC, s, 10));
+		print_str("\t");
+		print_str(IntToStr(link->lqi_max, s, 10));
+		print_str("\n");
+
+		// Histogram, bins start at the dBm shown
+		print_str("  <");
+		print_str(IntToStr(LINK_HIST_MIN, s, 10));
+		print_str(":");
+		print_str(IntToStr(link->hist[0], s, 10));
+		for(j=1; j<LINK_HIST_BINS; j++)
+		{
+			print_str(" ");
+			print_str(IntToStr(LINK_HIST_MIN + (j - 1) * LINK_HIST_STEP, s, 10));
+			print_str(":");
+			print_str(IntToStr(link->hist[j], s, 10));
+		}
+		print_str("\n");
+	}
+}
+
+
+/* print_duty
+ *
+ * Print a duty cycle in 0.001% units as a percentage.
+ */
+void print_duty(uint32_t duty)
+{
+	char s[16];
+
+
+	print_str(IntToStr(duty / 1000, s, 10));
+	print_str(".");
+	s[0] = '0' + (duty / 100) % 10;
+	s[1] = '0' + (duty / 10) % 10;
+	s[2] = '0' + duty % 10;
+	s[3] = 0;
+	print_str(s);
+	print_str("%");
+}
+
+
+/* cmd_power
+ *
+ * Wake-on-Radio low power receive.
+ *
+ * Usage:
+ * power				Show duty cycles, current estimate and wake-ups
+ * power wor [msec]		Start WOR, radio wake interval in msec
+ * power off			Stop WOR, radio in RX
+ *
+ * The MCU duty cycle is measured, the radio duty cycle is worked out
+ * from the WOR settings.  The first character typed while the MCU is
+ * in STOP is lost.
+ */
+void cmd_power(void)
+{
+	uint32_t msec;
+	uint32_t current;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "off") == 0)
+		{
+			power_wor_stop();
+		}
+		else if(strcmp(args[1], "wor") == 0)
+		{
+			msec = WOR_EVENT0_MSEC;
+			if(n_args > 2)
+				msec = strtol(args[2], &ptr, 10);
+
+			if((msec > WOR_EVENT0_MAX) || (power_wor_start(msec) < 0))
+			{
+				print_str("Interval range [1-1890], FHSS and TDMA must be off\n");
+				return;
+			}
+		}
+		else
+		{
+			print_str("Usage: power [wor [msec]|off]\n");
+			return;
+		}
+	}
+
+	print_str(power_wor ? "WOR on\n" : "WOR off\n");
+
+	print_str("MCU duty ");
+	print_duty(power_mcu_duty());
+	print_str("  radio duty ");
+	print_duty(power_radio_duty());
+
+	current = power_current_na();
+	print_str("\naverage current ");
+	print_str(IntToStr(current / 1000, s, 10));
+	print_str(".");
+	print_str(IntToStr((current / 100) % 10, s, 10));
+	print_str(" uA\n");
+
+	print_str("sleeps ");
+	print_str(IntToStr(power_stats.sleeps, s, 10));
+	print_str("  packet wakes ");
+	print_str(IntToStr(power_stats.radio_wakes, s, 10));
+	print_str("  uart wakes ");
+	print_str(IntToStr(power_stats.uart_wakes, s, 10));
+	print_str("\nasleep ");
+	print_str(IntToStr(power_stats.sleep_msec, s, 10));
+	print_str(" ms  awake ");
+	print_str(IntToStr(power_stats.awake_msec, s, 10));
+	print_str(" ms  clock restore ");
+	print_str(IntToStr(power_stats.wake_usec, s, 10));
+	print_str(" us (max ");
+	print_str(IntToStr(power_stats.wake_max_usec, s, 10));
+	print_str(" us)\n");
+}
+
+
+#define BULK_BUF_SIZE	2048
+uint8_t bulk_cmd_buf[BULK_BUF_SIZE];
+
+
+/* cmd_bulk
+ *
+ * Bulk transfer test and statistics.
+ *
+ * Usage:
+ * bulk					Statistics and throughput of the last packet sent
+ * bulk rx				Wait for one bulk packet
+ * bulk tx <n> [addr]	Send n bytes [61-2048], addr in hex
+ * bulk abort			Stop waiting
+ */
+void cmd_bulk(void)
+{
+	int n;
+	int addr;
+	int i;
+	uint32_t kbps;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "rx") == 0)
+		{
+			if(cc_bulk_recv(bulk_cmd_buf, BULK_BUF_SIZE, cmd_bulk_rcvd) < 0)
+				print_str("Radio busy\n");
+			return;
+		}
+		else if((strcmp(args[1], "tx") == 0) && (n_args >= 3))
+		{
+			n = strtol(args[2], &ptr, 10);
+			addr = 0;
+			if(n_args > 3)
+				addr = strtol(args[3], &ptr, 16);
+
+			if((n < BULK_MIN_DATA) || (n > BULK_BUF_SIZE))
+			{
+				print_str("Length range [61-2048]\n");
+				return;
+			}
+
+			for(i=0; i<n; i++)
+				bulk_cmd_buf[i] = (uint8_t)i;
+
+			if(cc_bulk_send((uint8_t)addr, bulk_cmd_buf, n, cmd_bulk_sent) < 0)
+				print_str("Radio busy\n");
+			return;
+		}
+		else if(strcmp(args[1], "abort") == 0)
+		{
+			cc_bulk_abort();
+			return;
+		}
+		else
+		{
+			print_str("Usage: bulk [rx|tx <n> [addr]|abort]\n");
+			return;
+		}
+	}
+
+	print_str("sent ");
+	print_str(IntToStr(bulk_stats.tx_pkts, s, 10));
+	print_str("  received ");
+	print_str(IntToStr(bulk_stats.rx_pkts, s, 10));
+	print_str("  underflow ");
+	print_str(IntToStr(bulk_stats.underflow, s, 10));
+	print_str("  overflow ");
+	print_str(IntToStr(bulk_stats.overflow, s, 10));
+	print_str("\nlength errors ");
+	print_str(IntToStr(bulk_stats.len_err, s, 10));
+	print_str("  CRC errors ");
+	print_str(IntToStr(bulk_stats.crc_err, s, 10));
+	print_str("  timeouts ");
+	print_str(IntToStr(bulk_stats.timeout, s, 10));
+
+	print_str("\ndata rate ");
+	print_str(IntToStr(cc_data_rate() / 1000, s, 10));
+	print_str(" kbit/s");
+
+	if(bulk_stats.cycles)
+	{
+		kbps = (unsigned long long)bulk_stats.bytes * 8 * CYC_PER_USEC * 1000 / bulk_stats.cycles;
+		print_str("  last packet ");
+		print_str(IntToStr(bulk_stats.bytes, s, 10));
+		print_str(" bytes at ");
+		print_str(IntToStr(kbps, s, 10));
+		print_str(" kbit/s");
+	}
+	print_str("\n");
+}
+
+
+/* cmd_bulk_sent
+ *
+ * Bulk transmit completion callback for the bulk command.
+ * Called from interrupt context.
+ */
+void cmd_bulk_sent(int result)
+{
+	if(result == RF_BULK_FAIL)
+		print_str("Bulk TX failed\n");
+	else
+		print_str("Bulk TX done\n");
+}
+
+
+/* cmd_bulk_rcvd
+ *
+ * Bulk receive completion callback for the bulk command.
+ * Checks the test pattern sent by "bulk tx".
+ * Called from interrupt context.
+ */
+void cmd_bulk_rcvd(int result)
+{
+	int i;
+	int errors;
+	char s[16];
+
+
+	if(result == RF_BULK_FAIL)
+	{
+		print_str("Bulk RX failed\n");
+		return;
+	}
+
+	errors = 0;
+	for(i=0; i<result; i++)
+	{
+		if(bulk_cmd_buf[i] != (uint8_t)i)
+			errors++;
+	}
+
+	print_str("Bulk RX ");
+	print_str(IntToStr(result, s, 10));
+	print_str(" bytes from ");
+	ByteToHex(s, bulk_rx_addr);
+	print_str(s);
+	print_str(", ");
+	print_str(IntToStr(errors, s, 10));
+	print_str(" pattern errors\n");
+}
+
+
+#define SCAN_BEST		8				// Quietest channels listed
+#define SCAN_PER_LINE	4
+RF_SCAN_CHAN scan_result[RF_N_CHANNELS];
+
+
+/* cmd_scan
+ *
+ * Spectrum survey.  Sweep the channels and show maximum and mean RSSI
+ * (dBm) and occupancy (% of samples at or above the threshold) for
+ * each channel, then the quietest channels.
+ *
+ * Usage:
+ * scan						All channels, threshold -85dBm
+ * scan <first> <last>		Channel range
+ * scan <first> <last> <dBm>	Channel range and threshold
+ */
+void cmd_scan(void)
+{
+	int first;
+	int last;
+	int busy_dbm;
+	int n;
+	int i;
+	int j;
+	int best;
+	uint32_t t0;
+	uint32_t usec;
+	char s[16];
+	char *ptr;
+	uint8_t used[RF_N_CHANNELS];
+
+
+	first = 0;
+	last = RF_N_CHANNELS - 1;
+	busy_dbm = SCAN_BUSY_DBM;
+
+	if(n_args >= 3)
+	{
+		first = strtol(args[1], &ptr, 10);
+		last = strtol(args[2], &ptr, 10);
+	}
+	if(n_args >= 4)
+		busy_dbm = strtol(args[3], &ptr, 10);
+
+	if((fhss_mode != FHSS_OFF) || (tdma_mode != TDMA_OFF) || power_wor)
+	{
+		print_str("FHSS, TDMA and WOR must be off\n");
+		return;
+	}
+
+	t0 = cyc_count();
+
+	if(cc_scan(scan_result, first, last, busy_dbm) < 0)
+	{
+		print_str("Channel range [0-195], radio must be idle\n");
+		return;
+	}
+
+	usec = (cyc_count() - t0) / CYC_PER_USEC;
+
+	n = last - first + 1;
+
+	print_str("ch    max   mean occ");
+	for(i=0; i<n; i++)
+	{
+		if((i % SCAN_PER_LINE) == 0)
+			print_str("\n");
+		else
+			print_str("  |");
+
+		IntToStr(first + i, s, 10);
+		for(j=strlen(s); j<3; j++)
+			print_str(" ");
+		print_str(s);
+		print_str(" ");
+		print_dbm(scan_result[i].rssi_max);
+		print_str(" ");
+		print_dbm(scan_result[i].rssi_mean);
+		print_str(" ");
+		print_str(IntToStr(scan_result[i].busy * 100 / SCAN_SAMPLES, s, 10));
+		print_str("%");
+	}
+
+	// Quietest channels by maximum RSSI
+	for(i=0; i<n; i++)
+		used[i] = 0;
+
+	print_str("\nquietest:");
+	for(j=0; (j<SCAN_BEST) && (j<n); j++)
+	{
+		best = -1;
+		for(i=0; i<n; i++)
+		{
+			if(!used[i] && ((best < 0) || (scan_result[i].rssi_max < scan_result[best].rssi_max)))
+				best = i;
+		}
+		used[best] = 1;
+
+		print_str(" ");
+		print_str(IntToStr(first + best, s, 10));
+	}
+
+	print_str("\n");
+	print_str(IntToStr(n, s, 10));
+	print_str(" channels x ");
+	print_str(IntToStr(SCAN_SAMPLES, s, 10));
+	print_str(" samples in ");
+	print_str(IntToStr(usec / 1000, s, 10));
+	print_str(" ms\n");
+}
+
+
+/* cmd_fault
+ *
+ * Radio fault watchdog statistics.
+ *
+ * Usage:
+ * fault				Show statistics
+ * fault clear			Clear statistics
+ */
+void cmd_fault(void)
+{
+	char s[16];
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "clear") == 0)
+		{
+			cc_fault_clear();
+		}
+		else
+		{
+			print_str("Usage: fault [clear]\n");
+			return;
+		}
+	}
+
+	print_str("RX overflows ");
+	print_str(IntToStr(fault_stats.rx_overflow, s, 10));
+	print_str("  TX underflows ");
+	print_str(IntToStr(fault_stats.tx_underflow, s, 10));
+	print_str("\nrecovered ");
+	print_str(IntToStr(fault_stats.recovered, s, 10));
+	print_str("  failed ");
+	print_str(IntToStr(fault_stats.failed, s, 10));
+	print_str("  packets dropped ");
+	print_str(IntToStr(fault_stats.dropped, s, 10));
+	print_str("\nrecovery ");
+	print_str(IntToStr(fault_stats.rec_usec, s, 10));
+	print_str(" us (max ");
+	print_str(IntToStr(fault_stats.rec_usec_max, s, 10));
+	print_str(" us)\n");
+}
+
+
+/* cmd_loco
+ *
+ * Locomotive control queue.  Updates to a locomotive that hasn't been
+ * sent yet are replaced by the newest value.
+ *
+ * Usage:
+ * loco								Show locomotives and queue statistics
+ * loco <addr> <speed> [func] [flags]	Queue a control record
+ * loco multi on|off					Pack pending locomotives in one frame
+ * loco sel <addr>						Speed adjust mode also controls addr
+ * loco clear							Empty the table
+ * addr, func and flags in hex, speed in decimal [-512 to 512].
+ * A negative speed sets reverse.
+ */
+void cmd_loco(void)
+{
+	long n;
+	int speed;
+	int func;
+	int flags;
+	int i;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 3)
+	{
+		if(strcmp(args[1], "multi") == 0)
+		{
+			loco_multi = (strcmp(args[2], "on") == 0);
+		}
+		else if(strcmp(args[1], "sel") == 0)
+		{
+			n = strtol(args[2], &ptr, 16);
+			if((n < 0) || (n > 0xFF))
+			{
+				print_str("Address range [00-FF]\n");
+				return;
+			}
+			loco_sel = n;
+		}
+		else
+		{
+			speed = strtol(args[2], &ptr, 10);
+			func = 0;
+			flags = 0;
+			if(n_args > 3)
+				func = strtol(args[3], &ptr, 16);
+			if(n_args > 4)
+				flags = strtol(args[4], &ptr, 16);
+
+			if(loco_set(strtol(args[1], &ptr, 16), speed, func, flags) < 0)
+				print_str("Locomotive table full\n");
+			return;
+		}
+	}
+	else if(n_args == 2)
+	{
+		if(strcmp(args[1], "clear") == 0)
+		{
+			loco_clear();
+		}
+		else
+		{
+			print_str("Usage: loco [<addr> <speed> [func] [flags]|multi on|off|sel <addr>|clear]\n");
+			return;
+		}
+	}
+
+	print_str(loco_multi ? "multi-record frames" : "one frame per locomotive");
+	if(loco_sel >= 0)
+	{
+		print_str(", speed adjust controls ");
+		ByteToHex(s, loco_sel);
+		print_str(s);
+	}
+	print_str("\n");
+
+	for(i=0; i<LOCO_MAX; i++)
+	{
+		if(!loco_table[i].used)
+			continue;
+
+		ByteToHex(s, loco_table[i].rec.addr);
+		print_str(s);
+		print_str(" speed ");
+		print_str(IntToStr(loco_table[i].rec.speed, s, 10));
+		print_str(loco_table[i].rec.dir ? " fwd" : " rev");
+		print_str(" func ");
+		ByteToHex(s, loco_table[i].rec.func);
+		print_str(s);
+		print_str(" seq ");
+		print_str(IntToStr(loco_table[i].rec.seq, s, 10));
+		print_str(loco_table[i].pending ? " pending\n" : "\n");
+	}
+
+	print_str("updates ");
+	print_str(IntToStr(loco_stats.updates, s, 10));
+	print_str("  coalesced ");
+	print_str(IntToStr(loco_stats.coalesced, s, 10));
+	print_str("  frames ");
+	print_str(IntToStr(loco_stats.frames, s, 10));
+	print_str("  records ");
+	print_str(IntToStr(loco_stats.records, s, 10));
+	print_str("  table full ");
+	print_str(IntToStr(loco_stats.full, s, 10));
+	print_str("\n");
+}
+
+
+/* cmd_auth
+ *
+ * Control frame authentication.
+ *
+ * Usage:
+ * auth					Mode, key state, statistics and cycle cost
+ * auth on|off			Sign and require tags on control frames
+ * auth key				Enter the key, 32 hex digits, not echoed
+ * auth key clear		Remove the key
+ * auth clear			Clear statistics
+ */
+void cmd_auth(void)
+{
+	char s[16];
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "on") == 0)
+		{
+			if(!auth_key_valid)
+			{
+				print_str("No key\n");
+				return;
+			}
+			auth_mode = AUTH_ON;
+		}
+		else if(strcmp(args[1], "off") == 0)
+		{
+			auth_mode = AUTH_OFF;
+		}
+		else if(strcmp(args[1], "key") == 0)
+		{
+			if((n_args > 2) && (strcmp(args[2], "clear") == 0))
+			{
+				auth_mode = AUTH_OFF;
+				auth_set_key(NULL);
+				return;
+			}
+
+			// The key is typed on the next line, see key_entry()
+			key_index = 0;
+			cmd_mode = CMD_MODE_KEY;
+			print_str("Key (32 hex digits): ");
+			return;
+		}
+		else if(strcmp(args[1], "clear") == 0)
+		{
+			auth_clear();
+		}
+		else
+		{
+			print_str("Usage: auth [on|off|key [clear]|clear]\n");
+			return;
+		}
+	}
+
+	print_str(auth_mode == AUTH_ON ? "auth on" : "auth off");
+	print_str(auth_key_valid ? ", key set" : ", no key");
+	print_str(", tx counter ");
+	print_str(IntToStr(auth_tx_ctr >> AUTH_EPOCH_SHIFT, s, 10));
+	print_str(":");
+	print_str(IntToStr(auth_tx_ctr & AUTH_FRAME_MASK, s, 10));
+	print_str("\n");
+
+	print_str("signed ");
+	print_str(IntToStr(auth_stats.signed_frames, s, 10));
+	print_str("  verified ");
+	print_str(IntToStr(auth_stats.verified, s, 10));
+	print_str("  bad tag ");
+	print_str(IntToStr(auth_stats.bad_mac, s, 10));
+	print_str("  replays ");
+	print_str(IntToStr(auth_stats.replay, s, 10));
+	print_str("  unauthenticated ");
+	print_str(IntToStr(auth_stats.unauth, s, 10));
+	print_str("  epoch errors ");
+	print_str(IntToStr(auth_stats.epoch_err, s, 10));
+
+	print_str("\nsign ");
+	print_str(IntToStr(auth_stats.sign_cyc, s, 10));
+	print_str(" cycles  verify ");
+	print_str(IntToStr(auth_stats.verify_cyc, s, 10));
+	print_str(" cycles (max ");
+	print_str(IntToStr(auth_stats.verify_cyc_max, s, 10));
+	print_str(", ");
+	print_str(IntToStr(auth_stats.verify_cyc_max / CYC_PER_USEC, s, 10));
+	print_str(" us)\n");
+}
+
+
+/* key_entry
+ *
+ * Parameters
+ * c			Character typed
+ *
+ * Collect the authentication key typed after "auth key".  Nothing is
+ * echoed.  Enter sets the key if there were exactly 32 hex digits.
+ * The key text is wiped from the buffer afterwards.
+ */
+void key_entry(uint8_t c)
+{
+	uint8_t key[AUTH_KEY_LEN];
+	uint8_t d;
+	int i;
+
+
+	if(c != '\r')
+	{
+		if(key_index < sizeof(key_buf))
+			key_buf[key_index] = c;
+		key_index++;
+		return;
+	}
+
+	kputc('\n');
+
+	if(key_index == 2 * AUTH_KEY_LEN)
+	{
+		for(i=0; i<2 * AUTH_KEY_LEN; i++)
+		{
+			c = key_buf[i];
+			if((c >= '0') && (c <= '9'))
+				d = c - '0';
+			else if((c >= 'a') && (c <= 'f'))
+				d = c - 'a' + 10;
+			else if((c >= 'A') && (c <= 'F'))
+				d = c - 'A' + 10;
+			else
+				break;
+
+			if(i & 1)
+				key[i / 2] |= d;
+			else
+				key[i / 2] = d << 4;
+		}
+	}
+
+	if((key_index == 2 * AUTH_KEY_LEN) && (i == 2 * AUTH_KEY_LEN))
+	{
+		auth_set_key(key);
+		print_str("Key set\n");
+	}
+	else
+	{
+		print_str("Key must be 32 hex digits\n");
+	}
+
+	memset(key_buf, 0, sizeof(key_buf));
+	memset(key, 0, sizeof(key));
+	key_index = 0;
+
+	cmd_mode = 0;
+	kputc('>');
+}
+
+
+/* cmd_ota
+ *
+ * Over-the-air firmware update.
+ *
+ * Usage:
+ * ota					Update state and statistics
+ * ota send <addr>		Send this firmware to addr (hex)
+ * ota abort			Stop an update
+ */
+void cmd_ota(void)
+{
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 2)
+	{
+		if((strcmp(args[1], "send") == 0) && (n_args >= 3))
+		{
+			if(ota_send(strtol(args[2], &ptr, 16)) < 0)
+			{
+				print_str("Update in progress or ARQ queue full\n");
+				return;
+			}
+		}
+		else if(strcmp(args[1], "abort") == 0)
+		{
+			ota_abort();
+		}
+		else
+		{
+			print_str("Usage: ota [send <addr>|abort]\n");
+			return;
+		}
+	}
+
+	print_str("image ");
+	print_str(IntToStr(ota_image_size(), s, 10));
+	print_str(" bytes, max ");
+	print_str(IntToStr(OTA_MAX_SIZE, s, 10));
+	print_str("\nstate ");
+	print_str(IntToStr(ota_state, s, 10));
+	print_str("  page ");
+	print_str(IntToStr(ota_next, s, 10));
+	print_str(" of ");
+	print_str(IntToStr(ota_n_pages, s, 10));
+	print_str("\npages ");
+	print_str(IntToStr(ota_stats.pages, s, 10));
+	print_str("  resends ");
+	print_str(IntToStr(ota_stats.resends, s, 10));
+	print_str("  bad pages ");
+	print_str(IntToStr(ota_stats.bad_pages, s, 10));
+	print_str("  refused ");
+	print_str(IntToStr(ota_stats.refused, s, 10));
+	print_str("  bad images ");
+	print_str(IntToStr(ota_stats.bad_image, s, 10));
+	print_str("  last update ");
+	print_str(IntToStr(ota_stats.msec, s, 10));
+	print_str(" ms\n");
+}
+
+
+/* print_nsec
+ *
+ * Print a time in nsec as usec with three decimals.
+ */
+void print_nsec(uint32_t nsec)
+{
+	char s[16];
+
+
+	print_str(IntToStr(nsec / 1000, s, 10));
+	print_str(".");
+	s[0] = '0' + (nsec / 100) % 10;
+	s[1] = '0' + (nsec / 10) % 10;
+	s[2] = '0' + nsec % 10;
+	s[3] = 0;
+	print_str(s);
+}
+
+
+/* print_lat
+ *
+ * Parameters
+ * name			Histogram name
+ * h			Histogram
+ *
+ * Print the summary and the non-empty bins of a latency histogram.
+ */
+void print_lat(char *name, LAT_HIST *h)
+{
+	char s[16];
+	int i;
+
+
+	print_str(name);
+	print_str(": ");
+	print_str(IntToStr(h->n, s, 10));
+	print_str(" samples");
+
+	if(h->n == 0)
+	{
+		print_str("\n");
+		return;
+	}
+
+	print_str("  min ");
+	print_nsec(h->min);
+	print_str("  mean ");
+	print_str(IntToStr(h->sum / h->n, s, 10));
+	print_str("  max ");
+	print_nsec(h->max);
+	print_str(" us\n");
+
+	for(i=0; i<LAT_BINS; i++)
+	{
+		if(h->bin[i] == 0)
+			continue;
+
+		print_str("  ");
+		print_str(IntToStr((i == 0) ? 0 : 1UL << i, s, 10));
+		print_str("-");
+		print_str(IntToStr((1UL << (i + 1)) - 1, s, 10));
+		print_str(" us\t");
+		print_str(IntToStr(h->bin[i], s, 10));
+		print_str("\n");
+	}
+}
+
+
+/* cmd_lat
+ *
+ * Latency of acked packets from the TIM3 GDO0 timestamps.
+ *
+ * Usage:
+ * lat					Round trip and one way histograms
+ * lat clear			Clear the histograms
+ */
+void cmd_lat(void)
+{
+	char s[16];
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "clear") == 0)
+		{
+			cc_lat_clear();
+		}
+		else
+		{
+			print_str("Usage: lat [clear]\n");
+			return;
+		}
+	}
+
+	print_lat("Round trip", &lat_rtt);
+	print_lat("One way", &lat_oneway);
+
+	print_str("Edges: sync ");
+	print_str(IntToStr(lat_stats.sync, s, 10));
+	print_str("  end ");
+	print_str(IntToStr(lat_stats.eop, s, 10));
+	print_str("  missed ");
+	print_str(IntToStr(lat_stats.missed, s, 10));
+	print_str("\nAcks without turnaround ");
+	print_str(IntToStr(lat_stats.no_turn, s, 10));
+	print_str("  last turnaround ");
+	print_str(IntToStr(lat_stats.turn, s, 10));
+	print_str(" us  preamble+sync ");
+	print_str(IntToStr(cc_presync_usec(), s, 10));
+	print_str(" us\n");
+}
+
+
+/* cmd_sniff
+ *
+ * Promiscuous capture streamed to the host in binary frames, see
+ * sniff.h.  While sniffing the UART runs at the capture baud rate and
+ * text output is held, so "sniff off" is typed at that rate.
+ *
+ * Usage:
+ * sniff				Capture statistics
+ * sniff on [baud]		Start capture, default 921600 baud
+ * sniff off			Stop, back to text at the old baud rate
+ */
+void cmd_sniff(void)
+{
+	uint32_t baud;
+	char s[16];
+	char *ptr;
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "on") == 0)
+		{
+			baud = (n_args > 2) ? strtol(args[2], &ptr, 10) : SNIFF_BAUD;
+
+			// Text is held once sniffing, so check before the banner
+			if(sniff_active)
+			{
+				print_str("Already sniffing\n");
+				return;
+			}
+			if(sniff_check(baud) < 0)
+			{
+				print_str("Baud range [115200-2000000]\n");
+				return;
+			}
+
+			print_str("Sniffing at ");
+			print_str(IntToStr(baud, s, 10));
+			print_str(" baud\n");
+
+			sniff_start(baud);
+			return;
+		}
+		else if(strcmp(args[1], "off") == 0)
+		{
+			sniff_stop();
+		}
+		else
+		{
+			print_str("Usage: sniff [on [baud]|off]\n");
+			return;
+		}
+	}
+
+	print_str(sniff_active ? "on" : "off");
+	print_str("  frames ");
+	print_str(IntToStr(sniff_stats.frames, s, 10));
+	print_str("  bytes ");
+	print_str(IntToStr(sniff_stats.bytes, s, 10));
+	print_str("  dropped ");
+	print_str(IntToStr(sniff_stats.dropped, s, 10));
+	print_str("  crc_err ");
+	print_str(IntToStr(sniff_stats.crc_err, s, 10));
+	print_str("\nRing max ");
+	print_str(IntToStr(sniff_stats.max_used, s, 10));
+	print_str(" of ");
+	print_str(IntToStr(SNIFF_RING_SIZE, s, 10));
+	print_str(" bytes\n");
+}
+
+
+/* cmd_dual
+ *
+ * Second CC2500 on SPI2, receive only.
+ *
+ * Usage:
+ * dual					Mode and per radio receive counts
+ * dual div				Same channel as radio 0, stronger copy kept
+ * dual listen <chan>	Listen on its own channel
+ * dual off				Radio 1 asleep
+ */
+void cmd_dual(void)
+{
+	uint32_t chan;
+	char s[16];
+	char *ptr;
+	int i;
+
+
+	if(n_args >= 2)
+	{
+		if(strcmp(args[1], "off") == 0)
+		{
+			dual_stop();
+		}
+		else if(strcmp(args[1], "div") == 0)
+		{
+			if(dual_start(DUAL_DIV, 0) < 0)
+			{
+				print_str("No radio on SPI2\n");
+				return;
+			}
+		}
+		else if((strcmp(args[1], "listen") == 0) && (n_args > 2))
+		{
+			chan = strtol(args[2], &ptr, 10);
+			if((chan >= RF_N_CHANNELS) || (dual_start(DUAL_LISTEN, chan) < 0))
+			{
+				print_str("No radio on SPI2, or channel range [0-195]\n");
+				return;
+			}
+		}
+		else
+		{
+			print_str("Usage: dual [off|div|listen <chan>]\n");
+			return;
+		}
+	}
+
+	if(dual_mode == DUAL_OFF)
+		print_str("off");
+	else
+	{
+		print_str((dual_mode == DUAL_DIV) ? "div" : "listen");
+		print_str("  chan ");
+		print_str(IntToStr(dual_chan, s, 10));
+	}
+	print_str("  retunes ");
+	print_str(IntToStr(dual_stats.retunes, s, 10));
+	print_str("  overflow ");
+	print_str(IntToStr(dual_stats.overflow, s, 10));
+	print_str("  len_err ");
+	print_str(IntToStr(dual_stats.len_err, s, 10));
+	print_str("\nradio   heard    only    best\n");
+
+	for(i=0; i<CC_N_DEV; i++)
+	{
+		print_str(IntToStr(i, s, 10));
+		print_str("\t");
+		print_str(IntToStr(div_stats.heard[i], s, 10));
+		print_str("\t");
+		print_str(IntToStr(div_stats.heard[i] - div_stats.dups, s, 10));
+		print_str("\t");
+		print_str(IntToStr(div_stats.best[i], s, 10));
+		print_str("\n");
+	}
+
+	print_str("Heard by both ");
+	print_str(IntToStr(div_stats.dups, s, 10));
+	print_str("\n");
+}
+
+
+/* cmd_txpwr
+ *
+ * Transmit power control.  Shows the power used to each address in the
+ * link table and the signal it last reported in an ack.
+ *
+ * Usage:
+ * txpwr				Mode and level per address
+ * txpwr auto [margin]	Hold the signal margin dB above sensitivity
+ * txpwr fixed <dBm>	All packets at the highest level not above dBm
+ */
+void cmd_txpwr(void)
+{
+	RF_LINK_STATS *link;
+	int margin;
+	int dbm;
+	char s[16];
+	char *ptr;
+	int i;
+
+
+	if((n_args >= 2) && (strcmp(args[1], "auto") == 0))
+	{
+		margin = (n_args > 2) ? strtol(args[2], &ptr, 10) : PA_MARGIN;
+		cc_pa_auto(margin);
+	}
+	else if((n_args > 2) && (strcmp(args[1], "fixed") == 0))
+	{
+		dbm = strtol(args[2], &ptr, 10);
+		for(i=PA_LEVEL_MAX; (i > 0) && (pa_dbm[i] > dbm); i--)
+			;
+		cc_pa_fixed(i);
+	}
+	else if(n_args >= 2)
+	{
+		print_str("Usage: txpwr [auto [margin]|fixed <dBm>]\n");
+		return;
+	}
+
+	if(pa_ctrl.on)
+	{
+		print_str("auto  margin ");
+		print_str(IntToStr(pa_ctrl.margin, s, 10));
+		print_str("dB");
+	}
+	else
+	{
+		print_str("fixed ");
+		print_str(IntToStr(pa_dbm[pa_ctrl.fixed], s, 10));
+		print_str("dBm");
+	}
+	print_str("  up ");
+	print_str(IntToStr(pa_ctrl.up, s, 10));
+	print_str("  down ");
+	print_str(IntToStr(pa_ctrl.down, s, 10));
+	print_str("  missed ");
+	print_str(IntToStr(pa_ctrl.missed, s, 10));
+	print_str("  writes ");
+	print_str(IntToStr(pa_ctrl.writes, s, 10));
+	print_str("\naddr  tx dBm  rx rssi  lqi\n");
+
+	for(i=0; i<link_n_addr; i++)
+	{
+		link = &link_stats[i];
+
+		ByteToHex(s, link->addr);
+		print_str(s);
+		print_str("\t");
+		print_str(IntToStr(pa_dbm[cc_pa_level(link->addr)], s, 10));
+		print_str("\t");
+		if(link->rssi_peer == 0)
+		{
+			print_str("-\t-");			// No signal report yet
+		}
+		else
+		{
+			print_dbm(link->rssi_peer);
+			print_str("\t");
+			print_str(IntToStr(link->lqi_peer, s, 10));
+		}
+		print_str("\n");
+	}
+}
+
+
+/* cmd_estop
+ *
+ * Emergency stop.  The histogram max is the worst case seen.
+ *
+ * Usage:
+ * estop				Worst case press to brake, here and at a loco
+ * estop go [loco]		E-stop as the user button, one loco (hex) or all
+ * estop clear			Clear statistics
+ */
+void cmd_estop(void)
+{
+	uint8_t loco;
+	char s[16];
+	char *ptr;
+
+
+	if((n_args >= 2) && (strcmp(args[1], "go") == 0))
+	{
+		loco = (n_args > 2) ? strtol(args[2], &ptr, 16) : ESTOP_ALL;
+		estop_press(loco);
+	}
+	else if((n_args >= 2) && (strcmp(args[1], "clear") == 0))
+	{
+		estop_clear();
+	}
+	else if(n_args >= 2)
+	{
+		print_str("Usage: estop [go [loco]|clear]\n");
+		return;
+	}
+
+	print_lat("Press to brake", &estop_brake);
+	print_lat("Press to TX FIFO", &estop_load);
+	print_lat("Press to brake at loco", &estop_recv);
+
+	print_str("Presses ");
+	print_str(IntToStr(estop_stats.presses, s, 10));
+	print_str("  bounces ");
+	print_str(IntToStr(estop_stats.bounces, s, 10));
+	print_str("  copies sent ");
+	print_str(IntToStr(tx_stats.urgent, s, 10));
+	print_str("  packets preempted ");
+	print_str(IntToStr(tx_stats.preempted, s, 10));
+	print_str("\nReceived ");
+	print_str(IntToStr(estop_stats.rx, s, 10));
+	print_str("  copies ");
+	print_str(IntToStr(estop_stats.rx_copies, s, 10));
+	print_str("  missed before first ");
+	print_str(IntToStr(estop_stats.rx_missed, s, 10));
+	print_str("  other loco ");
+	print_str(IntToStr(estop_stats.rx_other, s, 10));
+	print_str("\n");
 }
@@ -0,0 +1,167 @@
+/*
+ * ctrl_frame.c
+ *
+ * Bit-packed locomotive control frames.
+ *
+ * A control record packs address, speed, direction, functions, sequence
+ * number and flags into 4 bytes, where an ASCII command string takes 10
+ * or more.  Each byte saved is 3.3ms on air at 2.4kBaud.  Several
+ * locomotives can share one frame behind a single header byte.
+ *
+ * No hardware access, only types.h, so the codec builds on a host.
+ *
+ */
+
+#include "types.h"
+#include "ctrl_frame.h"
+
+
+
+/* ctrl_pack
+ *
+ * Parameters
+ * rec			Record
+ *
+ * Returns
+ * Record as a 32 bit word.  Speed is clamped to the 10 bit range.
+ */
+uint32_t ctrl_pack(CTRL_REC *rec)
+{
+	uint32_t w;
+	int speed;
+
+
+	speed = rec->speed;
+	if(speed > CTRL_SPEED_MAX)
+		speed = CTRL_SPEED_MAX;
+	if(speed < CTRL_SPEED_MIN)
+		speed = CTRL_SPEED_MIN;
+
+	w = (uint32_t)rec->addr << 24;
+	w |= ((uint32_t)speed & 0x3FF) << 14;
+	w |= (uint32_t)(rec->dir ? 1 : 0) << 13;
+	w |= (uint32_t)(rec->func & CTRL_FUNC_MASK) << 8;
+	w |= (uint32_t)(rec->seq & CTRL_SEQ_MASK) << 4;
+	w |= (uint32_t)(rec->flags & CTRL_FLAGS_MASK);
+
+	return w;
+}
+
+
+/* ctrl_unpack
+ *
+ * Parameters
+ * w			Record as a 32 bit word
+ * rec			Decoded record
+ */
+void ctrl_unpack(uint32_t w, CTRL_REC *rec)
+{
+	int speed;
+
+
+	// Sign extend the 10 bit speed
+	speed = (w >> 14) & 0x3FF;
+	if(speed & 0x200)
+		speed -= 0x400;
+
+	rec->addr = (uint8_t)(w >> 24);
+	rec->speed = speed;
+	rec->dir = (w >> 13) & 1;
+	rec->func = (w >> 8) & CTRL_FUNC_MASK;
+	rec->seq = (w >> 4) & CTRL_SEQ_MASK;
+	rec->flags = w & CTRL_FLAGS_MASK;
+}
+
+
+/* ctrl_encode
+ *
+ * Parameters
+ * buf			Frame buffer
+ * max			Buffer size
+ * rec			Records
+ * n			No. of records [1-CTRL_MAX_RECS]
+ *
+ * Returns
+ * Frame length, or -1 if n is out of range or the buffer is too short.
+ */
+int ctrl_encode(uint8_t *buf, int max, CTRL_REC *rec, int n)
+{
+	uint32_t w;
+	int i;
+
+
+	if((n < 1) || (n > CTRL_MAX_RECS) || (CTRL_FRAME_LEN(n) > max))
+		return -1;
+
+	*buf++ = CTRL_FRAME | (n - 1);
+
+	for(i=0; i<n; i++)
+	{
+		w = ctrl_pack(&rec[i]);
+
+		*buf++ = (uint8_t)(w >> 24);
+		*buf++ = (uint8_t)(w >> 16);
+		*buf++ = (uint8_t)(w >> 8);
+		*buf++ = (uint8_t)w;
+	}
+
+	return CTRL_FRAME_LEN(n);
+}
+
+
+/* ctrl_decode
+ *
+ * Parameters
+ * buf			Frame
+ * len			Frame length
+ * rec			Decoded records
+ * max			Size of rec
+ *
+ * Returns
+ * No. of records, or -1 if the frame is not a control frame, its
+ * length doesn't match the header or there are more than max records.
+ */
+int ctrl_decode(uint8_t *buf, int len, CTRL_REC *rec, int max)
+{
+	uint32_t w;
+	int n;
+	int i;
+
+
+	if(!ctrl_is_frame(buf, len))
+		return -1;
+
+	n = (buf[0] & ~CTRL_FRAME_MASK) + 1;
+	if(n > max)
+		return -1;
+
+	buf += CTRL_HDR_LEN;
+
+	for(i=0; i<n; i++, buf += CTRL_REC_LEN)
+	{
+		w = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+			((uint32_t)buf[2] << 8) | buf[3];
+
+		ctrl_unpack(w, &rec[i]);
+	}
+
+	return n;
+}
+
+
+/* ctrl_is_frame
+ *
+ * Parameters
+ * buf			Packet data
+ * len			Packet data length
+ *
+ * Returns
+ * 1 if the data is a control frame of the right length, 0 if not.
+ */
+int ctrl_is_frame(uint8_t *buf, int len)
+{
+	if((len < CTRL_FRAME_LEN(1)) || ((buf[0] & CTRL_FRAME_MASK) != CTRL_FRAME))
+		return 0;
+
+	return (len == CTRL_FRAME_LEN((buf[0] & ~CTRL_FRAME_MASK) + 1));
+}
@@ -0,0 +1,62 @@
+/*
+ * ctrl_frame.h
+ *
+ * Bit-packed locomotive control frames.
+ *
+ * Only depends on types.h so it can be built and checked on a host.
+ *
+ */
+
+#ifndef CTRL_FRAME_H_
+#define CTRL_FRAME_H_
+
+#include "types.h"
+
+
+// Frame
+// [HDR][RECORD]...
+// HDR bits [7-4] CTRL_FRAME, bits [3-0] no. of records - 1
+//
+// Record, 32 bits sent MSB first
+// [31-24]	Locomotive address
+// [23-14]	Speed, 10 bit two's complement, -512 to 511
+// [13]		Direction, 1 = forward.  Kept at speed 0.
+// [12-8]	Function bits F0-F4
+// [7-4]	Sequence number
+// [3-0]	Flags
+#define CTRL_FRAME			0xC0		// First data byte, upper nibble
+#define CTRL_FRAME_MASK		0xF0
+#define CTRL_HDR_LEN		1
+#define CTRL_REC_LEN		4
+#define CTRL_MAX_RECS		16
+#define CTRL_FRAME_LEN(n)	(CTRL_HDR_LEN + (n) * CTRL_REC_LEN)
+
+// Field limits
+#define CTRL_SPEED_MAX		511			// pwm.c range is +/-512, +512 is sent as 511
+#define CTRL_SPEED_MIN		-512
+#define CTRL_FUNC_MASK		0x1F
+#define CTRL_SEQ_MASK		0x0F
+#define CTRL_FLAGS_MASK		0x0F
+
+// Flags
+#define CTRL_F_ESTOP		0x01		// Emergency stop
+#define CTRL_F_ACK			0x02		// Acknowledge requested
+#define CTRL_F_RAMP			0x04		// Ramp to the new speed
+
+// Decoded record
+typedef struct {
+	uint8_t addr;
+	int speed;
+	uint8_t dir;
+	uint8_t func;
+	uint8_t seq;
+	uint8_t flags;
+} CTRL_REC;
+
+
+int ctrl_encode(uint8_t *buf, int max, CTRL_REC *rec, int n);
+int ctrl_decode(uint8_t *buf, int len, CTRL_REC *rec, int max);
+int ctrl_is_frame(uint8_t *buf, int len);
+
+
+#endif /* CTRL_FRAME_H_ */
@@ -0,0 +1,297 @@
+/*
+ * dual.c
+ *
+ * Second CC2500 on SPI2, receive only.
+ *
+ * Radio 1 gets radio 0's register image, so it uses the same data
+ * rate, sync word and address filter.  Its packets go into the same
+ * receive queue as radio 0's, through cc_rx_queue_put().
+ *
+ * DUAL_DIV is receive diversity.  Radio 1 follows radio 0's channel,
+ * including hops, and a packet heard by both is queued once with the
+ * stronger copy's RSSI.  A packet missed by one antenna is still
+ * received by the other.
+ *
+ * DUAL_LISTEN keeps radio 1 on its own channel, so uplink telemetry is
+ * received while radio 0 is sending commands.  Acks for packets heard
+ * by radio 1 are sent by radio 0 on its channel, so telemetry in this
+ * mode should not ask for acks.
+ *
+ * Radio 1 is polled, SPI1 DMA is kept for radio 0.  The GDO0 interrupt
+ * is at CC_IRQ_PRIORITY, so it doesn't preempt radio 0's handlers.
+ *
+ */
+
+#include <string.h>
+#include "stm32f103xb.h"
+#include "gpio.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "dual.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+#define DUAL_GDO0_ACTIVE()	(GPIOB->IDR & (1 << DUAL_GDO0_PIN))
+
+
+uint8_t dual_mode;						// DUAL_OFF, DUAL_DIV, DUAL_LISTEN
+uint8_t dual_chan;						// Radio 1 channel
+DUAL_STATS dual_stats;
+
+// RX FIFO staging buffer, as radio 0's
+uint8_t dual_buf[2*CC_FIFO_SIZE];
+uint8_t dual_buf_n;
+
+
+void dual_rx(void);
+void dual_parse(void);
+void dual_flush(void);
+
+
+
+/* dual_start
+ *
+ * Parameters
+ * mode			DUAL_DIV or DUAL_LISTEN, DUAL_OFF to stop.
+ * chan			Channel for DUAL_LISTEN
+ *
+ * Returns
+ * 0, or -1 if the channel is out of range or there is no CC2500 on
+ * SPI2.
+ *
+ * Reset radio 1, load radio 0's registers and start RX.  Radio 0
+ * must have been configured.
+ */
+int dual_start(uint8_t mode, uint8_t chan)
+{
+	uint8_t regs[N_CONFIG_REGS];
+	uint32_t key;
+	int i;
+
+
+	dual_stop();
+
+	if(mode == DUAL_OFF)
+		return 0;
+
+	if(chan >= RF_N_CHANNELS)
+		return -1;
+
+	key = cc_lock();
+
+	cc_dev_write_cmd(CC_DEV1, SRES);
+	CC_DEV1->sleeping = 1;						// Wait for SO low on the next access
+
+	if(cc_dev_read_status(CC_DEV1, PARTNUM) != CC2500_PARTNUM)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	for(i=0; i<N_CONFIG_REGS; i++)
+		regs[i] = cc_reg_get(i);
+
+	if(mode == DUAL_DIV)
+		chan = regs[CHANNR];
+
+	regs[IOCFG2] = GDO_HI_Z;
+	regs[IOCFG0] = GDO_SYNC_EOP;
+	regs[CHANNR] = chan;
+	regs[PKTCTRL1] |= PKTCTRL1_APPEND_STATUS;
+	regs[MCSM2] |= MCSM2_RX_TIME;				// No RX timeout
+	regs[MCSM1] |= MCSM1_RXOFF_RX;
+	regs[MCSM0] = (regs[MCSM0] & ~MCSM0_FS_AUTOCAL) | FS_AUTOCAL_FROM_IDLE;
+	cc_dev_write_b(CC_DEV1, IOCFG2, regs, N_CONFIG_REGS);
+
+	// GDO0 end of packet interrupt
+	AFIO->EXTICR[1] &= ~AFIO_EXTICR2_EXTI5;
+	AFIO->EXTICR[1] |= AFIO_EXTICR2_EXTI5_PB;		// EXTI5 source is PB5
+	EXTI->RTSR &= ~EXTI_RTSR_TR5;
+	EXTI->FTSR |= EXTI_FTSR_TR5;
+	EXTI->PR = EXTI_PR_PR5;
+	EXTI->IMR |= EXTI_IMR_MR5;
+
+	dual_buf_n = 0;
+	dual_chan = chan;
+	dual_mode = mode;
+	cc_dev_write_cmd(CC_DEV1, SRX);				// Calibrates first
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* dual_stop
+ *
+ * Put radio 1 to sleep.
+ */
+void dual_stop(void)
+{
+	uint32_t key;
+
+
+	if(dual_mode == DUAL_OFF)
+		return;
+
+	key = cc_lock();
+
+	EXTI->IMR &= ~EXTI_IMR_MR5;
+	cc_dev_write_cmd(CC_DEV1, SIDLE);
+	cc_dev_write_cmd(CC_DEV1, SPWD);
+	CC_DEV1->sleeping = 1;
+	dual_mode = DUAL_OFF;
+
+	cc_unlock(key);
+}
+
+
+/* dual_tick
+ *
+ * Called every 1msec from the main loop.  In DUAL_DIV, retune radio 1
+ * when radio 0 has changed channel.  The hop scheduler changes
+ * channel from the TIM2 interrupt, so radio 1 is up to 1msec late,
+ * plus calibration.
+ */
+void dual_tick(void)
+{
+	uint32_t key;
+	uint8_t chan;
+
+
+	if(dual_mode != DUAL_DIV)
+		return;
+
+	key = cc_lock();
+
+	chan = cc_reg_get(CHANNR);
+	if(chan != dual_chan)
+	{
+		cc_dev_write_cmd(CC_DEV1, SIDLE);
+		cc_dev_write(CC_DEV1, CHANNR, chan);
+		cc_dev_write_cmd(CC_DEV1, SFRX);
+		cc_dev_write_cmd(CC_DEV1, SRX);
+
+		dual_buf_n = 0;
+		dual_chan = chan;
+		dual_stats.retunes++;
+	}
+
+	cc_unlock(key);
+}
+
+
+/* dual_rx
+ *
+ * Drain the radio 1 RX FIFO.  While a packet is being received the
+ * last byte is left in the FIFO (errata), as cc_rx_avail().
+ */
+void dual_rx(void)
+{
+	uint8_t rxbytes;
+	uint8_t last;
+	int n;
+
+
+	rxbytes = cc_dev_read_status(CC_DEV1, RXBYTES);
+	do
+	{
+		last = rxbytes;
+		rxbytes = cc_dev_read_status(CC_DEV1, RXBYTES);
+	} while(rxbytes != last);
+
+	if(rxbytes & FIFO_OVERFLOW)
+	{
+		dual_stats.overflow++;
+		dual_flush();
+		return;
+	}
+
+	n = rxbytes & FIFO_NUM_BYTES;
+	if(DUAL_GDO0_ACTIVE() && (n > 0))
+		n--;
+
+	if(n > (int)(sizeof(dual_buf) - dual_buf_n))
+		n = sizeof(dual_buf) - dual_buf_n;
+
+	if(n == 0)
+		return;
+
+	cc_dev_read_fifo(CC_DEV1, dual_buf + dual_buf_n, n);
+	dual_buf_n += n;
+
+	dual_parse();
+}
+
+
+/* dual_parse
+ *
+ * Split the staging buffer into packets, as cc_rx_parse(), and queue
+ * them from radio 1.
+ */
+void dual_parse(void)
+{
+	uint8_t *p;
+	uint8_t len;
+	int remain;
+
+
+	p = dual_buf;
+	remain = dual_buf_n;
+
+	while(remain > 0)
+	{
+		len = p[0];
+
+		if((len < 1) || (len > RF_MAX_LEN))
+		{
+			dual_stats.len_err++;
+			dual_flush();
+			return;
+		}
+
+		if(remain < (len + 3))			// LEN byte + packet + RSSI + LQI
+			break;
+
+		cc_rx_queue_put(p, 1);
+
+		p += len + 3;
+		remain -= len + 3;
+	}
+
+	memmove(dual_buf, p, remain);
+	dual_buf_n = remain;
+}
+
+
+/* dual_flush
+ *
+ * Flush the radio 1 RX FIFO and staging buffer and restart RX.
+ */
+void dual_flush(void)
+{
+	cc_dev_write_cmd(CC_DEV1, SIDLE);
+	cc_dev_write_cmd(CC_DEV1, SFRX);
+	cc_dev_write_cmd(CC_DEV1, SRX);
+	dual_buf_n = 0;
+}
+
+
+/* EXTI9_5 Interrupt Handler
+ *
+ * Radio 1 GDO0 falling edge, end of packet.
+ * Must be at CC_IRQ_PRIORITY.
+ */
+void __attribute__((interrupt("IRQ")))EXTI9_5_IRQHandler(void)
+{
+	EXTI->PR = EXTI_PR_PR5;				// Clear pending flag (write 1).
+
+	if(dual_mode == DUAL_OFF)
+		return;
+
+	dual_stats.eop++;
+	dual_rx();
+}
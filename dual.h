@@ -0,0 +1,39 @@
+/*
+ * dual.h
+ *
+ * Second CC2500 on SPI2, receive only.
+ *
+ */
+
+#ifndef DUAL_H_
+#define DUAL_H_
+
+#include "types.h"
+#include "cc_hal.h"
+
+
+// Modes
+#define DUAL_OFF		0				// Radio 1 asleep
+#define DUAL_DIV		1				// Follows radio 0's channel, stronger copy kept
+#define DUAL_LISTEN		2				// Own channel, radio 0 is free to transmit
+
+// Radio 1 GDO0 on PB5 (EXTI5), end of packet
+#define DUAL_GDO0_PIN	5
+
+typedef struct {
+	uint32_t eop;						// End of packet interrupts
+	uint32_t overflow;					// RX FIFO overflows
+	uint32_t len_err;					// Invalid length byte, FIFO flushed
+	uint32_t retunes;					// Channel changes to follow radio 0
+} DUAL_STATS;
+
+extern uint8_t dual_mode;
+extern uint8_t dual_chan;
+extern DUAL_STATS dual_stats;
+
+
+int dual_start(uint8_t mode, uint8_t chan);
+void dual_stop(void);
+void dual_tick(void);
+
+#endif /* DUAL_H_ */
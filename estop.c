@@ -0,0 +1,256 @@
+/*
+ * estop.c
+ *
+ * Emergency stop from the user button or the radio.
+ *
+ * The text CLI and the main loop are not on the path.  A press of the
+ * user button brakes the motor from the EXTI interrupt, which runs
+ * above CC_IRQ_PRIORITY so a radio access in progress doesn't delay
+ * it.  The interrupt then pends a software interrupt at
+ * CC_IRQ_PRIORITY that broadcasts ESTOP_REPS copies of an e-stop frame
+ * with cc_send_urgent(), ahead of the transmit queue and acks.
+ *
+ * A node receiving an e-stop frame for itself or for all brakes its
+ * motor from the radio interrupt, through the cc_rx_fast hook.
+ *
+ * Timing:
+ * estop_brake		Press to PWM brake on this node, from the EXTI
+ *					interrupt entry.  A press while the MCU is in STOP
+ *					adds the wake-up time shown by the power command.
+ * estop_load		Press to the first copy written to the TX FIFO.
+ * estop_recv		Press at the sender to PWM brake at the receiver.
+ *					The sender's AGE in the frame, plus the TX start and
+ *					preamble and sync word air time, plus the time from
+ *					the sync word captured by TIM3 to the brake here.
+ * The histograms keep the worst case as their max.
+ *
+ * E-stop frames are acted on without authentication.  A forged one can
+ * only stop trains, which jamming the channel does anyway, and signing
+ * would put SipHash and the frame counter on the interrupt path.
+ *
+ */
+
+#include <string.h>
+#include "stm32f103xb.h"
+#include "timer.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "pwm.h"
+#include "estop.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+ESTOP_STATS estop_stats;
+LAT_HIST estop_brake;
+LAT_HIST estop_load;
+LAT_HIST estop_recv;
+
+// Last press
+volatile uint32_t estop_t0;				// cyc_count() at the press
+volatile uint8_t estop_loco;			// Locomotive to stop, ESTOP_ALL for all
+volatile uint8_t estop_seq;				// E-stop number
+
+// Last e-stop received
+uint8_t estop_rx_seq;
+uint8_t estop_rx_valid;
+
+
+void estop_start(uint32_t t0, uint8_t loco);
+int estop_build(uint8_t *frame, int rep);
+int estop_rx(uint8_t *p, uint32_t time);
+
+
+
+/* estop_init
+ *
+ * Button interrupt on the PC13 falling edge, and the receive hook.
+ * The NVIC priorities are set in main().
+ */
+void estop_init(void)
+{
+	AFIO->EXTICR[3] &= ~AFIO_EXTICR4_EXTI13;
+	AFIO->EXTICR[3] |= AFIO_EXTICR4_EXTI13_PC;		// EXTI13 source is PC13
+	EXTI->RTSR &= ~EXTI_RTSR_TR13;
+	EXTI->FTSR |= EXTI_FTSR_TR13;					// Pressed
+	EXTI->PR = EXTI_PR_PR13;
+	EXTI->IMR |= EXTI_IMR_MR13;
+
+	cc_rx_fast = estop_rx;
+}
+
+
+/* estop_press
+ *
+ * Parameters
+ * loco			Locomotive to stop, ESTOP_ALL for all
+ *
+ * E-stop as if the button had been pressed.
+ */
+void estop_press(uint8_t loco)
+{
+	estop_start(cyc_count(), loco);
+}
+
+
+/* estop_start
+ *
+ * Parameters
+ * t0			cyc_count() at the press
+ * loco			Locomotive to stop
+ *
+ * Brake this node's motor and pend the radio side.
+ */
+void estop_start(uint32_t t0, uint8_t loco)
+{
+	pwm_brake();
+	cc_lat_add(&estop_brake, cyc_count() - t0);
+
+	estop_t0 = t0;
+	estop_loco = loco;
+	estop_seq++;
+	estop_stats.presses++;
+
+	NVIC_SetPendingIRQ(ESTOP_SWI_IRQn);
+}
+
+
+/* estop_build
+ *
+ * Parameters
+ * frame		Packet buffer, [LEN][ADDR][DATA...]
+ * rep			Copies still to send, this one included
+ *
+ * Returns
+ * Packet length.
+ *
+ * Called by the transmitter just before each copy goes into the
+ * TX FIFO, so the age is up to date.
+ */
+int estop_build(uint8_t *frame, int rep)
+{
+	uint32_t cyc;
+	uint32_t age;
+
+
+	cyc = cyc_count() - estop_t0;
+	if(rep == ESTOP_REPS)
+		cc_lat_add(&estop_load, cyc);
+
+	age = cyc / CYC_PER_USEC;
+	if(age > 0xFFFF)
+		age = 0xFFFF;
+
+	frame[0] = ESTOP_LEN + 1;
+	frame[1] = ESTOP_ADDR;
+	frame[2] = ESTOP_FRAME;
+	frame[3] = estop_loco;
+	frame[4] = estop_seq;
+	frame[5] = rep - 1;
+	frame[6] = (uint8_t)age;
+	frame[7] = (uint8_t)(age >> 8);
+
+	return ESTOP_LEN + 2;
+}
+
+
+/* estop_rx
+ *
+ * Parameters
+ * p			Received packet [LEN][ADDR][DATA...][RSSI][LQI]
+ * time			cyc_count() at its sync word
+ *
+ * Returns
+ * 1 if the packet was an e-stop frame, 0 if not.
+ *
+ * Called from the radio interrupt for every good packet.  Every copy
+ * for this locomotive brakes, the first copy of each e-stop is timed.
+ */
+int estop_rx(uint8_t *p, uint32_t time)
+{
+	uint32_t now;
+	uint32_t usec;
+
+
+	if((p[0] != ESTOP_LEN + 1) || (p[2] != ESTOP_FRAME))
+		return 0;
+
+	estop_stats.rx_copies++;
+
+	if((p[3] != ESTOP_ALL) && (p[3] != cc_reg_get(ADDR)))
+	{
+		estop_stats.rx_other++;
+		return 1;
+	}
+
+	pwm_brake();
+	now = cyc_count();
+
+	if(estop_rx_valid && (p[4] == estop_rx_seq))
+		return 1;
+
+	estop_rx_seq = p[4];
+	estop_rx_valid = 1;
+	estop_stats.rx++;
+	if(p[5] < ESTOP_REPS)
+		estop_stats.rx_missed += ESTOP_REPS - 1 - p[5];
+
+	usec = (p[6] | (p[7] << 8)) + ESTOP_TX_START_USEC + cc_presync_usec();
+	cc_lat_add(&estop_recv, usec * CYC_PER_USEC + (now - time));
+
+	return 1;
+}
+
+
+/* estop_clear
+ *
+ * Clear the statistics and histograms.
+ */
+void estop_clear(void)
+{
+	__disable_irq();					// The button interrupt is above cc_lock()
+
+	memset(&estop_stats, 0, sizeof(estop_stats));
+	memset(&estop_brake, 0, sizeof(estop_brake));
+	memset(&estop_load, 0, sizeof(estop_load));
+	memset(&estop_recv, 0, sizeof(estop_recv));
+
+	__enable_irq();
+}
+
+
+/* EXTI15_10 Interrupt Handler
+ *
+ * User button pressed.
+ */
+void __attribute__((interrupt("IRQ")))EXTI15_10_IRQHandler(void)
+{
+	uint32_t t0;
+
+
+	t0 = cyc_count();
+
+	EXTI->PR = EXTI_PR_PR13;			// Clear pending flag (write 1).
+
+	if((estop_stats.presses > 0) &&
+		((t0 - estop_t0) < ESTOP_HOLDOFF_MSEC * 1000UL * CYC_PER_USEC))
+	{
+		estop_stats.bounces++;
+		return;
+	}
+
+	estop_start(t0, ESTOP_ALL);
+}
+
+
+/* EXTI2 Interrupt Handler
+ *
+ * ESTOP_SWI_IRQn, pended by estop_start().  Broadcast the e-stop.
+ */
+void __attribute__((interrupt("IRQ")))EXTI2_IRQHandler(void)
+{
+	cc_send_urgent(ESTOP_REPS, estop_build);
+}
@@ -0,0 +1,56 @@
+/*
+ * estop.h
+ *
+ * Emergency stop from the user button or the radio.
+ *
+ */
+
+#ifndef ESTOP_H_
+#define ESTOP_H_
+
+#include "types.h"
+#include "cc_hal.h"
+
+
+// E-stop frame, broadcast
+// [ESTOP_FRAME][LOCO][SEQ][REP][AGE_L][AGE_H]
+// LOCO is the locomotive to stop, ESTOP_ALL for all of them.  SEQ
+// counts e-stops, REP is the no. of copies still to come after this
+// one.  AGE is the time from the press to this copy being written to
+// the TX FIFO (usec), so a locomotive can time the whole path.
+#define ESTOP_FRAME			0xB7		// First data byte
+#define ESTOP_LEN			6
+#define ESTOP_ADDR			0x00		// Broadcast
+#define ESTOP_ALL			0x00
+#define ESTOP_REPS			5			// Copies sent back to back
+#define ESTOP_HOLDOFF_MSEC	200			// Presses ignored, contact bounce
+#define ESTOP_TX_START_USEC	90			// IDLE to TX, synthesizer settling
+
+// User button on PC13 (EXTI13), low when pressed.
+// The button interrupt is above CC_IRQ_PRIORITY so cc_lock() doesn't
+// hold off the brake.  It pends ESTOP_SWI_IRQn, an unused EXTI line at
+// CC_IRQ_PRIORITY, to send the e-stop frames.
+#define ESTOP_PIN			13
+#define ESTOP_IRQ_PRIORITY	0
+#define ESTOP_SWI_IRQn		EXTI2_IRQn
+
+typedef struct {
+	uint32_t presses;					// Button presses and estop commands
+	uint32_t bounces;					// Presses ignored in the holdoff
+	uint32_t rx;						// E-stops received for this locomotive
+	uint32_t rx_copies;					// Frame copies received
+	uint32_t rx_missed;					// Copies lost before the first one heard
+	uint32_t rx_other;					// Copies for another locomotive
+} ESTOP_STATS;
+
+extern ESTOP_STATS estop_stats;
+extern LAT_HIST estop_brake;			// Press to PWM brake, this node
+extern LAT_HIST estop_load;				// Press to the first copy in the TX FIFO
+extern LAT_HIST estop_recv;				// Press at the sender to PWM brake here
+
+
+void estop_init(void);
+void estop_press(uint8_t loco);
+void estop_clear(void);
+
+#endif /* ESTOP_H_ */
@@ -0,0 +1,318 @@
+/*
+ * fhss.c
+ *
+ * Frequency hopping scheduler.
+ *
+ * The radio hops CHANNR on a pseudo-random sequence of channels.  The
+ * sequence is made from a seed, so all nodes with the same seed, slot
+ * length and channel count hop together.  Slots are timed from the
+ * TIM2 1msec interrupt.
+ *
+ * The master (base station) sends a beacon at the start of each slot
+ * with the hop number.  Slaves (locomotives) keep hopping on their own
+ * timer and correct the hop number and slot timing from each beacon.
+ *
+ * A slave that misses FHSS_LOST_SLOTS beacons in a row is out of sync.
+ * It stops on the channel the master is due on next, and normally
+ * rejoins on the next beacon.  If the master has moved on (restart,
+ * new hop number) it still visits that channel once per cycle, so the
+ * worst case is FHSS_LOST_SLOTS slots plus one cycle.  If the channel
+ * is jammed, the slave moves to the next channel in the sequence after
+ * each cycle with no beacon.
+ *
+ */
+
+#include "stm32f103xb.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "fhss.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+FHSS_CONFIG fhss_config = {FHSS_SEED, FHSS_SLOT_MSEC, FHSS_N_CHAN};
+FHSS_STATS fhss_stats;
+
+uint8_t fhss_mode;						// FHSS_OFF, FHSS_MASTER, FHSS_SLAVE
+uint8_t fhss_synced;					// Slave is following the master
+uint8_t fhss_hop;						// Position in the hop sequence
+uint8_t fhss_seq[FHSS_MAX_CHAN];		// Channel for each hop
+
+uint16_t fhss_slot_timer;				// msec since the start of the slot
+uint16_t fhss_missed;					// Slots since the last beacon
+uint8_t fhss_late;						// msec the hop has been delayed
+uint32_t fhss_rand_state;
+
+
+void fhss_build_seq(void);
+uint32_t fhss_rand(void);
+void fhss_beacon(void);
+
+
+
+/* fhss_rand
+ *
+ * Returns
+ * Next pseudo-random number (xorshift32).
+ */
+uint32_t fhss_rand(void)
+{
+	uint32_t x;
+
+
+	x = fhss_rand_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	fhss_rand_state = x;
+
+	return x;
+}
+
+
+/* fhss_build_seq
+ *
+ * Make the hop sequence from the seed.
+ *
+ * The channels are spread evenly over the band and shuffled, so each
+ * channel is used once per cycle.
+ */
+void fhss_build_seq(void)
+{
+	int i;
+	int j;
+	uint8_t step;
+	uint8_t tmp;
+
+
+	step = RF_N_CHANNELS / fhss_config.n_chan;
+
+	for(i=0; i<fhss_config.n_chan; i++)
+		fhss_seq[i] = i * step;
+
+	// Seed 0 would lock the generator at 0
+	fhss_rand_state = 0x9E370000UL | fhss_config.seed;
+
+	// Fisher-Yates shuffle
+	for(i=fhss_config.n_chan - 1; i>0; i--)
+	{
+		j = fhss_rand() % (i + 1);
+		tmp = fhss_seq[i];
+		fhss_seq[i] = fhss_seq[j];
+		fhss_seq[j] = tmp;
+	}
+}
+
+
+/* fhss_start
+ *
+ * Parameters
+ * mode			FHSS_MASTER or FHSS_SLAVE
+ * config		Hop sequence settings, NULL to keep the current settings
+ *
+ * Returns
+ * 0 on success, -1 if the settings are out of range.
+ *
+ * Start hopping from the first channel of the sequence.
+ * The master is in sync at once, a slave waits for a beacon on the
+ * first channel.
+ */
+int fhss_start(uint8_t mode, FHSS_CONFIG *config)
+{
+	uint32_t key;
+
+
+	if((mode != FHSS_MASTER) && (mode != FHSS_SLAVE))
+		return -1;
+
+	if(config != NULL)
+	{
+		if((config->n_chan < FHSS_MIN_CHAN) || (config->n_chan > FHSS_MAX_CHAN))
+			return -1;
+
+		if((config->slot_msec < FHSS_MIN_SLOT) || (config->slot_msec > FHSS_MAX_SLOT))
+			return -1;
+	}
+
+	// Stop the scheduler in the TIM2 interrupt while it is set up
+	key = cc_lock();
+
+	if(config != NULL)
+		fhss_config = *config;
+
+	fhss_build_seq();
+
+	fhss_hop = 0;
+	fhss_slot_timer = 0;
+	fhss_missed = 0;
+	fhss_late = 0;
+	fhss_synced = (mode == FHSS_MASTER);
+	fhss_mode = mode;
+
+	cc_set_channel(fhss_seq[0]);
+
+	if(mode == FHSS_MASTER)
+		fhss_beacon();
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* fhss_stop
+ *
+ * Stop hopping.  The radio stays on the current channel.
+ */
+void fhss_stop(void)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+	fhss_mode = FHSS_OFF;
+	fhss_synced = 0;
+	cc_unlock(key);
+}
+
+
+/* fhss_beacon
+ *
+ * Queue the beacon for the current hop.
+ * If the transmit queue is full the beacon is skipped.
+ */
+void fhss_beacon(void)
+{
+	uint8_t beacon[FHSS_BEACON_LEN];
+
+
+	beacon[0] = FHSS_BEACON;
+	beacon[1] = fhss_hop;
+	beacon[2] = (uint8_t)fhss_config.seed;
+	beacon[3] = (uint8_t)(fhss_config.seed >> 8);
+
+	if(cc_send_pkt(FHSS_BEACON_ADDR, beacon, FHSS_BEACON_LEN, NULL) == 0)
+		fhss_stats.beacons++;
+}
+
+
+/* fhss_tick
+ *
+ * Hop scheduler, called from the TIM2 interrupt every 1msec.
+ * TIM2 must be at CC_IRQ_PRIORITY.
+ *
+ * At the end of a slot the radio moves to the next channel.  A packet
+ * on air, sent or being received, delays the hop by up to
+ * FHSS_GUARD_MSEC.  The next slot is still timed from the slot
+ * boundary, so delays don't add up.
+ */
+void fhss_tick(void)
+{
+	if(fhss_mode == FHSS_OFF)
+		return;
+
+	if(++fhss_slot_timer < fhss_config.slot_msec)
+		return;
+
+	// Don't cut off a packet on air
+	if((fhss_late < FHSS_GUARD_MSEC) && (cc_rx_active() || cc_tx_active()))
+	{
+		if(fhss_late == 0)
+			fhss_stats.late_hops++;
+		fhss_late++;
+		return;
+	}
+
+	fhss_slot_timer -= fhss_config.slot_msec;
+	fhss_late = 0;
+
+	// Searching: stay on one channel for a cycle
+	if((fhss_mode == FHSS_SLAVE) && !fhss_synced)
+	{
+		if(++fhss_missed >= fhss_config.n_chan)
+		{
+			fhss_missed = 0;
+			fhss_hop = (fhss_hop + 1) % fhss_config.n_chan;
+			cc_set_channel(fhss_seq[fhss_hop]);
+		}
+		return;
+	}
+
+	fhss_hop = (fhss_hop + 1) % fhss_config.n_chan;
+	cc_set_channel(fhss_seq[fhss_hop]);
+	fhss_stats.hops++;
+
+	if(fhss_mode == FHSS_MASTER)
+	{
+		fhss_beacon();
+	}
+	else if(++fhss_missed >= FHSS_LOST_SLOTS)
+	{
+		// Wait on the master's next channel
+		fhss_synced = 0;
+		fhss_missed = 0;
+		fhss_stats.lost++;
+		fhss_hop = (fhss_hop + 1) % fhss_config.n_chan;
+		cc_set_channel(fhss_seq[fhss_hop]);
+	}
+}
+
+
+/* fhss_rx
+ *
+ * Parameters
+ * pkt			Received packet
+ *
+ * Returns
+ * 1 if the packet was a beacon and has been used, 0 if not.
+ *
+ * Called from the main loop for each received packet.  A slave takes
+ * the hop number from the beacon and restarts the slot timer from the
+ * beacon's sync word.  Slave slots start a preamble and sync word
+ * after the master's, which is well inside a slot.
+ */
+int fhss_rx(RF_PKT *pkt)
+{
+	uint32_t key;
+	uint16_t seed;
+	uint16_t elapsed;
+
+
+	if((pkt->len != FHSS_BEACON_LEN) || (pkt->data[0] != FHSS_BEACON))
+		return 0;
+
+	if(fhss_mode != FHSS_SLAVE)
+		return 1;
+
+	// Beacon from another layout
+	seed = pkt->data[2] | (pkt->data[3] << 8);
+	if((seed != fhss_config.seed) || (pkt->data[1] >= fhss_config.n_chan))
+		return 1;
+
+	elapsed = (cyc_count() - pkt->sync) / (CYC_PER_USEC * 1000);
+
+	key = cc_lock();
+
+	if(!fhss_synced || (fhss_hop != pkt->data[1]))
+		fhss_stats.resyncs++;
+
+	if(fhss_hop != pkt->data[1])
+	{
+		fhss_hop = pkt->data[1];
+		cc_set_channel(fhss_seq[fhss_hop]);
+	}
+
+	fhss_slot_timer = elapsed;
+	fhss_missed = 0;
+	fhss_late = 0;
+	fhss_synced = 1;
+	fhss_stats.beacons++;
+
+	cc_unlock(key);
+
+	return 1;
+}
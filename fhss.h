@@ -0,0 +1,68 @@
+/*
+ * fhss.h
+ *
+ * Frequency hopping scheduler.
+ *
+ */
+
+#ifndef FHSS_H_
+#define FHSS_H_
+
+#include "types.h"
+#include "cc_hal.h"
+
+
+// Node roles
+#define FHSS_OFF		0				// Fixed channel
+#define FHSS_MASTER		1				// Base station, sends the beacons
+#define FHSS_SLAVE		2				// Locomotive, follows the beacons
+
+// Limits
+#define FHSS_MIN_CHAN	2
+#define FHSS_MAX_CHAN	RF_N_CHANNELS
+#define FHSS_MIN_SLOT	2				// msec
+#define FHSS_MAX_SLOT	1000			// msec
+#define FHSS_GUARD_MSEC	5				// Max hop delay for a packet on air
+#define FHSS_LOST_SLOTS	3				// Missed beacons before a slave is out of sync
+
+// Defaults
+#define FHSS_SEED		0x2B1D
+#define FHSS_SLOT_MSEC	20
+#define FHSS_N_CHAN		16
+
+// Beacon sent by the master at the start of each slot.
+// [FHSS_BEACON][HOP][SEED_LO][SEED_HI]
+#define FHSS_BEACON		0xB5			// First data byte
+#define FHSS_BEACON_LEN	4
+#define FHSS_BEACON_ADDR	0x00		// Broadcast
+
+// Hop sequence settings, same on all nodes of a layout.
+typedef struct {
+	uint16_t seed;						// Sequence seed
+	uint16_t slot_msec;					// Time on each channel
+	uint8_t n_chan;						// Channels in the sequence
+} FHSS_CONFIG;
+
+// Scheduler statistics
+typedef struct {
+	uint32_t hops;						// Channel changes
+	uint32_t late_hops;					// Hops delayed by a packet on air
+	uint32_t beacons;					// Beacons received (slave) or sent (master)
+	uint32_t resyncs;					// Slot timing or hop corrected by a beacon
+	uint32_t lost;						// Sync lost, searching
+} FHSS_STATS;
+
+extern FHSS_CONFIG fhss_config;
+extern FHSS_STATS fhss_stats;
+extern uint8_t fhss_mode;
+extern uint8_t fhss_synced;
+extern uint8_t fhss_hop;
+extern uint8_t fhss_seq[FHSS_MAX_CHAN];
+
+
+int fhss_start(uint8_t mode, FHSS_CONFIG *config);
+void fhss_stop(void);
+void fhss_tick(void);
+int fhss_rx(RF_PKT *pkt);
+
+#endif /* FHSS_H_ */
@@ -0,0 +1,824 @@
+/*
+ * cc_sim.c
+ *
+ * CC2500 behavioural model.
+ *
+ * Models the chip as seen through the SPI interface: the header byte
+ * (R/W, burst and 6-bit address), command strobes 0x30-0x3D, config
+ * registers, status registers, PATABLE, the 64-byte TX and RX FIFOs
+ * and the main radio control state machine.  The status byte is
+ * returned for every header byte and for every data byte of a write.
+ *
+ * State changes that take time on the chip (calibration, synthesizer
+ * settling, packets on air) are timed from the modelled clock in
+ * sim_port.c.  GDO0 is modelled for GDO_SYNC_EOP: the rising edge at
+ * the sync word, the falling edge at the end of packet or when the
+ * address check drops the packet.  GDO2 FIFO thresholds are not
+ * modelled, so bulk transfers can't be simulated.
+ *
+ * Packets are put on air to the radio with sim_air_rx(), and a hook
+ * sees each packet the radio sends.  CRC is always good.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f103xb.h"
+#include "cc2500_regs.h"
+#include "sim.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+// Model states
+#define ST_IDLE			0
+#define ST_SLEEP		1
+#define ST_WOR			2
+#define ST_CAL			3
+#define ST_SETTLE		4				// Synthesizer settling, then sim_next
+#define ST_RX			5
+#define ST_TX			6
+#define ST_FSTXON		7
+#define ST_RXOVF		8
+#define ST_TXUNF		9
+
+#define SIM_RSSI_OFFSET	72				// dB, raw RSSI to dBm
+#define SIM_LQI			4				// Link quality estimate of a clean packet
+
+
+// Register values after reset
+const uint8_t sim_reset_regs[N_CONFIG_REGS] =
+{
+	0x29, 0x2E, 0x3F, 0x07, 0xD3, 0x91, 0xFF, 0x04,		// IOCFG2 - PKTCTRL1
+	0x45, 0x00, 0x00, 0x0F, 0x00, 0x5E, 0xC4, 0xEC,		// PKTCTRL0 - FREQ0
+	0x8C, 0x22, 0x02, 0x22, 0xF8, 0x47, 0x07, 0x30,		// MDMCFG4 - MCSM1
+	0x04, 0x36, 0x6C, 0x03, 0x40, 0x91, 0x87, 0x6B,		// MCSM0 - WOREVT0
+	0xF8, 0xA6, 0x10, 0xA9, 0x0A, 0x20, 0x0D, 0x41,		// WORCTRL - RCCTRL1
+	0x00, 0x59, 0x7F, 0x3F, 0x88, 0x31, 0x0B			// RCCTRL0 - TEST0
+};
+
+// Preamble bytes for MDMCFG1 NUM_PREAMBLE
+const uint8_t sim_preamble[8] = {2, 3, 4, 6, 8, 12, 16, 24};
+
+const char *sim_strobe_names[] =
+{
+	"SRES", "SFSTXON", "SXOFF", "SCAL", "SRX", "STX", "SIDLE", "(37)",
+	"SWOR", "SPWD", "SFRX", "SFTX", "SWORRST", "SNOP"
+};
+
+SIM_CHIP_STATS sim_chip;
+
+uint8_t sim_regs[N_CONFIG_REGS];
+uint8_t sim_pa[8];
+uint8_t sim_pa_index;
+uint8_t sim_tx_pa;						// PATABLE entry 0 for the last packet sent
+
+uint8_t sim_txf[CC_FIFO_SIZE];
+int sim_txn;
+uint8_t sim_rxf[CC_FIFO_SIZE];
+int sim_rxn;
+
+int sim_state;
+int sim_next;							// State after ST_SETTLE
+int sim_after_cal;						// State after ST_CAL
+int sim_sleep;							// ST_SLEEP or ST_WOR at CSn high, 0 if none
+unsigned long long sim_t_state;			// End of calibration or settling, 0 if none
+unsigned long long sim_t_sync;			// Sync word edge due
+unsigned long long sim_t_eop;			// End of packet due
+
+int sim_rssi = -100;					// Channel RSSI (dBm)
+int sim_rx_busy;						// Receiving a packet
+int sim_rx_drop;						// Packet failed the address check
+uint8_t sim_pkt[CC_FIFO_SIZE];			// Packet on air
+int sim_pkt_n;
+void (*sim_hook)(uint8_t *pkt, int n);
+
+// Packets waiting to go on air to the radio
+struct {
+	unsigned long long start;
+	int n;
+	uint8_t data[CC_FIFO_SIZE];
+} sim_rxq[SIM_RX_QUEUE];
+int sim_rxq_n;
+
+// SPI transaction
+int sim_cs_low;
+int sim_need_hdr;
+uint8_t sim_hdr;						// Header, address moves on in a burst
+uint8_t sim_hdr0;						// Header as sent
+int sim_xfer_n;							// Bytes in this transaction
+
+
+void sim_strobe(uint8_t cmd);
+void sim_start_fs(int target);
+void sim_tx_begin(void);
+void sim_tx_end(void);
+void sim_rx_begin(void);
+void sim_rx_end(void);
+uint8_t sim_status(int rd);
+uint8_t sim_status_reg(uint8_t addr);
+uint32_t sim_air_ns(int bytes);
+void sim_trace_xfer(void);
+void sim_gdo0(int edge);
+
+
+
+/* sim_reset
+ *
+ * Power on reset.  Registers to their reset values, FIFOs empty and
+ * the chip in IDLE.
+ */
+void sim_reset(void)
+{
+	memcpy(sim_regs, sim_reset_regs, N_CONFIG_REGS);
+	memset(sim_pa, 0, sizeof(sim_pa));
+	sim_pa[0] = 0xC6;
+	sim_txn = 0;
+	sim_rxn = 0;
+	sim_state = ST_IDLE;
+	sim_sleep = 0;
+	sim_t_state = 0;
+	sim_t_sync = 0;
+	sim_t_eop = 0;
+	sim_rx_busy = 0;
+	sim_rxq_n = 0;
+	sim_need_hdr = 1;
+}
+
+
+/* sim_marcstate
+ *
+ * Returns
+ * MARCSTATE for the model state.
+ */
+uint8_t sim_marcstate(void)
+{
+	switch(sim_state)
+	{
+	case ST_SLEEP:
+	case ST_WOR:	return MARCSTATE_SLEEP;
+	case ST_CAL:	return 0x08;				// STARTCAL
+	case ST_SETTLE:	return 0x0A;				// FS_LOCK
+	case ST_RX:		return MARCSTATE_RX;
+	case ST_TX:		return MARCSTATE_TX;
+	case ST_FSTXON:	return 0x12;
+	case ST_RXOVF:	return MARCSTATE_RXFIFO_OVERFLOW;
+	case ST_TXUNF:	return MARCSTATE_TXFIFO_UNDERFLOW;
+	}
+
+	return MARCSTATE_IDLE;
+}
+
+
+/* sim_status
+ *
+ * Parameters
+ * rd			Header has the R/W bit set
+ *
+ * Returns
+ * Chip status byte.  FIFO_BYTES_AVAILABLE is the RX FIFO count for
+ * reads and the TX FIFO free space for writes, up to 15.
+ */
+uint8_t sim_status(int rd)
+{
+	uint8_t state;
+	int n;
+
+
+	switch(sim_state)
+	{
+	case ST_RX:		state = RX_STATE;					break;
+	case ST_TX:		state = TX_STATE;					break;
+	case ST_FSTXON:	state = FSTXON_STATE;				break;
+	case ST_CAL:	state = CALIBRATE_STATE;			break;
+	case ST_SETTLE:	state = SETTLING_STATE;				break;
+	case ST_RXOVF:	state = RXFIFO_OVERFLOW_STATE;		break;
+	case ST_TXUNF:	state = TXFIFO_UNDERFLOW_STATE;		break;
+	default:		state = IDLE_STATE;					break;
+	}
+
+	n = rd ? sim_rxn : CC_FIFO_SIZE - sim_txn;
+	if(n > 15)
+		n = 15;
+
+	return (state << 4) | n;
+}
+
+
+/* sim_status_reg
+ *
+ * Parameters
+ * addr			Status register 0x30-0x3D
+ *
+ * Returns
+ * Register value.
+ */
+uint8_t sim_status_reg(uint8_t addr)
+{
+	switch(addr)
+	{
+	case PARTNUM:		return 0x80;
+	case VERSION:		return 0x03;
+	case LQI:			return LQI_CRC_OK | SIM_LQI;
+	case RSSI:			return (uint8_t)((sim_rssi + SIM_RSSI_OFFSET) * 2);
+	case MARCSTATE:		return sim_marcstate();
+	case PKTSTATUS:		return (sim_rx_busy ? 0x48 : 0x00) | (GPIOB->IDR & 0x01);
+	case TXBYTES:		return ((sim_state == ST_TXUNF) ? FIFO_OVERFLOW : 0) | sim_txn;
+	case RXBYTES:		return ((sim_state == ST_RXOVF) ? FIFO_OVERFLOW : 0) | sim_rxn;
+	}
+
+	return 0;
+}
+
+
+/* sim_cs
+ *
+ * Parameters
+ * low			1 for CSn low, 0 for CSn high
+ *
+ * CSn low starts a transaction and wakes the chip from SLEEP or WOR.
+ * CSn high ends it, SPWD and SWOR take effect then.
+ */
+void sim_cs(int low)
+{
+	if(low)
+	{
+		if(sim_cs_low)
+			return;
+
+		sim_cs_low = 1;
+		sim_need_hdr = 1;
+		sim_xfer_n = 0;
+
+		if((sim_state == ST_SLEEP) || (sim_state == ST_WOR))
+		{
+			sim_advance(SIM_WAKE_USEC * 1000);		// SO high until the crystal runs
+			sim_state = ST_IDLE;
+		}
+		return;
+	}
+
+	if(!sim_cs_low)
+		return;
+
+	sim_cs_low = 0;
+	sim_pa_index = 0;
+
+	if(sim_trace)
+		sim_trace_xfer();
+
+	if(sim_sleep)
+	{
+		sim_state = sim_sleep;
+		sim_sleep = 0;
+	}
+}
+
+
+/* sim_spi_byte
+ *
+ * Parameters
+ * mosi			Byte from the MCU
+ *
+ * Returns
+ * Byte to the MCU.
+ *
+ * The first byte after CSn low is a header.  A single access has one
+ * data byte, a burst continues until CSn high.  Strobes have no data
+ * byte, so the next byte is another header.
+ */
+uint8_t sim_spi_byte(uint8_t mosi)
+{
+	uint8_t addr;
+	int rd;
+	int burst;
+	uint8_t miso;
+
+
+	if(!sim_cs_low)
+		return 0xFF;
+
+	sim_xfer_n++;
+
+	if(sim_need_hdr)
+	{
+		sim_hdr = mosi;
+		sim_hdr0 = mosi;
+		sim_need_hdr = 0;
+		sim_spi.headers++;
+
+		addr = mosi & 0x3F;
+		miso = sim_status(mosi & 0x80);
+
+		if((addr >= 0x30) && (addr <= 0x3D) && !(mosi & 0x40))
+		{
+			sim_spi.strobes++;
+			sim_strobe(addr);
+			sim_need_hdr = 1;
+		}
+		return miso;
+	}
+
+	addr = sim_hdr & 0x3F;
+	rd = sim_hdr & 0x80;
+	burst = sim_hdr & 0x40;
+	miso = sim_status(0);
+
+	if(addr == 0x3F)
+	{
+		// FIFO
+		if(rd)
+		{
+			miso = (sim_rxn > 0) ? sim_rxf[0] : 0x00;
+			if(sim_rxn > 0)
+				memmove(sim_rxf, sim_rxf + 1, --sim_rxn);
+		}
+		else if(sim_txn < CC_FIFO_SIZE)
+		{
+			sim_txf[sim_txn++] = mosi;
+		}
+	}
+	else if(addr == 0x3E)
+	{
+		// PATABLE
+		if(rd)
+			miso = sim_pa[sim_pa_index];
+		else
+			sim_pa[sim_pa_index] = mosi;
+		sim_pa_index = (sim_pa_index + 1) & 0x07;
+	}
+	else if(addr >= 0x30)
+	{
+		// Status register, R/W and burst set
+		if(rd)
+			miso = sim_status_reg(addr);
+		burst = 0;
+	}
+	else
+	{
+		// Config register, a burst moves on to the next one
+		if(addr < N_CONFIG_REGS)
+		{
+			if(rd)
+				miso = sim_regs[addr];
+			else
+				sim_regs[addr] = mosi;
+		}
+		else if(rd)
+		{
+			miso = 0x00;
+		}
+
+		if(burst)
+			sim_hdr = (sim_hdr & 0xC0) | ((addr + 1) & 0x3F);
+	}
+
+	if(!burst)
+		sim_need_hdr = 1;
+
+	return miso;
+}
+
+
+/* sim_strobe
+ *
+ * Parameters
+ * cmd			Command strobe 0x30-0x3D
+ *
+ * Strobes that aren't valid in the current state are ignored, as on
+ * the chip.
+ */
+void sim_strobe(uint8_t cmd)
+{
+	switch(cmd)
+	{
+	case SRES:
+		sim_reset();
+		sim_need_hdr = 1;
+		break;
+
+	case SFSTXON:
+		if((sim_state == ST_IDLE) || (sim_state == ST_RX))
+			sim_start_fs(ST_FSTXON);
+		break;
+
+	case SCAL:
+		if(sim_state == ST_IDLE)
+		{
+			sim_state = ST_CAL;
+			sim_after_cal = ST_IDLE;
+			sim_t_state = sim_time_ns() + SIM_CAL_USEC * 1000ULL;
+		}
+		break;
+
+	case SRX:
+		if((sim_state == ST_IDLE) || (sim_state == ST_FSTXON) || (sim_state == ST_TX))
+			sim_start_fs(ST_RX);
+		break;
+
+	case STX:
+		// CCA: STX is ignored while a packet is being received
+		if((sim_state == ST_RX) && sim_rx_busy && (sim_regs[MCSM1] & MCSM1_CCA_MODE))
+			break;
+
+		if((sim_state == ST_IDLE) || (sim_state == ST_RX) || (sim_state == ST_FSTXON))
+			sim_start_fs(ST_TX);
+		break;
+
+	case SIDLE:
+		if((sim_state != ST_SLEEP) && (sim_state != ST_WOR))
+		{
+			sim_state = ST_IDLE;
+			sim_t_state = 0;
+			sim_t_sync = 0;
+			sim_t_eop = 0;
+			sim_rx_busy = 0;
+		}
+		break;
+
+	case SWOR:
+		if(sim_state == ST_IDLE)
+			sim_sleep = ST_WOR;
+		break;
+
+	case SPWD:
+		if(sim_state == ST_IDLE)
+			sim_sleep = ST_SLEEP;
+		break;
+
+	case SFRX:
+		if((sim_state == ST_IDLE) || (sim_state == ST_RXOVF))
+		{
+			sim_rxn = 0;
+			sim_state = ST_IDLE;
+		}
+		break;
+
+	case SFTX:
+		if((sim_state == ST_IDLE) || (sim_state == ST_TXUNF))
+		{
+			sim_txn = 0;
+			sim_state = ST_IDLE;
+		}
+		break;
+	}
+}
+
+
+/* sim_start_fs
+ *
+ * Parameters
+ * target		ST_RX, ST_TX or ST_FSTXON
+ *
+ * Start the synthesizer.  From IDLE it calibrates first if MCSM0 asks
+ * for it, then settles.  From RX, TX or FSTXON it only turns around.
+ */
+void sim_start_fs(int target)
+{
+	unsigned long long now;
+
+
+	now = sim_time_ns();
+
+	if(sim_state == ST_IDLE)
+	{
+		if((sim_regs[MCSM0] & MCSM0_FS_AUTOCAL) == FS_AUTOCAL_FROM_IDLE)
+		{
+			sim_state = ST_CAL;
+			sim_after_cal = target;
+			sim_t_state = now + SIM_CAL_USEC * 1000ULL;
+			return;
+		}
+		sim_t_state = now + SIM_SETTLE_USEC * 1000ULL;
+	}
+	else
+	{
+		sim_t_state = now + SIM_TURN_USEC * 1000ULL;
+	}
+
+	sim_rx_busy = 0;
+	sim_t_sync = 0;
+	sim_t_eop = 0;
+	sim_state = ST_SETTLE;
+	sim_next = target;
+}
+
+
+/* sim_air_ns
+ *
+ * Parameters
+ * bytes		Bytes after the sync word
+ *
+ * Returns
+ * Air time of a packet, preamble and sync word included (nsec).
+ */
+uint32_t sim_air_ns(int bytes)
+{
+	unsigned long long rate;
+	uint8_t sync;
+	int n;
+
+
+	rate = (unsigned long long)(256 + sim_regs[MDMCFG3]) * CC_FXOSC;
+	rate <<= (sim_regs[MDMCFG4] & MDMCFG4_DRATE_E);
+	rate >>= 28;
+
+	n = sim_preamble[(sim_regs[MDMCFG1] & MDMCFG1_NUM_PREAMBLE) >> 4];
+	sync = sim_regs[MDMCFG2] & MDMCFG2_SYNC_MODE;
+	n += ((sync == 3) || (sync == 7)) ? 4 : 2;
+	n += bytes;
+
+	return (uint32_t)((n * 8ULL * 1000000000ULL) / rate);
+}
+
+
+/* sim_tx_begin
+ *
+ * Synthesizer ready, send the packet at the head of the TX FIFO at the
+ * PATABLE entry 0 power.
+ * An empty or short FIFO underflows.
+ */
+void sim_tx_begin(void)
+{
+	unsigned long long now;
+	int len;
+
+
+	now = sim_time_ns();
+
+	if((sim_regs[PKTCTRL0] & PKTCTRL0_LEN_CONFIG) == PKTCTRL0_LEN_VAR)
+		len = (sim_txn > 0) ? sim_txf[0] + 1 : 1;
+	else
+		len = sim_regs[PKTLEN];
+
+	if((sim_txn == 0) || (sim_txn < len))
+	{
+		sim_state = ST_TXUNF;
+		sim_chip.underflow++;
+		return;
+	}
+
+	sim_state = ST_TX;
+	sim_tx_pa = sim_pa[0];
+	sim_pkt_n = len;
+	memcpy(sim_pkt, sim_txf, len);
+
+	sim_t_sync = now + sim_air_ns(0);
+	sim_t_eop = now + sim_air_ns(len + 2);
+}
+
+
+/* sim_tx_end
+ *
+ * Packet sent.  Remove it from the TX FIFO, drop GDO0 and go to the
+ * MCSM1 TXOFF_MODE state.
+ */
+void sim_tx_end(void)
+{
+	sim_txn -= sim_pkt_n;
+	memmove(sim_txf, sim_txf + sim_pkt_n, sim_txn);
+	sim_chip.tx_pkts++;
+
+	switch(sim_regs[MCSM1] & MCSM1_TXOFF_RX)
+	{
+	case 0x01:	sim_state = ST_FSTXON;		break;
+	case 0x03:	sim_state = ST_RX;			break;
+	default:	sim_state = ST_IDLE;		break;
+	}
+
+	sim_gdo0(0);
+
+	if(sim_hook)
+		sim_hook(sim_pkt, sim_pkt_n);
+}
+
+
+/* sim_rx_begin
+ *
+ * The packet at the head of the air queue starts.  It is missed if
+ * the radio isn't listening.
+ */
+void sim_rx_begin(void)
+{
+	unsigned long long now;
+	uint8_t addr;
+	uint8_t mode;
+	int i;
+
+
+	now = sim_time_ns();
+
+	sim_pkt_n = sim_rxq[0].n;
+	memcpy(sim_pkt, sim_rxq[0].data, sim_pkt_n);
+
+	sim_rxq_n--;
+	for(i=0; i<sim_rxq_n; i++)
+		sim_rxq[i] = sim_rxq[i + 1];
+
+	// WOR picks up the packet on its next RX period
+	if(sim_state == ST_WOR)
+		sim_state = ST_RX;
+
+	if((sim_state != ST_RX) || sim_rx_busy)
+	{
+		sim_chip.rx_missed++;
+		return;
+	}
+
+	addr = sim_pkt[1];
+	mode = sim_regs[PKTCTRL1] & PKTCTRL1_ADR_CHK;
+	sim_rx_drop = (mode != ADR_CHK_NONE) && (addr != sim_regs[ADDR]) &&
+					!((mode >= 2) && (addr == 0x00)) && !((mode == 3) && (addr == 0xFF));
+
+	sim_rx_busy = 1;
+	sim_t_sync = now + sim_air_ns(0);
+	sim_t_eop = now + sim_air_ns(sim_rx_drop ? 2 : sim_pkt_n + 2);
+}
+
+
+/* sim_rx_end
+ *
+ * End of the packet.  Put it in the RX FIFO with RSSI and LQI, then
+ * drop GDO0.  The RX FIFO overflows if it doesn't fit.
+ */
+void sim_rx_end(void)
+{
+	int n;
+
+
+	sim_rx_busy = 0;
+
+	if(sim_rx_drop)
+	{
+		sim_chip.rx_filtered++;
+		sim_gdo0(0);
+		return;
+	}
+
+	sim_pkt[sim_pkt_n] = (uint8_t)((sim_rssi + SIM_RSSI_OFFSET) * 2);
+	sim_pkt[sim_pkt_n + 1] = LQI_CRC_OK | SIM_LQI;
+	n = sim_pkt_n + 2;
+
+	if(sim_rxn + n > CC_FIFO_SIZE)
+	{
+		memcpy(sim_rxf + sim_rxn, sim_pkt, CC_FIFO_SIZE - sim_rxn);
+		sim_rxn = CC_FIFO_SIZE;
+		sim_state = ST_RXOVF;
+		sim_chip.overflow++;
+		return;
+	}
+
+	memcpy(sim_rxf + sim_rxn, sim_pkt, n);
+	sim_rxn += n;
+	sim_chip.rx_pkts++;
+
+	if((sim_regs[MCSM1] & MCSM1_RXOFF_RX) != MCSM1_RXOFF_RX)
+		sim_state = ST_IDLE;
+
+	sim_gdo0(0);
+}
+
+
+/* sim_gdo0
+ *
+ * Parameters
+ * edge			1 for the sync word, 0 for the end of packet
+ *
+ * GDO0 edges, when IOCFG0 has GDO0 on sync word / end of packet.
+ */
+void sim_gdo0(int edge)
+{
+	if((sim_regs[IOCFG0] & 0x3F) == GDO_SYNC_EOP)
+		sim_capture(edge);
+}
+
+
+/* sim_events
+ *
+ * Run the chip events that are due at the modelled time.
+ */
+void sim_events(void)
+{
+	unsigned long long now;
+	int busy;
+
+
+	now = sim_time_ns();
+
+	do
+	{
+		busy = 0;
+
+		if(sim_t_state && (now >= sim_t_state))
+		{
+			sim_t_state = 0;
+			busy = 1;
+
+			if(sim_state == ST_CAL)
+			{
+				sim_regs[FSCAL1] = 0x20 + (sim_regs[CHANNR] >> 3);
+				sim_state = ST_IDLE;
+				if(sim_after_cal != ST_IDLE)
+					sim_start_fs(sim_after_cal);
+			}
+			else if(sim_state == ST_SETTLE)
+			{
+				if(sim_next == ST_TX)
+					sim_tx_begin();
+				else
+					sim_state = sim_next;
+			}
+		}
+
+		if(sim_t_sync && (now >= sim_t_sync))
+		{
+			sim_t_sync = 0;
+			busy = 1;
+			sim_gdo0(1);
+		}
+
+		if(sim_t_eop && (now >= sim_t_eop))
+		{
+			sim_t_eop = 0;
+			busy = 1;
+
+			if(sim_state == ST_TX)
+				sim_tx_end();
+			else
+				sim_rx_end();
+		}
+
+		if((sim_rxq_n > 0) && (now >= sim_rxq[0].start))
+		{
+			busy = 1;
+			sim_rx_begin();
+		}
+	} while(busy);
+}
+
+
+/* sim_air_rx
+ *
+ * Parameters
+ * pkt			[LEN][ADDR][DATA...]
+ * n			Bytes, LEN included
+ * delay_usec	Start of the packet on air from now
+ *
+ * Queue a packet to go on air to the radio.
+ */
+void sim_air_rx(uint8_t *pkt, int n, int delay_usec)
+{
+	if((sim_rxq_n >= SIM_RX_QUEUE) || (n > CC_FIFO_SIZE - 2))
+		return;
+
+	sim_rxq[sim_rxq_n].start = sim_time_ns() + delay_usec * 1000ULL;
+	sim_rxq[sim_rxq_n].n = n;
+	memcpy(sim_rxq[sim_rxq_n].data, pkt, n);
+	sim_rxq_n++;
+}
+
+
+/* sim_set_rssi
+ *
+ * Parameters
+ * dbm			Signal strength for RSSI reads and received packets
+ */
+void sim_set_rssi(int dbm)
+{
+	sim_rssi = dbm;
+}
+
+
+/* sim_tx_hook
+ *
+ * Parameters
+ * hook			Called with each packet sent, or NULL
+ */
+void sim_tx_hook(void (*hook)(uint8_t *pkt, int n))
+{
+	sim_hook = hook;
+}
+
+
+/* sim_trace_xfer
+ *
+ * Print the transaction that has just ended.
+ */
+void sim_trace_xfer(void)
+{
+	uint8_t addr;
+
+
+	addr = sim_hdr0 & 0x3F;
+
+	printf("%10.3f us  %02X  ", sim_time_ns() / 1000.0, sim_hdr0);
+
+	if((addr >= 0x30) && (addr <= 0x3D) && (sim_xfer_n == 1))
+		printf("%s\n", sim_strobe_names[addr - 0x30]);
+	else
+		printf("%s %s %d bytes\n", (sim_hdr0 & 0x80) ? "read" : "write",
+			(addr == 0x3F) ? "FIFO" : (addr == 0x3E) ? "PATABLE" : (addr >= 0x30) ? "status" :
+			(sim_hdr0 & 0x40) ? "burst" : "single", sim_xfer_n - 1);
+}
@@ -0,0 +1,372 @@
+/*
+ * ctrl_test.c
+ *
+ * Round trip tests and timing of the control frame codec (ctrl_frame.c)
+ * on the host.
+ *
+ * Every speed from CTRL_SPEED_MIN to +512 is encoded and decoded, +512
+ * comes back clamped to CTRL_SPEED_MAX.  The other fields are checked
+ * at their extremes, and frames of 1 to CTRL_MAX_RECS records.  Frames
+ * with a bad header nibble or a length that doesn't match the header
+ * must be rejected.
+ *
+ * Usage: ctrltest
+ * Returns 0 if all the tests pass, 1 if not.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ctrl_frame.h"
+
+
+#define TIME_LOOPS		1000000
+
+
+int test_fails;
+int test_checks;
+volatile uint32_t test_sink;			// Keeps the timed loops
+
+
+void check(int ok, char *what, int value);
+int rec_equal(CTRL_REC *a, CTRL_REC *b);
+void rec_expect(CTRL_REC *in, CTRL_REC *out);
+void test_speeds(void);
+void test_fields(void);
+void test_lengths(void);
+void test_reject(void);
+void time_codec(int n);
+unsigned long long now_ns(void);
+
+
+
+/* check
+ *
+ * Parameters
+ * ok			Test result
+ * what			Test name
+ * value		Value under test, printed on failure
+ */
+void check(int ok, char *what, int value)
+{
+	test_checks++;
+
+	if(ok)
+		return;
+
+	test_fails++;
+	if(test_fails <= 20)
+		printf("FAIL %s (%d)\n", what, value);
+}
+
+
+/* rec_equal
+ *
+ * Returns
+ * 1 if the records are the same, 0 if not.
+ */
+int rec_equal(CTRL_REC *a, CTRL_REC *b)
+{
+	return (a->addr == b->addr) && (a->speed == b->speed) &&
+		(a->dir == b->dir) && (a->func == b->func) &&
+		(a->seq == b->seq) && (a->flags == b->flags);
+}
+
+
+/* rec_expect
+ *
+ * Parameters
+ * in			Record as given to ctrl_encode()
+ * out			Record as ctrl_decode() should return it
+ *
+ * Speed is clamped to the 10 bit range, dir becomes 0 or 1 and the
+ * other fields are masked to their widths.
+ */
+void rec_expect(CTRL_REC *in, CTRL_REC *out)
+{
+	*out = *in;
+
+	if(out->speed > CTRL_SPEED_MAX)
+		out->speed = CTRL_SPEED_MAX;
+	if(out->speed < CTRL_SPEED_MIN)
+		out->speed = CTRL_SPEED_MIN;
+
+	out->dir = in->dir ? 1 : 0;
+	out->func &= CTRL_FUNC_MASK;
+	out->seq &= CTRL_SEQ_MASK;
+	out->flags &= CTRL_FLAGS_MASK;
+}
+
+
+/* test_speeds
+ *
+ * Round trip every speed, -512 to +512.
+ */
+void test_speeds(void)
+{
+	uint8_t buf[CTRL_FRAME_LEN(1)];
+	CTRL_REC in;
+	CTRL_REC out;
+	CTRL_REC want;
+	int speed;
+
+
+	memset(&in, 0, sizeof(in));
+	in.addr = 0x5A;
+	in.dir = 1;
+	in.func = 0x15;
+	in.seq = 9;
+	in.flags = CTRL_F_RAMP;
+
+	for(speed=CTRL_SPEED_MIN; speed<=512; speed++)
+	{
+		in.speed = speed;
+		rec_expect(&in, &want);
+
+		check(ctrl_encode(buf, sizeof(buf), &in, 1) == CTRL_FRAME_LEN(1), "speed encode", speed);
+		check(ctrl_decode(buf, sizeof(buf), &out, 1) == 1, "speed decode", speed);
+		check(rec_equal(&out, &want), "speed round trip", speed);
+	}
+
+	// Out of the pwm.c range
+	in.speed = 10000;
+	ctrl_encode(buf, sizeof(buf), &in, 1);
+	ctrl_decode(buf, sizeof(buf), &out, 1);
+	check(out.speed == CTRL_SPEED_MAX, "speed clamp high", out.speed);
+
+	in.speed = -10000;
+	ctrl_encode(buf, sizeof(buf), &in, 1);
+	ctrl_decode(buf, sizeof(buf), &out, 1);
+	check(out.speed == CTRL_SPEED_MIN, "speed clamp low", out.speed);
+}
+
+
+/* test_fields
+ *
+ * Round trip address, direction, function, sequence and flag extremes,
+ * including values wider than the fields.
+ */
+void test_fields(void)
+{
+	static const uint8_t addrs[] = {0x00, 0x01, 0x7F, 0x80, 0xFF};
+	static const uint8_t dirs[] = {0, 1, 0x80};
+	static const uint8_t funcs[] = {0x00, 0x01, 0x10, 0x1F, 0xFF};
+	static const uint8_t seqs[] = {0x00, 0x01, 0x0F, 0xF0, 0xFF};
+	static const uint8_t flags[] = {0x00, CTRL_F_ESTOP, CTRL_F_ACK, 0x0F, 0xF5};
+	static const int speeds[] = {CTRL_SPEED_MIN, -1, 0, 1, CTRL_SPEED_MAX};
+	uint8_t buf[CTRL_FRAME_LEN(1)];
+	CTRL_REC in;
+	CTRL_REC out;
+	CTRL_REC want;
+	int a, d, f, s, g, v;
+	int n;
+
+
+	n = 0;
+	for(a=0; a<sizeof(addrs); a++)
+	for(d=0; d<sizeof(dirs); d++)
+	for(f=0; f<sizeof(funcs); f++)
+	for(s=0; s<sizeof(seqs); s++)
+	for(g=0; g<sizeof(flags); g++)
+	for(v=0; v<sizeof(speeds)/sizeof(speeds[0]); v++)
+	{
+		in.addr = addrs[a];
+		in.speed = speeds[v];
+		in.dir = dirs[d];
+		in.func = funcs[f];
+		in.seq = seqs[s];
+		in.flags = flags[g];
+		rec_expect(&in, &want);
+
+		ctrl_encode(buf, sizeof(buf), &in, 1);
+		check(ctrl_decode(buf, sizeof(buf), &out, 1) == 1, "fields decode", n);
+		check(rec_equal(&out, &want), "fields round trip", n);
+		n++;
+	}
+}
+
+
+/* test_lengths
+ *
+ * Round trip frames of 1 to CTRL_MAX_RECS records, each record
+ * different, and check the header and buffer limits.
+ */
+void test_lengths(void)
+{
+	uint8_t buf[CTRL_FRAME_LEN(CTRL_MAX_RECS)];
+	CTRL_REC in[CTRL_MAX_RECS + 1];
+	CTRL_REC out[CTRL_MAX_RECS];
+	CTRL_REC want;
+	int n;
+	int i;
+
+
+	for(i=0; i<=CTRL_MAX_RECS; i++)
+	{
+		in[i].addr = i + 1;
+		in[i].speed = (i * 67) - 512;
+		in[i].dir = i & 1;
+		in[i].func = i;
+		in[i].seq = i;
+		in[i].flags = i;
+	}
+
+	for(n=1; n<=CTRL_MAX_RECS; n++)
+	{
+		check(ctrl_encode(buf, sizeof(buf), in, n) == CTRL_FRAME_LEN(n), "length encode", n);
+		check((buf[0] & CTRL_FRAME_MASK) == CTRL_FRAME, "length header", n);
+		check(ctrl_is_frame(buf, CTRL_FRAME_LEN(n)), "length is frame", n);
+		check(ctrl_decode(buf, CTRL_FRAME_LEN(n), out, CTRL_MAX_RECS) == n, "length decode", n);
+
+		for(i=0; i<n; i++)
+		{
+			rec_expect(&in[i], &want);
+			check(rec_equal(&out[i], &want), "length round trip", n * 100 + i);
+		}
+
+		// rec too small for the frame
+		check(ctrl_decode(buf, CTRL_FRAME_LEN(n), out, n - 1) == -1, "length decode max", n);
+
+		// Buffer one byte short
+		check(ctrl_encode(buf, CTRL_FRAME_LEN(n) - 1, in, n) == -1, "length encode max", n);
+	}
+
+	check(ctrl_encode(buf, sizeof(buf), in, 0) == -1, "encode 0 records", 0);
+	check(ctrl_encode(buf, sizeof(buf) + CTRL_REC_LEN, in, CTRL_MAX_RECS + 1) == -1,
+		"encode too many records", CTRL_MAX_RECS + 1);
+}
+
+
+/* test_reject
+ *
+ * Frames with a bad header nibble or a length that doesn't match the
+ * no. of records in the header.
+ */
+void test_reject(void)
+{
+	uint8_t buf[CTRL_FRAME_LEN(CTRL_MAX_RECS) + 1];
+	CTRL_REC in[CTRL_MAX_RECS];
+	CTRL_REC out[CTRL_MAX_RECS];
+	int nibble;
+	int len;
+	int n;
+
+
+	memset(in, 0, sizeof(in));
+
+	// Header nibble
+	for(n=1; n<=CTRL_MAX_RECS; n++)
+	{
+		ctrl_encode(buf, sizeof(buf), in, n);
+
+		for(nibble=0; nibble<16; nibble++)
+		{
+			if((nibble << 4) == CTRL_FRAME)
+				continue;
+
+			buf[0] = (nibble << 4) | (n - 1);
+			check(!ctrl_is_frame(buf, CTRL_FRAME_LEN(n)), "nibble is frame", buf[0]);
+			check(ctrl_decode(buf, CTRL_FRAME_LEN(n), out, CTRL_MAX_RECS) == -1, "nibble decode", buf[0]);
+		}
+	}
+
+	// Length
+	for(n=1; n<=CTRL_MAX_RECS; n++)
+	{
+		memset(buf, 0, sizeof(buf));
+		ctrl_encode(buf, sizeof(buf), in, n);
+
+		for(len=0; len<=sizeof(buf); len++)
+		{
+			if(len == CTRL_FRAME_LEN(n))
+				continue;
+
+			check(!ctrl_is_frame(buf, len), "length is frame", n * 1000 + len);
+			check(ctrl_decode(buf, len, out, CTRL_MAX_RECS) == -1, "length decode", n * 1000 + len);
+		}
+	}
+}
+
+
+/* now_ns
+ *
+ * Returns
+ * Monotonic time (nsec).
+ */
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* time_codec
+ *
+ * Parameters
+ * n			Records per frame
+ *
+ * Print the encode and decode time per frame.
+ */
+void time_codec(int n)
+{
+	uint8_t buf[CTRL_FRAME_LEN(CTRL_MAX_RECS)];
+	CTRL_REC in[CTRL_MAX_RECS];
+	CTRL_REC out[CTRL_MAX_RECS];
+	unsigned long long t0;
+	unsigned long long enc_ns;
+	unsigned long long dec_ns;
+	int i;
+
+
+	for(i=0; i<n; i++)
+	{
+		in[i].addr = i + 1;
+		in[i].speed = i * 30 - 200;
+		in[i].dir = 1;
+		in[i].func = 0x11;
+		in[i].seq = i;
+		in[i].flags = CTRL_F_ACK;
+	}
+
+	t0 = now_ns();
+	for(i=0; i<TIME_LOOPS; i++)
+	{
+		in[0].seq = i;
+		test_sink += ctrl_encode(buf, sizeof(buf), in, n);
+	}
+	enc_ns = now_ns() - t0;
+
+	t0 = now_ns();
+	for(i=0; i<TIME_LOOPS; i++)
+	{
+		buf[CTRL_HDR_LEN + 3] = i;
+		test_sink += ctrl_decode(buf, CTRL_FRAME_LEN(n), out, CTRL_MAX_RECS);
+		test_sink += out[0].flags;
+	}
+	dec_ns = now_ns() - t0;
+
+	printf("%2d records  %3d bytes  encode %7.1f ns  decode %7.1f ns\n", n, CTRL_FRAME_LEN(n),
+		(double)enc_ns / TIME_LOOPS, (double)dec_ns / TIME_LOOPS);
+}
+
+
+int main(void)
+{
+	test_speeds();
+	test_fields();
+	test_lengths();
+	test_reject();
+
+	printf("Control frame codec: %d checks, %d failed\n\n", test_checks, test_fails);
+
+	printf("Per frame, %d frames\n", TIME_LOOPS);
+	time_codec(1);
+	time_codec(4);
+	time_codec(CTRL_MAX_RECS);
+
+	return test_fails ? 1 : 0;
+}
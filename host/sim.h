@@ -0,0 +1,77 @@
+/*
+ * sim.h
+ *
+ * CC2500 behavioural simulator for host builds of the radio driver.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "stm32f103xb.h"
+
+
+#define SIM_CPU_HZ		32000000UL			// Same as the target, cyc_count() rate
+
+// Bus timing model
+// SCLK is PCLK2 (32MHz) divided by the SPI1 baud divider.  A polled
+// byte has a gap for the spi_out() busy/RXNE loop, DMA bytes have none.
+#define SIM_CS_NS		250					// CSn setup and hold per transaction
+#define SIM_POLL_GAP_NS	400					// CPU time between polled bytes
+#define SIM_DWT_CYC		4					// CPU cycles per cycle counter read
+
+// Chip timing (usec)
+#define SIM_CAL_USEC	721					// SCAL, FS calibration
+#define SIM_SETTLE_USEC	88					// IDLE to RX or TX, FS settling
+#define SIM_TURN_USEC	10					// RX to TX and TX to RX
+#define SIM_WAKE_USEC	150					// SLEEP or WOR to IDLE, crystal start
+
+#define SIM_RX_QUEUE	4					// Packets waiting to go on air to the radio
+
+// SPI accounting
+typedef struct {
+	uint32_t xfers;						// CSn low periods
+	uint32_t bytes;						// Header and data bytes
+	uint32_t headers;					// Header bytes
+	uint32_t strobes;					// Command strobes
+	uint32_t dma_bytes;					// Data bytes moved by DMA
+	uint32_t bus_ns;					// Modelled bus time
+} SIM_SPI_STATS;
+
+// Chip events
+typedef struct {
+	uint32_t tx_pkts;					// Packets sent on air
+	uint32_t rx_pkts;					// Packets put in the RX FIFO
+	uint32_t rx_missed;					// Packets on air while not in RX
+	uint32_t rx_filtered;				// Dropped by the address check
+	uint32_t overflow;					// RX FIFO overflows
+	uint32_t underflow;					// TX FIFO underflows
+	uint32_t irqs;						// Interrupt handlers run
+} SIM_CHIP_STATS;
+
+extern SIM_SPI_STATS sim_spi;
+extern SIM_CHIP_STATS sim_chip;
+extern int sim_trace;					// Print every SPI transaction
+extern uint8_t sim_tx_pa;				// PATABLE entry 0 for the last packet sent
+
+
+// Chip model, cc_sim.c
+void sim_reset(void);
+void sim_cs(int low);
+uint8_t sim_spi_byte(uint8_t mosi);
+void sim_air_rx(uint8_t *pkt, int n, int delay_usec);
+void sim_set_rssi(int dbm);
+void sim_tx_hook(void (*hook)(uint8_t *pkt, int n));
+void sim_events(void);
+uint8_t sim_marcstate(void);
+
+// MCU and bus, sim_port.c
+void sim_advance(uint32_t ns);
+void sim_run(uint32_t usec);
+unsigned long long sim_time_ns(void);
+void sim_byte_time(int dma);
+void sim_irq(IRQn_Type irq);
+void sim_dispatch(void);
+void sim_capture(int edge);
+
+
+#endif /* SIM_H_ */
@@ -0,0 +1,444 @@
+/*
+ * sim_main.c
+ *
+ * Runs the radio driver (cc_hal.c, cc2500_regs.c, cc_profiles.c) on the
+ * host against the CC2500 model, and reports the SPI cost of each HAL
+ * call: transactions, bytes, strobes, DMA bytes and modelled bus time.
+ *
+ * Calls that wait for the radio run the 1msec cc_hal_tick() as the
+ * main loop does, and its SPI traffic is counted with the call.
+ *
+ * Usage: ccsim [-p fast|safe|slow] [-t]
+ * -p			SPI timing profile, as the spibaud command
+ * -t			Print every SPI transaction
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f103xb.h"
+#include "timer.h"
+#include "spi.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "sim.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+#define SIM_ADDR		0x12				// Driver's ADDR
+#define SIM_PEER		0x20				// Other end of the link
+#define SIM_ACK_USEC	120					// Peer's ack turnaround
+#define SIM_PEER_RSSI	24					// Raw RSSI the peer reports, -60dBm in lowlat
+#define SIM_PEER_LQI	4
+#define SIM_WAIT_MSEC	50					// Give up waiting for the radio
+
+typedef struct {
+	char *name;
+	void (*fn)(void);
+} SIM_BENCH;
+
+RF_CONFIG sim_config = {0, NULL};
+SIM_SPI_STATS sim_mark;
+unsigned long long sim_mark_ns;
+volatile int sim_done;
+int sim_result;
+uint8_t sim_data[8] = {0xC1, 1, 2, 3, 4, 5, 6, 7};
+RF_SCAN_CHAN sim_scan[16];
+
+
+void sim_wait(void);
+void sim_sent(int result);
+void sim_peer(uint8_t *pkt, int n);
+void bench_reset(void);
+void bench_config(void);
+void bench_start(void);
+void bench_reg(void);
+void bench_status(void);
+void bench_rssi(void);
+void bench_channel(void);
+void bench_send(void);
+void bench_recv(void);
+void bench_rel(void);
+void bench_scan(void);
+void bench_tick(void);
+void bench_wor(void);
+void bench_urgent(void);
+void bench_urgent_pa(void);
+int sim_urgent_build(uint8_t *frame, int rep);
+void print_hist(char *name, LAT_HIST *h);
+
+
+const SIM_BENCH sim_bench[] =
+{
+	{"cc_reset", bench_reset},
+	{"cc_radio_config", bench_config},
+	{"cc_radio_start", bench_start},
+	{"cc_reg_set+commit", bench_reg},
+	{"cc_read_status", bench_status},
+	{"cc_read_rssi", bench_rssi},
+	{"cc_set_channel", bench_channel},
+	{"cc_send_pkt 8", bench_send},
+	{"receive 8", bench_recv},
+	{"cc_send_rel 8", bench_rel},
+	{"cc_scan 16 chan", bench_scan},
+	{"cc_hal_tick x10", bench_tick},
+	{"cc_wor_start+wake", bench_wor},
+	{"urgent x3 over 8", bench_urgent},
+	{"urgent after low PA", bench_urgent_pa}
+};
+
+const int n_sim_bench = sizeof(sim_bench) / sizeof(SIM_BENCH);
+
+
+
+/* sim_wait
+ *
+ * Run the main loop tick until sim_done is set or SIM_WAIT_MSEC.
+ */
+void sim_wait(void)
+{
+	int ms;
+
+
+	for(ms=0; (ms < SIM_WAIT_MSEC) && !sim_done; ms++)
+	{
+		sim_run(1000);
+		cc_hal_tick();
+	}
+
+	if(!sim_done)
+		sim_result = -2;
+}
+
+
+/* sim_sent
+ *
+ * Transmit completion callback.
+ */
+void sim_sent(int result)
+{
+	sim_result = result;
+	sim_done = 1;
+}
+
+
+/* sim_peer
+ *
+ * Parameters
+ * pkt			Packet sent by the radio, [LEN][ADDR][DATA...]
+ * n			Bytes
+ *
+ * The peer acks ARQ data packets sent to it, with its turnaround
+ * and signal report.
+ */
+void sim_peer(uint8_t *pkt, int n)
+{
+	uint8_t ack[ARQ_ACK_LEN + 2];
+
+
+	if((n < ARQ_HDR_LEN + 2) || (pkt[1] != SIM_PEER) || (pkt[2] != ARQ_DATA))
+		return;
+
+	ack[0] = ARQ_ACK_LEN + 1;
+	ack[1] = pkt[3];
+	ack[2] = ARQ_ACK;
+	ack[3] = SIM_PEER;
+	ack[4] = pkt[4];
+	ack[5] = (uint8_t)SIM_ACK_USEC;
+	ack[6] = (uint8_t)(SIM_ACK_USEC >> 8);
+	ack[7] = SIM_PEER_RSSI;
+	ack[8] = SIM_PEER_LQI;
+
+	sim_air_rx(ack, sizeof(ack), SIM_ACK_USEC);
+}
+
+
+void bench_reset(void)
+{
+	cc_reset();
+}
+
+
+void bench_config(void)
+{
+	sim_config.profile = cc_find_profile("lowlat");
+	cc_radio_config(&sim_config);
+	cc_gdo_init();
+}
+
+
+void bench_start(void)
+{
+	cc_radio_start();
+	sim_run(200);								// Settle into RX
+}
+
+
+void bench_reg(void)
+{
+	cc_reg_set(ADDR, SIM_ADDR);
+	cc_reg_commit();
+}
+
+
+void bench_status(void)
+{
+	cc_read_status(MARCSTATE);
+}
+
+
+void bench_rssi(void)
+{
+	cc_read_rssi();
+}
+
+
+void bench_channel(void)
+{
+	cc_set_channel(20);
+	sim_run(200);
+}
+
+
+void bench_send(void)
+{
+	sim_done = 0;
+	if(cc_send_pkt(SIM_PEER, sim_data, sizeof(sim_data), sim_sent) < 0)
+		sim_result = -1;
+	else
+		sim_wait();
+}
+
+
+void bench_recv(void)
+{
+	RF_PKT pkt;
+	uint8_t air[2 + sizeof(sim_data)];
+	int ms;
+
+
+	air[0] = sizeof(air) - 1;
+	air[1] = SIM_ADDR;
+	memcpy(air + 2, sim_data, sizeof(sim_data));
+	sim_air_rx(air, sizeof(air), 0);
+
+	sim_result = -2;
+	for(ms=0; ms<SIM_WAIT_MSEC; ms++)
+	{
+		sim_run(1000);
+		cc_hal_tick();
+
+		if(cc_receive_pkt(&pkt))
+		{
+			sim_result = (pkt.len == sizeof(sim_data)) ? 0 : -1;
+			break;
+		}
+	}
+}
+
+
+void bench_rel(void)
+{
+	sim_done = 0;
+	if(cc_send_rel(SIM_PEER, sim_data, sizeof(sim_data), sim_sent) < 0)
+		sim_result = -1;
+	else
+		sim_wait();
+}
+
+
+void bench_scan(void)
+{
+	sim_result = cc_scan(sim_scan, 0, 15, -80);
+}
+
+
+void bench_tick(void)
+{
+	int i;
+
+
+	for(i=0; i<10; i++)
+	{
+		sim_run(1000);
+		cc_hal_tick();
+	}
+}
+
+
+void bench_wor(void)
+{
+	cc_wor_start();
+	sim_run(1000);
+	cc_radio_start();
+}
+
+
+/* bench_urgent
+ *
+ * Three urgent copies preempt a packet that has just been queued.
+ * The packet is sent after them.
+ */
+void bench_urgent(void)
+{
+	sim_done = 0;
+	if(cc_send_pkt(SIM_PEER, sim_data, sizeof(sim_data), sim_sent) < 0)
+	{
+		sim_result = -1;
+		return;
+	}
+
+	cc_send_urgent(3, sim_urgent_build);
+	sim_wait();
+}
+
+
+/* bench_urgent_pa
+ *
+ * An urgent copy right after a packet at the lowest power level must
+ * go at full power.  Result -3 if either packet had the wrong level.
+ */
+void bench_urgent_pa(void)
+{
+	uint32_t sent;
+	int ms;
+
+
+	cc_pa_fixed(0);
+
+	sim_done = 0;
+	if(cc_send_pkt(SIM_PEER, sim_data, sizeof(sim_data), sim_sent) < 0)
+	{
+		sim_result = -1;
+		cc_pa_auto(pa_ctrl.margin);
+		return;
+	}
+	sim_wait();
+
+	if(sim_tx_pa != pa_table[0])
+		sim_result = -3;
+
+	sent = sim_chip.tx_pkts;
+	cc_send_urgent(1, sim_urgent_build);
+
+	for(ms=0; (ms < SIM_WAIT_MSEC) && (sim_chip.tx_pkts == sent); ms++)
+	{
+		sim_run(1000);
+		cc_hal_tick();
+	}
+
+	if(sim_chip.tx_pkts == sent)
+		sim_result = -2;
+	else if(sim_tx_pa != pa_table[PA_LEVEL_MAX])
+		sim_result = -3;
+
+	cc_pa_auto(pa_ctrl.margin);
+}
+
+
+int sim_urgent_build(uint8_t *frame, int rep)
+{
+	frame[0] = 3;
+	frame[1] = 0x00;
+	frame[2] = 0xB7;
+	frame[3] = rep;
+
+	return 4;
+}
+
+
+/* print_hist
+ *
+ * Print the summary of a latency histogram.
+ */
+void print_hist(char *name, LAT_HIST *h)
+{
+	if(h->n == 0)
+	{
+		printf("%-12s no samples\n", name);
+		return;
+	}
+
+	printf("%-12s %lu samples  min %.3f  mean %lu  max %.3f us\n", name,
+		h->n, h->min / 1000.0, h->sum / h->n, h->max / 1000.0);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const SIM_BENCH *b;
+	unsigned long long ns;
+	int i;
+
+
+	for(i=1; i<argc; i++)
+	{
+		if((strcmp(argv[i], "-p") == 0) && (i + 1 < argc))
+		{
+			if(spi_set_profile(argv[++i]) < 0)
+			{
+				printf("Unknown SPI profile %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-t") == 0)
+		{
+			sim_trace = 1;
+		}
+		else
+		{
+			printf("Usage: ccsim [-p fast|safe|slow] [-t]\n");
+			return 1;
+		}
+	}
+
+	cyc_init();
+	timer3_capture_init();
+	sim_reset();
+	sim_set_rssi(-60);
+	sim_tx_hook(sim_peer);
+
+	printf("SPI profile %s: %s\n\n", spi_get_profile()->name, spi_get_profile()->help_txt);
+	printf("%-20s %6s %6s %7s %6s %10s %10s  %s\n",
+		"call", "xfers", "bytes", "strobes", "dma", "bus us", "elapsed us", "result");
+
+	for(i=0; i<n_sim_bench; i++)
+	{
+		b = &sim_bench[i];
+
+		if(sim_trace)
+			printf("-- %s\n", b->name);
+
+		sim_mark = sim_spi;
+		sim_mark_ns = sim_time_ns();
+		sim_result = 0;
+
+		b->fn();
+
+		ns = sim_time_ns() - sim_mark_ns;
+		printf("%-20s %6lu %6lu %7lu %6lu %10.3f %10.3f  %d\n", b->name,
+			sim_spi.xfers - sim_mark.xfers,
+			sim_spi.bytes - sim_mark.bytes,
+			sim_spi.strobes - sim_mark.strobes,
+			sim_spi.dma_bytes - sim_mark.dma_bytes,
+			(sim_spi.bus_ns - sim_mark.bus_ns) / 1000.0,
+			ns / 1000.0, sim_result);
+	}
+
+	printf("\nChip: %lu sent, %lu received, %lu missed, %lu filtered, %lu overflows, "
+		"%lu underflows, %lu interrupts\n",
+		sim_chip.tx_pkts, sim_chip.rx_pkts, sim_chip.rx_missed, sim_chip.rx_filtered,
+		sim_chip.overflow, sim_chip.underflow, sim_chip.irqs);
+	printf("HAL: %lu sent, %lu received, %lu CRC errors, %lu acks\n",
+		tx_stats.tx_pkts, rx_stats.rx_pkts, rx_stats.crc_err, arq_stats.sent);
+	printf("Urgent: %lu copies, %lu packets preempted\n", tx_stats.urgent, tx_stats.preempted);
+	printf("Power: %d dBm to peer, %lu up, %lu down, %lu PATABLE writes\n",
+		pa_dbm[cc_pa_level(SIM_PEER)], pa_ctrl.up, pa_ctrl.down, pa_ctrl.writes);
+	print_hist("Round trip", &lat_rtt);
+	print_hist("One way", &lat_oneway);
+
+	return 0;
+}
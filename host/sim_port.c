@@ -0,0 +1,462 @@
+/*
+ * sim_port.c
+ *
+ * MCU side of the CC2500 simulator: SPI1 and its DMA, the CSn pin,
+ * BASEPRI and the radio interrupts, and the modelled clock.  SPI2 has
+ * no radio.
+ *
+ * Replaces spi.c and gpio.c in the host build.  Every SPI byte costs
+ * bus time at the SCLK rate of the current SPI timing profile, and the
+ * clock moves on by that time.  DWT->CYCCNT and TIM3->CNT follow the
+ * clock, so cyc_count() timings in the driver read modelled time.
+ *
+ * Interrupts run when they are raised if BASEPRI is clear and no
+ * handler is running, otherwise when cc_unlock() clears BASEPRI or
+ * sim_run() moves the clock on.
+ */
+
+#include <string.h>
+#include "stm32f103xb.h"
+#include "gpio.h"
+#include "spi.h"
+#include "sim.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+void EXTI0_IRQHandler(void);
+void TIM3_IRQHandler(void);
+
+
+GPIO_TypeDef sim_gpioa;
+GPIO_TypeDef sim_gpiob;
+AFIO_TypeDef sim_afio;
+EXTI_TypeDef sim_exti;
+TIM_TypeDef sim_tim2;
+TIM_TypeDef sim_tim3_regs;
+TIM_TypeDef sim_tim4;
+DWT_Type sim_dwt_regs;
+CoreDebug_Type sim_coredebug;
+
+SIM_SPI_STATS sim_spi;
+int sim_trace;
+
+unsigned long long sim_ns;				// Modelled time
+uint32_t sim_basepri;
+uint32_t sim_pending;					// One bit per IRQn
+int sim_in_isr;
+
+// Same profiles as spi.c
+const SPI_PROFILE spi_profiles[] =
+{
+	{"fast", SPI_DIV4,   SPI_DIV8,   "8MHz single, 4MHz burst"},
+	{"safe", SPI_DIV16,  SPI_DIV16,  "2MHz single and burst"},
+	{"slow", SPI_DIV256, SPI_DIV256, "125kHz single and burst"}
+};
+
+const int n_spi_profiles = sizeof(spi_profiles) / sizeof(SPI_PROFILE);
+
+const SPI_PROFILE *spi_profile = &spi_profiles[0];
+uint8_t spi_baud;
+
+volatile uint8_t spi_dma_active;
+void (*spi_dma_callback)(void);
+
+
+
+/******************************************************************************
+ * Modelled clock.
+ ******************************************************************************/
+
+
+/* sim_time_ns
+ *
+ * Returns
+ * Modelled time since start (nsec).
+ */
+unsigned long long sim_time_ns(void)
+{
+	return sim_ns;
+}
+
+
+/* sim_advance
+ *
+ * Parameters
+ * ns			Time to move on
+ *
+ * Move the clock on and run the chip events that are due.
+ */
+void sim_advance(uint32_t ns)
+{
+	sim_ns += ns;
+	sim_events();
+}
+
+
+/* sim_run
+ *
+ * Parameters
+ * usec			Time to run for
+ *
+ * Let the clock run with the MCU idle, 1usec at a time, taking
+ * interrupts as they come.
+ */
+void sim_run(uint32_t usec)
+{
+	while(usec--)
+	{
+		sim_advance(1000);
+		sim_dispatch();
+	}
+}
+
+
+/* sim_dwt
+ *
+ * Returns
+ * DWT registers with CYCCNT at the modelled time.  Each read of the
+ * cycle counter costs a few CPU cycles, so polling loops end.
+ */
+DWT_Type *sim_dwt(void)
+{
+	sim_advance(SIM_DWT_CYC * 1000000000ULL / SIM_CPU_HZ);
+	sim_dwt_regs.CYCCNT = (uint32_t)(sim_ns * SIM_CPU_HZ / 1000000000ULL);
+
+	return &sim_dwt_regs;
+}
+
+
+/* sim_tim3
+ *
+ * Returns
+ * TIM3 registers with CNT at the modelled time.  TIM3 runs at the CPU
+ * clock, as set up by timer3_capture_init().
+ */
+TIM_TypeDef *sim_tim3(void)
+{
+	sim_tim3_regs.CNT = (uint16_t)(sim_ns * SIM_CPU_HZ / 1000000000ULL);
+
+	return &sim_tim3_regs;
+}
+
+
+/* sim_capture
+ *
+ * Parameters
+ * edge			1 for GDO0 rising (sync word), 0 for falling (end of packet)
+ *
+ * Drive the GDO0 pin.  TIM3 captures the edge on IC3 or IC4 and the
+ * falling edge sets the EXTI0 pending flag.
+ */
+void sim_capture(int edge)
+{
+	TIM_TypeDef *tim;
+
+
+	tim = sim_tim3();
+
+	if(edge)
+	{
+		GPIOB->IDR |= 0x01;
+
+		if((tim->CR1 & TIM_CR1_CEN) && (tim->CCER & TIM_CCER_CC3E))
+		{
+			if(tim->SR & TIM_SR_CC3IF)
+				tim->SR |= TIM_SR_CC3OF;
+			tim->CCR3 = tim->CNT;
+			tim->SR |= TIM_SR_CC3IF;
+
+			if(tim->DIER & TIM_DIER_CC3IE)
+				sim_irq(TIM3_IRQn);
+		}
+		return;
+	}
+
+	GPIOB->IDR &= ~0x01;
+
+	if((tim->CR1 & TIM_CR1_CEN) && (tim->CCER & TIM_CCER_CC4E))
+	{
+		if(tim->SR & TIM_SR_CC4IF)
+			tim->SR |= TIM_SR_CC4OF;
+		tim->CCR4 = tim->CNT;
+		tim->SR |= TIM_SR_CC4IF;
+	}
+
+	if((EXTI->IMR & EXTI_IMR_MR0) && (EXTI->FTSR & EXTI_FTSR_TR0))
+		sim_irq(EXTI0_IRQn);
+}
+
+
+
+/******************************************************************************
+ * Interrupts.
+ ******************************************************************************/
+
+
+/* sim_irq
+ *
+ * Parameters
+ * irq			Interrupt to make pending
+ */
+void sim_irq(IRQn_Type irq)
+{
+	sim_pending |= 1UL << irq;
+}
+
+
+/* sim_dispatch
+ *
+ * Run the pending interrupt handlers, lowest IRQn first, if BASEPRI
+ * and the running handler allow.  All the radio interrupts are at
+ * CC_IRQ_PRIORITY, so they don't nest.
+ */
+void sim_dispatch(void)
+{
+	if(sim_in_isr || sim_basepri)
+		return;
+
+	sim_in_isr = 1;
+
+	while(sim_pending)
+	{
+		sim_chip.irqs++;
+
+		if(sim_pending & (1UL << EXTI0_IRQn))
+		{
+			sim_pending &= ~(1UL << EXTI0_IRQn);
+			EXTI0_IRQHandler();
+		}
+		else if(sim_pending & (1UL << DMA1_Channel2_IRQn))
+		{
+			sim_pending &= ~(1UL << DMA1_Channel2_IRQn);
+			spi_dma_poll();
+		}
+		else if(sim_pending & (1UL << TIM3_IRQn))
+		{
+			sim_pending &= ~(1UL << TIM3_IRQn);
+			TIM3_IRQHandler();
+		}
+		else
+		{
+			sim_pending = 0;
+		}
+	}
+
+	sim_in_isr = 0;
+}
+
+
+uint32_t __get_BASEPRI(void)
+{
+	return sim_basepri;
+}
+
+
+void __set_BASEPRI(uint32_t basepri)
+{
+	sim_basepri = basepri;
+
+	if(basepri == 0)
+		sim_dispatch();
+}
+
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+}
+
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+}
+
+
+void NVIC_DisableIRQ(IRQn_Type irq)
+{
+}
+
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	sim_pending &= ~(1UL << irq);
+}
+
+
+
+/******************************************************************************
+ * GPIO, CSn on PB12.
+ ******************************************************************************/
+
+
+void GPIO_Config(GPIO_TypeDef *gpio, uint16_t pin, uint16_t cnf, uint16_t mode)
+{
+}
+
+
+void GPIO_BitSet(GPIO_TypeDef *gpio, uint16_t pin)
+{
+	gpio->ODR |= 1UL << pin;
+
+	if((gpio == GPIOB) && (pin == GPIO_PIN12))
+		sim_cs(0);
+}
+
+
+void GPIO_BitReset(GPIO_TypeDef *gpio, uint16_t pin)
+{
+	gpio->ODR &= ~(1UL << pin);
+
+	if((gpio == GPIOB) && (pin == GPIO_PIN12))
+	{
+		sim_spi.xfers++;
+		sim_spi.bus_ns += SIM_CS_NS;
+		sim_advance(SIM_CS_NS);
+		sim_cs(1);
+	}
+}
+
+
+
+/******************************************************************************
+ * SPI1 and DMA.
+ ******************************************************************************/
+
+
+/* sim_byte_time
+ *
+ * Parameters
+ * dma			1 for a DMA byte, 0 for a polled byte
+ *
+ * Account for one byte on the bus.  SCLK is 32MHz / 2^(BR+1).
+ */
+void sim_byte_time(int dma)
+{
+	uint32_t ns;
+
+
+	ns = 250UL << (spi_baud + 1);			// 8 bits at 32MHz / 2^(BR+1)
+	if(!dma)
+		ns += SIM_POLL_GAP_NS;
+
+	sim_spi.bytes++;
+	sim_spi.bus_ns += ns;
+	sim_advance(ns);
+}
+
+
+int spi_set_profile(char *name)
+{
+	int i;
+
+
+	for(i=0; i<n_spi_profiles; i++)
+	{
+		if(strcmp(name, spi_profiles[i].name) == 0)
+		{
+			spi_profile = &spi_profiles[i];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+const SPI_PROFILE *spi_get_profile(void)
+{
+	return spi_profile;
+}
+
+
+void spi_speed(int access)
+{
+	spi_baud = (access == SPI_BURST) ? spi_profile->burst : spi_profile->single;
+}
+
+
+uint8_t spi_out(uint8_t d)
+{
+	sim_byte_time(0);
+
+	return sim_spi_byte(d);
+}
+
+
+/* spi_dma_xfer
+ *
+ * The bytes go through the model straight away with DMA timing.  The
+ * transfer complete interrupt is then pending.
+ */
+void spi_dma_xfer(uint8_t *tx, uint8_t *rx, uint16_t n, void (*done)(void))
+{
+	uint8_t d;
+	int i;
+
+
+	spi_dma_active = 1;
+	spi_dma_callback = done;
+
+	for(i=0; i<n; i++)
+	{
+		sim_byte_time(1);
+		sim_spi.dma_bytes++;
+
+		d = sim_spi_byte(tx ? tx[i] : 0x00);
+		if(rx)
+			rx[i] = d;
+	}
+
+	sim_irq(DMA1_Channel2_IRQn);
+}
+
+
+int spi_dma_busy(void)
+{
+	return spi_dma_active;
+}
+
+
+void spi_dma_poll(void)
+{
+	void (*done)(void);
+
+
+	if(!spi_dma_active)
+		return;
+
+	sim_pending &= ~(1UL << DMA1_Channel2_IRQn);
+
+	done = spi_dma_callback;
+	spi_dma_callback = NULL;
+	spi_dma_active = 0;
+
+	if(done)
+		done();
+}
+
+
+void spi_dma_wait(void)
+{
+	while(spi_dma_active)
+		spi_dma_poll();
+}
+
+
+
+/* spi2_out
+ *
+ * SPI2 radio 1 isn't modelled, MISO is pulled up.
+ */
+uint8_t spi2_out(uint8_t d)
+{
+	return 0xFF;
+}
+
+
+void spi2_speed(int access)
+{
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# sniff2pcap.py
+#
+# Convert the radio sniffer stream (sniff on) to a pcap file.
+#
+# Frame, see sniff.h:
+# [A5][5A][N][TIME x4][DROPS x2][CHAN][LEN][ADDR][DATA...][RSSI][LQI][CHK]
+#
+# Each pcap record is [CHAN][LEN][ADDR][DATA...][RSSI][LQI] with link
+# type USER0 (147).  LQI bit 7 is CRC_OK.  Gaps reported in DROPS and
+# bad frames are counted on stderr.
+#
+# Usage: sniff2pcap.py [-b baud] input output.pcap
+# input			Capture file, or the serial port with -b (needs pyserial)
+# -b			Read the serial port at this baud rate, until Ctrl-C
+
+import struct
+import sys
+
+SYNC = b'\xa5\x5a'
+LINKTYPE_USER0 = 147
+SNAPLEN = 256
+
+
+def frames(src):
+	buf = b''
+	while True:
+		data = src.read(256)
+		if not data:
+			return
+		buf += data
+
+		while True:
+			i = buf.find(SYNC)
+			if i < 0:
+				buf = buf[-1:]
+				break
+			if len(buf) < i + 3:
+				buf = buf[i:]
+				break
+
+			n = buf[i + 2]
+			if len(buf) < i + 4 + n:
+				buf = buf[i:]
+				break
+
+			body = buf[i + 2:i + 3 + n]
+			chk = 0
+			for b in body:
+				chk ^= b
+
+			if (n < 9) or (chk != buf[i + 3 + n]) or (body[8] + 3 != n - 7):
+				yield None					# Bad frame, resync after the sync bytes
+				buf = buf[i + 2:]
+				continue
+
+			yield body[1:]
+			buf = buf[i + 4 + n:]
+
+
+def main():
+	args = sys.argv[1:]
+	baud = None
+	if len(args) == 4 and args[0] == '-b':
+		baud = int(args[1])
+		args = args[2:]
+	if len(args) != 2:
+		sys.exit('Usage: sniff2pcap.py [-b baud] input output.pcap')
+
+	if baud:
+		import serial
+		src = serial.Serial(args[0], baud, timeout=1)
+		src.write(b'sniff on %d\r' % baud)
+	else:
+		src = open(args[0], 'rb')
+
+	out = open(args[1], 'wb')
+	out.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, SNAPLEN, LINKTYPE_USER0))
+
+	usec = 0
+	last = None
+	pkts = drops = bad = 0
+
+	try:
+		for f in frames(src):
+			if f is None:
+				bad += 1
+				continue
+
+			time, lost = struct.unpack_from('<IH', f)
+			if last is not None:
+				usec += (time - last) & 0xFFFFFFFF		# TIME wraps
+			last = time
+			drops += lost
+			pkts += 1
+
+			rec = f[6:]								# CHAN to LQI
+			out.write(struct.pack('<IIII', usec // 1000000, usec % 1000000, len(rec), len(rec)))
+			out.write(rec)
+	except KeyboardInterrupt:
+		pass
+
+	if baud:
+		src.write(b'sniff off\r')
+
+	out.close()
+	sys.stderr.write('%d packets, %d dropped, %d bad frames\n' % (pkts, drops, bad))
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,145 @@
+/*
+ * stm32f103xb.h
+ *
+ * Host replacement for the CMSIS device header, used by the CC2500
+ * simulator.  The host build puts this directory first on the include
+ * path, so the radio driver compiles unchanged against it.
+ *
+ * Only the peripherals the radio driver and timer.c touch are here.
+ * They are plain structures in host memory.  DWT and TIM3 are reached
+ * through functions so the simulator can keep the cycle counter and
+ * the TIM3 counter up to date with the modelled time.
+ *
+ * The fixed width types match types.h (uint32_t is unsigned long, so
+ * 64 bits on an LP64 host).  The driver only uses differences of cycle
+ * counts, which are not affected until the counter would have wrapped.
+ */
+
+#ifndef STM32F103XB_H
+#define STM32F103XB_H
+
+
+typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned long uint32_t;
+typedef signed char int8_t;
+typedef short int16_t;
+typedef int int32_t;
+
+#define __IO	volatile
+#define __I		volatile const
+
+#define __NVIC_PRIO_BITS	4
+
+// Interrupt service routines are plain functions on the host
+#define interrupt(x)	__used__
+
+
+typedef enum {
+	EXTI0_IRQn = 6,
+	EXTI1_IRQn = 7,
+	EXTI3_IRQn = 9,
+	DMA1_Channel2_IRQn = 12,
+	TIM2_IRQn = 28,
+	TIM3_IRQn = 29,
+	TIM4_IRQn = 30,
+	USART2_IRQn = 38
+} IRQn_Type;
+
+
+typedef struct {
+	__IO uint32_t CRL, CRH, IDR, ODR, BSRR, BRR, LCKR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t EVCR, MAPR, EXTICR[4], MAPR2;
+} AFIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t IMR, EMR, RTSR, FTSR, SWIER, PR;
+} EXTI_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR,
+				RCR, CCR1, CCR2, CCR3, CCR4, BDTR, DCR, DMAR;
+} TIM_TypeDef;
+
+typedef struct {
+	__IO uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	__IO uint32_t DHCSR, DCRSR, DCRDR, DEMCR;
+} CoreDebug_Type;
+
+
+extern GPIO_TypeDef sim_gpioa;
+extern GPIO_TypeDef sim_gpiob;
+extern AFIO_TypeDef sim_afio;
+extern EXTI_TypeDef sim_exti;
+extern TIM_TypeDef sim_tim2;
+extern TIM_TypeDef sim_tim4;
+extern CoreDebug_Type sim_coredebug;
+
+DWT_Type *sim_dwt(void);
+TIM_TypeDef *sim_tim3(void);
+
+#define GPIOA		(&sim_gpioa)
+#define GPIOB		(&sim_gpiob)
+#define AFIO		(&sim_afio)
+#define EXTI		(&sim_exti)
+#define TIM2		(&sim_tim2)
+#define TIM3		(sim_tim3())
+#define TIM4		(&sim_tim4)
+#define DWT			(sim_dwt())
+#define CoreDebug	(&sim_coredebug)
+
+
+// Core
+uint32_t __get_BASEPRI(void);
+void __set_BASEPRI(uint32_t basepri);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+
+#define DWT_CTRL_CYCCNTENA_Msk			0x00000001
+#define CoreDebug_DEMCR_TRCENA_Msk		0x01000000
+
+// AFIO
+#define AFIO_EXTICR1_EXTI0				0x000F
+#define AFIO_EXTICR1_EXTI0_PB			0x0001
+#define AFIO_EXTICR1_EXTI1				0x00F0
+#define AFIO_EXTICR1_EXTI1_PB			0x0010
+
+// EXTI
+#define EXTI_IMR_MR0					0x0001
+#define EXTI_IMR_MR1					0x0002
+#define EXTI_RTSR_TR0					0x0001
+#define EXTI_RTSR_TR1					0x0002
+#define EXTI_FTSR_TR0					0x0001
+#define EXTI_FTSR_TR1					0x0002
+#define EXTI_PR_PR0						0x0001
+#define EXTI_PR_PR1						0x0002
+
+// TIM
+#define TIM_CR1_CEN						0x0001
+#define TIM_DIER_UIE					0x0001
+#define TIM_DIER_CC3IE					0x0008
+#define TIM_DIER_CC4IE					0x0010
+#define TIM_SR_CC3IF					0x0008
+#define TIM_SR_CC4IF					0x0010
+#define TIM_SR_CC3OF					0x0800
+#define TIM_SR_CC4OF					0x1000
+#define TIM_CCMR2_CC3S_0				0x0001
+#define TIM_CCMR2_CC4S_0				0x0100
+#define TIM_CCMR2_CC4S_1				0x0200
+#define TIM_CCMR2_OC3M					0x0070
+#define TIM_CCMR2_OC4M					0x7000
+#define TIM_CCER_CC3E					0x0100
+#define TIM_CCER_CC3P					0x0200
+#define TIM_CCER_CC4E					0x1000
+#define TIM_CCER_CC4P					0x2000
+
+
+#endif /* STM32F103XB_H */
@@ -0,0 +1,237 @@
+/*
+ * loco.c
+ *
+ * Outbound locomotive control queue.
+ *
+ * Throttle input can change a locomotive's speed many times while one
+ * frame is on air.  Each locomotive has one entry holding its latest
+ * state.  A new setting overwrites the entry and marks it pending, so
+ * a burst of updates becomes one frame with the final value.
+ *
+ * Pending entries are sent when the radio transmit queue is empty.
+ * One frame per locomotive is sent to its own address, or with
+ * loco_multi set all pending locomotives go in one broadcast frame.
+ * With authentication on, frames are signed before they are queued.
+ *
+ */
+
+#include "types.h"
+#include "cc_hal.h"
+#include "ctrl_frame.h"
+#include "auth.h"
+#include "loco.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+LOCO loco_table[LOCO_MAX];
+LOCO_STATS loco_stats;
+uint8_t loco_multi;						// Pack pending locomotives in one frame
+uint8_t loco_next;						// Round robin start for single frames
+
+
+
+/* loco_set
+ *
+ * Parameters
+ * addr			Locomotive address
+ * speed		Speed [-512 to 512], negative is reverse
+ * func			Function bits F0-F4
+ * flags		CTRL_F_ flags
+ *
+ * Returns
+ * 0 on success, -1 if the table is full.
+ *
+ * Set a locomotive's state for the next frame.  An update that hasn't
+ * been sent yet is replaced.  At speed 0 the direction is kept.
+ */
+int loco_set(uint8_t addr, int speed, uint8_t func, uint8_t flags)
+{
+	LOCO *loco;
+	int i;
+
+
+	loco_stats.updates++;
+
+	loco = NULL;
+	for(i=0; i<LOCO_MAX; i++)
+	{
+		if(loco_table[i].used && (loco_table[i].rec.addr == addr))
+		{
+			loco = &loco_table[i];
+			break;
+		}
+
+		if(!loco_table[i].used && (loco == NULL))
+			loco = &loco_table[i];
+	}
+
+	if(loco == NULL)
+	{
+		loco_stats.full++;
+		return -1;
+	}
+
+	if(!loco->used)
+	{
+		loco->used = 1;
+		loco->pending = 0;
+		loco->rec.addr = addr;
+		loco->rec.dir = 1;
+		loco->rec.seq = 0;
+	}
+
+	if(loco->pending)
+		loco_stats.coalesced++;
+
+	loco->rec.speed = speed;
+	if(speed != 0)
+		loco->rec.dir = (speed > 0);
+	loco->rec.func = func;
+	loco->rec.flags = flags;
+	loco->pending = 1;
+
+	return 0;
+}
+
+
+/* loco_set_speed
+ *
+ * Parameters
+ * addr			Locomotive address
+ * speed		Speed [-512 to 512], negative is reverse
+ *
+ * Returns
+ * 0 on success, -1 if the table is full.
+ *
+ * Change only the speed, functions are kept and flags cleared.
+ */
+int loco_set_speed(uint8_t addr, int speed)
+{
+	int i;
+
+
+	for(i=0; i<LOCO_MAX; i++)
+	{
+		if(loco_table[i].used && (loco_table[i].rec.addr == addr))
+			return loco_set(addr, speed, loco_table[i].rec.func, 0);
+	}
+
+	return loco_set(addr, speed, 0, 0);
+}
+
+
+/* loco_flush
+ *
+ * Called from the main loop.
+ * Sends pending locomotives when the radio transmit queue is empty.
+ */
+void loco_flush(void)
+{
+	CTRL_REC recs[LOCO_MAX_RECS];
+	uint8_t frame[RF_MAX_DATA];
+	uint8_t addr;
+	int n;
+	int len;
+	int i;
+	int j;
+
+
+	if(cc_tx_queued() || !loco_pending())
+		return;
+
+	n = 0;
+	addr = LOCO_BCAST_ADDR;
+
+	for(j=0; (j<LOCO_MAX) && (n<LOCO_MAX_RECS); j++)
+	{
+		i = (loco_next + j) % LOCO_MAX;
+
+		if(!loco_table[i].pending)
+			continue;
+
+		recs[n++] = loco_table[i].rec;
+
+		if(!loco_multi)
+		{
+			addr = loco_table[i].rec.addr;
+			loco_next = (i + 1) % LOCO_MAX;
+			break;
+		}
+	}
+
+	len = ctrl_encode(frame, sizeof(frame), recs, n);
+
+	if(auth_mode == AUTH_ON)
+		len = auth_sign(addr, frame, len, sizeof(frame));
+	if(len < 0)
+		return;
+
+	if(cc_send_pkt(addr, frame, len, NULL) < 0)
+		return;
+
+	// Sent, clear the pending entries
+	for(j=0; j<n; j++)
+	{
+		for(i=0; i<LOCO_MAX; i++)
+		{
+			if(loco_table[i].used && (loco_table[i].rec.addr == recs[j].addr))
+			{
+				loco_table[i].pending = 0;
+				loco_table[i].rec.seq = (loco_table[i].rec.seq + 1) & CTRL_SEQ_MASK;
+				break;
+			}
+		}
+	}
+
+	loco_stats.frames++;
+	loco_stats.records += n;
+}
+
+
+/* loco_pending
+ *
+ * Returns
+ * No. of locomotives waiting to be sent.
+ */
+int loco_pending(void)
+{
+	int n;
+	int i;
+
+
+	n = 0;
+	for(i=0; i<LOCO_MAX; i++)
+	{
+		if(loco_table[i].pending)
+			n++;
+	}
+
+	return n;
+}
+
+
+/* loco_clear
+ *
+ * Empty the table and clear the statistics.
+ */
+void loco_clear(void)
+{
+	int i;
+
+
+	for(i=0; i<LOCO_MAX; i++)
+	{
+		loco_table[i].used = 0;
+		loco_table[i].pending = 0;
+	}
+
+	loco_stats.updates = 0;
+	loco_stats.coalesced = 0;
+	loco_stats.frames = 0;
+	loco_stats.records = 0;
+	loco_stats.full = 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * loco.h
+ *
+ * Outbound locomotive control queue.
+ *
+ */
+
+#ifndef LOCO_H_
+#define LOCO_H_
+
+#include "types.h"
+#include "cc_hal.h"
+#include "ctrl_frame.h"
+#include "auth.h"
+
+
+#define LOCO_MAX		16				// Locomotives in the table
+#define LOCO_BCAST_ADDR	0x00			// Multi-record frames
+#define LOCO_MAX_RECS	((RF_MAX_DATA - CTRL_HDR_LEN - AUTH_TRAILER_LEN) / CTRL_REC_LEN)
+
+// Locomotive state, the last values set
+typedef struct {
+	CTRL_REC rec;
+	uint8_t used;
+	uint8_t pending;					// Changed since last sent
+} LOCO;
+
+// Queue statistics
+typedef struct {
+	uint32_t updates;					// loco_set() calls
+	uint32_t coalesced;					// Updates that replaced a pending one
+	uint32_t frames;					// Frames sent
+	uint32_t records;					// Records sent
+	uint32_t full;						// Updates dropped, table full
+} LOCO_STATS;
+
+extern LOCO loco_table[LOCO_MAX];
+extern LOCO_STATS loco_stats;
+extern uint8_t loco_multi;
+
+
+int loco_set(uint8_t addr, int speed, uint8_t func, uint8_t flags);
+int loco_set_speed(uint8_t addr, int speed);
+void loco_flush(void);
+int loco_pending(void);
+void loco_clear(void);
+
+#endif /* LOCO_H_ */
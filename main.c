@@ -17,6 +17,16 @@
 #include "led.h"
 #include "cc2500_regs.h"
 #include "cc_hal.h"
+#include "fhss.h"
+#include "tdma.h"
+#include "power.h"
+#include "ctrl_frame.h"
+#include "loco.h"
+#include "auth.h"
+#include "ota.h"
+#include "dual.h"
+#include "sniff.h"
+#include "estop.h"
 #include "textio.h"
 #include "pwm.h"
 
@@ -33,6 +43,7 @@
 #define SPI2_clk_enable()	(RCC->APB1ENR |= RCC_APB1ENR_SPI2EN)
 
 
+#define AFIO_clk_enable()	(RCC->APB2ENR |= RCC_APB2ENR_AFIOEN)
 #define GPIOA_clk_enable()	(RCC->APB2ENR |= RCC_APB2ENR_IOPAEN)
 #define GPIOB_clk_enable()	(RCC->APB2ENR |= RCC_APB2ENR_IOPBEN)
 #define GPIOC_clk_enable()	(RCC->APB2ENR |= RCC_APB2ENR_IOPCEN)
@@ -52,6 +63,8 @@ void speed_adjust_mode(char c);
 void gpio_init(void);
 void delay(int t);
 uint16_t read_key(void);
+void rx_pkt_proc(RF_PKT *pkt);
+void ctrl_print(uint8_t *frame, int len);
 
 
 
@@ -76,6 +89,9 @@ char x;
 uint8_t freq[3];
 uint8_t regs[0x30];
 
+RF_CONFIG rf_config;
+RF_PKT rx_pkt;
+
 extern int cmd_mode;
 
 
@@ -92,6 +108,7 @@ int main(void)
 	BKP_clk_enable();		// Enable clock to Backup domain registers.
 
 	DMA1_clk_enable();		// Enable DMA1 clock.
+		// DMA1 channels 2 and 3 are used for SPI1 bursts to the CC2500.
 
 	USART2_clk_enable();	// Enable USART2 clock.
 		// USART2 clock source is PCKL1 for APB1 peripherals.
@@ -112,32 +129,58 @@ int main(void)
 
 	SPI2_clk_enable();
 
+	AFIO_clk_enable();		// Enable AFIO clock.
+		// Needed to select the EXTI line source ports.
+
 	ADC_prescaler(ADC_PRE_DIV4);		// ADCCLK = PCLK2/4 = 8MHz
 	ADC1_clk_enable();					// Enable ADC1 clock.
 
 
 	// Hardware initialization
+	cyc_init();
 	gpio_init();
 	uart2_init();
 	timer2_init();
 	//timer3_init();
+	timer3_capture_init();
 	timer4_init();
 	spi_init();
+	spi_dma_init();
 	spi2_init();
 	adc1_init();
+	power_init();
 
 	led_off();
 
 	// Interrupt priorities and enable
-	NVIC_SetPriority(TIM2_IRQn, 0);					// Set priority of TIM2 interrupt
+	NVIC_SetPriority(TIM2_IRQn, CC_IRQ_PRIORITY);	// TIM2 runs the hop scheduler
 	NVIC_EnableIRQ(TIM2_IRQn);						// Enable TIM2 interrupt
 
 	NVIC_SetPriority(USART2_IRQn, 0);				// Set UART2 interrupt priority
 	NVIC_EnableIRQ(USART2_IRQn);					// Enable UART2 interrupt.
 
+	NVIC_SetPriority(EXTI0_IRQn, CC_IRQ_PRIORITY);	// CC2500 GDO0 interrupt priority
+	NVIC_SetPriority(TIM3_IRQn, CC_IRQ_PRIORITY);	// GDO0 sync word timestamp
+
+	NVIC_SetPriority(EXTI1_IRQn, CC_IRQ_PRIORITY);	// CC2500 GDO2 FIFO threshold
+	NVIC_SetPriority(EXTI9_5_IRQn, CC_IRQ_PRIORITY);	// Radio 1 GDO0, masked in EXTI until used
+	NVIC_EnableIRQ(EXTI9_5_IRQn);
+	NVIC_SetPriority(DMA1_Channel2_IRQn, CC_IRQ_PRIORITY);	// SPI1 RX DMA complete
+	NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+	NVIC_SetPriority(DMA1_Channel7_IRQn, CC_IRQ_PRIORITY);	// USART2 TX DMA, sniffer stream
+	NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+	NVIC_SetPriority(EXTI3_IRQn, 0);				// USART2 RX wake-up from STOP
+	NVIC_EnableIRQ(EXTI3_IRQn);
+
+	NVIC_SetPriority(EXTI15_10_IRQn, ESTOP_IRQ_PRIORITY);	// User button e-stop, brakes
+	NVIC_SetPriority(ESTOP_SWI_IRQn, CC_IRQ_PRIORITY);	// E-stop broadcast
+	NVIC_EnableIRQ(ESTOP_SWI_IRQn);
+
 	__enable_irq();									// Enable interrupts
 
 	GPIO_BitSet(GPIOB, GPIO_PIN12);					// CSn high
+	GPIO_BitSet(GPIOA, GPIO_PIN4);					// Radio 1 CSn high
 
 	// Reset message.
 	print_str("\n\nRCC\n");
@@ -153,9 +196,21 @@ int main(void)
 
 	cc_reset();										// Send reset command to CC2500
 	print_str("CC2500 Reset\n");
+	delay(100);										// Wait for CC2500 to come out of reset
+
+	rf_config.profile = cc_find_profile("lowlat");
+	cc_radio_config(&rf_config);
+	cc_gdo_init();
+	NVIC_EnableIRQ(EXTI0_IRQn);						// Enable GDO0 interrupt
+	NVIC_EnableIRQ(EXTI1_IRQn);						// Enable GDO2 interrupt
+	NVIC_EnableIRQ(TIM3_IRQn);						// Enable GDO0 timestamps
+	cc_radio_start();								// Radio in receive state
 
 	pwm_out(0);										// Both FWD and REV PWM output off.
 
+	estop_init();									// User button and e-stop frames
+	NVIC_EnableIRQ(EXTI15_10_IRQn);
+
 	cmd_proc_init();
 
 	while(1)
@@ -171,11 +226,28 @@ int main(void)
 				cmd_proc(c);
 		}
 
+		// Radio receive
+		if(cc_receive_pkt(&rx_pkt))					// Packets queued by GDO0 ISR
+		{
+			if(!fhss_rx(&rx_pkt) && !tdma_rx(&rx_pkt) &&	// Beacons
+				!ota_rx(&rx_pkt))							// Firmware update
+				rx_pkt_proc(&rx_pkt);
+		}
+
+		// Locomotive control, latest values when the transmitter is free
+		loco_flush();
+
+		// Firmware update
+		ota_poll();
+
 		// Timer tick 1msec
 		if(tick_msec)								// Incremented by timer ISR
 		{
 			tick_msec--;							// Decrement with atomic operation
 
+			cc_hal_tick();							// Radio transmit supervision
+			dual_tick();							// Radio 1 follows radio 0's channel
+			ota_tick();								// Firmware update timers
 
 			// 10msec
 			if(!count_10msec)
@@ -200,6 +272,9 @@ int main(void)
 			}
 			count_1sec--;
 		}
+
+		// Low power receive
+		power_sleep();								// STOP until packet or command
 	}
 
 	return 0;
@@ -222,6 +297,7 @@ void gpio_init(void)
 	GPIO_Config(GPIOA, GPIO_PIN1, GPIO_PP, GPIO_OUT_10MHz);			// PA1 Output Push-pull.
 	GPIO_Config(GPIOA, GPIO_PIN2, ALT_FUNC_PP, GPIO_OUT_10MHz);		// PA2/UART2_TX set to alternate function output
 	GPIO_Config(GPIOA, GPIO_PIN3, GPIO_FLOAT, GPIO_IN);				// PA3/USART2_RX set to floating input
+	GPIO_Config(GPIOA, GPIO_PIN4, GPIO_PP, GPIO_OUT_10MHz);			// PA4 Radio 1 CC2500 CSn
 
 	GPIO_Config(GPIOA, GPIO_PIN5, ALT_FUNC_PP, GPIO_OUT_10MHz);		// PA5 alternate function output (SPI1_SCK)
 	GPIO_Config(GPIOA, GPIO_PIN6, GPIO_FLOAT, GPIO_IN);				// PA6 alternate function input (SPI1_MISO)
@@ -232,17 +308,24 @@ void gpio_init(void)
 	//------
 	GPIOB_clk_enable();
 
+	GPIO_Config(GPIOB, GPIO_PIN0, GPIO_FLOAT, GPIO_IN);				// PB0 Input, CC2500 GDO0
+
 	GPIO_Config(GPIOB, GPIO_PIN1, GPIO_PULL, GPIO_IN);				// PB1 Input,pull-up
 	GPIOB->ODR |= (1UL<<1);
 
+	GPIO_Config(GPIOB, GPIO_PIN5, GPIO_PULL, GPIO_IN);				// PB5 Input, radio 1 GDO0
+	GPIOB->ODR &= ~(1UL<<5);										// Pull-down, no radio fitted
+
 	// PWM outputs
 	GPIO_Config(GPIOB, GPIO_PIN8, ALT_FUNC_PP, GPIO_OUT_10MHz);		// PB8 TIM4_CH3
 	GPIO_Config(GPIOB, GPIO_PIN9, ALT_FUNC_PP, GPIO_OUT_10MHz);		// PB9 TIM4_CH4
 
-	// SPI2
-	GPIO_Config(GPIOB, GPIO_PIN12, GPIO_PP, GPIO_OUT_10MHz);		// PB12 SPI2_NSS
+	GPIO_Config(GPIOB, GPIO_PIN12, GPIO_PP, GPIO_OUT_10MHz);		// PB12 Radio 0 CC2500 CSn (SPI1)
+
+	// SPI2, radio 1
 	GPIO_Config(GPIOB, GPIO_PIN13, ALT_FUNC_PP, GPIO_OUT_10MHz);	// PB13 SPI2_SCK
-	GPIO_Config(GPIOB, GPIO_PIN14, GPIO_FLOAT, GPIO_IN);			// PB14 SPI2_MISO
+	GPIO_Config(GPIOB, GPIO_PIN14, GPIO_PULL, GPIO_IN);			// PB14 SPI2_MISO
+	GPIOB->ODR |= (1UL<<14);										// Pull-up, 0xFF with no radio fitted
 	GPIO_Config(GPIOB, GPIO_PIN15, ALT_FUNC_PP, GPIO_OUT_10MHz);	// PB15 SPI2_MOSI
 
 
@@ -250,13 +333,101 @@ void gpio_init(void)
 	//------
 	GPIOC_clk_enable();								// Enable clock to GPIOC
 
-	// PC13 to GPIO input. (User P/B)
+	// PC13 to GPIO input. (User P/B, e-stop)
 	GPIO_Config(GPIOC, GPIO_PIN13, GPIO_FLOAT, GPIO_IN);
 
 
 }
 
 
+/* rx_pkt_proc
+ *
+ * Process a packet from the radio receive queue.
+ * Prints control frame records, or the packet address, length and
+ * data in hex.  With authentication on, only control frames with a
+ * good tag and a new counter are used.
+ */
+void rx_pkt_proc(RF_PKT *pkt)
+{
+	char s[8];
+	int n;
+	int i;
+
+
+	if(auth_is_frame(pkt->data, pkt->len))
+	{
+		n = auth_verify(pkt->addr, pkt->data, pkt->len);
+		if(n > 0)
+			ctrl_print(pkt->data, n);
+		return;
+	}
+
+	if(ctrl_is_frame(pkt->data, pkt->len))
+	{
+		if(auth_mode == AUTH_ON)
+			auth_stats.unauth++;
+		else
+			ctrl_print(pkt->data, pkt->len);
+		return;
+	}
+
+	print_str("RX ");
+	ByteToHex(s, pkt->addr);
+	print_str(s);
+	print_str(" ");
+	ByteToHex(s, pkt->len);
+	print_str(s);
+	print_str(":");
+
+	for(i=0; i<pkt->len; i++)
+	{
+		print_str(" ");
+		ByteToHex(s, pkt->data[i]);
+		print_str(s);
+	}
+	print_str("\n");
+}
+
+
+/* ctrl_print
+ *
+ * Parameters
+ * frame		Control frame
+ * len			Frame length
+ *
+ * Print each record of a received control frame.
+ */
+void ctrl_print(uint8_t *frame, int len)
+{
+	CTRL_REC rec[CTRL_MAX_RECS];
+	char s[12];
+	int n;
+	int i;
+
+
+	n = ctrl_decode(frame, len, rec, CTRL_MAX_RECS);
+
+	for(i=0; i<n; i++)
+	{
+		print_str("LOCO ");
+		ByteToHex(s, rec[i].addr);
+		print_str(s);
+		print_str(" speed ");
+		print_str(IntToStr(rec[i].speed, s, 10));
+		print_str(rec[i].dir ? " fwd" : " rev");
+		print_str(" func ");
+		ByteToHex(s, rec[i].func);
+		print_str(s);
+		print_str(" seq ");
+		print_str(IntToStr(rec[i].seq, s, 10));
+		print_str(" flags ");
+		ByteToHex(s, rec[i].flags);
+		print_str(s);
+		print_str("\n");
+	}
+}
+
+
 /*
  *
  */
@@ -287,6 +458,8 @@ void delay(int t)
  * Global variable tick_ms is incremented in this handler every 1msec.
  * The main loop decrements the variable.
  *
+ * The frequency hopping and TDMA slots and the capture clock are timed
+ * here.
  */
 void __attribute__((interrupt("IRQ")))TIM2_IRQHandler(void)
 {
@@ -294,6 +467,10 @@ void __attribute__((interrupt("IRQ")))TIM2_IRQHandler(void)
 
 	tick_msec++;						// Set 1msec tick flag
 
+	fhss_tick();						// Hop scheduler
+	tdma_tick();						// Slot scheduler
+	sniff_tick();						// Capture clock
+
 }
 
 
@@ -0,0 +1,880 @@
+/*
+ * ota.c
+ *
+ * Over-the-air firmware update.
+ *
+ * The sender copies its own application to a receiver, so a base
+ * station flashed with SWD can update its locomotives by radio.
+ *
+ * The sender starts the update with an ARQ packet giving the image size
+ * and CRC.  The receiver erases its staging area and acks.  Pages then
+ * go as bulk packets, OTA_WINDOW at a time, and the receiver acks with
+ * the next page it wants after programming the window.  Pages out of
+ * order or lost are sent again from that page (go back N).
+ *
+ * When a layout key is set (auth.c) the start message is signed, and a
+ * receiver with a key refuses a start that is unsigned, has a bad tag
+ * or is a replay.  The signed start also carries a SipHash MAC of the
+ * whole image, which the receiver checks before committing: the pages
+ * themselves aren't signed, and the CRC is no defence against pages
+ * made to match it.
+ *
+ * Acks carry the receiver's address, and the sender only takes acks
+ * from the receiver it is updating.
+ *
+ * When the last page is in, the receiver checks the staging CRC (and
+ * MAC) and commits the update record with one halfword write.  It acks and
+ * restarts, and the boot block copies the new image into place.  An
+ * update that stops part way leaves the application untouched.
+ *
+ * At 250kBaud a page is about 33ms on air and 26ms to program, so a
+ * 59KB image takes under 10 seconds.
+ *
+ */
+
+#include "stm32f103xb.h"
+#include <string.h>
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "ota.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+#define FLASH_KEY1		0x45670123UL
+#define FLASH_KEY2		0xCDEF89ABUL
+
+// End of the image in flash, from the linker script
+extern uint32_t _eimage;
+
+
+// Page buffer
+typedef struct {
+	volatile uint8_t full;
+	uint16_t page;
+	uint8_t data[OTA_DATA_LEN];
+} OTA_BUF;
+
+
+uint8_t ota_state;
+uint8_t ota_peer;					// Other end of the update
+uint32_t ota_size;
+uint32_t ota_crc_val;
+uint8_t ota_mac[AUTH_MAC_LEN];		// Image MAC from a signed start
+uint8_t ota_mac_valid;
+uint16_t ota_n_pages;
+uint16_t ota_next;					// Receiver: next page to program.  Sender: first page of the window.
+uint16_t ota_sent;					// Sender: next page to send
+uint8_t ota_tries;
+uint16_t ota_timer;					// msec in the current state
+uint32_t ota_msec;					// msec since the start
+volatile uint8_t ota_busy;			// Bulk or ack packet in progress
+volatile uint8_t ota_ack_sent;
+uint8_t ota_ack_status;
+int8_t ota_armed;					// Buffer waiting in cc_bulk_recv(), -1 if none
+OTA_BUF ota_buf[OTA_WINDOW];
+OTA_STATS ota_stats;
+
+
+int ota_send_start(void);
+void ota_send_page(void);
+int ota_start_ok(RF_PKT *pkt);
+void ota_start(uint8_t src, uint8_t *msg);
+void ota_send_ack(uint8_t status);
+void ota_ack_done(int result);
+void ota_arm(void);
+void ota_page_done(int result);
+void ota_sent_done(int result);
+void ota_program(void);
+void ota_commit(void);
+
+
+
+/******************************************************************************
+ * Flash programming.
+ ******************************************************************************/
+
+
+void ota_flash_unlock(void)
+{
+	FLASH->KEYR = FLASH_KEY1;
+	FLASH->KEYR = FLASH_KEY2;
+}
+
+
+void ota_flash_lock(void)
+{
+	FLASH->CR |= FLASH_CR_LOCK;
+}
+
+
+/* ota_flash_erase
+ *
+ * Parameters
+ * addr			Page address
+ *
+ * Returns
+ * 0 on success, -1 on a flash error.
+ *
+ * The CPU stalls for about 20ms while the page is erased.
+ */
+int ota_flash_erase(uint32_t addr)
+{
+	while(FLASH->SR & FLASH_SR_BSY);
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = addr;
+	FLASH->CR |= FLASH_CR_STRT;
+	while(FLASH->SR & FLASH_SR_BSY);
+	FLASH->CR &= ~FLASH_CR_PER;
+
+	if(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR))
+		return -1;
+
+	return 0;
+}
+
+
+/* ota_flash_write
+ *
+ * Parameters
+ * addr			Flash address, halfword aligned and erased
+ * data			Data
+ * n			No. of bytes, even
+ *
+ * Returns
+ * 0 on success, -1 on a flash error.
+ */
+int ota_flash_write(uint32_t addr, uint8_t *data, int n)
+{
+	volatile uint16_t *dst;
+	int i;
+
+
+	dst = (volatile uint16_t *)addr;
+
+	while(FLASH->SR & FLASH_SR_BSY);
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+
+	FLASH->CR |= FLASH_CR_PG;
+	for(i=0; i<n; i+=2)
+	{
+		dst[i / 2] = data[i] | (data[i + 1] << 8);
+		while(FLASH->SR & FLASH_SR_BSY);
+	}
+	FLASH->CR &= ~FLASH_CR_PG;
+
+	if(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR))
+		return -1;
+
+	return 0;
+}
+
+
+/* ota_crc
+ *
+ * Parameters
+ * addr			Start address
+ * size			Bytes, multiple of 4
+ *
+ * Returns
+ * CRC-32 (STM32 CRC unit) of the words.
+ */
+uint32_t ota_crc(uint32_t addr, uint32_t size)
+{
+	uint32_t *p;
+	uint32_t i;
+
+
+	RCC->AHBENR |= RCC_AHBENR_CRCEN;
+	CRC->CR = CRC_CR_RESET;
+
+	p = (uint32_t *)addr;
+	for(i=0; i<size / 4; i++)
+		CRC->DR = p[i];
+
+	return CRC->DR;
+}
+
+
+/* ota_image_size
+ *
+ * Returns
+ * Size of the running application, rounded up to a word.
+ */
+uint32_t ota_image_size(void)
+{
+	return (((uint32_t)&_eimage - OTA_APP_ADDR) + 3) & ~3UL;
+}
+
+
+
+/******************************************************************************
+ * Sender.
+ ******************************************************************************/
+
+
+/* ota_send
+ *
+ * Parameters
+ * addr			Receiver
+ *
+ * Returns
+ * 0 if started, -1 if an update is in progress or the start packet
+ * couldn't be queued.
+ *
+ * Send the running application to the receiver.
+ */
+int ota_send(uint8_t addr)
+{
+	if(ota_state != OTA_IDLE)
+		return -1;
+
+	ota_peer = addr;
+	ota_size = ota_image_size();
+	ota_crc_val = ota_crc(OTA_APP_ADDR, ota_size);
+	ota_mac_valid = (auth_mac((uint8_t *)OTA_APP_ADDR, ota_size, ota_mac) == 0);
+	ota_n_pages = (ota_size + OTA_PAGE_SIZE - 1) / OTA_PAGE_SIZE;
+
+	if(ota_send_start() < 0)
+		return -1;
+
+	ota_next = 0;
+	ota_sent = 0;
+	ota_tries = 0;
+	ota_timer = 0;
+	ota_msec = 0;
+	ota_busy = 0;
+	ota_stats.pages = 0;
+	ota_stats.resends = 0;
+	ota_stats.bad_pages = 0;
+	ota_state = OTA_TX_START;
+
+	return 0;
+}
+
+
+/* ota_send_start
+ *
+ * Returns
+ * 0 if queued, -1 if the ARQ queue is full.
+ *
+ * Send the start message with the image size and CRC.  If there is a
+ * key the image MAC is added and the message is signed.  A new counter
+ * is used for each start sent.
+ */
+int ota_send_start(void)
+{
+	uint8_t msg[OTA_START_AUTH_LEN];
+	int len;
+	int i;
+
+
+	msg[0] = OTA_START;
+	for(i=0; i<4; i++)
+	{
+		msg[1 + i] = (uint8_t)(ota_size >> (8 * i));
+		msg[5 + i] = (uint8_t)(ota_crc_val >> (8 * i));
+	}
+
+	len = OTA_START_LEN;
+	if(auth_key_valid)
+	{
+		// Key set since ota_send()
+		if(!ota_mac_valid)
+			return -1;
+
+		for(i=0; i<AUTH_MAC_LEN; i++)
+			msg[len++] = ota_mac[i];
+		len = auth_sign_msg(ota_peer, msg, len, sizeof(msg));
+	}
+	if(len < 0)
+		return -1;
+
+	return cc_send_rel(ota_peer, msg, len, NULL);
+}
+
+
+/* ota_sent_done
+ *
+ * Bulk transmit callback, interrupt context.
+ */
+void ota_sent_done(int result)
+{
+	if(result != RF_BULK_FAIL)
+		ota_stats.pages++;
+
+	ota_timer = 0;
+	ota_busy = 0;
+}
+
+
+/* ota_send_page
+ *
+ * Send the next page of the window.
+ * The page is read from the running application.
+ */
+void ota_send_page(void)
+{
+	OTA_BUF *buf;
+
+
+	buf = &ota_buf[0];
+	buf->data[0] = OTA_DATA;
+	buf->data[1] = (uint8_t)ota_sent;
+	buf->data[2] = (uint8_t)(ota_sent >> 8);
+	memcpy(buf->data + OTA_DATA_HDR, (uint8_t *)(OTA_APP_ADDR + ota_sent * OTA_PAGE_SIZE), OTA_PAGE_SIZE);
+
+	ota_busy = 1;
+	if(cc_bulk_send(ota_peer, buf->data, OTA_DATA_LEN, ota_sent_done) < 0)
+	{
+		ota_busy = 0;
+		return;
+	}
+
+	ota_sent++;
+}
+
+
+
+/******************************************************************************
+ * Receiver.
+ ******************************************************************************/
+
+
+/* ota_start_ok
+ *
+ * Parameters
+ * pkt			ARQ packet with a start message
+ *
+ * Returns
+ * 1 if the update may start, 0 if not.
+ *
+ * A start message erases the staging area and a good CRC commits the
+ * image, so with a key set only a start signed by its ARQ sender is
+ * accepted.  Without a key the start is plain, as control frames are.
+ */
+int ota_start_ok(RF_PKT *pkt)
+{
+	uint8_t *msg;
+	int len;
+
+
+	msg = pkt->data + ARQ_HDR_LEN;
+	len = pkt->len - ARQ_HDR_LEN;
+
+	if(!auth_key_valid)
+		return (len == OTA_START_LEN);
+
+	if((len != OTA_START_AUTH_LEN) || (auth_verify_msg(pkt->addr, msg, len) < 0))
+		return 0;
+
+	return (msg[OTA_START_LEN + AUTH_MAC_LEN] == pkt->data[1]);
+}
+
+
+/* ota_start
+ *
+ * Parameters
+ * src			Sender
+ * msg			Start message
+ *
+ * Erase the staging area and ack page 0.  The image MAC is kept if
+ * the start was signed.
+ */
+void ota_start(uint8_t src, uint8_t *msg)
+{
+	uint32_t addr;
+	int i;
+
+
+	ota_armed = -1;
+	cc_bulk_abort();
+
+	ota_size = 0;
+	ota_crc_val = 0;
+	for(i=3; i>=0; i--)
+	{
+		ota_size = (ota_size << 8) | msg[1 + i];
+		ota_crc_val = (ota_crc_val << 8) | msg[5 + i];
+	}
+
+	ota_mac_valid = auth_key_valid;
+	if(ota_mac_valid)
+	{
+		for(i=0; i<AUTH_MAC_LEN; i++)
+			ota_mac[i] = msg[OTA_START_LEN + i];
+	}
+
+	ota_peer = src;
+	ota_next = 0;
+	ota_armed = -1;
+	ota_msec = 0;
+	ota_stats.pages = 0;
+	ota_stats.resends = 0;
+	ota_stats.bad_pages = 0;
+	for(i=0; i<OTA_WINDOW; i++)
+		ota_buf[i].full = 0;
+
+	if((ota_size == 0) || (ota_size > OTA_MAX_SIZE) || (ota_size & 3))
+	{
+		ota_send_ack(OTA_ST_ERR);
+		return;
+	}
+
+	ota_n_pages = (ota_size + OTA_PAGE_SIZE - 1) / OTA_PAGE_SIZE;
+
+	ota_flash_unlock();
+
+	for(addr=0; addr<ota_n_pages * OTA_PAGE_SIZE; addr+=OTA_PAGE_SIZE)
+	{
+		if(ota_flash_erase(OTA_STAGE_ADDR + addr) < 0)
+		{
+			ota_flash_lock();
+			ota_send_ack(OTA_ST_ERR);
+			return;
+		}
+	}
+
+	ota_flash_lock();
+
+	ota_send_ack(OTA_ST_OK);
+}
+
+
+/* ota_send_ack
+ *
+ * Parameters
+ * status		OTA_ST_
+ *
+ * Ack with the next page wanted.  Normal packets can't be sent while
+ * waiting for a bulk packet, so the receiver stops waiting first.
+ */
+void ota_send_ack(uint8_t status)
+{
+	uint8_t msg[OTA_ACK_LEN];
+
+
+	if(ota_armed >= 0)
+	{
+		ota_armed = -1;
+		cc_bulk_abort();
+	}
+
+	msg[0] = OTA_ACK;
+	msg[1] = (uint8_t)ota_next;
+	msg[2] = (uint8_t)(ota_next >> 8);
+	msg[3] = status;
+	msg[4] = cc_reg_get(ADDR);
+
+	ota_ack_status = status;
+	ota_ack_sent = 0;
+	ota_timer = 0;
+	ota_state = OTA_RX_ACK;
+
+	if(cc_send_pkt(ota_peer, msg, OTA_ACK_LEN, ota_ack_done) < 0)
+		ota_ack_sent = 1;				// Sender will time out and resend
+}
+
+
+/* ota_ack_done
+ *
+ * Ack transmit callback, interrupt context.
+ */
+void ota_ack_done(int result)
+{
+	ota_ack_sent = 1;
+}
+
+
+/* ota_arm
+ *
+ * Wait for the next page in a free buffer.
+ * Called from the main loop and the bulk receive callback.
+ */
+void ota_arm(void)
+{
+	int i;
+
+
+	if(ota_armed >= 0)
+		return;
+
+	for(i=0; i<OTA_WINDOW; i++)
+	{
+		if(!ota_buf[i].full)
+		{
+			if(cc_bulk_recv(ota_buf[i].data, OTA_DATA_LEN, ota_page_done) == 0)
+				ota_armed = i;
+			return;
+		}
+	}
+}
+
+
+/* ota_page_done
+ *
+ * Bulk receive callback, interrupt context.
+ * Keep the page if it is in the window, then wait for the next one.
+ */
+void ota_page_done(int result)
+{
+	OTA_BUF *buf;
+	uint16_t page;
+
+
+	if(ota_armed < 0)
+		return;								// Aborted
+
+	buf = &ota_buf[ota_armed];
+	ota_armed = -1;
+
+	if((result == OTA_PAGE_SIZE + OTA_DATA_HDR) && (buf->data[0] == OTA_DATA))
+	{
+		page = buf->data[1] | (buf->data[2] << 8);
+
+		if((page >= ota_next) && (page < ota_next + OTA_WINDOW) && (page < ota_n_pages))
+		{
+			buf->page = page;
+			buf->full = 1;
+		}
+		else
+		{
+			ota_stats.bad_pages++;
+		}
+	}
+	else
+	{
+		ota_stats.bad_pages++;
+	}
+
+	ota_timer = 0;
+	ota_arm();
+}
+
+
+/* ota_program
+ *
+ * Program the buffered pages that follow on from ota_next.
+ * Other pages are dropped and will be sent again.
+ */
+void ota_program(void)
+{
+	int found;
+	int i;
+
+
+	ota_flash_unlock();
+
+	do
+	{
+		found = 0;
+		for(i=0; i<OTA_WINDOW; i++)
+		{
+			if(ota_buf[i].full && (ota_buf[i].page == ota_next))
+			{
+				if(ota_flash_write(OTA_STAGE_ADDR + ota_next * OTA_PAGE_SIZE,
+						ota_buf[i].data + OTA_DATA_HDR, OTA_PAGE_SIZE) < 0)
+				{
+					ota_flash_lock();
+					ota_send_ack(OTA_ST_ERR);
+					return;
+				}
+
+				ota_buf[i].full = 0;
+				ota_next++;
+				ota_stats.pages++;
+				found = 1;
+			}
+		}
+	} while(found);
+
+	ota_flash_lock();
+
+	for(i=0; i<OTA_WINDOW; i++)
+		ota_buf[i].full = 0;
+
+	if(ota_next == ota_n_pages)
+		ota_commit();
+	else
+		ota_send_ack(OTA_ST_OK);
+}
+
+
+/* ota_commit
+ *
+ * All pages are in.  Check the staging CRC, and the MAC if the start
+ * was signed, and commit the update.  A key removed during the update
+ * fails the MAC.
+ */
+void ota_commit(void)
+{
+	OTA_RECORD rec;
+	uint8_t mac[AUTH_MAC_LEN];
+	uint8_t diff;
+	int i;
+
+
+	diff = (ota_crc(OTA_STAGE_ADDR, ota_size) != ota_crc_val);
+
+	if(ota_mac_valid)
+	{
+		if(auth_mac((uint8_t *)OTA_STAGE_ADDR, ota_size, mac) < 0)
+			diff = 1;
+
+		// Compare all bytes, no early exit
+		for(i=0; i<AUTH_MAC_LEN; i++)
+			diff |= mac[i] ^ ota_mac[i];
+	}
+
+	if(diff)
+	{
+		ota_stats.bad_image++;
+		ota_send_ack(OTA_ST_ERR);
+		return;
+	}
+
+	rec.magic = OTA_MAGIC;
+	rec.size = ota_size;
+	rec.crc = ota_crc_val;
+	rec.state = OTA_STATE_COPY;
+	rec.pad = 0xFFFF;
+
+	ota_flash_unlock();
+
+	// Record without the state, then the state on its own
+	if((ota_flash_erase(OTA_REC_ADDR) < 0) ||
+		(ota_flash_write(OTA_REC_ADDR, (uint8_t *)&rec, 12) < 0) ||
+		(ota_flash_write(OTA_REC_ADDR + 12, (uint8_t *)&rec.state, 2) < 0))
+	{
+		ota_flash_lock();
+		ota_send_ack(OTA_ST_ERR);
+		return;
+	}
+
+	ota_flash_lock();
+
+	ota_send_ack(OTA_ST_DONE);
+}
+
+
+
+/******************************************************************************
+ * Both ends.
+ ******************************************************************************/
+
+
+/* ota_rx
+ *
+ * Parameters
+ * pkt			Received packet
+ *
+ * Returns
+ * 1 if the packet was an update message, 0 if not.
+ *
+ * Called from the main loop for each received packet.
+ * The start message comes with an ARQ header.  Acks from anyone but
+ * the receiver being updated are dropped.
+ */
+int ota_rx(RF_PKT *pkt)
+{
+	uint8_t *msg;
+	uint16_t next;
+
+
+	if((pkt->len > ARQ_HDR_LEN) && (pkt->data[0] == ARQ_DATA) &&
+		(pkt->data[ARQ_HDR_LEN] == OTA_START))
+	{
+		if(!ota_start_ok(pkt))
+		{
+			ota_stats.refused++;
+			return 1;
+		}
+
+		if((ota_state == OTA_IDLE) || (ota_state >= OTA_RX_ACK))
+			ota_start(pkt->data[1], pkt->data + ARQ_HDR_LEN);
+		return 1;
+	}
+
+	if((pkt->len != OTA_ACK_LEN) || (pkt->data[0] != OTA_ACK))
+		return 0;
+
+	if((ota_state < OTA_TX_START) || (ota_state > OTA_TX_WAIT))
+		return 1;
+
+	msg = pkt->data;
+	if(msg[4] != ota_peer)
+		return 1;
+
+	next = msg[1] | (msg[2] << 8);
+
+	if((msg[3] == OTA_ST_ERR) || (next > ota_n_pages))
+	{
+		ota_state = OTA_IDLE;
+		return 1;
+	}
+
+	if(msg[3] == OTA_ST_DONE)
+	{
+		ota_stats.msec = ota_msec;
+		ota_state = OTA_IDLE;
+		return 1;
+	}
+
+	if(next > ota_next)
+		ota_tries = 0;
+	else if(ota_state == OTA_TX_WAIT)
+		ota_stats.resends++;
+
+	// Go back to the page the receiver wants
+	ota_next = next;
+	ota_sent = next;
+	ota_timer = 0;
+	ota_state = OTA_TX_DATA;
+
+	return 1;
+}
+
+
+/* ota_tick
+ *
+ * Timers, called from the main loop every 1msec.
+ */
+void ota_tick(void)
+{
+	if(ota_state == OTA_IDLE)
+		return;
+
+	ota_timer++;
+	ota_msec++;
+
+	switch(ota_state)
+	{
+		case OTA_TX_START:
+		case OTA_TX_WAIT:
+			if(ota_timer < OTA_ACK_MSEC)
+				break;
+
+			// No ack, send the window again
+			if(++ota_tries > OTA_MAX_TRIES)
+			{
+				ota_state = OTA_IDLE;
+				break;
+			}
+			ota_stats.resends++;
+			ota_timer = 0;
+			if(ota_state == OTA_TX_START)
+			{
+				ota_send_start();
+			}
+			else
+			{
+				ota_sent = ota_next;
+				ota_state = OTA_TX_DATA;
+			}
+			break;
+
+		case OTA_RX_DATA:
+			if(ota_timer >= OTA_RX_MSEC)
+			{
+				cc_bulk_abort();
+				ota_armed = -1;
+				ota_state = OTA_IDLE;
+			}
+			break;
+	}
+}
+
+
+/* ota_poll
+ *
+ * Called from the main loop.  Runs the sender and receiver.
+ */
+void ota_poll(void)
+{
+	int n;
+	int i;
+
+
+	switch(ota_state)
+	{
+		case OTA_TX_DATA:
+			if(ota_busy || (ota_timer < OTA_GAP_MSEC))
+				break;
+
+			if((ota_sent < ota_n_pages) && (ota_sent < ota_next + OTA_WINDOW))
+			{
+				ota_send_page();
+			}
+			else
+			{
+				ota_timer = 0;
+				ota_state = OTA_TX_WAIT;
+			}
+			break;
+
+		case OTA_RX_ACK:
+			if(!ota_ack_sent)
+				break;
+
+			if(ota_ack_status == OTA_ST_DONE)
+			{
+				ota_state = OTA_RX_RESET;
+			}
+			else if(ota_ack_status == OTA_ST_ERR)
+			{
+				ota_state = OTA_IDLE;
+			}
+			else
+			{
+				ota_timer = 0;
+				ota_state = OTA_RX_DATA;
+				ota_arm();
+			}
+			break;
+
+		case OTA_RX_DATA:
+			n = 0;
+			for(i=0; i<OTA_WINDOW; i++)
+				n += ota_buf[i].full;
+
+			// Whole window, or the rest of it isn't coming
+			if((n == OTA_WINDOW) || (ota_next + n == ota_n_pages) ||
+				((n > 0) && (ota_timer >= OTA_PAGE_MSEC)))
+			{
+				ota_program();
+			}
+			else if((n == 0) && (ota_timer >= OTA_ACK_MSEC) && (ota_armed >= 0))
+			{
+				// Ack lost, ask again
+				ota_send_ack(OTA_ST_OK);
+			}
+			break;
+
+		case OTA_RX_RESET:
+			// Let the ack go, then restart into the boot block
+			if(cc_hal_idle())
+				NVIC_SystemReset();
+			break;
+	}
+}
+
+
+/* ota_abort
+ *
+ * Stop an update.
+ */
+void ota_abort(void)
+{
+	if((ota_state == OTA_RX_DATA) || (ota_state == OTA_RX_ACK))
+	{
+		ota_armed = -1;
+		cc_bulk_abort();
+	}
+
+	ota_state = OTA_IDLE;
+}
@@ -0,0 +1,110 @@
+/*
+ * ota.h
+ *
+ * Over-the-air firmware update.
+ *
+ */
+
+#ifndef OTA_H_
+#define OTA_H_
+
+#include "types.h"
+#include "cc_hal.h"
+#include "auth.h"
+
+
+// Flash layout, 128KB in 1KB pages
+// 0x08000000	Boot block: reset vector table and ota_boot.c, never updated
+// 0x08001000	Application, starting with the alternate vector table
+// 0x0800FC00	Update record
+// 0x08010000	Staging area for the new application
+// 0x0801F800	Authentication counter epochs, 2 pages (auth.h)
+#define OTA_BOOT_ADDR		0x08000000UL
+#define OTA_APP_ADDR		0x08001000UL
+#define OTA_REC_ADDR		0x0800FC00UL
+#define OTA_STAGE_ADDR		0x08010000UL
+#define OTA_PAGE_SIZE		1024
+#define OTA_MAX_SIZE		(OTA_REC_ADDR - OTA_APP_ADDR)		// 59KB
+
+// Update record.  state is programmed last, in one halfword write,
+// after the staged image has been checked.  The boot block then copies
+// the staging area over the application and erases the record.
+typedef struct {
+	uint32_t magic;
+	uint32_t size;						// Image bytes, multiple of 4
+	uint32_t crc;						// STM32 CRC unit over the image words
+	uint16_t state;
+	uint16_t pad;
+} OTA_RECORD;
+
+#define OTA_MAGIC			0x4F544131UL	// "OTA1"
+#define OTA_STATE_COPY		0x5AA5
+
+// Messages, first data byte
+// Start, sent with ARQ:	[OTA_START][SIZE0..3][CRC0..3]
+//							When a key is set: [MAC0..7], auth_mac() of the
+//							image, then the auth.h trailer
+// Page, bulk transfer:		[OTA_DATA][PAGE_LO][PAGE_HI][1024 bytes]
+// Ack:						[OTA_ACK][NEXT_LO][NEXT_HI][STATUS][SRC]
+#define OTA_START			0xE1
+#define OTA_DATA			0xE2
+#define OTA_ACK				0xE3
+#define OTA_START_LEN		9
+#define OTA_START_AUTH_LEN	(OTA_START_LEN + AUTH_MAC_LEN + AUTH_TRAILER_LEN)
+#define OTA_DATA_HDR		3
+#define OTA_DATA_LEN		(OTA_DATA_HDR + OTA_PAGE_SIZE)
+#define OTA_ACK_LEN			5
+
+// Ack status
+#define OTA_ST_OK			0			// NEXT is the next page wanted
+#define OTA_ST_DONE			1			// Image checked, receiver restarting
+#define OTA_ST_ERR			2			// Too large, CRC, MAC or flash error
+
+// Window and timing
+#define OTA_WINDOW			4			// Pages sent between acks
+#define OTA_GAP_MSEC		5			// Between pages, receiver re-arms
+#define OTA_PAGE_MSEC		100			// Receiver waits this long for the rest of a window
+#define OTA_ACK_MSEC		500			// Sender waits this long for an ack
+#define OTA_RX_MSEC			3000		// Receiver gives up
+#define OTA_MAX_TRIES		5			// Windows resent without progress
+
+// States
+#define OTA_IDLE			0
+#define OTA_TX_START		1			// Sender waiting for the first ack
+#define OTA_TX_DATA			2			// Sender sending a window
+#define OTA_TX_WAIT			3			// Sender waiting for an ack
+#define OTA_RX_ACK			4			// Receiver sending an ack
+#define OTA_RX_DATA			5			// Receiver waiting for pages
+#define OTA_RX_RESET		6			// Receiver restarting into the new image
+
+typedef struct {
+	uint32_t pages;						// Pages sent or programmed
+	uint32_t resends;					// Windows sent again
+	uint32_t bad_pages;					// Bulk errors or pages out of window
+	uint32_t refused;					// Start messages unsigned or with a bad tag
+	uint32_t bad_image;					// Staged image failed the CRC or MAC
+	uint32_t msec;						// Last update, start to end
+} OTA_STATS;
+
+extern uint8_t ota_state;
+extern uint16_t ota_next;
+extern uint16_t ota_n_pages;
+extern OTA_STATS ota_stats;
+
+
+int ota_send(uint8_t addr);
+void ota_abort(void);
+int ota_rx(RF_PKT *pkt);
+void ota_tick(void);
+void ota_poll(void);
+uint32_t ota_crc(uint32_t addr, uint32_t size);
+uint32_t ota_image_size(void);
+
+void ota_flash_unlock(void);
+void ota_flash_lock(void);
+int ota_flash_erase(uint32_t addr);
+int ota_flash_write(uint32_t addr, uint8_t *data, int n);
+
+void ota_boot_reset(void);
+
+#endif /* OTA_H_ */
@@ -0,0 +1,151 @@
+/*
+ * ota_boot.c
+ *
+ * Over-the-air update boot block.
+ *
+ * The reset vector in the first vector table points here.  This code
+ * and the first vector table are linked into the first 4KB of flash,
+ * which an update never writes.  Everything here stays in the
+ * .ota_boot section: no library calls and no calls into the
+ * application, which may be half copied.
+ *
+ * If the update record is committed the staging area is copied over
+ * the application and checked.  The record is erased once the copy is
+ * good, so a reset during the copy starts it again.  Then the
+ * application starts from the alternate vector table at OTA_APP_ADDR.
+ *
+ */
+
+#include "stm32f103xb.h"
+#include "ota.h"
+
+
+#define BOOT	__attribute__((section(".ota_boot")))
+
+#define BOOT_KEY1		0x45670123UL
+#define BOOT_KEY2		0xCDEF89ABUL
+
+
+void boot_erase(uint32_t addr) BOOT;
+void boot_copy(uint32_t size) BOOT;
+uint32_t boot_crc(uint32_t addr, uint32_t size) BOOT;
+void ota_boot_reset(void) BOOT;
+
+
+
+/* boot_erase
+ *
+ * Parameters
+ * addr			Page address
+ *
+ * The flash must be unlocked.
+ */
+void boot_erase(uint32_t addr)
+{
+	while(FLASH->SR & FLASH_SR_BSY);
+
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = addr;
+	FLASH->CR |= FLASH_CR_STRT;
+	while(FLASH->SR & FLASH_SR_BSY);
+	FLASH->CR &= ~FLASH_CR_PER;
+}
+
+
+/* boot_copy
+ *
+ * Parameters
+ * size			Image bytes
+ *
+ * Copy the staging area to the application area, page by page.
+ */
+void boot_copy(uint32_t size)
+{
+	volatile uint16_t *src;
+	volatile uint16_t *dst;
+	uint32_t page;
+	int i;
+
+
+	FLASH->KEYR = BOOT_KEY1;
+	FLASH->KEYR = BOOT_KEY2;
+
+	for(page=0; page<size; page+=OTA_PAGE_SIZE)
+	{
+		boot_erase(OTA_APP_ADDR + page);
+
+		src = (volatile uint16_t *)(OTA_STAGE_ADDR + page);
+		dst = (volatile uint16_t *)(OTA_APP_ADDR + page);
+
+		FLASH->CR |= FLASH_CR_PG;
+		for(i=0; i<OTA_PAGE_SIZE / 2; i++)
+		{
+			dst[i] = src[i];
+			while(FLASH->SR & FLASH_SR_BSY);
+		}
+		FLASH->CR &= ~FLASH_CR_PG;
+	}
+
+	FLASH->CR |= FLASH_CR_LOCK;
+}
+
+
+/* boot_crc
+ *
+ * Parameters
+ * addr			Start address
+ * size			Bytes, multiple of 4
+ *
+ * Returns
+ * CRC of the words, same as ota_crc().
+ */
+uint32_t boot_crc(uint32_t addr, uint32_t size)
+{
+	volatile uint32_t *p;
+	uint32_t i;
+
+
+	RCC->AHBENR |= RCC_AHBENR_CRCEN;
+	CRC->CR = CRC_CR_RESET;
+
+	p = (volatile uint32_t *)addr;
+	for(i=0; i<size / 4; i++)
+		CRC->DR = p[i];
+
+	return CRC->DR;
+}
+
+
+/* ota_boot_reset
+ *
+ * Reset handler in the first vector table.
+ * Finish a committed update, then start the application.
+ */
+void ota_boot_reset(void)
+{
+	volatile OTA_RECORD *rec;
+	volatile uint32_t *vectors;
+
+
+	rec = (volatile OTA_RECORD *)OTA_REC_ADDR;
+
+	if((rec->magic == OTA_MAGIC) && (rec->state == OTA_STATE_COPY) && (rec->size <= OTA_MAX_SIZE))
+	{
+		// The staging CRC was checked before the commit
+		boot_copy(rec->size);
+
+		if(boot_crc(OTA_APP_ADDR, rec->size) != rec->crc)
+			NVIC_SystemReset();							// Copy again
+
+		FLASH->KEYR = BOOT_KEY1;
+		FLASH->KEYR = BOOT_KEY2;
+		boot_erase(OTA_REC_ADDR);
+		FLASH->CR |= FLASH_CR_LOCK;
+	}
+
+	// Start the application from its own vector table
+	vectors = (volatile uint32_t *)OTA_APP_ADDR;
+	SCB->VTOR = OTA_APP_ADDR;
+	__set_MSP(vectors[0]);
+	((void (*)(void))vectors[1])();
+}
@@ -0,0 +1,350 @@
+/*
+ * power.c
+ *
+ * Low power receive: CC2500 Wake-on-Radio with the MCU in STOP mode.
+ *
+ * In WOR the radio sleeps and wakes every EVENT0 on its RC oscillator
+ * to listen for a packet, with no help from the MCU.  The MCU sleeps
+ * in STOP mode and is woken by the GDO0 EXTI line when a packet has
+ * been received, or by a falling edge on the USART2 RX pin (EXTI3)
+ * when a command is typed.  The character that wakes the MCU is lost.
+ *
+ * STOP mode turns off the PLL, so the MCU wakes on HSI 8MHz.  Wake-up
+ * is done with interrupts masked: WFI returns, the 32MHz clock is
+ * restored, then interrupts are unmasked and the GDO0 interrupt reads
+ * the packet at full speed.  Only the clock restore (HSE start and PLL
+ * lock) is measured, on every wake.  The STOP exit before it can't be:
+ * the DWT counter stops in STOP and the RTC only counts msec.  The
+ * datasheet gives a few usec for it with the regulator in low power.
+ *
+ * The 1msec timer tick stops while the MCU is in STOP, so WOR can't be
+ * used with the FHSS or TDMA schedulers.  Time asleep is measured with
+ * the RTC running from LSI.
+ *
+ * A node in WOR only hears a packet that is on air when it wakes, so
+ * senders must repeat a packet for one EVENT0 period to reach it.
+ */
+
+#include "stm32f103xb.h"
+#include "uart.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "fhss.h"
+#include "tdma.h"
+#include "power.h"
+
+
+#define RTC_PRESCALE	39				// LSI 40kHz / 40 = 1kHz RTC count
+#define CYC_PER_MSEC	(CK_INT / 1000)
+
+#define USART2_RX_PIN	3				// PA3, EXTI3
+
+
+// External functions
+void SystemClockRestore(void);
+
+
+uint8_t power_wor;						// WOR and STOP mode on
+POWER_STATS power_stats;
+
+uint32_t power_wake_cyc;				// cyc_count() at the last wake
+uint32_t power_awake_cyc;				// Awake cycles less than 1msec
+
+
+uint32_t rtc_count(void);
+
+
+
+/* power_init
+ *
+ * Start the RTC from LSI to time STOP mode, and set up EXTI3 on the
+ * USART2 RX pin as a wake-up source.  EXTI3 is only unmasked while the
+ * MCU is in STOP.
+ *
+ * The PWR and BKP clocks must be enabled.
+ */
+void power_init(void)
+{
+	// LSI on
+	RCC->CSR |= RCC_CSR_LSION;
+	while((RCC->CSR & RCC_CSR_LSIRDY) == 0);
+
+	// RTC clock source LSI
+	PWR->CR |= PWR_CR_DBP;						// Backup domain write access
+	if((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_LSI)
+	{
+		RCC->BDCR |= RCC_BDCR_BDRST;			// RTCSEL can only be set after reset
+		RCC->BDCR &= ~RCC_BDCR_BDRST;
+		RCC->BDCR |= RCC_BDCR_RTCSEL_LSI;
+	}
+	RCC->BDCR |= RCC_BDCR_RTCEN;
+
+	// RTC prescaler
+	RTC->CRL &= ~RTC_CRL_RSF;
+	while((RTC->CRL & RTC_CRL_RSF) == 0);		// Wait for registers to sync
+	while((RTC->CRL & RTC_CRL_RTOFF) == 0);
+	RTC->CRL |= RTC_CRL_CNF;					// Configuration mode
+	RTC->PRLH = 0;
+	RTC->PRLL = RTC_PRESCALE;
+	RTC->CRL &= ~RTC_CRL_CNF;
+	while((RTC->CRL & RTC_CRL_RTOFF) == 0);		// Wait for write to finish
+
+	// EXTI3 from PA3, falling edge (start bit)
+	AFIO->EXTICR[0] &= ~AFIO_EXTICR1_EXTI3;		// PA3
+	EXTI->FTSR |= EXTI_FTSR_TR3;
+	EXTI->IMR &= ~EXTI_IMR_MR3;
+
+	power_wake_cyc = cyc_count();
+}
+
+
+/* rtc_count
+ *
+ * Returns
+ * RTC count, msec.
+ */
+uint32_t rtc_count(void)
+{
+	uint16_t high;
+	uint16_t low;
+
+
+	// Read the high half again if the low half wrapped
+	do
+	{
+		high = RTC->CNTH;
+		low = RTC->CNTL;
+	} while(high != RTC->CNTH);
+
+	return ((uint32_t)high << 16) | low;
+}
+
+
+/* power_wor_start
+ *
+ * Parameters
+ * event0_msec		Radio wake interval [1-WOR_EVENT0_MAX]
+ *
+ * Returns
+ * 0 on success, -1 if the interval is out of range or a slot
+ * scheduler is running.
+ *
+ * Set up WOR in the radio and start sleeping.
+ * EVENT0 = event0_msec * fRCOSC / 1000 with WOR_RES 0.  If the profile
+ * has no RX timeout the timeout is set to 0.45% of EVENT0.
+ */
+int power_wor_start(uint16_t event0_msec)
+{
+	uint32_t event0;
+	uint32_t key;
+
+
+	if((event0_msec < 1) || (event0_msec > WOR_EVENT0_MAX))
+		return -1;
+
+	if((fhss_mode != FHSS_OFF) || (tdma_mode != TDMA_OFF))
+		return -1;
+
+	event0 = ((uint32_t)event0_msec * CC_RCOSC) / 1000;
+
+	key = cc_lock();
+
+	cc_radio_stop();
+
+	cc_reg_set(WOREVT1, (uint8_t)(event0 >> 8));
+	cc_reg_set(WOREVT0, (uint8_t)event0);
+	cc_reg_set(WORCTRL, (cc_reg_get(WORCTRL) & ~(WORCTRL_RC_PD | WORCTRL_EVENT1 | WORCTRL_WOR_RES)) |
+		WOR_EVENT1 | WORCTRL_RC_CAL);
+
+	if((cc_reg_get(MCSM2) & MCSM2_RX_TIME) == MCSM2_RX_TIME)
+		cc_reg_set(MCSM2, (cc_reg_get(MCSM2) & ~MCSM2_RX_TIME) | 3);
+
+	cc_reg_commit();
+
+	cc_wor_start();
+
+	cc_unlock(key);
+
+	power_stats.sleeps = 0;
+	power_stats.radio_wakes = 0;
+	power_stats.uart_wakes = 0;
+	power_stats.sleep_msec = 0;
+	power_stats.awake_msec = 0;
+	power_stats.wake_usec = 0;
+	power_stats.wake_max_usec = 0;
+	power_awake_cyc = 0;
+	power_wake_cyc = cyc_count();
+
+	power_wor = 1;
+
+	return 0;
+}
+
+
+/* power_wor_stop
+ *
+ * Leave WOR, the radio goes back to RX.
+ */
+void power_wor_stop(void)
+{
+	power_wor = 0;
+
+	cc_radio_start();
+}
+
+
+/* power_sleep
+ *
+ * Called from the main loop.  If WOR is on and there is nothing to do,
+ * put the radio back in WOR if a packet woke it and stop the MCU until
+ * the next packet or command.
+ */
+void power_sleep(void)
+{
+	uint32_t t0;
+	uint32_t cycles;
+
+
+	if(!power_wor || !cc_hal_idle() || usart2_rxdata_rdy())
+		return;
+
+	// Wait for the UART to finish sending
+	if((USART2->CR1 & USART_CR1_TXEIE) || !(USART2->SR & USART_SR_TC))
+		return;
+
+	if(!cc_sleeping && (cc_wor_start() < 0))
+		return;
+
+	// Awake time since the last wake
+	power_awake_cyc += cyc_count() - power_wake_cyc;
+	power_stats.awake_msec += power_awake_cyc / CYC_PER_MSEC;
+	power_awake_cyc %= CYC_PER_MSEC;
+
+	__disable_irq();
+
+	// Timer tick would wake the MCU
+	TIM2->CR1 &= ~TIM_CR1_CEN;
+	TIM2->SR &= ~TIM_SR_UIF;
+	NVIC_ClearPendingIRQ(TIM2_IRQn);
+
+	EXTI->PR = EXTI_PR_PR3;
+	EXTI->IMR |= EXTI_IMR_MR3;					// USART2 RX wake-up
+
+	// STOP mode, regulator in low power mode
+	PWR->CR &= ~PWR_CR_PDDS;
+	PWR->CR |= PWR_CR_LPDS | PWR_CR_CWUF;
+	SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+
+	t0 = rtc_count();
+
+	__WFI();
+
+	// Running on HSI 8MHz
+	cycles = cyc_count();
+	SystemClockRestore();
+	cycles = cyc_count() - cycles;
+
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	EXTI->IMR &= ~EXTI_IMR_MR3;
+
+	power_stats.sleep_msec += rtc_count() - t0;
+	power_stats.sleeps++;
+	power_stats.wake_usec = cycles / 8;			// HSI cycles, clock restore only
+	if(power_stats.wake_usec > power_stats.wake_max_usec)
+		power_stats.wake_max_usec = power_stats.wake_usec;
+
+	if(EXTI->PR & EXTI_PR_PR0)
+		power_stats.radio_wakes++;
+	else if(EXTI->PR & EXTI_PR_PR3)
+		power_stats.uart_wakes++;
+
+	TIM2->CR1 |= TIM_CR1_CEN;
+
+	power_wake_cyc = cyc_count();
+
+	__enable_irq();								// Packet is handled now
+}
+
+
+/* EXTI3 Interrupt Handler
+ *
+ * USART2 RX start bit while in STOP mode.
+ */
+void __attribute__((interrupt("IRQ")))EXTI3_IRQHandler(void)
+{
+	EXTI->PR = EXTI_PR_PR3;				// Clear pending flag (write 1).
+}
+
+
+/* power_mcu_duty
+ *
+ * Returns
+ * Measured fraction of time the MCU is running, 0.001% units.
+ */
+uint32_t power_mcu_duty(void)
+{
+	unsigned long long total;
+
+
+	total = (unsigned long long)power_stats.awake_msec + power_stats.sleep_msec;
+	if(total == 0)
+		return DUTY_FULL;
+
+	return (uint32_t)(((unsigned long long)power_stats.awake_msec * DUTY_FULL) / total);
+}
+
+
+/* power_radio_duty
+ *
+ * Returns
+ * Fraction of time the radio is on in WOR, 0.001% units.
+ *
+ * Worked out from the WOR registers: the radio wakes EVENT1 RC clocks
+ * before RX, then listens for the MCSM2 RX timeout, a fraction of
+ * EVENT0.  Time spent receiving packets isn't included.
+ */
+const uint8_t wor_event1_clk[8] = {4, 6, 8, 12, 16, 24, 32, 48};
+const uint16_t wor_rx_time[7] = {3606, 1803, 901, 451, 225, 113, 56};	// WOR_RES 0
+
+uint32_t power_radio_duty(void)
+{
+	uint32_t event0;
+	uint32_t duty;
+
+
+	event0 = (cc_reg_get(WOREVT1) << 8) | cc_reg_get(WOREVT0);
+	if(event0 == 0)
+		return DUTY_FULL;
+
+	duty = (wor_event1_clk[(cc_reg_get(WORCTRL) & WORCTRL_EVENT1) >> 4] * DUTY_FULL) / event0;
+
+	if((cc_reg_get(MCSM2) & MCSM2_RX_TIME) == MCSM2_RX_TIME)
+		return DUTY_FULL;								// No RX timeout
+
+	duty += wor_rx_time[cc_reg_get(MCSM2) & MCSM2_RX_TIME];
+
+	return (duty > DUTY_FULL) ? DUTY_FULL : duty;
+}
+
+
+/* power_current_na
+ *
+ * Returns
+ * Estimated average supply current of MCU and radio (nA).
+ */
+uint32_t power_current_na(void)
+{
+	unsigned long long mcu;
+	unsigned long long radio;
+	uint32_t d;
+
+
+	d = power_mcu_duty();
+	mcu = (unsigned long long)d * STM_I_RUN_UA * 1000 + (unsigned long long)(DUTY_FULL - d) * STM_I_STOP_NA;
+
+	d = power_radio_duty();
+	radio = (unsigned long long)d * CC_I_RX_UA * 1000 + (unsigned long long)(DUTY_FULL - d) * CC_I_SLEEP_NA;
+
+	return (uint32_t)((mcu + radio) / DUTY_FULL);
+}
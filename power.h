@@ -0,0 +1,51 @@
+/*
+ * power.h
+ *
+ * Low power receive: CC2500 Wake-on-Radio with the MCU in STOP mode.
+ *
+ */
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include "types.h"
+
+
+// WOR settings
+#define WOR_EVENT0_MSEC		300			// Default wake interval
+#define WOR_EVENT0_MAX		1890		// msec, EVENT0 = 0xFFFF with WOR_RES 0
+#define WOR_EVENT1			0x70		// WORCTRL EVENT1 = 48 RC clocks (1.4ms)
+
+// Supply currents for the estimate (typical, from the data sheets)
+#define STM_I_RUN_UA		18000		// STM32F103 run, 32MHz, peripherals on
+#define STM_I_STOP_NA		14000		// STOP, regulator in low power mode
+#define CC_I_RX_UA			15000		// CC2500 RX
+#define CC_I_SLEEP_NA		900			// CC2500 SLEEP, RC oscillator on
+
+// Duty cycles are in units of 0.001%
+#define DUTY_FULL			100000UL
+
+// Wake-up statistics
+typedef struct {
+	uint32_t sleeps;					// Times in STOP mode
+	uint32_t radio_wakes;				// Woken by GDO0, packet received
+	uint32_t uart_wakes;				// Woken by USART2 RX, char lost
+	uint32_t sleep_msec;				// Time in STOP mode (RTC)
+	uint32_t awake_msec;				// Time running (DWT)
+	uint32_t wake_usec;					// Last clock restore, STOP exit not included
+	uint32_t wake_max_usec;				// Worst clock restore
+} POWER_STATS;
+
+extern uint8_t power_wor;
+extern POWER_STATS power_stats;
+
+
+void power_init(void);
+int power_wor_start(uint16_t event0_msec);
+void power_wor_stop(void);
+void power_sleep(void);
+uint32_t power_mcu_duty(void);
+uint32_t power_radio_duty(void);
+uint32_t power_current_na(void);
+
+#endif /* POWER_H_ */
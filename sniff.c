@@ -0,0 +1,296 @@
+/*
+ * sniff.c
+ *
+ * Promiscuous packet capture streamed to the host.
+ *
+ * The address check and CRC autoflush are turned off, so the radio
+ * receives every packet on the channel.  The receive tap in cc_hal.c
+ * hands each packet to sniff_put() instead of the receive queue.
+ * Nothing is acked or passed to the main loop.
+ *
+ * Each packet is framed with its timestamp and status bytes into a RAM
+ * ring.  USART2 TX DMA sends the ring straight to the host, so the CPU
+ * only copies the frame in.  A packet that doesn't fit is counted and
+ * the count goes out in the next frame, so the host sees every gap.
+ *
+ * The UART runs at the capture baud rate while sniffing.  Text output
+ * is held until sniff_stop(), commands are still read at the capture
+ * rate.  host/sniff2pcap.py converts the stream to a pcap file.
+ *
+ */
+
+#include <string.h>
+#include "stm32f103xb.h"
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "uart.h"
+#include "sniff.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+SNIFF_STATS sniff_stats;
+uint8_t sniff_active;
+
+uint8_t sniff_ring[SNIFF_RING_SIZE];
+volatile uint16_t sniff_head;			// Next byte written by sniff_put()
+volatile uint16_t sniff_tail;			// Next byte to send
+uint16_t sniff_dma_n;					// Bytes in the DMA transfer
+uint16_t sniff_drops;					// Packets lost since the last frame
+uint32_t sniff_cyc;						// cyc_count() time of sniff_usec
+uint32_t sniff_usec;					// Capture clock, usec since sniff_start()
+uint8_t sniff_pktctrl1;					// PKTCTRL1 before sniffing
+uint32_t sniff_baud;					// UART baud rate before sniffing
+
+
+void sniff_put(uint8_t *p, uint32_t time);
+void sniff_clock(uint32_t now);
+void sniff_send(void);
+void sniff_sent(void);
+
+
+
+/* sniff_clock
+ *
+ * Parameters
+ * now			cyc_count()
+ *
+ * Advance the usec capture clock.  The 32 bit cycle count wraps every
+ * 134 seconds, so the clock is kept up from the 1msec tick and not only
+ * when packets arrive.
+ */
+void sniff_clock(uint32_t now)
+{
+	uint32_t usec;
+
+
+	usec = (now - sniff_cyc) / CYC_PER_USEC;
+	sniff_usec += usec;
+	sniff_cyc += usec * CYC_PER_USEC;
+}
+
+
+/* sniff_tick
+ *
+ * Called from the TIM2 interrupt every 1msec, at CC_IRQ_PRIORITY like
+ * the receive tap.
+ */
+void sniff_tick(void)
+{
+	if(sniff_active)
+		sniff_clock(cyc_count());
+}
+
+
+/* sniff_put
+ *
+ * Parameters
+ * *p			[LEN][ADDR][DATA...][RSSI][LQI]
+ * time			cyc_count() time of the sync word
+ *
+ * Receive tap, called from the radio interrupts.  Frame the packet
+ * into the ring and start the DMA if it is idle.
+ */
+void sniff_put(uint8_t *p, uint32_t time)
+{
+	uint8_t frame[SNIFF_MAX_FRAME];
+	uint32_t usec;
+	uint16_t used;
+	uint8_t chk;
+	int len;
+	int n;
+	int i;
+
+
+	len = p[0] + 3;								// LEN byte to LQI
+	n = SNIFF_HDR_LEN + len + 1;
+
+	used = (sniff_head - sniff_tail) & (SNIFF_RING_SIZE - 1);
+	if((used + n) >= SNIFF_RING_SIZE)
+	{
+		sniff_stats.dropped++;
+		if(sniff_drops < 0xFFFF)
+			sniff_drops++;
+		return;
+	}
+
+	// The sync word is within a few msec of the clock, either side
+	usec = sniff_usec + (int32_t)(time - sniff_cyc) / (int32_t)CYC_PER_USEC;
+
+	frame[0] = SNIFF_SYNC0;
+	frame[1] = SNIFF_SYNC1;
+	frame[2] = (uint8_t)(n - 4);				// TIME to LQI
+	frame[3] = (uint8_t)usec;
+	frame[4] = (uint8_t)(usec >> 8);
+	frame[5] = (uint8_t)(usec >> 16);
+	frame[6] = (uint8_t)(usec >> 24);
+	frame[7] = (uint8_t)sniff_drops;
+	frame[8] = (uint8_t)(sniff_drops >> 8);
+	frame[9] = cc_reg_get(CHANNR);
+	memcpy(frame + SNIFF_HDR_LEN, p, len);
+
+	chk = 0;
+	for(i=2; i<(n - 1); i++)
+		chk ^= frame[i];
+	frame[n - 1] = chk;
+
+	// Copy into the ring, in two parts at the end of the buffer
+	i = SNIFF_RING_SIZE - sniff_head;
+	if(i > n)
+		i = n;
+	memcpy(sniff_ring + sniff_head, frame, i);
+	memcpy(sniff_ring, frame + i, n - i);
+	sniff_head = (sniff_head + n) & (SNIFF_RING_SIZE - 1);
+
+	if(!(p[len - 1] & LQI_CRC_OK))
+		sniff_stats.crc_err++;
+	sniff_stats.frames++;
+	sniff_stats.bytes += n;
+	sniff_drops = 0;
+	if((used + n) > sniff_stats.max_used)
+		sniff_stats.max_used = used + n;
+
+	if(!uart2_dma_busy())
+		sniff_send();
+}
+
+
+/* sniff_send
+ *
+ * Start a DMA transfer of the ring from the tail, up to the head or
+ * the end of the buffer.
+ */
+void sniff_send(void)
+{
+	uint16_t head;
+
+
+	head = sniff_head;
+	if(head == sniff_tail)
+		return;
+
+	if(head > sniff_tail)
+		sniff_dma_n = head - sniff_tail;
+	else
+		sniff_dma_n = SNIFF_RING_SIZE - sniff_tail;
+
+	uart2_dma_send(sniff_ring + sniff_tail, sniff_dma_n, sniff_sent);
+}
+
+
+/* sniff_sent
+ *
+ * DMA complete, at CC_IRQ_PRIORITY so it doesn't preempt sniff_put().
+ */
+void sniff_sent(void)
+{
+	sniff_tail = (sniff_tail + sniff_dma_n) & (SNIFF_RING_SIZE - 1);
+
+	sniff_send();
+}
+
+
+/* sniff_check
+ *
+ * Parameters
+ * baud			UART baud rate for the capture stream
+ *
+ * Returns
+ * 0 if sniff_start() would accept the rate, -1 if already sniffing or
+ * the baud rate is out of range.
+ */
+int sniff_check(uint32_t baud)
+{
+	if(sniff_active || (baud < SNIFF_MIN_BAUD) || (baud > SNIFF_MAX_BAUD))
+		return -1;
+
+	return 0;
+}
+
+
+/* sniff_start
+ *
+ * Parameters
+ * baud			UART baud rate for the capture stream
+ *
+ * Returns
+ * 0, or -1 if already sniffing or the baud rate is out of range.
+ *
+ * Text already queued is sent at the old rate first.
+ */
+int sniff_start(uint32_t baud)
+{
+	uint32_t key;
+
+
+	if(sniff_check(baud) < 0)
+		return -1;
+
+	memset(&sniff_stats, 0, sizeof(sniff_stats));
+	sniff_head = 0;
+	sniff_tail = 0;
+	sniff_drops = 0;
+
+	uart2_flush();
+	uart2_tx_hold(1);
+	sniff_baud = uart2_get_baud();
+	uart2_set_baud(baud);
+
+	key = cc_lock();
+
+	cc_radio_stop();
+	sniff_pktctrl1 = cc_reg_get(PKTCTRL1);
+	cc_reg_set(PKTCTRL1, (sniff_pktctrl1 & ~(PKTCTRL1_ADR_CHK | PKTCTRL1_CRC_AUTOFLUSH)) |
+		PKTCTRL1_APPEND_STATUS);
+	cc_reg_commit();
+
+	sniff_cyc = cyc_count();
+	sniff_usec = 0;
+	cc_rx_tap = sniff_put;
+
+	cc_radio_start();
+
+	cc_unlock(key);
+
+	sniff_active = 1;
+
+	return 0;
+}
+
+
+/* sniff_stop
+ *
+ * Restore the address check, send the rest of the ring and return the
+ * UART to text at the old baud rate.
+ */
+void sniff_stop(void)
+{
+	uint32_t key;
+
+
+	if(!sniff_active)
+		return;
+
+	key = cc_lock();
+
+	cc_radio_stop();
+	cc_rx_tap = NULL;
+	cc_reg_set(PKTCTRL1, sniff_pktctrl1);
+	cc_reg_commit();
+	cc_radio_start();
+
+	cc_unlock(key);
+
+	while(uart2_dma_busy())					// The DMA interrupt sends the rest
+	{}
+	uart2_flush();
+
+	uart2_set_baud(sniff_baud);
+	uart2_tx_hold(0);
+
+	sniff_active = 0;
+}
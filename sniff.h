@@ -0,0 +1,55 @@
+/*
+ * sniff.h
+ *
+ * Promiscuous packet capture streamed to the host.
+ *
+ */
+
+#ifndef SNIFF_H_
+#define SNIFF_H_
+
+#include "types.h"
+#include "cc_hal.h"
+
+
+// Capture frame, sent on USART2 by DMA.  Multi-byte fields little endian.
+// [SYNC0][SYNC1][N][TIME x4][DROPS x2][CHAN][LEN][ADDR][DATA...][RSSI][LQI][CHK]
+// N counts TIME to LQI.  CHK is the XOR of N to LQI.
+// TIME is the sync word time in usec since sniff_start(), wraps after 71 minutes.
+// Packets read from the RX FIFO in one drain, when the end of packet
+// interrupt was held off past the next sync word, all get the time of
+// the last sync word.  Only TIM3 captures sync words, there is no time
+// per end of packet.
+// DROPS is the no. of packets lost before this one, ring full.
+// RSSI and LQI are the raw appended status bytes, LQI bit 7 is CRC_OK.
+#define SNIFF_SYNC0		0xA5
+#define SNIFF_SYNC1		0x5A
+#define SNIFF_HDR_LEN	10					// SYNC to CHAN
+#define SNIFF_MAX_FRAME	(SNIFF_HDR_LEN + RF_MAX_LEN + 3 + 1)
+
+// The shortest packet at 250kBaud is 12 bytes on air (384usec) and
+// makes a 14 byte frame, 365kBaud on the UART back to back.  The
+// default rate has 2.5x margin, the ring covers bursts.
+#define SNIFF_BAUD		921600
+#define SNIFF_MIN_BAUD	115200
+#define SNIFF_MAX_BAUD	2000000				// PCLK1 / 16
+#define SNIFF_RING_SIZE	2048				// Power of 2
+
+typedef struct {
+	uint32_t frames;					// Packets streamed
+	uint32_t bytes;						// Frame bytes streamed
+	uint32_t dropped;					// Packets lost, ring full
+	uint32_t crc_err;					// Packets streamed with bad CRC
+	uint16_t max_used;					// Ring high water mark (bytes)
+} SNIFF_STATS;
+
+extern SNIFF_STATS sniff_stats;
+extern uint8_t sniff_active;
+
+
+int sniff_check(uint32_t baud);
+int sniff_start(uint32_t baud);
+void sniff_stop(void);
+void sniff_tick(void);
+
+#endif /* SNIFF_H_ */
@@ -6,10 +6,51 @@
 #include "spi.h"
 
 
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+#include <string.h>
+
 void spi_set_baud(uint8_t baud);
 void spi2_set_baud(uint8_t baud);
 
 
+// SPI1 DMA
+// DMA1 Channel 2	SPI1_RX
+// DMA1 Channel 3	SPI1_TX
+#define SPI1_DMA_RX		DMA1_Channel2
+#define SPI1_DMA_TX		DMA1_Channel3
+
+volatile uint8_t spi_dma_active;			// DMA transfer in progress
+void (*spi_dma_callback)(void);				// Transfer complete callback
+
+uint8_t spi_dma_zero;						// TX source when there is no TX data
+uint8_t spi_dma_sink;						// RX destination when RX data is discarded
+
+
+// SPI1 timing profiles.
+//
+// CC2500 SCLK limits with no delay between bytes:
+// 	Single access	9MHz
+// 	Burst access	6.5MHz
+// With PCLK2 = 32MHz the fastest usable dividers are f/4 (8MHz) for
+// single access and f/8 (4MHz) for bursts.  DMA bursts run with no
+// gaps between bytes, so the burst limit always applies.
+const SPI_PROFILE spi_profiles[] =
+{
+	{"fast", SPI_DIV4,   SPI_DIV8,   "8MHz single, 4MHz burst"},
+	{"safe", SPI_DIV16,  SPI_DIV16,  "2MHz single and burst"},
+	{"slow", SPI_DIV256, SPI_DIV256, "125kHz single and burst"}
+};
+
+const int n_spi_profiles = sizeof(spi_profiles) / sizeof(SPI_PROFILE);
+
+const SPI_PROFILE *spi_profile = &spi_profiles[0];		// Current profile
+uint8_t spi_baud;										// Current BR[2:0]
+uint8_t spi2_baud;										// SPI2 current BR[2:0]
+
+
 /*
  * SPI Initialise
  */
@@ -19,10 +60,12 @@ void spi_init(void)
 		// CPOL	0 	Data is clocked on rising edge of SCK
 		// CPHA	0	Clock is 0 when idle
 
-	spi_set_baud(0x07);						// Set SPI baud rate divider (f/256).
+	spi_baud = spi_profile->single;
+	spi_set_baud(spi_baud);					// Set SPI baud rate divider.
 
 
 	SPI1->CR1 |= SPI_CR1_BIDIOE;
+	SPI1->CR1 |= SPI_CR1_SSM | SPI_CR1_SSI;	// Software NSS, PA4 is radio 1 CSn
 	SPI1->CR1 |= SPI_CR1_MSTR;				// Set SPI Master mode.
 
 
@@ -46,6 +89,76 @@ void spi_set_baud(uint8_t baud)
 }
 
 
+/* spi_set_profile
+ *
+ * Parameters
+ * name			Profile name
+ *
+ * Returns
+ * 0 if the profile was found, -1 if not.
+ *
+ * Select an SPI1 timing profile.  The new baud rate takes effect on
+ * the next spi_speed() call.
+ */
+int spi_set_profile(char *name)
+{
+	int i;
+
+
+	for(i=0; i<n_spi_profiles; i++)
+	{
+		if(strcmp(name, spi_profiles[i].name) == 0)
+		{
+			spi_profile = &spi_profiles[i];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/* spi_get_profile
+ *
+ * Returns the current SPI1 timing profile.
+ */
+const SPI_PROFILE *spi_get_profile(void)
+{
+	return spi_profile;
+}
+
+
+/* spi_speed
+ *
+ * Parameters
+ * access		SPI_SINGLE or SPI_BURST
+ *
+ * Set the SPI1 baud rate for the next access from the current
+ * timing profile.  Call with chip select high, before the access.
+ * The baud rate must not change during a transfer, so wait for
+ * the SPI to finish the last byte.
+ */
+void spi_speed(int access)
+{
+	uint8_t baud;
+
+
+	if(access == SPI_BURST)
+		baud = spi_profile->burst;
+	else
+		baud = spi_profile->single;
+
+	if(baud == spi_baud)
+		return;
+
+	while(SPI1->SR & SPI_SR_BSY)
+	{}
+
+	spi_set_baud(baud);
+	spi_baud = baud;
+}
+
+
 /* spi_out
  *
  * Write 8-bit data to SPI data register.
@@ -135,6 +248,170 @@ void spi_rd_array(uint8_t addr, uint8_t *data, uint8_t n)
 }
 
 
+/*---------------------------------------------------------------
+ *                        SPI1 DMA
+ *---------------------------------------------------------------
+ *
+ * SPI is full duplex, so every DMA transfer uses both channels.
+ * The TX channel writes bytes to SPI1_DR, the RX channel reads the
+ * bytes clocked in on MISO.  The RX channel transfer complete
+ * interrupt marks the end of the transfer, the last byte has
+ * been shifted out and in.
+ *
+ * The RX channel has the higher DMA priority so received bytes are
+ * always read before the next byte is shifted in (no overrun).
+ *
+ * The DMA1 clock must be enabled before calling spi_dma_init().
+ */
+
+
+/* spi_dma_init
+ *
+ * Set the DMA channel peripheral addresses to the SPI1 data register.
+ */
+void spi_dma_init(void)
+{
+	SPI1_DMA_RX->CCR = 0;
+	SPI1_DMA_TX->CCR = 0;
+
+	SPI1_DMA_RX->CPAR = (uint32_t)&SPI1->DR;
+	SPI1_DMA_TX->CPAR = (uint32_t)&SPI1->DR;
+
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+	spi_dma_active = 0;
+}
+
+
+/* spi_dma_xfer
+ *
+ * Parameters
+ * *tx			Bytes to send, or NULL to send zeroes.
+ * *rx			Buffer for received bytes, or NULL to discard them.
+ * n			No. of bytes
+ * done			Called when the transfer is complete, or NULL.
+ *
+ * Starts a DMA transfer of n bytes and returns.
+ * Chip select is driven outside this function, and must stay
+ * asserted until the transfer is complete.
+ * done() is called from the DMA interrupt, or from spi_dma_poll().
+ */
+void spi_dma_xfer(uint8_t *tx, uint8_t *rx, uint16_t n, void (*done)(void))
+{
+	spi_dma_active = 1;
+	spi_dma_callback = done;
+
+	while(SPI1->SR & SPI_SR_BSY)			// Wait for last polled byte.
+	{}
+	(void)SPI1->DR;							// Clear RXNE, stale byte.
+
+	SPI1_DMA_RX->CCR = 0;
+	SPI1_DMA_TX->CCR = 0;
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+	// RX channel, peripheral to memory.
+	SPI1_DMA_RX->CNDTR = n;
+	if(rx)
+	{
+		SPI1_DMA_RX->CMAR = (uint32_t)rx;
+		SPI1_DMA_RX->CCR = DMA_CCR_MINC;
+	}
+	else
+	{
+		SPI1_DMA_RX->CMAR = (uint32_t)&spi_dma_sink;
+	}
+	SPI1_DMA_RX->CCR |= DMA_CCR_PL_1 | DMA_CCR_PL_0 | DMA_CCR_TCIE | DMA_CCR_TEIE;
+		// Very high priority, transfer complete and error interrupts.
+
+	// TX channel, memory to peripheral.
+	SPI1_DMA_TX->CNDTR = n;
+	if(tx)
+	{
+		SPI1_DMA_TX->CMAR = (uint32_t)tx;
+		SPI1_DMA_TX->CCR = DMA_CCR_MINC;
+	}
+	else
+	{
+		spi_dma_zero = 0;
+		SPI1_DMA_TX->CMAR = (uint32_t)&spi_dma_zero;
+	}
+	SPI1_DMA_TX->CCR |= DMA_CCR_DIR | DMA_CCR_PL_1;
+		// Read from memory, high priority.
+
+	SPI1_DMA_RX->CCR |= DMA_CCR_EN;
+	SPI1_DMA_TX->CCR |= DMA_CCR_EN;
+
+	SPI1->CR2 |= SPI_CR2_RXDMAEN;			// Enable RX requests first
+	SPI1->CR2 |= SPI_CR2_TXDMAEN;			// TX request starts the transfer
+}
+
+
+/* spi_dma_busy
+ *
+ * Returns 1 while a DMA transfer is in progress.
+ */
+int spi_dma_busy(void)
+{
+	return spi_dma_active;
+}
+
+
+/* spi_dma_poll
+ *
+ * Finish the DMA transfer if the RX channel is complete.
+ * Called by the DMA interrupt handler, and by spi_dma_wait() when the
+ * DMA interrupt is masked.
+ */
+void spi_dma_poll(void)
+{
+	void (*done)(void);
+
+
+	if(!spi_dma_active)
+		return;
+
+	if(!(DMA1->ISR & (DMA_ISR_TCIF2 | DMA_ISR_TEIF2)))
+		return;
+
+	SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+	SPI1_DMA_RX->CCR = 0;
+	SPI1_DMA_TX->CCR = 0;
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+	NVIC_ClearPendingIRQ(DMA1_Channel2_IRQn);
+
+	done = spi_dma_callback;
+	spi_dma_callback = NULL;
+	spi_dma_active = 0;
+
+	if(done)
+		done();
+}
+
+
+/* spi_dma_wait
+ *
+ * Wait until there is no DMA transfer in progress.
+ * The DMA interrupt may be masked by the caller, so the transfer
+ * is completed here.  A completion callback may start another
+ * transfer, so keep going until the bus is free.
+ */
+void spi_dma_wait(void)
+{
+	while(spi_dma_active)
+		spi_dma_poll();
+}
+
+
+/* DMA1 Channel 2 Interrupt Handler
+ *
+ * SPI1 RX DMA transfer complete.
+ */
+void __attribute__((interrupt("IRQ")))DMA1_Channel2_IRQHandler(void)
+{
+	spi_dma_poll();
+}
+
+
 /*---------------------------------------------------------------
  *                            SPI2
  *---------------------------------------------------------------
@@ -152,8 +429,10 @@ void spi2_init(void)
 		// CPHA	0	Clock is 0 when idle
 
 	spi2_set_baud(0x07);						// Set SPI baud rate divider (f/256).
+	spi2_baud = 0x07;
 
 	SPI2->CR1 |= SPI_CR1_BIDIOE;
+	SPI2->CR1 |= SPI_CR1_SSM | SPI_CR1_SSI;	// Software NSS, PB12 is radio 0 CSn
 	SPI2->CR1 |= SPI_CR1_MSTR;				// Set SPI Master mode.
 
 	SPI2->CR2 = 0;
@@ -175,6 +454,35 @@ void spi2_set_baud(uint8_t baud)
 }
 
 
+/* spi2_speed
+ *
+ * Parameters
+ * access		SPI_SINGLE or SPI_BURST
+ *
+ * As spi_speed(), for SPI2.  PCLK1 is 32MHz, the same as PCLK2, so
+ * the SPI1 timing profile dividers are used.
+ */
+void spi2_speed(int access)
+{
+	uint8_t baud;
+
+
+	if(access == SPI_BURST)
+		baud = spi_profile->burst;
+	else
+		baud = spi_profile->single;
+
+	if(baud == spi2_baud)
+		return;
+
+	while(SPI2->SR & SPI_SR_BSY)
+	{}
+
+	spi2_set_baud(baud);
+	spi2_baud = baud;
+}
+
+
 /* spi2_out
  *
  * Parameters
@@ -197,7 +505,8 @@ uint8_t spi2_out(uint8_t d)
 
 	SPI2->DR = (uint16_t)(d);				// Write 8-bit data to SPI transmit register.
 
-	while(SPI2->SR & SPI_SR_BSY);			// Poll the SPI Busy flag until it is clear.
+	while(!(SPI2->SR & SPI_SR_RXNE))		// Wait for receive data, BSY may not be set yet.
+	{}
 
 	spi_data = SPI2->DR;					// Read 8-bit data from SPI receive register
 
@@ -10,15 +10,55 @@
 #include "stm32f103xb.h"
 
 
+// SPI1 baud rate divider BR[2:0]
+// PCLK2 = 32MHz
+#define SPI_DIV2		0			// 16MHz
+#define SPI_DIV4		1			// 8MHz
+#define SPI_DIV8		2			// 4MHz
+#define SPI_DIV16		3			// 2MHz
+#define SPI_DIV32		4			// 1MHz
+#define SPI_DIV64		5			// 500kHz
+#define SPI_DIV128		6			// 250kHz
+#define SPI_DIV256		7			// 125kHz
+
+// Access types
+#define SPI_SINGLE		0			// Header + one data byte
+#define SPI_BURST		1			// Header + consecutive data bytes
+
+// SPI timing profile
+typedef struct {
+	char *name;
+	uint8_t single;					// Baud divider for single access
+	uint8_t burst;					// Baud divider for burst access
+	char *help_txt;
+} SPI_PROFILE;
+
+extern const SPI_PROFILE spi_profiles[];
+extern const int n_spi_profiles;
+
+
 // SPI1
 void spi_init(void);
+int spi_set_profile(char *name);
+const SPI_PROFILE *spi_get_profile(void);
+void spi_speed(int access);
 uint8_t spi_out(uint8_t d);
 void spi_wr(uint8_t addr, uint8_t data);
 void spi_wr_array(uint8_t addr, uint8_t *data, uint8_t n);
 uint8_t spi_rd(uint8_t addr);
 
+// SPI1 DMA transfers
+#define SPI_DMA_MIN		4			// Shorter transfers are quicker polled
+
+void spi_dma_init(void);
+void spi_dma_xfer(uint8_t *tx, uint8_t *rx, uint16_t n, void (*done)(void));
+int spi_dma_busy(void);
+void spi_dma_poll(void);
+void spi_dma_wait(void);
+
 // SPI2
 void spi2_init(void);
+void spi2_speed(int access);
 uint8_t spi2_out(uint8_t d);
 
 
@@ -140,6 +140,8 @@ Infinite_Loop:
 * must be placed on this to ensure that it ends up at physical address
 * 0x0000.0000.
 * This is the vector table used at reset.
+* Reset goes to the OTA boot block (ota_boot.c), which finishes a pending
+* firmware update and starts the application from the alternate table.
 *
 ******************************************************************************/
   .section .isr_vector,"a",%progbits
@@ -149,7 +151,7 @@ Infinite_Loop:
 
 g_pfnVectors:
   .word _estack
-  .word Reset_Handler
+  .word ota_boot_reset
   .word NMI_Handler
   .word HardFault_Handler
   .word MemManage_Handler
@@ -11,6 +11,7 @@
 
 
 void SystemInitError(void);
+void SystemClockRestore(void);
 
 
 /* SystemInit
@@ -89,6 +90,26 @@ void SystemInit(void)
 }
 
 
+/* SystemClockRestore
+ *
+ * Restore the 32MHz system clock after STOP mode.
+ *
+ * STOP mode turns off the PLL and wakes up running from HSI 8MHz.
+ * The PLL configuration and bus prescalers in RCC_CFGR are kept,
+ * so only the PLL has to be started and selected again.
+ */
+void SystemClockRestore(void)
+{
+	// Enable PLL
+	RCC->CR |= RCC_CR_PLLON;
+	while((RCC->CR & RCC_CR_PLLRDY) == 0);			// Wait until PLL has locked.
+
+	// Set SYSCLK source (SW[1:0])
+	RCC->CFGR |= RCC_CFGR_SW_PLL;					// SYSCLK source: PLL (32MHz)
+	while((RCC->CFGR & RCC_CFGR_SWS_PLL) != RCC_CFGR_SWS_PLL);
+}
+
+
 /*
  *
  */
@@ -0,0 +1,475 @@
+/*
+ * tdma.c
+ *
+ * Time division slot scheduler.
+ *
+ * One base station serves many locomotives.  Time is divided into
+ * frames of n_slots slots, timed from the TIM2 1msec interrupt.
+ *
+ * Slot 0 belongs to the base station.  It sends a beacon at the start
+ * of slot 0 with the slot length and the slot map, the loco address
+ * that owns each slot.  Each loco sends its uplink packets only at the
+ * start of its own slot, so locos don't collide.  An uplink packet must
+ * fit in one slot.
+ *
+ * Locos set the CC2500 ADDR register to their own address with address
+ * check on, so the radio drops packets for other locos and only the
+ * loco's own packets and 0x00 broadcasts reach the RX FIFO.  The base
+ * station uses TDMA_BASE_ADDR.
+ *
+ * A loco times its frames from the last beacon.  After TDMA_LOST_FRAMES
+ * frames with no beacon it stops sending until the next beacon.
+ *
+ */
+
+#include "stm32f103xb.h"
+#include <string.h>
+#include "cc2500_regs.h"
+#include "cc_hal.h"
+#include "timer.h"
+#include "tdma.h"
+
+
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
+uint8_t tdma_mode;						// TDMA_OFF, TDMA_BASE, TDMA_LOCO
+uint8_t tdma_synced;					// Loco has a beacon
+uint8_t tdma_n_slots;					// Slots per frame
+uint8_t tdma_slot_msec;					// Slot length
+uint8_t tdma_my_slot;					// Loco uplink slot, 0 if none
+uint8_t tdma_map[TDMA_MAX_SLOTS];		// Address owning each slot
+uint32_t tdma_frames;					// Frames counted for utilisation
+TDMA_SLOT_STATS tdma_stats[TDMA_MAX_SLOTS];
+
+uint8_t tdma_addr;						// Own address
+uint8_t tdma_slot;						// Current slot
+uint8_t tdma_slot_timer;				// msec since the start of the slot
+uint8_t tdma_missed;					// Frames since the last beacon
+uint8_t tdma_heard[TDMA_MAX_SLOTS];		// Packet received in the slot this frame
+uint32_t tdma_crc_err;					// rx_stats.crc_err at the slot start
+
+// Uplink packet waiting for the loco's slot
+uint8_t tdma_tx_pending;
+uint8_t tdma_tx_len;
+uint8_t tdma_tx_buf[RF_MAX_DATA];
+
+
+void tdma_set_address(uint8_t addr, uint8_t adr_chk);
+void tdma_frame_start(void);
+void tdma_beacon(void);
+
+
+
+/* tdma_set_address
+ *
+ * Parameters
+ * addr			Device address for the ADDR register
+ * adr_chk		PKTCTRL1 address check, ADR_CHK_NONE to turn it off
+ *
+ * Set the hardware address filter and restart RX.
+ */
+void tdma_set_address(uint8_t addr, uint8_t adr_chk)
+{
+	uint32_t key;
+
+
+	key = cc_lock();
+
+	cc_radio_stop();
+
+	cc_reg_set(ADDR, addr);
+	cc_reg_set(PKTCTRL1, (cc_reg_get(PKTCTRL1) & ~PKTCTRL1_ADR_CHK) | adr_chk);
+	cc_reg_commit();
+
+	cc_radio_start();
+
+	cc_unlock(key);
+}
+
+
+/* tdma_start
+ *
+ * Parameters
+ * mode			TDMA_BASE or TDMA_LOCO
+ * addr			Loco address [02-FF], not used by the base
+ * slot_msec	Base slot length, locos take it from the beacon
+ *
+ * Returns
+ * 0 on success, -1 if a parameter is out of range.
+ *
+ * The base starts with only its own slot.  Add locos with tdma_add().
+ */
+int tdma_start(uint8_t mode, uint8_t addr, uint8_t slot_msec)
+{
+	uint32_t key;
+
+
+	if(mode == TDMA_BASE)
+	{
+		if((slot_msec < TDMA_MIN_SLOT) || (slot_msec > TDMA_MAX_SLOT))
+			return -1;
+		addr = TDMA_BASE_ADDR;
+	}
+	else if(mode == TDMA_LOCO)
+	{
+		if((addr == TDMA_BCAST_ADDR) || (addr == TDMA_BASE_ADDR))
+			return -1;
+		slot_msec = TDMA_SLOT_MSEC;
+	}
+	else
+		return -1;
+
+	tdma_stop();
+
+	tdma_set_address(addr, ADR_CHK_BCAST0);
+
+	key = cc_lock();
+
+	memset(tdma_map, TDMA_FREE, sizeof(tdma_map));
+	memset(tdma_stats, 0, sizeof(tdma_stats));
+	memset(tdma_heard, 0, sizeof(tdma_heard));
+
+	tdma_addr = addr;
+	tdma_map[0] = TDMA_BASE_ADDR;
+	tdma_n_slots = 1;
+	tdma_slot_msec = slot_msec;
+	tdma_my_slot = 0;
+	tdma_slot = 0;
+	tdma_slot_timer = 0;
+	tdma_missed = 0;
+	tdma_synced = 0;
+	tdma_frames = 0;
+	tdma_tx_pending = 0;
+	tdma_crc_err = rx_stats.crc_err;
+	tdma_mode = mode;
+
+	if(mode == TDMA_BASE)
+		tdma_beacon();
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* tdma_stop
+ *
+ * Stop the scheduler and turn off the address check.
+ */
+void tdma_stop(void)
+{
+	if(tdma_mode == TDMA_OFF)
+		return;
+
+	tdma_mode = TDMA_OFF;
+	tdma_synced = 0;
+
+	tdma_set_address(0, ADR_CHK_NONE);
+}
+
+
+/* tdma_add
+ *
+ * Parameters
+ * addr			Loco address
+ *
+ * Returns
+ * Slot number, or -1 if there is no free slot.
+ *
+ * Give a loco an uplink slot.  The first free slot is used, the frame
+ * gets longer if there is none.  Locos see the new map in the next
+ * beacon.
+ */
+int tdma_add(uint8_t addr)
+{
+	uint32_t key;
+	int i;
+
+
+	if((tdma_mode != TDMA_BASE) || (addr == TDMA_BCAST_ADDR) || (addr == TDMA_BASE_ADDR))
+		return -1;
+
+	key = cc_lock();
+
+	for(i=1; i<tdma_n_slots; i++)
+	{
+		if(tdma_map[i] == addr)
+			break;
+	}
+
+	if(i == tdma_n_slots)
+	{
+		for(i=1; i<tdma_n_slots; i++)
+		{
+			if(tdma_map[i] == TDMA_FREE)
+				break;
+		}
+	}
+
+	if(i == TDMA_MAX_SLOTS)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	tdma_map[i] = addr;
+	if(i == tdma_n_slots)
+		tdma_n_slots++;
+
+	cc_unlock(key);
+
+	return i;
+}
+
+
+/* tdma_del
+ *
+ * Parameters
+ * addr			Loco address
+ *
+ * Returns
+ * 0 on success, -1 if the loco has no slot.
+ *
+ * Free a loco's slot.  Free slots at the end of the frame are removed.
+ */
+int tdma_del(uint8_t addr)
+{
+	uint32_t key;
+	int i;
+
+
+	if((tdma_mode != TDMA_BASE) || (addr == TDMA_FREE))
+		return -1;
+
+	key = cc_lock();
+
+	for(i=1; i<tdma_n_slots; i++)
+	{
+		if(tdma_map[i] == addr)
+			break;
+	}
+
+	if(i == tdma_n_slots)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	tdma_map[i] = TDMA_FREE;
+
+	while((tdma_n_slots > 1) && (tdma_map[tdma_n_slots - 1] == TDMA_FREE))
+		tdma_n_slots--;
+
+	if(tdma_slot >= tdma_n_slots)
+		tdma_slot = tdma_n_slots - 1;
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* tdma_send
+ *
+ * Parameters
+ * data			Uplink data
+ * n			No. of bytes [0-RF_MAX_DATA]
+ *
+ * Returns
+ * 0 if queued, -1 if an uplink packet is already waiting or n is
+ * out of range.
+ *
+ * Queue an uplink packet for the loco's next slot.
+ */
+int tdma_send(uint8_t *data, int n)
+{
+	uint32_t key;
+
+
+	if((n < 0) || (n > RF_MAX_DATA))
+		return -1;
+
+	key = cc_lock();
+
+	if(tdma_tx_pending)
+	{
+		cc_unlock(key);
+		return -1;
+	}
+
+	memcpy(tdma_tx_buf, data, n);
+	tdma_tx_len = n;
+	tdma_tx_pending = 1;
+
+	cc_unlock(key);
+
+	return 0;
+}
+
+
+/* tdma_beacon
+ *
+ * Queue the beacon with the slot map.
+ */
+void tdma_beacon(void)
+{
+	uint8_t beacon[TDMA_BEACON_HDR + TDMA_MAX_SLOTS];
+
+
+	beacon[0] = TDMA_BEACON;
+	beacon[1] = tdma_n_slots;
+	beacon[2] = tdma_slot_msec;
+	memcpy(beacon + TDMA_BEACON_HDR, tdma_map, tdma_n_slots);
+
+	cc_send_pkt(TDMA_BCAST_ADDR, beacon, TDMA_BEACON_HDR + tdma_n_slots, NULL);
+}
+
+
+/* tdma_frame_start
+ *
+ * Start of slot 0.
+ */
+void tdma_frame_start(void)
+{
+	tdma_frames++;
+	memset(tdma_heard, 0, sizeof(tdma_heard));
+
+	if(tdma_mode == TDMA_BASE)
+	{
+		tdma_beacon();
+	}
+	else if(tdma_synced && (++tdma_missed >= TDMA_LOST_FRAMES))
+	{
+		tdma_synced = 0;
+	}
+}
+
+
+/* tdma_tick
+ *
+ * Slot scheduler, called from the TIM2 interrupt every 1msec.
+ * TIM2 must be at CC_IRQ_PRIORITY.
+ */
+void tdma_tick(void)
+{
+	if(tdma_mode == TDMA_OFF)
+		return;
+
+	if(++tdma_slot_timer < tdma_slot_msec)
+		return;
+
+	tdma_slot_timer = 0;
+
+	// Bad packets in the slot that ended
+	tdma_stats[tdma_slot].crc_err += rx_stats.crc_err - tdma_crc_err;
+	tdma_crc_err = rx_stats.crc_err;
+
+	if(++tdma_slot >= tdma_n_slots)
+	{
+		tdma_slot = 0;
+		tdma_frame_start();
+	}
+
+	// Loco uplink
+	if((tdma_mode == TDMA_LOCO) && tdma_synced && tdma_tx_pending &&
+		(tdma_my_slot != 0) && (tdma_slot == tdma_my_slot))
+	{
+		if(cc_send_pkt(TDMA_BASE_ADDR, tdma_tx_buf, tdma_tx_len, NULL) == 0)
+			tdma_tx_pending = 0;
+	}
+}
+
+
+/* tdma_rx
+ *
+ * Parameters
+ * pkt			Received packet
+ *
+ * Returns
+ * 1 if the packet was a beacon and has been used, 0 if not.
+ *
+ * Called from the main loop for each received packet.
+ * The packet is counted in the slot it was received in, worked out
+ * from the packet time stamp.  A loco takes the frame timing and slot
+ * map from the beacon.
+ */
+int tdma_rx(RF_PKT *pkt)
+{
+	uint32_t key;
+	uint32_t age;
+	uint32_t frame;
+	uint32_t t;
+	uint8_t slot;
+	uint8_t n;
+	int i;
+
+
+	if(tdma_mode == TDMA_OFF)
+		return 0;
+
+	age = (cyc_count() - pkt->time) / (CYC_PER_USEC * 1000);
+
+	key = cc_lock();
+
+	// Slot when the packet arrived
+	frame = tdma_n_slots * tdma_slot_msec;
+	t = tdma_slot * tdma_slot_msec + tdma_slot_timer;
+	t = (t + frame - (age % frame)) % frame;
+	slot = t / tdma_slot_msec;
+
+	if((pkt->len < TDMA_BEACON_HDR) || (pkt->data[0] != TDMA_BEACON))
+	{
+		tdma_stats[slot].pkts++;
+		if(!tdma_heard[slot])
+		{
+			tdma_heard[slot] = 1;
+			tdma_stats[slot].used++;
+		}
+
+		cc_unlock(key);
+		return 0;
+	}
+
+	n = pkt->data[1];
+	if((tdma_mode != TDMA_LOCO) || (n < 1) || (n > TDMA_MAX_SLOTS) ||
+		(pkt->len != TDMA_BEACON_HDR + n) ||
+		(pkt->data[2] < TDMA_MIN_SLOT) || (pkt->data[2] > TDMA_MAX_SLOT))
+	{
+		cc_unlock(key);
+		return 1;
+	}
+
+	tdma_n_slots = n;
+	tdma_slot_msec = pkt->data[2];
+	memcpy(tdma_map, pkt->data + TDMA_BEACON_HDR, n);
+
+	tdma_my_slot = 0;
+	for(i=1; i<n; i++)
+	{
+		if(tdma_map[i] == tdma_addr)
+			tdma_my_slot = i;
+	}
+
+	// The beacon is sent at the start of slot 0
+	tdma_slot = age / tdma_slot_msec;
+	tdma_slot_timer = age % tdma_slot_msec;
+	if(tdma_slot >= tdma_n_slots)
+		tdma_slot = 0;
+
+	tdma_stats[0].pkts++;
+	if(!tdma_heard[0])
+	{
+		tdma_heard[0] = 1;
+		tdma_stats[0].used++;
+	}
+
+	tdma_missed = 0;
+	tdma_synced = 1;
+
+	cc_unlock(key);
+
+	return 1;
+}
@@ -0,0 +1,64 @@
+/*
+ * tdma.h
+ *
+ * Time division slot scheduler.
+ *
+ */
+
+#ifndef TDMA_H_
+#define TDMA_H_
+
+#include "types.h"
+#include "cc_hal.h"
+
+
+// Node roles
+#define TDMA_OFF		0
+#define TDMA_BASE		1				// Sends the beacon and slot map
+#define TDMA_LOCO		2				// Sends uplink in its own slot
+
+// Frame layout
+// Slot 0 is the base station's beacon and downlink slot.
+// Slots 1 to n_slots-1 are uplink slots, one per locomotive.
+#define TDMA_MAX_SLOTS	32
+#define TDMA_MIN_SLOT	2				// msec
+#define TDMA_MAX_SLOT	250				// msec
+#define TDMA_SLOT_MSEC	10				// Default slot length
+#define TDMA_LOST_FRAMES	4			// Frames without a beacon before uplink stops
+
+// Addresses
+#define TDMA_BCAST_ADDR	0x00			// Beacon
+#define TDMA_BASE_ADDR	0x01			// Uplink destination
+#define TDMA_FREE		0x00			// Slot map entry for an unused slot
+
+// Beacon
+// [TDMA_BEACON][N_SLOTS][SLOT_MSEC][MAP0]...[MAPn-1]
+#define TDMA_BEACON		0xB6			// First data byte
+#define TDMA_BEACON_HDR	3
+
+// Per slot statistics
+typedef struct {
+	uint32_t pkts;						// Packets received in the slot
+	uint32_t used;						// Frames with at least one packet
+	uint32_t crc_err;					// Bad packets in the slot
+} TDMA_SLOT_STATS;
+
+extern uint8_t tdma_mode;
+extern uint8_t tdma_synced;
+extern uint8_t tdma_n_slots;
+extern uint8_t tdma_slot_msec;
+extern uint8_t tdma_my_slot;
+extern uint8_t tdma_map[TDMA_MAX_SLOTS];
+extern uint32_t tdma_frames;
+extern TDMA_SLOT_STATS tdma_stats[TDMA_MAX_SLOTS];
+
+
+int tdma_start(uint8_t mode, uint8_t addr, uint8_t slot_msec);
+void tdma_stop(void);
+int tdma_add(uint8_t addr);
+int tdma_del(uint8_t addr);
+int tdma_send(uint8_t *data, int n);
+void tdma_tick(void);
+int tdma_rx(RF_PKT *pkt);
+
+#endif /* TDMA_H_ */
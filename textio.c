@@ -95,20 +95,56 @@ void Int32toHex(char *s, uint32_t x)
 }
 
 
-/*
+/* IntToStr
+ *
+ * Parameters
+ * value		Signed integer to convert
+ * str			Output buffer, 12 chars for base 10
+ * base			Number base [2-16]
+ *
+ * Returns
+ * str
  *
+ * Convert an integer to a null terminated string.
+ * Negative values have a leading '-'.
  */
 char* IntToStr(int value, char *str, int base)
 {
+	char buf[33];
+	char *p;
+	char *s;
+	uint32_t x;
 	int r;
 
 
-	if(value == 0)
-		*str++ = '0';
+	s = str;
+
+	if((base < 2) || (base > 16))
+		base = 10;
+
+	if(value < 0)
+	{
+		*s++ = '-';
+		x = 0u - (uint32_t)value;			// INT_MIN too
+	}
+	else
+	{
+		x = (uint32_t)value;
+	}
 
+	// Digits come out in reverse order
+	p = buf;
+	do
+	{
+		r = x % base;
+		*p++ = (r >= 10) ? (r - 10 + 'A') : (r + '0');
+		x /= base;
+	} while(x != 0);
 
+	while(p != buf)
+		*s++ = *--p;
 
-	*str = '\0';
+	*s = '\0';
 
 	return str;
 }
@@ -15,6 +15,7 @@ void print_str(char *s);
 void ByteToHex(char *s, uint8_t x);
 void IntToHex(char *s, uint16_t x);
 void Int32toHex(char *s, uint32_t x);
+char* IntToStr(int value, char *str, int base);
 
 
 #endif /* TEXTIO_H_ */
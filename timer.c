@@ -15,6 +15,20 @@ void TIM_SetPrescaler(TIM_TypeDef *timer, uint32_t psc);
 
 
 
+/* cyc_init
+ *
+ * Start the DWT cycle counter.
+ * Used to time code.  The counter wraps every 134 seconds at 32MHz,
+ * unsigned subtraction of two counts gives the elapsed cycles.
+ */
+void cyc_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;		// Enable DWT
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;				// Enable cycle counter
+}
+
+
 /* timer2_init
  *
  * 16-bit timer/counter
@@ -156,6 +170,53 @@ void timer3_init(void)
 }
 
 
+/* timer3_capture_init
+ *
+ * 16-bit free running counter
+ * Clock 32MHz, wraps every 2.048msec
+ *
+ * Timestamps CC2500 GDO0 edges on PB0 (TIM3_CH3, no remap).
+ * IC3 captures the rising edge (sync word), IC4 is mapped to the same
+ * pin and captures the falling edge (end of packet).  The capture
+ * flags are read by the radio driver, only IC3 interrupts.
+ */
+void timer3_capture_init(void)
+{
+	TIM3->CR1 = (uint16_t)0x0000;
+		// CKD		Sampling clock = timer clock
+		// CEN 		Count not enabled
+
+	TIM3->CR2 = (uint16_t)0x0000;
+	TIM3->SMCR = (uint16_t)0x0000;
+	TIM3->DIER = (uint16_t)0x0000;
+	TIM3->SR = (uint16_t)0x0000;
+
+	TIM3->CCMR1 = (uint16_t)0x0000;
+
+	TIM3->CCMR2 = (uint16_t)(TIM_CCMR2_CC3S_0 | TIM_CCMR2_CC4S_1 |
+						(0x02 << 4) | (0x02 << 12));
+		// CC3S		01 IC3 mapped on TI3
+		// IC3F		0010 4 samples at 32MHz, 125nsec filter
+		// CC4S		10 IC4 mapped on TI3
+		// IC4F		0010
+
+	// Prescaler
+	TIM_SetPrescaler(TIM3, PSC_32MHz);
+
+	// Auto-reload register.
+	TIM3->ARR = (uint16_t)0xFFFF;		// Full 16-bit count
+
+	TIM3->CCER = (uint16_t)(TIM_CCER_CC3E | TIM_CCER_CC4E | TIM_CCER_CC4P);
+		// CC3		Capture on rising edge
+		// CC4		Capture on falling edge
+
+	TIM3->DIER |= TIM_DIER_CC3IE;		// Sync word capture interrupt
+
+	TIM3_Enable();
+
+}
+
+
 
 /* Timer4
  *
@@ -24,8 +24,15 @@
 #define PWM_FREQ		62500						// 62.5kHz
 
 
+// DWT cycle counter, counts CPU clock cycles (32MHz)
+#define CYC_PER_USEC	(CK_INT / 1000000)
+#define cyc_count()		(DWT->CYCCNT)
+
+
+void cyc_init(void);
 void timer2_init(void);
 void timer3_init(void);
+void timer3_capture_init(void);
 void timer4_init(void);
 
 //uint16_t TIM_ReadConfigReg(TIM_TypeDef *timer, uint32_t reg);
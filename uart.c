@@ -9,6 +9,11 @@
 #include "led.h"
 
 
+#ifndef NULL
+#define NULL  (void *)0
+#endif
+
+
 #define RX_BUFF_SIZE	1024
 uint8_t usart2_rx_buff[RX_BUFF_SIZE];
 uint8_t *usart2_rx_in;
@@ -18,6 +23,16 @@ uint8_t *usart2_rx_out;
 uint8_t usart2_tx_buff[TX_BUFF_SIZE];
 uint8_t *usart2_tx_in;
 uint8_t *usart2_tx_out;
+uint8_t usart2_tx_held;				// Text output queued but not sent
+
+#define UART_PCLK		32000000UL		// PCLK1
+
+// USART2 TX DMA
+// DMA1 Channel 7	USART2_TX
+#define USART2_DMA_TX	DMA1_Channel7
+
+volatile uint8_t usart2_dma_active;
+void (*usart2_dma_callback)(void);
 
 
 
@@ -81,6 +96,68 @@ void uart2_init(void)
 }
 
 
+/* uart2_set_baud
+ *
+ * Parameters
+ * baud			Baud rate
+ *
+ * BRR = PCLK1 / baud, 12 bits of mantissa and 4 bits of fraction.
+ * Up to 2MBaud at 32MHz.  Send any queued bytes first with
+ * uart2_flush().
+ */
+void uart2_set_baud(uint32_t baud)
+{
+	USART2->BRR = (UART_PCLK + baud / 2) / baud;
+}
+
+
+/* uart2_get_baud
+ *
+ * Returns
+ * Current baud rate.
+ */
+uint32_t uart2_get_baud(void)
+{
+	return UART_PCLK / USART2->BRR;
+}
+
+
+/* uart2_flush
+ *
+ * Wait until the transmit queue is empty and the last byte has left
+ * the shift register.  Held text stays in the queue.
+ */
+void uart2_flush(void)
+{
+	while(!usart2_tx_held && (usart2_tx_out != usart2_tx_in))
+	{}
+
+	while(!(USART2->SR & USART_SR_TC))
+	{}
+}
+
+
+/* uart2_tx_hold
+ *
+ * Parameters
+ * hold			1 to hold text output, 0 to release it.
+ *
+ * While held, uart2_send_byte() queues bytes without starting the
+ * transmit interrupt, so DMA output has the line to itself.  Bytes
+ * beyond TX_BUFF_SIZE overwrite the oldest.
+ */
+void uart2_tx_hold(int hold)
+{
+	__disable_irq();
+
+	usart2_tx_held = hold;
+	if(!hold && (usart2_tx_out != usart2_tx_in))
+		USART2->CR1 |= USART_CR1_TXEIE;
+
+	__enable_irq();
+}
+
+
 /*
  * Polled mode serial byte transmit
  */
@@ -155,7 +232,8 @@ void uart2_send_byte(uint8_t tx_data)
 	if(usart2_tx_in >= (usart2_tx_buff + TX_BUFF_SIZE))
 		usart2_tx_in = usart2_tx_buff;
 
-	USART2->CR1 |= USART_CR1_TXEIE;					// Enable transmit interrupt
+	if(!usart2_tx_held)
+		USART2->CR1 |= USART_CR1_TXEIE;				// Enable transmit interrupt
 
 	__enable_irq();
 }
@@ -290,3 +368,75 @@ void __attribute__((interrupt("IRQ")))USART2_IRQHandler(void)
 
 }
 
+
+
+/*---------------------------------------------------------------
+ *                        USART2 TX DMA
+ *---------------------------------------------------------------
+ */
+
+
+/* uart2_dma_send
+ *
+ * Parameters
+ * *buf			Bytes to send
+ * n			No. of bytes
+ * done			Called from the DMA interrupt when the bytes have been
+ *				written to the USART, or NULL.
+ *
+ * Starts a DMA transfer to the transmit data register and returns.
+ * Text output should be held with uart2_tx_hold() while DMA is used.
+ * The DMA1 clock must be enabled.
+ */
+void uart2_dma_send(uint8_t *buf, uint16_t n, void (*done)(void))
+{
+	usart2_dma_active = 1;
+	usart2_dma_callback = done;
+
+	USART2_DMA_TX->CCR = 0;
+	DMA1->IFCR = DMA_IFCR_CGIF7;
+
+	USART2_DMA_TX->CPAR = (uint32_t)&USART2->DR;
+	USART2_DMA_TX->CMAR = (uint32_t)buf;
+	USART2_DMA_TX->CNDTR = n;
+	USART2_DMA_TX->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE | DMA_CCR_TEIE;
+		// Read from memory, low priority, transfer complete and error interrupts.
+
+	USART2->CR3 |= USART_CR3_DMAT;
+	USART2_DMA_TX->CCR |= DMA_CCR_EN;
+}
+
+
+/* uart2_dma_busy
+ *
+ * Returns 1 while a DMA transfer is in progress.
+ */
+int uart2_dma_busy(void)
+{
+	return usart2_dma_active;
+}
+
+
+/* DMA1 Channel 7 Interrupt Handler
+ *
+ * USART2 TX DMA transfer complete.
+ */
+void __attribute__((interrupt("IRQ")))DMA1_Channel7_IRQHandler(void)
+{
+	void (*done)(void);
+
+
+	if(!(DMA1->ISR & (DMA_ISR_TCIF7 | DMA_ISR_TEIF7)))
+		return;
+
+	USART2_DMA_TX->CCR = 0;
+	DMA1->IFCR = DMA_IFCR_CGIF7;
+	USART2->CR3 &= ~USART_CR3_DMAT;
+
+	done = usart2_dma_callback;
+	usart2_dma_callback = NULL;
+	usart2_dma_active = 0;
+
+	if(done)
+		done();
+}
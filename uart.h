@@ -15,5 +15,11 @@ void usart2_rcv_byte(void);
 int usart2_rxdata_rdy(void);
 uint8_t usart2_read_byte(void);
 uint8_t usart2_read(void);
+void uart2_set_baud(uint32_t baud);
+uint32_t uart2_get_baud(void);
+void uart2_flush(void);
+void uart2_tx_hold(int hold);
+void uart2_dma_send(uint8_t *buf, uint16_t n, void (*done)(void));
+int uart2_dma_busy(void);
 
 #endif